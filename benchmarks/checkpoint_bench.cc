@@ -0,0 +1,253 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Benchmarks for the checkpoint queue: appending to and iterating a
+ * CheckpointQueue against the std::list it replaces, queueDirty /
+ * cursor-drain throughput of a CheckpointManager, and queueDirty throughput
+ * with concurrent flusher and DCP cursors.
+ */
+
+#include "checkpoint.h"
+#include "configuration.h"
+#include "ep_vb.h"
+#include "stats.h"
+#include "tests/module_tests/test_helpers.h"
+
+#include <benchmark/benchmark.h>
+#include <platform/make_unique.h>
+
+#include <atomic>
+#include <list>
+#include <thread>
+#include <vector>
+
+/**
+ * Append range(0) items to a Queue, then iterate over them (as a cursor
+ * would) - with every other item erased, as de-duplication would.
+ */
+template <class Queue>
+static void BM_QueueAppendIterate(benchmark::State& state) {
+    const size_t numItems = state.range(0);
+    queued_item item(new Item(makeStoredDocKey("key"), 0, queue_op::set, 0, 0));
+    while (state.KeepRunning()) {
+        Queue queue;
+        for (size_t i = 0; i < numItems; ++i) {
+            queue.push_back(item);
+            if (i % 2) {
+                auto last = queue.end();
+                queue.erase(std::prev(last, 2));
+            }
+        }
+        size_t count = 0;
+        for (const auto& qi : queue) {
+            count += (qi.get() != nullptr);
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetItemsProcessed(state.iterations() * numItems);
+}
+
+BENCHMARK_TEMPLATE(BM_QueueAppendIterate, std::list<queued_item>)
+        ->Range(64, 64 * 1024);
+BENCHMARK_TEMPLATE(BM_QueueAppendIterate, CheckpointQueue)
+        ->Range(64, 64 * 1024);
+
+/**
+ * Fixture providing a CheckpointManager for a single (active) vBucket.
+ *
+ * Variables:
+ *  - range(0) : The number of distinct keys queued (items beyond this are
+ *               de-duplicated).
+ */
+class CheckpointBench : public benchmark::Fixture {
+protected:
+    void SetUp(const benchmark::State& state) override {
+        createManager();
+        keys.clear();
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            keys.push_back(makeStoredDocKey("key" + std::to_string(i)));
+        }
+    }
+
+    void TearDown(const benchmark::State& state) override {
+        manager.reset();
+        vbucket.reset();
+    }
+
+    void createManager() {
+        callback = std::make_shared<DummyCallback>();
+        vbucket = std::make_unique<EPVBucket>(0,
+                                              vbucket_state_active,
+                                              stats,
+                                              checkpointConfig,
+                                              /*kvshard*/ nullptr,
+                                              /*lastSeqno*/ 0,
+                                              /*lastSnapStart*/ 0,
+                                              /*lastSnapEnd*/ 0,
+                                              /*table*/ nullptr,
+                                              callback,
+                                              /*newSeqnoCb*/ nullptr,
+                                              config,
+                                              item_eviction_policy_t::VALUE_ONLY);
+        manager = std::make_unique<CheckpointManager>(stats,
+                                                      vbucket->getId(),
+                                                      checkpointConfig,
+                                                      /*lastSeqno*/ 0,
+                                                      /*lastSnapStart*/ 0,
+                                                      /*lastSnapEnd*/ 0,
+                                                      callback);
+    }
+
+    void queueItem(const StoredDocKey& key) {
+        queued_item qi(new Item(key, vbucket->getId(), queue_op::set, 0, 0));
+        manager->queueDirty(*vbucket,
+                            qi,
+                            GenerateBySeqno::Yes,
+                            GenerateCas::Yes,
+                            /*preLinkDocCtx*/ nullptr);
+    }
+
+    /// Consume all items for the persistence cursor and discard the
+    /// checkpoints it has finished with.
+    void drain() {
+        std::vector<queued_item> items;
+        manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+        bool newCheckpointCreated;
+        manager->removeClosedUnrefCheckpoints(*vbucket, newCheckpointCreated);
+    }
+
+    class DummyCallback : public Callback<uint16_t> {
+    public:
+        void callback(uint16_t&) override {
+        }
+    };
+
+    static const size_t itemsPerDrain = 10000;
+
+    EPStats stats;
+    CheckpointConfig checkpointConfig;
+    Configuration config;
+    std::shared_ptr<Callback<uint16_t>> callback;
+    std::unique_ptr<EPVBucket> vbucket;
+    std::unique_ptr<CheckpointManager> manager;
+    std::vector<StoredDocKey> keys;
+};
+
+BENCHMARK_DEFINE_F(CheckpointBench, QueueDirty)(benchmark::State& state) {
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        queueItem(keys[i % keys.size()]);
+        if (++i % itemsPerDrain == 0) {
+            state.PauseTiming();
+            drain();
+            state.ResumeTiming();
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_DEFINE_F(CheckpointBench, CursorDrain)(benchmark::State& state) {
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        for (size_t i = 0; i < itemsPerDrain; ++i) {
+            queueItem(keys[i % keys.size()]);
+        }
+        state.ResumeTiming();
+        drain();
+    }
+    state.SetItemsProcessed(state.iterations() * itemsPerDrain);
+}
+
+BENCHMARK_REGISTER_F(CheckpointBench, QueueDirty)->Arg(100)->Arg(100000);
+BENCHMARK_REGISTER_F(CheckpointBench, CursorDrain)->Arg(100)->Arg(100000);
+
+/**
+ * Fixture for concurrent access to one vBucket's CheckpointManager: the
+ * benchmark threads queue items (as front-end writers would), while in the
+ * background one thread drains the persistence cursor (as the flusher would)
+ * and numDcpCursors threads each drain their own cursor (as DCP
+ * ActiveStreams would).
+ */
+class CheckpointConcurrentBench : public CheckpointBench {
+protected:
+    void SetUp(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            createManager();
+            keys.clear();
+            for (int t = 0; t < state.threads; ++t) {
+                for (size_t i = 0; i < keysPerThread; ++i) {
+                    keys.push_back(makeStoredDocKey(
+                            "t" + std::to_string(t) + "_" + std::to_string(i)));
+                }
+            }
+
+            running = true;
+            readers.emplace_back([this]() {
+                while (running) {
+                    drain();
+                }
+            });
+            for (size_t c = 0; c < numDcpCursors; ++c) {
+                const std::string name = "dcp" + std::to_string(c);
+                manager->registerCursorBySeqno(
+                        name, 0, MustSendCheckpointEnd::NO);
+                readers.emplace_back([this, name]() {
+                    std::vector<queued_item> items;
+                    while (running) {
+                        items.clear();
+                        manager->getAllItemsForCursor(name, items);
+                    }
+                });
+            }
+        }
+    }
+
+    void TearDown(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            running = false;
+            for (auto& reader : readers) {
+                reader.join();
+            }
+            readers.clear();
+            CheckpointBench::TearDown(state);
+        }
+    }
+
+    static const size_t keysPerThread = 1024;
+    static const size_t numDcpCursors = 20;
+
+    std::atomic<bool> running;
+    std::vector<std::thread> readers;
+};
+
+BENCHMARK_DEFINE_F(CheckpointConcurrentBench, QueueDirty)
+(benchmark::State& state) {
+    const size_t base = state.thread_index * keysPerThread;
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        // (keys is populated by thread 0's SetUp, which is only guaranteed to
+        // have completed once KeepRunning() has returned.)
+        queueItem(keys[base + (i++ % keysPerThread)]);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(CheckpointConcurrentBench, QueueDirty)
+        ->Threads(1)
+        ->Threads(8)
+        ->UseRealTime();
@@ -0,0 +1,125 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Benchmarks for the DcpReadyQueue under contention between front-end threads
+ * notifying streams and the thread stepping the producer, against the
+ * mutex-guarded std::queue + std::unordered_set it replaced.
+ */
+
+#include "dcp/dcp-types.h"
+
+#include <benchmark/benchmark.h>
+#include <platform/make_unique.h>
+
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+
+static const uint16_t numVBuckets = 1024;
+
+/// The previous DcpReadyQueue implementation.
+class LockedReadyQueue {
+public:
+    bool popFront(uint16_t& frontValue) {
+        std::lock_guard<std::mutex> lh(lock);
+        if (!readyQueue.empty()) {
+            frontValue = readyQueue.front();
+            readyQueue.pop();
+            queuedValues.erase(frontValue);
+            return true;
+        }
+        return false;
+    }
+
+    bool pushUnique(uint16_t vbucket) {
+        std::lock_guard<std::mutex> lh(lock);
+        if (queuedValues.count(vbucket) == 0) {
+            readyQueue.push(vbucket);
+            queuedValues.insert(vbucket);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::mutex lock;
+    std::queue<uint16_t> readyQueue;
+    std::unordered_set<uint16_t> queuedValues;
+};
+
+/**
+ * Fixture for a ready queue over 1024 vBuckets: thread 0 steps the producer
+ * (popping a vBucket and pushing it back, as getNextItem does when the
+ * stream had a message), the other threads are front-ends notifying streams.
+ *
+ * Variables:
+ *  - range(0) : Implementation (0: LockedReadyQueue, 1: DcpReadyQueue)
+ */
+class DcpReadyQueueBench : public benchmark::Fixture {
+protected:
+    void SetUp(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            locked = std::make_unique<LockedReadyQueue>();
+            lockFree = std::make_unique<DcpReadyQueue>(numVBuckets);
+        }
+    }
+
+    void TearDown(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            locked.reset();
+            lockFree.reset();
+        }
+    }
+
+    // (The queue is created by thread 0's SetUp, which is only guaranteed
+    // to have completed once KeepRunning() has returned.)
+    template <typename Queue>
+    void run(benchmark::State& state, std::unique_ptr<Queue>& queue) {
+        size_t i = state.thread_index * 97;
+        uint16_t vbucket;
+        while (state.KeepRunning()) {
+            if (state.thread_index == 0) {
+                if (queue->popFront(vbucket)) {
+                    queue->pushUnique(vbucket);
+                }
+            } else {
+                queue->pushUnique(i++ % numVBuckets);
+            }
+        }
+        state.SetItemsProcessed(state.iterations());
+    }
+
+    std::unique_ptr<LockedReadyQueue> locked;
+    std::unique_ptr<DcpReadyQueue> lockFree;
+};
+
+BENCHMARK_DEFINE_F(DcpReadyQueueBench, Contention)(benchmark::State& state) {
+    if (state.range(0) == 0) {
+        state.SetLabel("LockedReadyQueue");
+        run(state, locked);
+    } else {
+        state.SetLabel("DcpReadyQueue");
+        run(state, lockFree);
+    }
+}
+
+BENCHMARK_REGISTER_F(DcpReadyQueueBench, Contention)
+        ->Arg(0)
+        ->Arg(1)
+        ->ThreadRange(1, 16)
+        ->UseRealTime();
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Benchmarks for the DocKeyHash key hashing and comparison kernels, against
+ * the generic DocKey::hash() and memcmp() they replace.
+ */
+
+#include "dockey_hash.h"
+#include "storeddockey.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <vector>
+
+/// Number of distinct keys to cycle through (must be a power of two).
+static const size_t numKeys = 1024;
+
+/// Create numKeys keys of the given length.
+static std::vector<StoredDocKey> makeKeys(size_t length) {
+    std::vector<StoredDocKey> keys;
+    keys.reserve(numKeys);
+    for (size_t i = 0; i < numKeys; ++i) {
+        std::string key = std::to_string(i) + ':';
+        key.resize(length, 'x');
+        keys.emplace_back(key, DocNamespace::DefaultCollection);
+    }
+    return keys;
+}
+
+static void setLabel(benchmark::State& state) {
+    state.SetLabel(DocKeyHash::getImplementation());
+}
+
+/// Variables: range(0) : Key length.
+static void BM_DocKeyHash_Legacy(benchmark::State& state) {
+    const auto keys = makeKeys(state.range(0));
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(keys[i++ & (numKeys - 1)].hash());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_DocKeyHash_Hash(benchmark::State& state) {
+    setLabel(state);
+    const auto keys = makeKeys(state.range(0));
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        benchmark::DoNotOptimize(DocKeyHash::hash(keys[i++ & (numKeys - 1)]));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+// Compare equal keys (in different buffers), which is the worst case - every
+// byte must be compared.
+static void BM_DocKeyCompare_Memcmp(benchmark::State& state) {
+    const auto keys = makeKeys(state.range(0));
+    const auto copies = makeKeys(state.range(0));
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const auto& a = keys[i & (numKeys - 1)];
+        const auto& b = copies[i++ & (numKeys - 1)];
+        benchmark::DoNotOptimize(std::memcmp(a.data(), b.data(), a.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_DocKeyCompare_Equal(benchmark::State& state) {
+    setLabel(state);
+    const auto keys = makeKeys(state.range(0));
+    const auto copies = makeKeys(state.range(0));
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const auto& a = keys[i & (numKeys - 1)];
+        const auto& b = copies[i++ & (numKeys - 1)];
+        benchmark::DoNotOptimize(
+                DocKeyHash::equal(a.data(), b.data(), a.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+static void KeyLengths(benchmark::internal::Benchmark* b) {
+    for (int length : {8, 16, 24, 32, 48, 64, 128, 250}) {
+        b->Arg(length);
+    }
+}
+
+BENCHMARK(BM_DocKeyHash_Legacy)->Apply(KeyLengths);
+BENCHMARK(BM_DocKeyHash_Hash)->Apply(KeyLengths);
+BENCHMARK(BM_DocKeyCompare_Memcmp)->Apply(KeyLengths);
+BENCHMARK(BM_DocKeyCompare_Equal)->Apply(KeyLengths);
@@ -0,0 +1,318 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "configuration.h"
+#include "hash_table.h"
+#include "item.h"
+#include "stats.h"
+#include "stored_value_factories.h"
+#include "tests/module_tests/test_helpers.h"
+
+#include <benchmark/benchmark.h>
+#include <platform/make_unique.h>
+
+#include <algorithm>
+#include <random>
+
+/**
+ * Fixture which populates a HashTable with a given number of items, using
+ * a given bucket layout.
+ *
+ * Variables:
+ *  - range(0) : Bucket layout (0: Chained, 1: CacheLine)
+ *  - range(1) : The number of items to populate the HashTable with
+ */
+class HashTableBench : public benchmark::Fixture {
+protected:
+    void SetUp(const benchmark::State& state) override {
+        const auto layout = state.range(0) == 1
+                                    ? HashTable::BucketLayout::CacheLine
+                                    : HashTable::BucketLayout::Chained;
+        const size_t numItems = state.range(1);
+
+        ht = std::make_unique<HashTable>(
+                stats,
+                std::make_unique<StoredValueFactory>(stats),
+                Configuration().getHtSize(),
+                /*locks*/ 47,
+                HashTable::ResizeMode::Blocking,
+                layout);
+
+        Item valueItem(makeStoredDocKey("value"), 0, 0, "value", 5);
+        value = valueItem.getValue();
+
+        keys.reserve(numItems);
+        for (size_t i = 0; i < numItems; ++i) {
+            keys.push_back(makeStoredDocKey("key" + std::to_string(i)));
+            Item item(keys.back(), 0, 0, value);
+            ht->set(item);
+        }
+        // Size the table for its contents, as the resizer task would.
+        ht->resize();
+
+        // Access keys in a random (but repeatable) order, so each access is
+        // likely to miss in the CPU caches.
+        std::mt19937 gen(numItems);
+        std::uniform_int_distribution<size_t> dist(0, numItems - 1);
+        order.resize(orderSize);
+        for (auto& idx : order) {
+            idx = dist(gen);
+        }
+
+        missingKeys.reserve(orderSize);
+        for (size_t i = 0; i < orderSize; ++i) {
+            missingKeys.push_back(
+                    makeStoredDocKey("missing" + std::to_string(i)));
+        }
+    }
+
+    void TearDown(const benchmark::State& state) override {
+        ht.reset();
+        keys.clear();
+        keys.shrink_to_fit();
+        missingKeys.clear();
+        order.clear();
+    }
+
+    static void setLabel(benchmark::State& state) {
+        state.SetLabel(state.range(0) == 1 ? "CacheLine" : "Chained");
+    }
+
+    // Must be a power of two.
+    static const size_t orderSize = 1 << 20;
+
+    EPStats stats;
+    std::unique_ptr<HashTable> ht;
+    std::vector<StoredDocKey> keys;
+    std::vector<StoredDocKey> missingKeys;
+    std::vector<size_t> order;
+    value_t value;
+};
+
+BENCHMARK_DEFINE_F(HashTableBench, Get)(benchmark::State& state) {
+    setLabel(state);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const auto& key = keys[order[i++ & (orderSize - 1)]];
+        benchmark::DoNotOptimize(
+                ht->find(key, TrackReference::No, WantsDeleted::No));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_DEFINE_F(HashTableBench, GetMissing)(benchmark::State& state) {
+    setLabel(state);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        const auto& key = missingKeys[i++ & (orderSize - 1)];
+        benchmark::DoNotOptimize(
+                ht->find(key, TrackReference::No, WantsDeleted::No));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_DEFINE_F(HashTableBench, Set)(benchmark::State& state) {
+    setLabel(state);
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        Item item(keys[order[i++ & (orderSize - 1)]], 0, 0, value);
+        benchmark::DoNotOptimize(ht->set(item));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+/// Visitor which reads the key of every item, as most real visitors do.
+class KeyLengthVisitor : public HashTableVisitor,
+                         public PauseResumeHashTableVisitor {
+public:
+    void visit(const HashTable::HashBucketLock& lh, StoredValue* v) override {
+        total += v->getKey().size();
+    }
+
+    bool visit(StoredValue& v) override {
+        total += v.getKey().size();
+        return true;
+    }
+
+    size_t total = 0;
+};
+
+// Time to visit every item in the HashTable (e.g. by the item pager or
+// defragmenter).
+BENCHMARK_DEFINE_F(HashTableBench, Visit)(benchmark::State& state) {
+    setLabel(state);
+    while (state.KeepRunning()) {
+        KeyLengthVisitor visitor;
+        ht->visit(visitor);
+        benchmark::DoNotOptimize(visitor.total);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+BENCHMARK_DEFINE_F(HashTableBench, PauseResumeVisit)(benchmark::State& state) {
+    setLabel(state);
+    while (state.KeepRunning()) {
+        KeyLengthVisitor visitor;
+        HashTable::Position position;
+        ht->pauseResumeVisit(visitor, position);
+        benchmark::DoNotOptimize(visitor.total);
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+static void HashTableArguments(benchmark::internal::Benchmark* b) {
+    for (int items : {1000000, 10000000}) {
+        b->Args({0, items});
+        b->Args({1, items});
+    }
+}
+
+BENCHMARK_REGISTER_F(HashTableBench, Get)->Apply(HashTableArguments);
+BENCHMARK_REGISTER_F(HashTableBench, GetMissing)->Apply(HashTableArguments);
+BENCHMARK_REGISTER_F(HashTableBench, Set)->Apply(HashTableArguments);
+BENCHMARK_REGISTER_F(HashTableBench, Visit)
+        ->Apply(HashTableArguments)
+        ->Unit(benchmark::kMillisecond);
+BENCHMARK_REGISTER_F(HashTableBench, PauseResumeVisit)
+        ->Apply(HashTableArguments)
+        ->Unit(benchmark::kMillisecond);
+
+/**
+ * Fixture for concurrent reads of a small set of hot keys (all guarded by
+ * the same few ht_locks), comparing exclusive lookups with shared ones.
+ *
+ * Variables:
+ *  - range(0) : Read mode (0: Exclusive (find), 1: Shared (findShared))
+ */
+class HashTableConcurrentGetBench : public benchmark::Fixture {
+protected:
+    void SetUp(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            ht = std::make_unique<HashTable>(
+                    stats,
+                    std::make_unique<StoredValueFactory>(stats),
+                    Configuration().getHtSize(),
+                    /*locks*/ 47);
+            for (size_t i = 0; i < numKeys; ++i) {
+                keys.push_back(makeStoredDocKey("hot" + std::to_string(i)));
+                Item item(keys.back(), 0, 0, "value", 5);
+                ht->set(item);
+            }
+        }
+    }
+
+    void TearDown(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            ht.reset();
+            keys.clear();
+        }
+    }
+
+    static const size_t numKeys = 4;
+
+    EPStats stats;
+    std::unique_ptr<HashTable> ht;
+    std::vector<StoredDocKey> keys;
+};
+
+BENCHMARK_DEFINE_F(HashTableConcurrentGetBench, Get)(benchmark::State& state) {
+    const bool shared = state.range(0) == 1;
+    state.SetLabel(shared ? "Shared" : "Exclusive");
+    size_t i = state.thread_index;
+    while (state.KeepRunning()) {
+        const auto& key = keys[i++ % numKeys];
+        if (shared) {
+            // Take a copy of the value, as a front-end GET would.
+            const bool found = ht->findShared(key, [](const StoredValue* v) {
+                value_t value = v->getValue();
+                benchmark::DoNotOptimize(value);
+            });
+            if (found) {
+                continue;
+            }
+        }
+        auto hbl = ht->getLockedBucket(key);
+        StoredValue* v = ht->unlocked_find(
+                key, hbl.getBucketNum(), WantsDeleted::No, TrackReference::No);
+        value_t value = v->getValue();
+        benchmark::DoNotOptimize(value);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(HashTableConcurrentGetBench, Get)
+        ->Arg(0)
+        ->Arg(1)
+        ->ThreadRange(1, 16)
+        ->UseRealTime();
+
+/**
+ * Fixture for concurrent sets of distinct keys from many threads, to measure
+ * how set throughput scales with the number of front-end threads. Uses many
+ * ht_locks so threads rarely contend on the same lock - leaving the
+ * HashTable's shared counters (item counts, memory sizes) as the main point
+ * of contention.
+ */
+class HashTableConcurrentSetBench : public benchmark::Fixture {
+protected:
+    void SetUp(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            ht = std::make_unique<HashTable>(
+                    stats,
+                    std::make_unique<StoredValueFactory>(stats),
+                    /*size*/ 1000003,
+                    /*locks*/ 1031);
+            keys.clear();
+            keys.resize(state.threads);
+            for (int t = 0; t < state.threads; ++t) {
+                for (size_t i = 0; i < keysPerThread; ++i) {
+                    keys[t].push_back(makeStoredDocKey(
+                            "t" + std::to_string(t) + "_" + std::to_string(i)));
+                }
+            }
+        }
+    }
+
+    void TearDown(const benchmark::State& state) override {
+        if (state.thread_index == 0) {
+            ht.reset();
+            keys.clear();
+        }
+    }
+
+    static const size_t keysPerThread = 1024;
+
+    EPStats stats;
+    std::unique_ptr<HashTable> ht;
+    std::vector<std::vector<StoredDocKey>> keys;
+};
+
+BENCHMARK_DEFINE_F(HashTableConcurrentSetBench, Set)(benchmark::State& state) {
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        // (keys is populated by thread 0's SetUp, which is only guaranteed to
+        // have completed once KeepRunning() has returned.)
+        const auto& key = keys[state.thread_index][i++ % keysPerThread];
+        Item item(key, 0, 0, "value", 5);
+        benchmark::DoNotOptimize(ht->set(item));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(HashTableConcurrentSetBench, Set)
+        ->ThreadRange(1, 64)
+        ->UseRealTime();
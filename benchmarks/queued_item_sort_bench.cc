@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Benchmarks for sorting and de-duplicating a flusher batch, with
+ * sortQueuedItemsByKey against the std::sort it replaces.
+ */
+
+#include "queued_item_sort.h"
+#include "tests/module_tests/test_helpers.h"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <random>
+
+/// Create a shuffled batch of range(0) items, with each key mutated (on
+/// average) twice.
+static std::vector<queued_item> makeBatch(size_t size) {
+    std::mt19937 rng(size);
+    std::uniform_int_distribution<size_t> keyId(0, size / 2);
+    std::vector<queued_item> items;
+    items.reserve(size);
+    for (size_t seqno = 1; seqno <= size; ++seqno) {
+        items.emplace_back(new Item(
+                makeStoredDocKey("customer::" + std::to_string(keyId(rng))),
+                0,
+                queue_op::set,
+                0,
+                seqno));
+    }
+    std::shuffle(items.begin(), items.end(), rng);
+    return items;
+}
+
+/// The flusher's de-duplication pass: count the items which would be
+/// persisted (the first of each run of equal keys).
+static size_t countUnique(const std::vector<queued_item>& items) {
+    size_t unique = 0;
+    const StoredDocKey* prev = nullptr;
+    for (const auto& item : items) {
+        if (!prev || *prev != item->getKey()) {
+            ++unique;
+        }
+        prev = &item->getKey();
+    }
+    return unique;
+}
+
+template <typename Sort>
+static void runSortDedup(benchmark::State& state, Sort sort) {
+    const auto batch = makeBatch(state.range(0));
+    while (state.KeepRunning()) {
+        state.PauseTiming();
+        auto items = batch;
+        state.ResumeTiming();
+        sort(items);
+        benchmark::DoNotOptimize(countUnique(items));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Variables: range(0) : Batch size.
+static void BM_FlushSortDedup_StdSort(benchmark::State& state) {
+    runSortDedup(state, [](std::vector<queued_item>& items) {
+        CompareQueuedItemsBySeqnoAndKey cq;
+        std::sort(items.begin(), items.end(), cq);
+    });
+}
+
+static void BM_FlushSortDedup_Radix(benchmark::State& state) {
+    runSortDedup(state, sortQueuedItemsByKey);
+}
+
+BENCHMARK(BM_FlushSortDedup_StdSort)->RangeMultiplier(10)->Range(100, 100000);
+BENCHMARK(BM_FlushSortDedup_Radix)->RangeMultiplier(10)->Range(100, 100000);
@@ -19,16 +19,10 @@
 
 #include "bloomfilter.h"
 
-#include "murmurhash3.h"
+#include "dockey_hash.h"
 
 #include <cmath>
 
-#if __x86_64__ || __ppc64__
-#define MURMURHASH_3 MurmurHash3_x64_128
-#else
-#define MURMURHASH_3 MurmurHash3_x86_128
-#endif
-
 BloomFilter::BloomFilter(size_t key_count, double false_positive_prob,
                          bfilter_status_t new_status) {
 
@@ -54,11 +48,16 @@ size_t BloomFilter::estimateNoOfHashes(size_t key_count) {
     return round(((double) filterSize / key_count) * (log(2.0)));
 }
 
-uint64_t BloomFilter::hashDocKey(const DocKey& key, uint32_t iteration) {
-    uint64_t result = 0;
-    uint32_t seed = iteration + (uint32_t(key.getDocNamespace()) * noOfHashes);
-    MURMURHASH_3(key.data(), key.size(), seed, &result);
-    return result;
+uint64_t BloomFilter::hashDocKey(const DocKey& key) {
+    return DocKeyHash::hash64(
+            key.data(), key.size(), uint64_t(key.getDocNamespace()));
+}
+
+uint64_t BloomFilter::getProbe(uint64_t keyHash, uint32_t iteration) {
+    // Kirsch-Mitzenmacher: h(i) = h1 + i * h2, with h2 odd so every
+    // iteration gives a distinct value.
+    const uint64_t h2 = ((keyHash >> 32) | (keyHash << 32)) | 1;
+    return keyHash + iteration * h2;
 }
 
 void BloomFilter::setStatus(bfilter_status_t to) {
@@ -116,8 +115,9 @@ std::string BloomFilter::getStatusString() {
 void BloomFilter::addKey(const DocKey& key) {
     if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
         bool overlap = true;
+        const uint64_t keyHash = hashDocKey(key);
         for (uint32_t i = 0; i < noOfHashes; i++) {
-            uint64_t result = hashDocKey(key, i);
+            uint64_t result = getProbe(keyHash, i);
             if (overlap && bitArray[result % filterSize] == 0) {
                 overlap = false;
             }
@@ -131,8 +131,9 @@ void BloomFilter::addKey(const DocKey& key) {
 
 bool BloomFilter::maybeKeyExists(const DocKey& key) {
     if (status == BFILTER_COMPACTING || status == BFILTER_ENABLED) {
+        const uint64_t keyHash = hashDocKey(key);
         for (uint32_t i = 0; i < noOfHashes; i++) {
-            uint64_t result = hashDocKey(key, i);
+            uint64_t result = getProbe(keyHash, i);
             if (bitArray[result % filterSize] == 0) {
                 // The key does NOT exist.
                 return false;
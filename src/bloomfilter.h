@@ -58,7 +58,21 @@ protected:
     size_t estimateFilterSize(size_t key_count, double false_positive_prob);
     size_t estimateNoOfHashes(size_t key_count);
 
-    uint64_t hashDocKey(const DocKey& key, uint32_t iteration);
+    /**
+     * Hash key, for use by getProbe(). Each key is hashed once, and each of
+     * its noOfHashes filter bits derived from that hash (double hashing).
+     */
+    static uint64_t hashDocKey(const DocKey& key);
+
+    /**
+     * @return the hash for the given iteration of a key whose hash (from
+     *         hashDocKey(key)) is keyHash.
+     */
+    static uint64_t getProbe(uint64_t keyHash, uint32_t iteration);
+
+    uint64_t hashDocKey(const DocKey& key, uint32_t iteration) {
+        return getProbe(hashDocKey(key), iteration);
+    }
 
     size_t filterSize;
     size_t noOfHashes;
@@ -18,12 +18,17 @@
 #include "config.h"
 
 #include <platform/checked_snprintf.h>
+#include <algorithm>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "checkpoint.h"
 #include "ep_engine.h"
+#include "kvshard.h"
+#include "mutation_journal.h"
 #include "pre_link_document_context.h"
 #define STATWRITER_NAMESPACE checkpoint
 #include "statwriter.h"
@@ -65,6 +70,8 @@ public:
             config.allowKeepClosedCheckpoints(value);
         } else if (key.compare("enable_chk_merge") == 0) {
             config.allowCheckpointMerge(value);
+        } else if (key.compare("chk_expel_enabled") == 0) {
+            config.allowCheckpointExpel(value);
         }
     }
 
@@ -138,7 +145,7 @@ void Checkpoint::popBackCheckpointEndItem() {
 }
 
 bool Checkpoint::keyExists(const DocKey& key) {
-    return keyIndex.find(key) != keyIndex.end();
+    return keyIndex.find(key) != nullptr;
 }
 
 queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
@@ -149,7 +156,9 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                         ") is not OPEN");
     }
     queue_dirty_t rv;
-    checkpoint_index::iterator it = keyIndex.find(qi->getKey());
+    // Index entry of this checkpoint's existing item for the same key (if
+    // any).
+    index_entry* existing = nullptr;
     // Check if the item is a meta item
     if (qi->isCheckPointMetaItem()) {
         // empty items act only as a dummy element for the start of the
@@ -162,10 +171,11 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         toWrite.push_back(qi);
     } else {
         // Check if this checkpoint already had an item for the same key
-        if (it != keyIndex.end()) {
+        existing = keyIndex.find(qi->getKey());
+        if (existing != nullptr) {
             rv = EXISTING_ITEM;
-            CheckpointQueue::iterator currPos = it->second.position;
-            const int64_t currMutationId{it->second.mutation_id};
+            CheckpointQueue::iterator currPos = existing->position;
+            const int64_t currMutationId{existing->mutation_id};
 
             // Given the key already exists, need to check all cursors in this
             // Checkpoint and see if the existing item for this key is to
@@ -184,7 +194,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                                                                 : keyIndex;
 
                     auto cursor_item_idx = index.find(cursor_item->getKey());
-                    if (cursor_item_idx == keyIndex.end()) {
+                    if (cursor_item_idx == nullptr) {
                         throw std::logic_error("Checkpoint::queueDirty: Unable "
                                 "to find key with"
                                 " op:" + to_string(cursor_item->getOperation()) +
@@ -199,7 +209,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                     // decrement if the the existing item is strictly less than
                     // the cursor, as meta-items can share a seqno with
                     // a non-meta item but are logically before them.
-                    int64_t cursor_mutation_id{cursor_item_idx->second.mutation_id};
+                    int64_t cursor_mutation_id{cursor_item_idx->mutation_id};
                     if (cursor_item->isCheckPointMetaItem()) {
                         --cursor_mutation_id;
                     }
@@ -222,7 +232,8 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
             }
 
             toWrite.push_back(qi);
-            // Remove the existing item for the same key from the list.
+            // Remove the existing item for the same key from the queue (this
+            // leaves a tombstone in its slot - see compaction below).
             toWrite.erase(currPos);
         } else {
             ++numItems;
@@ -233,20 +244,28 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
     }
 
     if (qi->getKey().size() > 0) {
-        CheckpointQueue::iterator last = toWrite.end();
-        // --last is okay as the list is not empty now.
-        index_entry entry = {--last, qi->getBySeqno()};
+        const size_t indexOverhead = keyIndex.getMemoryOverhead() +
+                                     metaKeyIndex.getMemoryOverhead();
+        // --end() is okay as the queue is not empty now.
+        CheckpointQueue::iterator last = --toWrite.end();
         // Set the index of the key to the new item that is pushed back into
-        // the list.
+        // the queue.
         if (qi->isCheckPointMetaItem()) {
             // We add a meta item only once to a checkpoint
-            metaKeyIndex[qi->getKey()] = entry;
+            metaKeyIndex.set(last, qi->getBySeqno());
+        } else if (existing != nullptr) {
+            // The existing item has been erased, so the entry can't be
+            // looked up again (that compares against its item's key) - update
+            // it in place.
+            *existing = {last, qi->getBySeqno()};
         } else {
-            keyIndex[qi->getKey()] = entry;
+            keyIndex.insert(last, qi->getBySeqno());
         }
         if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() +
-                                  sizeof(index_entry) + sizeof(queued_item);
+            size_t newEntrySize = sizeof(queued_item) +
+                                  keyIndex.getMemoryOverhead() +
+                                  metaKeyIndex.getMemoryOverhead() -
+                                  indexOverhead;
             memOverhead += newEntrySize;
             stats.memOverhead->fetch_add(newEntrySize);
             if (stats.memOverhead->load() >= GIGANTOR) {
@@ -258,6 +277,14 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
         }
     }
 
+    // Once the queue is mostly tombstones left by de-duplication, compact it
+    // so cursors and the memory footprint stay proportional to the live items.
+    if (rv != NEW_ITEM &&
+        toWrite.getNumTombstones() >= CheckpointQueue::ChunkSize &&
+        toWrite.getNumTombstones() > toWrite.size()) {
+        rebuildQueue(checkpointManager->connCursors, {});
+    }
+
     // Notify flusher if in case queued item is a checkpoint meta item or
     // vbpersist state.
     if (qi->getOperation() == queue_op::checkpoint_start ||
@@ -274,9 +301,9 @@ const StoredDocKey Checkpoint::CheckpointStartKey("checkpoint_start", DocNamespa
 const StoredDocKey Checkpoint::CheckpointEndKey("checkpoint_end", DocNamespace::System);
 const StoredDocKey Checkpoint::SetVBucketStateKey("set_vbucket_state", DocNamespace::System);
 
-size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
+size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                                       cursor_index& cursors) {
     size_t numNewItems = 0;
-    size_t newEntryMemOverhead = 0;
 
     LOG(EXTENSION_LOG_INFO,
         "Collapse the checkpoint %" PRIu64 " into the checkpoint %" PRIu64
@@ -285,16 +312,25 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
 
     CheckpointQueue::iterator itr = toWrite.begin();
     uint64_t seqno = pPrevCheckpoint->getMutationIdForKey(Checkpoint::DummyKey, true);
-    metaKeyIndex[Checkpoint::DummyKey].mutation_id = seqno;
+    metaKeyIndex.set(itr, seqno);
     (*itr)->setBySeqno(seqno);
 
     seqno = pPrevCheckpoint->getMutationIdForKey(Checkpoint::CheckpointStartKey, true);
-    metaKeyIndex[Checkpoint::CheckpointStartKey].mutation_id = seqno;
     ++itr;
+    metaKeyIndex.set(itr, seqno);
     (*itr)->setBySeqno(seqno);
 
-    // Iterate in reverse over the previous checkpoints' items, inserting them
-    // into the current checkpoint as necessary.
+    // Iterate in reverse over the previous checkpoints' items, collecting
+    // those which need inserting into the current checkpoint (and their
+    // mutation ids). They are added to the index once inserted, as the
+    // index compares keys against the queued items.
+    std::vector<queued_item> inserted;
+    std::vector<int64_t> insertedMutationIds;
+    using KeySet = std::unordered_set<StoredDocKey,
+                                      DocKeyHash::Hasher,
+                                      DocKeyHash::KeyEqual>;
+    KeySet insertedKeys;
+    KeySet insertedMetaKeys;
     for (auto rit = pPrevCheckpoint->rbegin(); rit != pPrevCheckpoint->rend();
             ++rit) {
         const auto key = (*rit)->getKey();
@@ -305,14 +341,11 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
                 // checkpoint if the key isn't already present (if it is already
                 // present then it must be an older revision and hence we can
                 // safely discard it).
-                if (keyIndex.find(key) == keyIndex.end()) {
-                    // Skip the first two meta items (empty & checkpoint start).
-                    auto pos = std::next(toWrite.begin(), 2);
-                    toWrite.insert(pos, *rit);
-                    index_entry entry = {--pos, static_cast<int64_t>(pPrevCheckpoint->
-                                                    getMutationIdForKey(key, false))};
-                    keyIndex[key] = entry;
-                    newEntryMemOverhead += key.size() + sizeof(index_entry);
+                if (keyIndex.find(key) == nullptr &&
+                    insertedKeys.insert(key).second) {
+                    inserted.push_back(*rit);
+                    insertedMutationIds.push_back(static_cast<int64_t>(
+                            pPrevCheckpoint->getMutationIdForKey(key, false)));
                     ++numItems;
                     ++numNewItems;
 
@@ -343,14 +376,11 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
             case queue_op::set_vbucket_state:
             case queue_op::system_event:
                 // Need to re-insert these into the correct place in the index.
-                if (metaKeyIndex.find(key) == metaKeyIndex.end()) {
-                    // Skip the first two meta items (empty & checkpoint start).
-                    auto pos = std::next(toWrite.begin(), 2);
-                    toWrite.insert(pos, *rit);
-                    auto mutationId = static_cast<int64_t>(
-                            pPrevCheckpoint->getMutationIdForKey(key, true));
-                    metaKeyIndex[key] = {--pos, mutationId};
-                    newEntryMemOverhead += key.size() + sizeof(index_entry);
+                if (metaKeyIndex.find(key) == nullptr &&
+                    insertedMetaKeys.insert(key).second) {
+                    inserted.push_back(*rit);
+                    insertedMutationIds.push_back(static_cast<int64_t>(
+                            pPrevCheckpoint->getMutationIdForKey(key, true)));
                     ++numMetaItems;
                     ++numNewItems;
 
@@ -361,6 +391,24 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
         }
     }
 
+    // Insert the collected items (in their original order) after the first
+    // two meta items (empty & checkpoint start), then index them.
+    std::reverse(inserted.begin(), inserted.end());
+    std::reverse(insertedMutationIds.begin(), insertedMutationIds.end());
+    rebuildQueue(cursors, inserted);
+
+    const size_t indexOverhead = keyIndex.getMemoryOverhead() +
+                                 metaKeyIndex.getMemoryOverhead();
+    auto pos = std::next(toWrite.begin(), 2);
+    for (const auto mutationId : insertedMutationIds) {
+        auto& index = (*pos)->isCheckPointMetaItem() ? metaKeyIndex : keyIndex;
+        index.insert(pos, mutationId);
+        ++pos;
+    }
+    const size_t newEntryMemOverhead = keyIndex.getMemoryOverhead() +
+                                       metaKeyIndex.getMemoryOverhead() -
+                                       indexOverhead;
+
     /**
      * Update snapshot start of current checkpoint to the first
      * item's sequence number, after merge completed, as items
@@ -378,13 +426,148 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     return numNewItems;
 }
 
+void Checkpoint::rebuildQueue(cursor_index& cursors,
+                              const std::vector<queued_item>& inserted) {
+    // Cursors in this checkpoint, by the address of the slot they are at.
+    std::unordered_multimap<const queued_item*, CheckpointCursor*> cursorSlots;
+    for (auto& cursor : cursors) {
+        if (*(cursor.second.currentCheckpoint) == this) {
+            cursorSlots.emplace(&*cursor.second.currentPos, &cursor.second);
+        }
+    }
+
+    CheckpointQueue rebuilt;
+    // Append the item to the new queue, updating its key's index entry.
+    auto append = [this, &rebuilt](const queued_item& qi) {
+        rebuilt.push_back(qi);
+        if (qi->getKey().size() > 0) {
+            auto& index = qi->isCheckPointMetaItem() ? metaKeyIndex : keyIndex;
+            auto* found = index.find(qi->getKey());
+            if (found != nullptr) {
+                // Meta items may be queued more than once; the index refers
+                // to the last of them, which is the last one visited.
+                found->position = --rebuilt.end();
+            }
+        }
+    };
+    // Move the item at pos to the new queue, along with any cursors at it.
+    auto moveItem = [&append, &rebuilt, &cursorSlots](
+                        CheckpointQueue::iterator pos) {
+        append(*pos);
+        auto range = cursorSlots.equal_range(&*pos);
+        for (auto it = range.first; it != range.second; ++it) {
+            it->second->currentPos = --rebuilt.end();
+        }
+    };
+
+    auto pos = toWrite.begin();
+    for (int ii = 0; ii < 2 && pos != toWrite.end(); ++ii, ++pos) {
+        moveItem(pos);
+    }
+    for (const auto& qi : inserted) {
+        append(qi);
+    }
+    for (; pos != toWrite.end(); ++pos) {
+        moveItem(pos);
+    }
+
+    toWrite.swap(rebuilt);
+}
+
+size_t Checkpoint::expelItems(cursor_index& cursors,
+                              int64_t maxSeqno,
+                              size_t& memoryFreed) {
+    memoryFreed = 0;
+
+    // Cursors in this checkpoint, and the slots they are at - items can only
+    // be expelled up to the first of these.
+    std::vector<CheckpointCursor*> ckptCursors;
+    std::unordered_set<const queued_item*> cursorSlots;
+    for (auto& cursor : cursors) {
+        if (*(cursor.second.currentCheckpoint) == this) {
+            ckptCursors.push_back(&cursor.second);
+            cursorSlots.insert(&*cursor.second.currentPos);
+        }
+    }
+    if (ckptCursors.empty() || toWrite.size() < 3) {
+        return 0;
+    }
+
+    // Never expel the dummy or checkpoint_start items.
+    auto checkpointStart = std::next(toWrite.begin());
+    if (cursorSlots.count(&*toWrite.begin()) ||
+        cursorSlots.count(&*checkpointStart)) {
+        return 0;
+    }
+
+    size_t expelledItems = 0;
+    size_t expelledMetaItems = 0;
+    int64_t lastExpelledSeqno = 0;
+    auto pos = std::next(checkpointStart);
+    while (pos != toWrite.end() && cursorSlots.count(&*pos) == 0 &&
+           (*pos)->getBySeqno() <= maxSeqno) {
+        const queued_item& qi = *pos;
+        // Remove the item's index entry, unless it refers to a later item
+        // for the same (meta) key. This must be done before the item is
+        // erased, as the index compares keys against the queued items.
+        auto& index = qi->isCheckPointMetaItem() ? metaKeyIndex : keyIndex;
+        auto* entry = index.find(qi->getKey());
+        if (entry != nullptr && entry->position == pos) {
+            index.erase(qi->getKey());
+        }
+
+        if (!qi->isCheckPointMetaItem()) {
+            ++expelledItems;
+        } else if (qi->isNonEmptyCheckpointMetaItem()) {
+            ++expelledMetaItems;
+        }
+        memoryFreed += qi->size();
+        lastExpelledSeqno = qi->getBySeqno();
+        pos = toWrite.erase(pos);
+    }
+
+    if (expelledItems + expelledMetaItems == 0) {
+        return 0;
+    }
+
+    numItems -= expelledItems;
+    numMetaItems -= expelledMetaItems;
+    decrementMemConsumption(memoryFreed);
+    for (auto* cursor : ckptCursors) {
+        cursor->setMetaItemOffset(
+                cursor->ckptMetaItemsRead -
+                std::min(cursor->ckptMetaItemsRead, expelledMetaItems));
+    }
+
+    // Move checkpoint_start after the expelled items, so that a cursor
+    // registered for any of them starts after them instead. Replace the item
+    // rather than modify it, as it may be shared with a consumer which has
+    // already read it. (A meta item shares its seqno with the following
+    // item, which may not have been expelled.)
+    int64_t startSeqno = lastExpelledSeqno + 1;
+    if (pos != toWrite.end()) {
+        startSeqno = std::min(startSeqno, (*pos)->getBySeqno());
+    }
+    queued_item newStart(new Item(**checkpointStart));
+    newStart->setBySeqno(startSeqno);
+    *checkpointStart = newStart;
+    metaKeyIndex.set(checkpointStart, startSeqno);
+
+    if (toWrite.getNumTombstones() >= CheckpointQueue::ChunkSize &&
+        toWrite.getNumTombstones() > toWrite.size()) {
+        rebuildQueue(cursors, {});
+    }
+
+    return expelledItems + expelledMetaItems;
+}
+
 uint64_t Checkpoint::getMutationIdForKey(const DocKey& key, bool isMeta) {
     uint64_t mid = 0;
-    checkpoint_index& chkIdx = isMeta ? metaKeyIndex : keyIndex;
+    CheckpointIndex& chkIdx = isMeta ? metaKeyIndex : keyIndex;
 
-    checkpoint_index::iterator it = chkIdx.find(key);
-    if (it != chkIdx.end()) {
-        mid = it->second.mutation_id;
+    index_entry* entry = chkIdx.find(key);
+    if (entry != nullptr) {
+        mid = entry->mutation_id;
     } else {
         throw std::invalid_argument("key{" +
                                     std::string(reinterpret_cast<const char*>(key.data())) +
@@ -436,6 +619,8 @@ CheckpointManager::CheckpointManager(EPStats& st,
       lastClosedChkBySeqno(lastSeqno),
       isCollapsedCheckpoint(false),
       pCursorPreCheckpointId(0),
+      numExpelledItems(0),
+      memFreedByExpel(0),
       flusherCB(cb) {
     LockHolder lh(queueLock);
     addNewCheckpoint_UNLOCKED(1, lastSnapStart, lastSnapEnd);
@@ -1002,6 +1187,36 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
     return numUnrefItems;
 }
 
+size_t CheckpointManager::expelUnreferencedCheckpointItems(VBucket& vbucket) {
+    LockHolder lh(queueLock);
+    // Only expel from the oldest checkpoint - a cursor registered in an
+    // earlier one would otherwise walk into the expelled range without
+    // being told to backfill it.
+    if (checkpointList.empty() ||
+        checkpointList.front()->getNumberOfCursors() == 0) {
+        return 0;
+    }
+
+    // Items not yet persisted must stay, as disk backfills can't yet
+    // provide them.
+    size_t memoryFreed = 0;
+    const size_t expelled = checkpointList.front()->expelItems(
+            connCursors, vbucket.getPersistenceSeqno(), memoryFreed);
+    if (expelled == 0) {
+        return 0;
+    }
+
+    numItems.fetch_sub(expelled);
+    for (auto& cursor : connCursors) {
+        cursor.second.decrOffset(expelled);
+    }
+    numExpelledItems += expelled;
+    memFreedByExpel += memoryFreed;
+    stats.itemsExpelledFromCheckpoints.fetch_add(expelled);
+    stats.memFreedByCheckpointItemExpel.fetch_add(memoryFreed);
+    return expelled;
+}
+
 void CheckpointManager::removeInvalidCursorsOnCheckpoint(
                                                      Checkpoint *pCheckpoint) {
     std::list<std::string> invalidCursorNames;
@@ -1055,7 +1270,8 @@ void CheckpointManager::collapseClosedCheckpoints(
         ++rit; ++rit; //Move to the second last closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(
+                    *rit, connCursors);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += (*rit)->getNumMetaItems();
 
@@ -1186,6 +1402,12 @@ bool CheckpointManager::queueDirty(
         checkpointList.back()->setSnapshotEndSeqno(lastBySeqno);
     } else {
         lastBySeqno = qi->getBySeqno();
+        if (vb.getState() == vbucket_state_active) {
+            // An active vBucket's item keeps its seqno only when it is
+            // replayed (see VBucket::replayItem); it extends the snapshot as
+            // a generated seqno would.
+            checkpointList.back()->setSnapshotEndSeqno(lastBySeqno);
+        }
     }
 
     // MB-20798: Allow the HLC to be created 'atomically' with the seqno as
@@ -1221,6 +1443,17 @@ bool CheckpointManager::queueDirty(
         updateStatsForNewQueuedItem_UNLOCKED(lh, vb, qi);
     }
 
+    // Journal the mutation while queueLock still orders it with the
+    // vBucket's others; this only references qi, which is encoded later by
+    // the journal's sync thread (see MutationJournal).
+    if (vb.getState() == vbucket_state_active) {
+        KVShard* shard = vb.getShard();
+        MutationJournal* journal = shard ? shard->getJournal() : nullptr;
+        if (journal) {
+            journal->append(qi);
+        }
+    }
+
     return result != EXISTING_ITEM;
 }
 
@@ -1247,39 +1480,54 @@ void CheckpointManager::queueSetVBState(VBucket& vb) {
 snapshot_range_t CheckpointManager::getAllItemsForCursor(
                                              const std::string& name,
                                              std::vector<queued_item> &items) {
+    return getItemsForCursor(name, items, 0).range;
+}
+
+CheckpointManager::ItemsForCursor CheckpointManager::getItemsForCursor(
+        const std::string& name,
+        std::vector<queued_item>& items,
+        size_t limit) {
     LockHolder lh(queueLock);
-    snapshot_range_t range;
+    ItemsForCursor result;
+    result.moreAvailable = false;
     cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end()) {
-        range.start = 0;
-        range.end = 0;
-        return range;
+        result.range.start = 0;
+        result.range.end = 0;
+        return result;
     }
 
-    bool moreItems;
+    snapshot_range_t& range = result.range;
+    size_t itemsAdded = 0;
     range.start = (*it->second.currentCheckpoint)->getSnapshotStartSeqno();
     range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
-    while ((moreItems = incrCursor(it->second))) {
+    while (incrCursor(it->second)) {
         queued_item& qi = *(it->second.currentPos);
         items.push_back(qi);
+        ++itemsAdded;
 
         if (qi->getOperation() == queue_op::checkpoint_end) {
             range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
             moveCursorToNextCheckpoint(it->second);
         }
-    }
 
-    if (!moreItems) {
-        range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
+        if (limit != 0 && itemsAdded >= limit) {
+            // Leave the rest of the cursor's items for the next call.
+            result.moreAvailable = true;
+            break;
+        }
     }
 
-    LOG(EXTENSION_LOG_DEBUG, "CheckpointManager::getAllItemsForCursor() "
-            "cursor:%s range:{%" PRIu64 ", %" PRIu64 "}",
-            name.c_str(), range.start, range.end);
+    range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
+
+    LOG(EXTENSION_LOG_DEBUG, "CheckpointManager::getItemsForCursor() "
+            "cursor:%s range:{%" PRIu64 ", %" PRIu64 "} more:%s",
+            name.c_str(), range.start, range.end,
+            result.moreAvailable ? "true" : "false");
 
     it->second.numVisits++;
 
-    return range;
+    return result;
 }
 
 queued_item CheckpointManager::nextItem(const std::string &name,
@@ -1702,7 +1950,7 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
     // Collapse all checkpoints.
     for (; rit != checkpointList.rend(); ++rit) {
         size_t numAddedItems = checkpointList.back()->
-                               mergePrevCheckpoint(*rit);
+                               mergePrevCheckpoint(*rit, connCursors);
         numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
         numMetaItems += (*rit)->getNumMetaItems();
         delete *rit;
@@ -1928,6 +2176,8 @@ void CheckpointConfig::addConfigChangeListener(
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("enable_chk_merge",
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_expel_enabled",
+             new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
 }
 
 CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
@@ -1939,6 +2189,7 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     keepClosedCheckpoints = config.isKeepClosedChks();
     enableChkMerge = config.isEnableChkMerge();
     persistenceEnabled = config.getBucketType() == "persistent";
+    checkpointExpelEnabled = config.isChkExpelEnabled();
 }
 
 bool CheckpointConfig::validateCheckpointMaxItemsParam(size_t
@@ -2036,6 +2287,12 @@ void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
                         add_stat, cookie);
         checked_snprintf(buf, sizeof(buf), "vb_%d:mem_usage", vbucketId);
         add_casted_stat(buf, getMemoryUsage_UNLOCKED(), add_stat, cookie);
+        checked_snprintf(buf, sizeof(buf), "vb_%d:num_expelled_items",
+                         vbucketId);
+        add_casted_stat(buf, numExpelledItems, add_stat, cookie);
+        checked_snprintf(buf, sizeof(buf), "vb_%d:mem_freed_by_expel",
+                         vbucketId);
+        add_casted_stat(buf, memFreedByExpel, add_stat, cookie);
 
         cursor_index::iterator cur_it = connCursors.begin();
         for (; cur_it != connCursors.end(); ++cur_it) {
@@ -21,11 +21,14 @@
 #include "config.h"
 
 #include "callbacks.h"
+#include "checkpoint_index.h"
+#include "checkpoint_queue.h"
 #include "ep_types.h"
 #include "item.h"
 #include "locks.h"
 #include "stats.h"
 
+#include <algorithm>
 #include <atomic>
 #include <list>
 #include <map>
@@ -58,18 +61,6 @@ enum checkpoint_state {
 
 const char* to_string(enum checkpoint_state);
 
-// List is used for queueing mutations as vector incurs shift operations for
-// deduplication.
-typedef std::list<queued_item> CheckpointQueue;
-
-/**
- * A checkpoint index entry.
- */
-struct index_entry {
-    CheckpointQueue::iterator position;
-    int64_t mutation_id;
-};
-
 typedef struct {
     uint64_t start;
     uint64_t end;
@@ -88,11 +79,6 @@ enum class MustSendCheckpointEnd {
     YES
 };
 
-/**
- * The checkpoint index maps a key to a checkpoint index_entry.
- */
-typedef std::unordered_map<StoredDocKey, index_entry> checkpoint_index;
-
 /**
  * List of pairs containing checkpoint cursor name and corresponding flag
  * indicating whether we must send checkpoint end meta item for the cursor
@@ -527,9 +513,30 @@ public:
      * Merge the previous checkpoint into the this checkpoint by adding the items from
      * the previous checkpoint, which don't exist in this checkpoint.
      * @param pPrevCheckpoint pointer to the previous checkpoint.
+     * @param cursors the manager's cursors; those in this checkpoint are
+     *        moved to the equivalent position in the merged queue.
      * @return the number of items added from the previous checkpoint.
      */
-    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint);
+    size_t mergePrevCheckpoint(Checkpoint *pPrevCheckpoint,
+                               cursor_index& cursors);
+
+    /**
+     * Expel (remove) items from the front of this checkpoint which all of
+     * the cursors in it have already processed, to free their memory while
+     * the checkpoint is still referenced. Items are expelled up to (but not
+     * including) the first item a cursor is at, and only while their seqno
+     * is no greater than maxSeqno. The dummy and checkpoint_start items are
+     * kept; checkpoint_start takes the seqno following the last expelled
+     * item, so that getLowSeqno() is the first seqno still in memory.
+     * @param cursors the manager's cursors; those in this checkpoint bound
+     *        the items which can be expelled.
+     * @param maxSeqno the highest seqno which may be expelled.
+     * @param memoryFreed set to the memory used by the expelled items.
+     * @return the number of items (including meta items) expelled.
+     */
+    size_t expelItems(cursor_index& cursors,
+                      int64_t maxSeqno,
+                      size_t& memoryFreed);
 
     /**
      * Get the mutation id for a given key in this checkpoint
@@ -555,6 +562,14 @@ public:
         effectiveMemUsage += by;
     }
 
+    /**
+     * Invoked whenever items are expelled from the given checkpoint.
+     * @param Amount of memory being removed from current usage
+     */
+    void decrementMemConsumption(size_t by) {
+        effectiveMemUsage -= std::min(by, effectiveMemUsage);
+    }
+
     /**
      * Returns the memory held by all the queued items which includes
      * key, metadata and the blob.
@@ -569,6 +584,15 @@ public:
     static const StoredDocKey SetVBucketStateKey;
 
 private:
+    /**
+     * Rebuild toWrite without its tombstones (erased items), inserting the
+     * given items after the leading dummy and checkpoint_start items.
+     * Positions held by keyIndex, metaKeyIndex and any of the given cursors
+     * which are in this checkpoint are updated to refer to the new queue.
+     */
+    void rebuildQueue(cursor_index& cursors,
+                      const std::vector<queued_item>& inserted);
+
     EPStats                       &stats;
     uint64_t                       checkpointId;
     uint64_t                       snapStartSeqno;
@@ -582,9 +606,9 @@ private:
     size_t numMetaItems;
     std::set<std::string>          cursors; // List of cursors with their unique names.
     CheckpointQueue                toWrite;
-    checkpoint_index               keyIndex;
+    CheckpointIndex                keyIndex;
     /* Index for meta keys like "dummy_key" */
-    checkpoint_index               metaKeyIndex;
+    CheckpointIndex                metaKeyIndex;
     size_t                         memOverhead;
 
     // The following stat is to contain the memory consumption of all
@@ -642,6 +666,18 @@ public:
     size_t removeClosedUnrefCheckpoints(VBucket& vbucket,
                                         bool& newOpenCheckpointCreated);
 
+    /**
+     * Expel the items at the front of the oldest checkpoint which have been
+     * processed by every cursor (and persisted), freeing their memory even
+     * though the checkpoint is still referenced by a slow cursor. Only done
+     * once all unreferenced checkpoints before it have been removed.
+     * Cursors subsequently registered for expelled seqnos are told to start
+     * after them (i.e. to backfill them), as for removed checkpoints.
+     * @param vbucket the vbucket that this checkpoint manager belongs to.
+     * @return the number of items (including meta items) expelled.
+     */
+    size_t expelUnreferencedCheckpointItems(VBucket& vbucket);
+
     /**
      * Register the cursor for getting items whose bySeqno values are between
      * startBySeqno and endBySeqno, and close the open checkpoint if endBySeqno
@@ -737,6 +773,26 @@ public:
     snapshot_range_t getAllItemsForCursor(const std::string& name,
                                           std::vector<queued_item> &items);
 
+    /// The result of getItemsForCursor.
+    struct ItemsForCursor {
+        snapshot_range_t range;
+        // True if the limit was reached, so the cursor may have more items.
+        bool moreAvailable;
+    };
+
+    /**
+     * Append to items the next items for the given cursor, stopping early
+     * once limit items have been appended.
+     *
+     * @param name the name of the cursor
+     * @param items the vector to append the items to
+     * @param limit the number of items to stop after (0 for no limit)
+     * @return the snapshot range of the items, and whether there may be more.
+     */
+    ItemsForCursor getItemsForCursor(const std::string& name,
+                                     std::vector<queued_item>& items,
+                                     size_t limit);
+
     /**
      * Return the total number of items (including meta items) that belong to
      * this checkpoint manager.
@@ -993,6 +1049,10 @@ private:
     uint64_t                 lastClosedCheckpointId;
     uint64_t                 pCursorPreCheckpointId;
     cursor_index             connCursors;
+    // Number of items (including meta items), and the memory they used,
+    // expelled from this manager's checkpoints.
+    size_t                   numExpelledItems;
+    size_t                   memFreedByExpel;
 
     FlusherCallback          flusherCB;
 
@@ -1015,19 +1075,22 @@ public:
           itemNumBasedNewCheckpoint(true),
           keepClosedCheckpoints(false),
           enableChkMerge(false),
-          persistenceEnabled(true)
+          persistenceEnabled(true),
+          checkpointExpelEnabled(false)
     { /* empty */ }
 
     CheckpointConfig(rel_time_t period, size_t max_items, size_t max_ckpts,
                      bool item_based_new_ckpt, bool keep_closed_ckpts,
-                     bool enable_ckpt_merge, bool persistence_enabled)
+                     bool enable_ckpt_merge, bool persistence_enabled,
+                     bool expel_enabled = false)
         : checkpointPeriod(period),
           checkpointMaxItems(max_items),
           maxCheckpoints(max_ckpts),
           itemNumBasedNewCheckpoint(item_based_new_ckpt),
           keepClosedCheckpoints(keep_closed_ckpts),
           enableChkMerge(enable_ckpt_merge),
-          persistenceEnabled(persistence_enabled) {}
+          persistenceEnabled(persistence_enabled),
+          checkpointExpelEnabled(expel_enabled) {}
 
     CheckpointConfig(EventuallyPersistentEngine &e);
 
@@ -1059,6 +1122,10 @@ public:
         return persistenceEnabled;
     }
 
+    bool isCheckpointExpelEnabled() const {
+        return checkpointExpelEnabled;
+    }
+
 protected:
     friend class CheckpointConfigChangeListener;
     friend class EventuallyPersistentEngine;
@@ -1083,6 +1150,10 @@ protected:
         enableChkMerge = value;
     }
 
+    void allowCheckpointExpel(bool value) {
+        checkpointExpelEnabled = value;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -1103,6 +1174,10 @@ private:
 
     // Flag indicating if persistence is enabled.
     bool persistenceEnabled;
+
+    // Flag indicating if items already processed by all cursors should be
+    // expelled from referenced checkpoints.
+    bool checkpointExpelEnabled;
 };
 
 #endif  // SRC_CHECKPOINT_H_
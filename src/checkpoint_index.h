@@ -0,0 +1,205 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "checkpoint_queue.h"
+#include "dockey_hash.h"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A checkpoint index entry.
+ */
+struct index_entry {
+    CheckpointQueue::iterator position;
+    int64_t mutation_id;
+};
+
+/**
+ * The checkpoint index maps a key to a checkpoint index_entry.
+ *
+ * A flat, open-addressed (linear probing) hash table. Each slot holds only
+ * the key's hash and its index_entry - the key itself isn't copied; lookups
+ * compare against the key of the queued item the entry's position refers
+ * to. Hence every entry's position must refer to a live (non-erased) item
+ * whenever the index is searched or added to.
+ */
+class CheckpointIndex {
+public:
+    CheckpointIndex() : mask(0), count(0) {
+    }
+
+    /**
+     * @return the entry for the given key (DocKey or StoredDocKey), or
+     *         nullptr if there is none.
+     */
+    template <class Key>
+    index_entry* find(const Key& key) {
+        Slot* slot = findSlot(key);
+        return slot ? &slot->entry : nullptr;
+    }
+
+    template <class Key>
+    const index_entry* find(const Key& key) const {
+        return const_cast<CheckpointIndex*>(this)->find(key);
+    }
+
+    /**
+     * Set the entry for the key of the item at position, adding it if
+     * there is none.
+     * @return the entry.
+     */
+    index_entry& set(CheckpointQueue::iterator position, int64_t mutationId) {
+        index_entry* entry = find((*position)->getKey());
+        if (entry == nullptr) {
+            return insert(position, mutationId);
+        }
+        *entry = {position, mutationId};
+        return *entry;
+    }
+
+    /**
+     * Add an entry for the key of the item at position, which must not
+     * already be in the index.
+     * @return the new entry.
+     */
+    index_entry& insert(CheckpointQueue::iterator position,
+                        int64_t mutationId) {
+        if ((count + 1) * 4 > slots.size() * 3) {
+            grow();
+        }
+        const uint32_t hash = hashOf((*position)->getKey());
+        Slot& slot = probeEmpty(hash);
+        slot.hash = hash;
+        slot.entry = {position, mutationId};
+        ++count;
+        return slot.entry;
+    }
+
+    /**
+     * Remove the entry for the given key.
+     * @return true if there was an entry to remove.
+     */
+    template <class Key>
+    bool erase(const Key& key) {
+        Slot* slot = findSlot(key);
+        if (slot == nullptr) {
+            return false;
+        }
+        // Backward-shift deletion: move later entries of the probe sequence
+        // into the hole, so that no tombstones are needed.
+        size_t hole = slot - slots.data();
+        for (size_t ii = (hole + 1) & mask; slots[ii].hash != 0;
+             ii = (ii + 1) & mask) {
+            const size_t home = slots[ii].hash & mask;
+            // Can slot ii move to the hole, i.e. is its home slot not
+            // cyclically within (hole, ii]?
+            const bool movable = (hole <= ii) ? (home <= hole || home > ii)
+                                              : (home <= hole && home > ii);
+            if (movable) {
+                slots[hole] = slots[ii];
+                hole = ii;
+            }
+        }
+        slots[hole].hash = 0;
+        slots[hole].entry = {};
+        --count;
+        return true;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /**
+     * @return the number of bytes of memory allocated for the index's slots.
+     */
+    size_t getMemoryOverhead() const {
+        return slots.capacity() * sizeof(Slot);
+    }
+
+private:
+    struct Slot {
+        // Hash of the entry's key, or zero if the slot is empty.
+        uint32_t hash = 0;
+        index_entry entry = {};
+    };
+
+    /// Initial number of slots; must be a power of two.
+    static const size_t InitialSize = 8;
+
+    template <class Key>
+    static uint32_t hashOf(const Key& key) {
+        // Zero marks an empty slot.
+        const uint32_t hash = DocKeyHash::hash(key);
+        return hash ? hash : 1;
+    }
+
+    /// @return the slot holding the given key, or nullptr if there is none.
+    template <class Key>
+    Slot* findSlot(const Key& key) {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        const uint32_t hash = hashOf(key);
+        for (size_t ii = hash & mask;; ii = (ii + 1) & mask) {
+            Slot& slot = slots[ii];
+            if (slot.hash == 0) {
+                return nullptr;
+            }
+            if (slot.hash == hash &&
+                DocKeyHash::KeyEqual()((*slot.entry.position)->getKey(),
+                                       key)) {
+                return &slot;
+            }
+        }
+    }
+
+    /// @return the first empty slot in hash's probe sequence.
+    Slot& probeEmpty(uint32_t hash) {
+        for (size_t ii = hash & mask;; ii = (ii + 1) & mask) {
+            if (slots[ii].hash == 0) {
+                return slots[ii];
+            }
+        }
+    }
+
+    /// Double the number of slots, re-inserting entries by their hash.
+    void grow() {
+        std::vector<Slot> old(slots.empty() ? size_t(InitialSize)
+                                            : slots.size() * 2);
+        old.swap(slots);
+        mask = slots.size() - 1;
+        for (const auto& slot : old) {
+            if (slot.hash != 0) {
+                probeEmpty(slot.hash) = slot;
+            }
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask;
+    size_t count;
+};
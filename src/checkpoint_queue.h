@@ -0,0 +1,322 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "item.h"
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+/**
+ * The queue of items in a Checkpoint.
+ *
+ * An append-only sequence of queued_items, stored in fixed-size chunks
+ * which are linked together - so appending an item only allocates once per
+ * ChunkSize items, and iterating over the queue mostly walks contiguous
+ * memory.
+ *
+ * Items are never moved once appended, so iterators (positions) remain
+ * valid until the item they refer to is erased or the queue is destroyed
+ * (as for std::list). Erasing an item doesn't remove its slot; it leaves a
+ * tombstone which iteration skips over. Callers which erase many items
+ * should periodically rebuild the queue (see getNumTombstones()).
+ *
+ * Iterators are bidirectional, and as for std::list the end() iterator
+ * remains the end as items are appended.
+ */
+class CheckpointQueue {
+public:
+    /// Number of items stored per chunk.
+    static const size_t ChunkSize = 64;
+
+private:
+    struct Link {
+        Link* prev;
+        Link* next;
+    };
+
+    struct Chunk : public Link {
+        // Number of slots which have been appended to (whether or not they
+        // have since been erased).
+        size_t used = 0;
+        queued_item slots[ChunkSize];
+    };
+
+public:
+    template <bool IsConst>
+    class Iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = queued_item;
+        using difference_type = std::ptrdiff_t;
+        using pointer = typename std::
+                conditional<IsConst, const queued_item*, queued_item*>::type;
+        using reference = typename std::
+                conditional<IsConst, const queued_item&, queued_item&>::type;
+
+        Iterator() : link(nullptr), end(nullptr), index(0) {
+        }
+
+        /// Conversion from an iterator to a const_iterator.
+        template <bool WasConst,
+                  class = typename std::enable_if<IsConst && !WasConst>::type>
+        Iterator(const Iterator<WasConst>& other)
+            : link(other.link), end(other.end), index(other.index) {
+        }
+
+        reference operator*() const {
+            return chunk()->slots[index];
+        }
+
+        pointer operator->() const {
+            return &chunk()->slots[index];
+        }
+
+        Iterator& operator++() {
+            ++index;
+            skipForward();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator tmp(*this);
+            ++*this;
+            return tmp;
+        }
+
+        // As for std::list, decrementing begin() is undefined.
+        Iterator& operator--() {
+            do {
+                while (index == 0) {
+                    link = link->prev;
+                    index = (link == end) ? 0 : chunk()->used;
+                }
+                --index;
+            } while (!chunk()->slots[index]);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator tmp(*this);
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return link == other.link && index == other.index;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class CheckpointQueue;
+        friend class Iterator<!IsConst>;
+
+        using LinkPtr =
+                typename std::conditional<IsConst, const Link*, Link*>::type;
+        using ChunkPtr =
+                typename std::conditional<IsConst, const Chunk*, Chunk*>::type;
+
+        Iterator(LinkPtr link, LinkPtr end, size_t index)
+            : link(link), end(end), index(index) {
+        }
+
+        ChunkPtr chunk() const {
+            return static_cast<ChunkPtr>(link);
+        }
+
+        /// Move forward to the first live slot at or after the current one.
+        void skipForward() {
+            while (link != end) {
+                for (; index < chunk()->used; ++index) {
+                    if (chunk()->slots[index]) {
+                        return;
+                    }
+                }
+                link = link->next;
+                index = 0;
+            }
+        }
+
+        LinkPtr link;
+        // The queue's sentinel link (i.e. the end() position).
+        LinkPtr end;
+        size_t index;
+    };
+
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    CheckpointQueue() : numItems(0), numTombstones(0), numChunks(0) {
+        head.prev = head.next = &head;
+    }
+
+    CheckpointQueue(const CheckpointQueue&) = delete;
+    CheckpointQueue& operator=(const CheckpointQueue&) = delete;
+
+    ~CheckpointQueue() {
+        clear();
+    }
+
+    iterator begin() {
+        iterator it(head.next, &head, 0);
+        it.skipForward();
+        return it;
+    }
+
+    const_iterator begin() const {
+        const_iterator it(head.next, &head, 0);
+        it.skipForward();
+        return it;
+    }
+
+    iterator end() {
+        return iterator(&head, &head, 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(&head, &head, 0);
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    /// @return the number of (non-erased) items in the queue.
+    size_t size() const {
+        return numItems;
+    }
+
+    bool empty() const {
+        return numItems == 0;
+    }
+
+    /// @return the number of erased items whose slots are still allocated.
+    size_t getNumTombstones() const {
+        return numTombstones;
+    }
+
+    queued_item& back() {
+        return *--end();
+    }
+
+    const queued_item& back() const {
+        return *--end();
+    }
+
+    void push_back(const queued_item& item) {
+        Chunk* tail = (head.prev == &head) ? nullptr
+                                           : static_cast<Chunk*>(head.prev);
+        if (tail == nullptr || tail->used == ChunkSize) {
+            tail = new Chunk;
+            tail->prev = head.prev;
+            tail->next = &head;
+            head.prev->next = tail;
+            head.prev = tail;
+            ++numChunks;
+        }
+        tail->slots[tail->used++] = item;
+        ++numItems;
+    }
+
+    /**
+     * Erase the item at pos, leaving a tombstone in its slot.
+     * @return an iterator to the item following pos.
+     */
+    iterator erase(iterator pos) {
+        pos->reset();
+        --numItems;
+        ++numTombstones;
+        return ++pos;
+    }
+
+    void pop_back() {
+        erase(--end());
+    }
+
+    void clear() {
+        Link* link = head.next;
+        while (link != &head) {
+            Link* next = link->next;
+            delete static_cast<Chunk*>(link);
+            link = next;
+        }
+        head.prev = head.next = &head;
+        numItems = 0;
+        numTombstones = 0;
+        numChunks = 0;
+    }
+
+    void swap(CheckpointQueue& other) {
+        Link* first = (head.next == &head) ? nullptr : head.next;
+        Link* last = head.prev;
+        attach(other.head.next == &other.head ? nullptr : other.head.next,
+               other.head.prev);
+        other.attach(first, last);
+        std::swap(numItems, other.numItems);
+        std::swap(numTombstones, other.numTombstones);
+        std::swap(numChunks, other.numChunks);
+    }
+
+    /**
+     * @return the number of bytes of memory allocated for the queue's
+     *         chunks.
+     */
+    size_t getMemoryOverhead() const {
+        return numChunks * sizeof(Chunk);
+    }
+
+private:
+    /// Make the chunks first..last (or none if first is null) this queue's.
+    void attach(Link* first, Link* last) {
+        if (first == nullptr) {
+            head.prev = head.next = &head;
+            return;
+        }
+        head.next = first;
+        head.prev = last;
+        first->prev = &head;
+        last->next = &head;
+    }
+
+    // Sentinel of the circular list of chunks; end() refers to it.
+    Link head;
+    size_t numItems;
+    size_t numTombstones;
+    size_t numChunks;
+};
@@ -29,7 +29,8 @@
 #include "tapconnmap.h"
 
 /**
- * Remove all the closed unreferenced checkpoints for each vbucket.
+ * Remove all the closed unreferenced checkpoints for each vbucket (and, if
+ * enabled, expel processed items from the referenced ones).
  */
 class CheckpointVisitor : public VBucketVisitor {
 public:
@@ -63,6 +64,19 @@ public:
                 removed, vb->getId());
         }
         removed = 0;
+
+        // A slow cursor keeps its whole checkpoint in memory; free the items
+        // before it, which every cursor has already processed.
+        if (vb->checkpointManager.getCheckpointConfig()
+                    .isCheckpointExpelEnabled()) {
+            size_t expelled =
+                    vb->checkpointManager.expelUnreferencedCheckpointItems(*vb);
+            if (expelled > 0) {
+                LOG(EXTENSION_LOG_DEBUG,
+                    "Expelled %" PRIu64 " items from checkpoints of VBucket %d",
+                    uint64_t(expelled), vb->getId());
+            }
+        }
     }
 
     void complete() override {
@@ -102,6 +102,7 @@ couchstore_error_t StatsOps::sync(couchstore_error_info_t* errinfo,
                                   couch_file_handle h) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
     BlockTimer bt(&stats.syncTimeHisto);
+    stats.totalSyncs++;
     return sf->orig_ops->sync(errinfo, sf->orig_handle);
 }
 
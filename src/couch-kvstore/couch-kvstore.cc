@@ -36,6 +36,7 @@
 #include <map>
 #include <phosphor/phosphor.h>
 #include <platform/cb_malloc.h>
+#include <platform/make_unique.h>
 #include <platform/checked_snprintf.h>
 #include <string>
 #include <utility>
@@ -190,6 +191,9 @@ struct AllKeysCtx {
     uint32_t count;
 };
 
+const size_t CouchRequestArena::BlockSize;
+const size_t CouchRequestArena::MaxRetainedBlocks;
+
 couchstore_content_meta_flags CouchRequest::getContentMeta(const Item& it) {
     couchstore_content_meta_flags rval;
 
@@ -418,15 +422,13 @@ void CouchKVStore::set(const Item &itm, Callback<mutation_result> &cb) {
     MutationRequestCallback requestcb;
     uint64_t fileRev = dbFileRevMap[itm.getVBucketId()];
 
-    // each req will be de-allocated after commit
+    // each req will be destroyed after commit
     requestcb.setCb = &cb;
-    CouchRequest* req =
-            new CouchRequest(itm,
-                             fileRev,
-                             requestcb,
-                             deleteItem,
-                             configuration.shouldPersistDocNamespace());
-    pendingReqsQ.push_back(req);
+    pendingReqs.emplace(itm,
+                        fileRev,
+                        requestcb,
+                        deleteItem,
+                        configuration.shouldPersistDocNamespace());
 }
 
 void CouchKVStore::get(const DocKey& key, uint16_t vb,
@@ -580,13 +582,11 @@ void CouchKVStore::del(const Item &itm,
     uint64_t fileRev = dbFileRevMap[itm.getVBucketId()];
     MutationRequestCallback requestcb;
     requestcb.delCb = &cb;
-    CouchRequest* req =
-            new CouchRequest(itm,
-                             fileRev,
-                             requestcb,
-                             true,
-                             configuration.shouldPersistDocNamespace());
-    pendingReqsQ.push_back(req);
+    pendingReqs.emplace(itm,
+                        fileRev,
+                        requestcb,
+                        true,
+                        configuration.shouldPersistDocNamespace());
 }
 
 void CouchKVStore::delVBucket(uint16_t vbucket, uint64_t fileRev) {
@@ -1126,7 +1126,8 @@ StorageProperties CouchKVStore::getStorageProperties() {
                          StorageProperties::EfficientVBDeletion::Yes,
                          StorageProperties::PersistedDeletion::Yes,
                          StorageProperties::EfficientGet::Yes,
-                         StorageProperties::ConcurrentWriteCompact::No);
+                         StorageProperties::ConcurrentWriteCompact::No,
+                         StorageProperties::DetachedCommit::Yes);
     return rv;
 }
 
@@ -1140,7 +1141,7 @@ bool CouchKVStore::commit(const Item* collectionsManifest) {
     }
 
     if (intransaction) {
-        if (commit2couchstore(collectionsManifest)) {
+        if (commit2couchstore(pendingReqs, collectionsManifest)) {
             intransaction = false;
         }
     }
@@ -1148,6 +1149,66 @@ bool CouchKVStore::commit(const Item* collectionsManifest) {
     return !intransaction;
 }
 
+/**
+ * The requests of a CouchKVStore transaction detached by detachCommit.
+ */
+class CouchPendingCommit : public KVStorePendingCommit {
+public:
+    explicit CouchPendingCommit(CouchKVStore& store) : store(store) {
+    }
+
+    ~CouchPendingCommit() {
+        store.releaseDetachedRequests(reqs);
+    }
+
+    CouchKVStore& store;
+    CouchRequestArena reqs;
+    const Item* collectionsManifest = nullptr;
+};
+
+std::unique_ptr<KVStorePendingCommit> CouchKVStore::detachCommit(
+        const Item* collectionsManifest) {
+    if (isReadOnly()) {
+        throw std::logic_error("CouchKVStore::detachCommit: Not valid on a "
+                               "read-only object.");
+    }
+
+    auto pending = std::make_unique<CouchPendingCommit>(*this);
+    pending->reqs.swap(pendingReqs);
+    {
+        // Carry on in the storage the previous detached commit released.
+        std::lock_guard<std::mutex> lh(spareReqsMutex);
+        pendingReqs.swap(spareReqs);
+    }
+    pending->collectionsManifest = collectionsManifest;
+    pending->persistenceCallbacks.swap(pcbs);
+    intransaction = false;
+    return std::move(pending);
+}
+
+bool CouchKVStore::commitDetached(KVStorePendingCommit& pendingCommit) {
+    TRACE_EVENT("ep-engine/couch-kvstore", "commitDetached",
+                this->configuration.getShardId());
+
+    if (isReadOnly()) {
+        throw std::logic_error("CouchKVStore::commitDetached: Not valid on a "
+                               "read-only object.");
+    }
+
+    auto& pending = static_cast<CouchPendingCommit&>(pendingCommit);
+    // On failure the requests have been completed (with the error), so a
+    // retry has nothing more to commit.
+    return commit2couchstore(pending.reqs, pending.collectionsManifest);
+}
+
+void CouchKVStore::releaseDetachedRequests(CouchRequestArena& reqs) {
+    reqs.clear();
+    std::lock_guard<std::mutex> lh(spareReqsMutex);
+    if (reqs.getCapacity() > spareReqs.getCapacity()) {
+        spareReqs.swap(reqs);
+    }
+}
+
 bool CouchKVStore::getStat(const char* name, size_t& value)  {
     if (strcmp("io_total_read_bytes", name) == 0) {
         value = st.fsStats.totalBytesRead.load() +
@@ -1163,6 +1224,12 @@ bool CouchKVStore::getStat(const char* name, size_t& value)  {
     } else if (strcmp("io_compaction_write_bytes", name) == 0) {
         value = st.fsStatsCompaction.totalBytesWritten;
         return true;
+    } else if (strcmp("io_num_write", name) == 0) {
+        value = st.io_num_write;
+        return true;
+    } else if (strcmp("io_num_sync", name) == 0) {
+        value = st.fsStats.totalSyncs;
+        return true;
     }
 
     return false;
@@ -1817,17 +1884,19 @@ int CouchKVStore::recordDbDump(Db *db, DocInfo *docinfo, void *ctx) {
     return COUCHSTORE_SUCCESS;
 }
 
-bool CouchKVStore::commit2couchstore(const Item* collectionsManifest) {
+bool CouchKVStore::commit2couchstore(CouchRequestArena& reqsToCommit,
+                                     const Item* collectionsManifest) {
     bool success = true;
 
-    size_t pendingCommitCnt = pendingReqsQ.size();
+    const auto& reqs = reqsToCommit.getRequests();
+    size_t pendingCommitCnt = reqs.size();
     if (pendingCommitCnt == 0 && !collectionsManifest) {
         return success;
     }
 
     // Use the vbucket of the first item or the manifest item
     uint16_t vbucket2flush = pendingCommitCnt
-                                     ? pendingReqsQ[0]->getVBucketId()
+                                     ? reqs[0]->getVBucketId()
                                      : collectionsManifest->getVBucketId();
 
     // When an item and a manifest are present, vbucket2flush is read from the
@@ -1849,14 +1918,14 @@ bool CouchKVStore::commit2couchstore(const Item* collectionsManifest) {
     std::vector<DocInfo*> docinfos(pendingCommitCnt);
 
     for (size_t i = 0; i < pendingCommitCnt; ++i) {
-        CouchRequest *req = pendingReqsQ[i];
+        CouchRequest *req = reqs[i];
         docs[i] = (Doc *)req->getDbDoc();
         docinfos[i] = req->getDbDocInfo();
         if (vbucket2flush != req->getVBucketId()) {
             throw std::logic_error(
                     "CouchKVStore::commit2couchstore: "
                     "mismatch between vbucket2flush (which is "
-                    + std::to_string(vbucket2flush) + ") and pendingReqsQ["
+                    + std::to_string(vbucket2flush) + ") and pendingReqs["
                     + std::to_string(i) + "] (which is "
                     + std::to_string(req->getVBucketId()) + ")");
         }
@@ -1876,13 +1945,9 @@ bool CouchKVStore::commit2couchstore(const Item* collectionsManifest) {
                    vbucket2flush, fileRev);
     }
 
-    commitCallback(pendingReqsQ, kvctx, errCode);
+    commitCallback(reqs, kvctx, errCode);
 
-    // clean up
-    for (size_t i = 0; i < pendingCommitCnt; ++i) {
-        delete pendingReqsQ[i];
-    }
-    pendingReqsQ.clear();
+    reqsToCommit.clear();
     return success;
 }
 
@@ -2045,9 +2110,10 @@ void CouchKVStore::remVBucketFromDbFileMap(uint16_t vbucketId) {
     dbFileRevMap[vbucketId] = 1;
 }
 
-void CouchKVStore::commitCallback(std::vector<CouchRequest *> &committedReqs,
-                                  kvstats_ctx &kvctx,
-                                  couchstore_error_t errCode) {
+void CouchKVStore::commitCallback(
+        const std::vector<CouchRequest*>& committedReqs,
+        kvstats_ctx& kvctx,
+        couchstore_error_t errCode) {
     size_t commitSize = committedReqs.size();
 
     for (size_t index = 0; index < commitSize; index++) {
@@ -22,9 +22,12 @@
 #include "libcouchstore/couch_db.h"
 #include <relaxed_atomic.h>
 
+#include <array>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "configuration.h"
@@ -144,6 +147,98 @@ protected:
     DocInfo dbDocInfo;
 };
 
+/**
+ * The CouchRequests of a CouchKVStore transaction.
+ *
+ * Requests are constructed in place in blocks of storage which are kept when
+ * the requests are cleared, so that a flusher writing batch after batch
+ * doesn't heap-allocate a request per mutation. A request's Doc and DocInfo
+ * point into the request itself, so requests never move once constructed.
+ *
+ * Only the request's own allocation is saved: each request still copies the
+ * Item's key and encodes its metadata, and holds a reference to its value.
+ */
+class CouchRequestArena {
+public:
+    CouchRequestArena() = default;
+
+    ~CouchRequestArena() {
+        clear();
+    }
+
+    CouchRequestArena(const CouchRequestArena&) = delete;
+    CouchRequestArena& operator=(const CouchRequestArena&) = delete;
+
+    /**
+     * Construct a request in the arena from the given arguments. Request
+     * may be a subclass of CouchRequest which adds no members.
+     */
+    template <typename Request = CouchRequest, typename... Args>
+    Request* emplace(Args&&... args) {
+        static_assert(sizeof(Request) == sizeof(CouchRequest),
+                      "CouchRequestArena::emplace: Request must be the same "
+                      "size as CouchRequest");
+        const size_t index = requests.size();
+        if (index / BlockSize == blocks.size()) {
+            blocks.emplace_back(new Block);
+        }
+        void* slot = &(*blocks[index / BlockSize])[index % BlockSize];
+        auto* req = new (slot) Request(std::forward<Args>(args)...);
+        requests.push_back(req);
+        return req;
+    }
+
+    /// @return the requests, in the order they were added.
+    const std::vector<CouchRequest*>& getRequests() const {
+        return requests;
+    }
+
+    size_t size() const {
+        return requests.size();
+    }
+
+    /// @return the number of requests the arena can hold without allocating.
+    size_t getCapacity() const {
+        return blocks.size() * BlockSize;
+    }
+
+    /**
+     * Destroy the requests. Their storage is kept for the next transaction,
+     * up to MaxRetainedBlocks blocks.
+     */
+    void clear() {
+        for (auto* req : requests) {
+            req->~CouchRequest();
+        }
+        requests.clear();
+        if (blocks.size() > MaxRetainedBlocks) {
+            blocks.resize(MaxRetainedBlocks);
+        }
+    }
+
+    void swap(CouchRequestArena& other) {
+        blocks.swap(other.blocks);
+        requests.swap(other.requests);
+    }
+
+    /// Number of requests in each block of storage.
+    static const size_t BlockSize = 256;
+
+    /// Number of blocks kept by clear(); storage beyond them (left by an
+    /// unusually large transaction) is freed.
+    static const size_t MaxRetainedBlocks = 64;
+
+private:
+    typedef std::array<typename std::aligned_storage<
+                               sizeof(CouchRequest),
+                               alignof(CouchRequest)>::type,
+                       BlockSize>
+            Block;
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::vector<CouchRequest*> requests;
+};
+
 /**
  * KVStore with couchstore as the underlying storage system
  */
@@ -212,7 +307,24 @@ public:
     bool commit(const Item* collectionsManifest) override;
 
     /**
-     * Rollback a transaction (unless not currently in one).
+     * End the current transaction, detaching its requests to be committed
+     * by commitDetached() while the next transaction is written.
+     */
+    std::unique_ptr<KVStorePendingCommit> detachCommit(
+            const Item* collectionsManifest) override;
+
+    /**
+     * Commit requests detached by detachCommit(). As they are all for one
+     * vbucket, this only touches that vbucket's file (and cached state), so
+     * it may run concurrently with writes to the other vbuckets.
+     *
+     * @return true if the commit is completed successfully.
+     */
+    bool commitDetached(KVStorePendingCommit& pendingCommit) override;
+
+    /**
+     * Rollback a transaction (unless not currently in one), discarding its
+     * requests without completing them.
      */
     void rollback(void) override {
         if (isReadOnly()) {
@@ -220,6 +332,7 @@ public:
                     "read-only object.");
         }
         if (intransaction) {
+            pendingReqs.clear();
             intransaction = false;
         }
     }
@@ -471,7 +584,20 @@ protected:
     void operator=(const CouchKVStore &from);
 
     void close();
-    bool commit2couchstore(const Item* collectionsManifest);
+    /**
+     * Commit the given requests, completing each (with the outcome) and
+     * clearing them, whether or not the commit succeeds.
+     */
+    bool commit2couchstore(CouchRequestArena& reqsToCommit,
+                           const Item* collectionsManifest);
+
+    friend class CouchPendingCommit;
+
+    /**
+     * Keep the storage of a detached commit's requests (once it has been
+     * committed) for the transaction after next.
+     */
+    void releaseDetachedRequests(CouchRequestArena& reqs);
 
     uint64_t checkNewRevNum(std::string &dbname, bool newFile = false);
     void populateFileNameMap(std::vector<std::string> &filenames,
@@ -508,7 +634,7 @@ protected:
                                 kvstats_ctx& kvctx,
                                 const Item* collectionsManifest);
 
-    void commitCallback(std::vector<CouchRequest *> &committedReqs,
+    void commitCallback(const std::vector<CouchRequest*>& committedReqs,
                         kvstats_ctx &kvctx,
                         couchstore_error_t errCode);
     couchstore_error_t saveVBState(Db *db, const vbucket_state &vbState);
@@ -564,9 +690,14 @@ protected:
     std::vector<std::atomic<uint64_t>> dbFileRevMap;
 
     uint16_t numDbFiles;
-    std::vector<CouchRequest *> pendingReqsQ;
+    CouchRequestArena pendingReqs;
     bool intransaction;
 
+    // Storage released by the last detached commit, taken up by the next
+    // detachCommit().
+    std::mutex spareReqsMutex;
+    CouchRequestArena spareReqs;
+
     /**
      * FileOpsInterface implementation for couchstore which tracks
      * all bytes read/written by couchstore *except* compaction.
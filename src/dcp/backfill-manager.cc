@@ -27,19 +27,23 @@
 
 #include <phosphor/phosphor.h>
 
+#include <algorithm>
+
 static const size_t sleepTime = 1;
 
 class BackfillManagerTask : public GlobalTask {
 public:
     BackfillManagerTask(EventuallyPersistentEngine& e,
                         std::weak_ptr<BackfillManager> mgr,
+                        size_t index,
                         double sleeptime = 0,
                         bool completeBeforeShutdown = false)
         : GlobalTask(&e,
                      TaskId::BackfillManagerTask,
                      sleeptime,
                      completeBeforeShutdown),
-          weak_manager(mgr) {
+          weak_manager(mgr),
+          taskIndex(index) {
     }
 
     bool run();
@@ -54,6 +58,9 @@ private:
     // If the manager is deleted (by the DcpProducer) then the
     // ManagerTask simply cancels itself and stops running.
     std::weak_ptr<BackfillManager> weak_manager;
+
+    // This task's index in the manager's managerTasks.
+    const size_t taskIndex;
 };
 
 bool BackfillManagerTask::run() {
@@ -68,7 +75,7 @@ bool BackfillManagerTask::run() {
         return false;
     }
 
-    backfill_status_t status = manager->backfill();
+    backfill_status_t status = manager->backfill(taskIndex);
     if (status == backfill_finished) {
         return false;
     } else if (status == backfill_snooze) {
@@ -87,13 +94,13 @@ cb::const_char_buffer BackfillManagerTask::getDescription() {
 }
 
 BackfillManager::BackfillManager(EventuallyPersistentEngine& e)
-    : engine(e), managerTask(NULL) {
+    : engine(e),
+      managerTasks(e.getConfiguration().getDcpBackfillTasks()) {
     Configuration& config = e.getConfiguration();
 
-    scanBuffer.bytesRead = 0;
-    scanBuffer.itemsRead = 0;
-    scanBuffer.maxBytes = config.getDcpScanByteLimit();
-    scanBuffer.maxItems = config.getDcpScanItemLimit();
+    runningScans.reserve(managerTasks.size());
+    scanMaxBytes = config.getDcpScanByteLimit();
+    scanMaxItems = config.getDcpScanItemLimit();
 
     buffer.bytesRead = 0;
     buffer.maxBytes = config.getDcpBackfillByteLimit();
@@ -110,12 +117,15 @@ void BackfillManager::addStats(connection_t conn, ADD_STAT add_stat,
     conn->addStat("backfill_num_active", activeBackfills.size(), add_stat, c);
     conn->addStat("backfill_num_snoozing", snoozingBackfills.size(), add_stat, c);
     conn->addStat("backfill_num_pending", pendingBackfills.size(), add_stat, c);
+    conn->addStat("backfill_num_running", runningScans.size(), add_stat, c);
 }
 
 BackfillManager::~BackfillManager() {
-    if (managerTask) {
-        managerTask->cancel();
-        managerTask.reset();
+    for (auto& task : managerTasks) {
+        if (task) {
+            task->cancel();
+            task.reset();
+        }
     }
 
     while (!activeBackfills.empty()) {
@@ -153,52 +163,92 @@ void BackfillManager::schedule(VBucket& vb,
         pendingBackfills.push_back(std::move(backfill));
     }
 
-    if (managerTask && !managerTask->isdead()) {
-        ExecutorPool::get()->wake(managerTask->getId());
-        return;
+    scheduleTasks_UNLOCKED();
+}
+
+void BackfillManager::scheduleTasks_UNLOCKED() {
+    // Run as many tasks as there are backfills for them to run, up to the
+    // configured number.
+    const size_t numBackfills = runningScans.size() + activeBackfills.size() +
+                                snoozingBackfills.size() +
+                                pendingBackfills.size();
+    const size_t wanted = std::min(managerTasks.size(), numBackfills);
+    size_t running = 0;
+    for (auto& task : managerTasks) {
+        if (task && !task->isdead()) {
+            ExecutorPool::get()->wake(task->getId());
+            ++running;
+        }
     }
 
-    managerTask.reset(new BackfillManagerTask(engine, shared_from_this()));
-    ExecutorPool::get()->schedule(managerTask);
+    for (size_t ii = 0; ii < managerTasks.size() && running < wanted; ++ii) {
+        auto& task = managerTasks[ii];
+        if (!task || task->isdead()) {
+            task.reset(new BackfillManagerTask(engine, shared_from_this(), ii));
+            ExecutorPool::get()->schedule(task);
+            ++running;
+        }
+    }
 }
 
-bool BackfillManager::bytesCheckAndRead(size_t bytes) {
-    LockHolder lh(lock);
-    if (scanBuffer.itemsRead >= scanBuffer.maxItems) {
-        return false;
+BackfillManager::ScanBuffer* BackfillManager::findScan_UNLOCKED(
+        uint16_t vbucket) {
+    for (auto& scan : runningScans) {
+        if (scan.vbucket == vbucket) {
+            return &scan;
+        }
     }
+    return nullptr;
+}
 
-    // Always allow an item to be backfilled if the scan buffer is empty,
-    // otherwise check to see if there is room for the item.
-    if (scanBuffer.bytesRead + bytes <= scanBuffer.maxBytes ||
-        scanBuffer.bytesRead == 0) {
-        scanBuffer.bytesRead += bytes;
-    } else {
-        /* Subsequent items for this backfill will be read in next run */
-        return false;
+bool BackfillManager::bytesCheckAndRead(uint16_t vbucket, size_t bytes) {
+    LockHolder lh(lock);
+    // (A backfill not being run by one of our tasks has no scan buffer,
+    // only the connection's buffer limits it.)
+    ScanBuffer* scan = findScan_UNLOCKED(vbucket);
+    if (scan) {
+        if (scan->itemsRead >= scanMaxItems) {
+            return false;
+        }
+
+        // Always allow an item to be backfilled if the scan buffer is empty,
+        // otherwise check to see if there is room for the item.
+        if (scan->bytesRead + bytes <= scanMaxBytes || scan->bytesRead == 0) {
+            scan->bytesRead += bytes;
+        } else {
+            /* Subsequent items for this backfill will be read in next run */
+            return false;
+        }
     }
 
     if (buffer.bytesRead == 0 || buffer.bytesRead + bytes <= buffer.maxBytes) {
         buffer.bytesRead += bytes;
     } else {
-        scanBuffer.bytesRead -= bytes;
+        if (scan) {
+            scan->bytesRead -= bytes;
+        }
         buffer.full = true;
         buffer.nextReadSize = bytes;
         return false;
     }
 
-    scanBuffer.itemsRead++;
+    if (scan) {
+        scan->itemsRead++;
+    }
 
     return true;
 }
 
-void BackfillManager::bytesForceRead(size_t bytes) {
+void BackfillManager::bytesForceRead(uint16_t vbucket, size_t bytes) {
     LockHolder lh(lock);
 
     /* Irrespective of the scan buffer usage and overall backfill buffer usage
        we want to complete this backfill */
-    ++scanBuffer.itemsRead;
-    scanBuffer.bytesRead += bytes;
+    ScanBuffer* scan = findScan_UNLOCKED(vbucket);
+    if (scan) {
+        ++scan->itemsRead;
+        scan->bytesRead += bytes;
+    }
     buffer.bytesRead += bytes;
 
     if (buffer.bytesRead > buffer.maxBytes) {
@@ -236,19 +286,22 @@ void BackfillManager::bytesSent(size_t bytes) {
         if (canFitNext && enoughCleared) {
             buffer.nextReadSize = 0;
             buffer.full = false;
-            if (managerTask) {
-                ExecutorPool::get()->wake(managerTask->getId());
+            for (auto& task : managerTasks) {
+                if (task) {
+                    ExecutorPool::get()->wake(task->getId());
+                }
             }
         }
     }
 }
 
-backfill_status_t BackfillManager::backfill() {
+backfill_status_t BackfillManager::backfill(size_t taskIndex) {
     std::unique_lock<std::mutex> lh(lock);
 
     if (activeBackfills.empty() && snoozingBackfills.empty()
         && pendingBackfills.empty()) {
-        managerTask.reset();
+        // (Any backfills being run by other tasks will be continued by them.)
+        managerTasks[taskIndex].reset();
         return backfill_finished;
     }
 
@@ -290,15 +343,30 @@ backfill_status_t BackfillManager::backfill() {
         return reschedule ? backfill_success : backfill_snooze;
     }
 
-    UniqueDCPBackfillPtr backfill = std::move(activeBackfills.front());
-    activeBackfills.pop_front();
+    // Run the first backfill whose vbucket isn't being backfilled by another
+    // task (a replaced stream's backfill may still be running).
+    auto itr = std::find_if(activeBackfills.begin(),
+                            activeBackfills.end(),
+                            [this](const UniqueDCPBackfillPtr& b) {
+                                return !findScan_UNLOCKED(b->getVBucketId());
+                            });
+    if (itr == activeBackfills.end()) {
+        return backfill_snooze;
+    }
+    UniqueDCPBackfillPtr backfill = std::move(*itr);
+    activeBackfills.erase(itr);
+    const uint16_t vbid = backfill->getVBucketId();
+    runningScans.push_back({vbid, 0, 0});
 
     lh.unlock();
     backfill_status_t status = backfill->run();
     lh.lock();
 
-    scanBuffer.bytesRead = 0;
-    scanBuffer.itemsRead = 0;
+    runningScans.erase(std::find_if(runningScans.begin(),
+                                    runningScans.end(),
+                                    [vbid](const ScanBuffer& scan) {
+                                        return scan.vbucket == vbid;
+                                    }));
 
     switch (status) {
         case backfill_success:
@@ -309,7 +377,6 @@ backfill_status_t BackfillManager::backfill() {
             engine.getDcpConnMap().decrNumActiveSnoozingBackfills();
             break;
         case backfill_snooze: {
-            uint16_t vbid = backfill->getVBucketId();
             VBucketPtr vb = engine.getVBucket(vbid);
             if (vb) {
                 snoozingBackfills.push_back(
@@ -355,7 +422,9 @@ void BackfillManager::moveToActiveQueue() {
 
 void BackfillManager::wakeUpTask() {
     LockHolder lh(lock);
-    if (managerTask) {
-        ExecutorPool::get()->wake(managerTask->getId());
+    for (auto& task : managerTasks) {
+        if (task) {
+            ExecutorPool::get()->wake(task->getId());
+        }
     }
 }
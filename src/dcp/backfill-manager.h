@@ -23,7 +23,10 @@
  * - BackfillManager, which acts as the main interface for adding new
  *    streams.
  * - BackfillManagerTask, which runs on a background AUXIO thread and
- *    performs most of the actual backfilling operations.
+ *    performs most of the actual backfilling operations. There are up to
+ *    dcp_backfill_tasks of them per connection, each running a different
+ *    vbucket's backfill, so a connection streaming many vbuckets can scan
+ *    their files in parallel.
  *
  * One main purpose of the BackfillManager is to impose a limit on the
  * in-memory buffer space a streams' backfills consume - often
@@ -40,6 +43,7 @@
  * - dcp_scan_byte_limit
  * - dcp_scan_item_limit
  * - dcp_backfill_byte_limit
+ * - dcp_backfill_tasks
  */
 
 #ifndef SRC_DCP_BACKFILL_MANAGER_H_
@@ -52,6 +56,7 @@
 #include "dcp/stream.h"
 
 #include <list>
+#include <vector>
 
 class EventuallyPersistentEngine;
 
@@ -72,26 +77,28 @@ public:
      * Checks if the read size can fit into the backfill buffer and scan
      * buffer and reads only if the read can fit.
      *
+     * @param vbucket vbucket being backfilled (identifying its scan buffer)
      * @param bytes read size
      *
      * @return true upon read success
      *         false if the buffer(s) is(are) full
      */
-    bool bytesCheckAndRead(size_t bytes);
+    bool bytesCheckAndRead(uint16_t vbucket, size_t bytes);
 
     /**
      * Reads the backfill item irrespective of whether backfill buffer or
      * scan buffer is full.
      *
+     * @param vbucket vbucket being backfilled (identifying its scan buffer)
      * @param bytes read size
      */
-    void bytesForceRead(size_t bytes);
+    void bytesForceRead(uint16_t vbucket, size_t bytes);
 
     void bytesSent(size_t bytes);
 
-    // Called by the managerTask to acutally perform backfilling & manage
+    // Called by the managerTasks to acutally perform backfilling & manage
     // backfills between the different queues.
-    backfill_status_t backfill();
+    backfill_status_t backfill(size_t taskIndex);
 
     void wakeUpTask();
 
@@ -105,9 +112,27 @@ protected:
     } buffer;
 
 private:
+    //! The scan buffer is for a backfill being run by one of the managerTasks
+    struct ScanBuffer {
+        uint16_t vbucket;
+        size_t bytesRead;
+        size_t itemsRead;
+    };
 
     void moveToActiveQueue();
 
+    /**
+     * Schedule the managerTasks which aren't running, and wake those which
+     * are.
+     */
+    void scheduleTasks_UNLOCKED();
+
+    /**
+     * @return the scan buffer of the running backfill of the given vbucket,
+     *         or nullptr if it isn't running.
+     */
+    ScanBuffer* findScan_UNLOCKED(uint16_t vbucket);
+
     std::mutex lock;
     std::list<UniqueDCPBackfillPtr> activeBackfills;
     std::list<std::pair<rel_time_t, UniqueDCPBackfillPtr> > snoozingBackfills;
@@ -115,15 +140,14 @@ private:
     //!   threshold we use waitingBackfills
     std::list<UniqueDCPBackfillPtr> pendingBackfills;
     EventuallyPersistentEngine& engine;
-    ExTask managerTask;
-
-    //! The scan buffer is for the current stream being backfilled
-    struct {
-        size_t bytesRead;
-        size_t itemsRead;
-        size_t maxBytes;
-        size_t maxItems;
-    } scanBuffer;
+    //! The tasks running backfills; a null entry has no task scheduled.
+    std::vector<ExTask> managerTasks;
+
+    //! Scan buffers of the backfills being run
+    std::vector<ScanBuffer> runningScans;
+    //! Limits of each scan buffer
+    size_t scanMaxBytes;
+    size_t scanMaxItems;
 };
 
 #endif  // SRC_DCP_BACKFILL_MANAGER_H_
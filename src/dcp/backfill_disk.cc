@@ -49,8 +49,12 @@ CacheCallback::CacheCallback(EventuallyPersistentEngine& e, active_stream_t& s)
 }
 
 void CacheCallback::callback(CacheLookup& lookup) {
-    VBucketPtr vb =
-            engine_.getKVBucket()->getVBucket(lookup.getVBucketId());
+    VBucketPtr lookedUp;
+    VBucket* vb = vbucket.get();
+    if (!vb) {
+        lookedUp = engine_.getKVBucket()->getVBucket(lookup.getVBucketId());
+        vb = lookedUp.get();
+    }
     if (!vb) {
         setStatus(ENGINE_SUCCESS);
         return;
@@ -180,10 +184,13 @@ backfill_status_t DCPBackfillDisk::create() {
     }
 
     std::shared_ptr<Callback<GetValue> > cb(new DiskCallback(stream));
-    std::shared_ptr<Callback<CacheLookup> > cl(
-            new CacheCallback(engine, stream));
-    scanCtx = kvstore->initScanContext(
-            cb, cl, vbid, startSeqno, DocumentFilter::ALL_ITEMS, valFilter);
+    cacheCallback = std::make_shared<CacheCallback>(engine, stream);
+    scanCtx = kvstore->initScanContext(cb,
+                                       cacheCallback,
+                                       vbid,
+                                       startSeqno,
+                                       DocumentFilter::ALL_ITEMS,
+                                       valFilter);
 
     if (scanCtx) {
         stream->incrBackfillRemaining(scanCtx->documentCount);
@@ -204,7 +211,9 @@ backfill_status_t DCPBackfillDisk::scan() {
     }
 
     KVStore* kvstore = engine.getKVBucket()->getROUnderlying(vbid);
+    cacheCallback->setVBucket(engine.getKVBucket()->getVBucket(vbid));
     scan_error_t error = kvstore->scan(scanCtx);
+    cacheCallback->setVBucket(nullptr);
 
     if (error == scan_again) {
         return backfill_success;
@@ -40,9 +40,21 @@ public:
 
     void callback(CacheLookup& lookup);
 
+    /**
+     * Set the vbucket whose HashTable items are looked up in for the
+     * duration of a scan, rather than getting it from the VBucketMap (and
+     * taking the map's per-vbucket lock, contended with front-end
+     * operations) for every item read. Reset it (to nullptr) at the end of
+     * the scan, so a deleted vbucket isn't kept alive by a paused backfill.
+     */
+    void setVBucket(VBucketPtr vb) {
+        vbucket = std::move(vb);
+    }
+
 private:
     EventuallyPersistentEngine& engine_;
     active_stream_t stream_;
+    VBucketPtr vbucket;
 };
 
 /* Callback to get the items that are found to be in the disk */
@@ -116,6 +128,7 @@ private:
     EventuallyPersistentEngine& engine;
 
     ScanContext* scanCtx;
+    std::shared_ptr<CacheCallback> cacheCallback;
     backfill_state_t state;
     std::mutex lock;
 };
@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "dcp/compressed_value_cache.h"
+
+#include "statwriter.h"
+
+#include <platform/compress.h>
+#include <platform/platform.h>
+
+CompressedValueCache::CompressedValueCache(size_t maxSize)
+    : maxStripeSize(maxSize / numStripes) {
+}
+
+bool CompressedValueCache::compress(const Item& item,
+                                    Item& copy,
+                                    float minCompressionRatio) {
+    if (copy.getNBytes() == 0 ||
+        mcbp::datatype::is_snappy(copy.getDataType())) {
+        return true;
+    }
+
+    const Key key{item.getVBucketId(), item.getBySeqno()};
+    Stripe& stripe = stripes[KeyHash()(key) % numStripes];
+    value_t compressed;
+    {
+        std::lock_guard<std::mutex> lh(stripe.mutex);
+        auto it = stripe.entries.find(key);
+        if (it != stripe.entries.end() &&
+            it->second.cas == item.getCas() &&
+            it->second.revSeqno == item.getRevSeqno()) {
+            ++hits;
+            compressed = it->second.value;
+        } else {
+            const hrtime_t start = gethrtime();
+            cb::compression::Buffer deflated;
+            if (!cb::compression::deflate(cb::compression::Algorithm::Snappy,
+                                          item.getData(),
+                                          item.getNBytes(),
+                                          deflated)) {
+                compressTime += gethrtime() - start;
+                return false;
+            }
+
+            if (deflated.len <= minCompressionRatio * item.getNBytes()) {
+                // (Read the datatype and extended meta from copy, which
+                // shares item's value.)
+                compressed.reset(
+                        Blob::New(deflated.data.get(),
+                                  deflated.len,
+                                  (uint8_t*)(copy.getExtMeta()),
+                                  copy.getExtMetaLen()));
+                compressed->setDataType(copy.getDataType() |
+                                        PROTOCOL_BINARY_DATATYPE_SNAPPY);
+            } else {
+                // No point doing the compression if the desired
+                // compression ratio isn't achieved.
+                ++skipped;
+            }
+            if (it != stripe.entries.end()) {
+                // A stale entry for a rolled back seqno.
+                memoryUsed -= entrySize(it->second);
+                stripe.size -= entrySize(it->second);
+                it->second = {item.getCas(), item.getRevSeqno(), compressed};
+                memoryUsed += entrySize(it->second);
+                stripe.size += entrySize(it->second);
+            } else {
+                insert(stripe,
+                       key,
+                       {item.getCas(), item.getRevSeqno(), compressed});
+            }
+            compressTime += gethrtime() - start;
+            ++misses;
+        }
+    }
+
+    if (compressed) {
+        const uint32_t sizeBefore = copy.getNBytes();
+        // The shared Blob is never modified; copy only takes a reference.
+        copy.setValue(compressed);
+        // Refresh copy's cached datatype from its new value.
+        copy.getDataType();
+        bytesSaved += sizeBefore - copy.getNBytes();
+    }
+    return true;
+}
+
+size_t CompressedValueCache::entrySize(const Entry& entry) {
+    return sizeof(Key) + sizeof(Entry) +
+           (entry.value ? entry.value->getSize() : 0);
+}
+
+void CompressedValueCache::insert(Stripe& stripe,
+                                  const Key& key,
+                                  Entry entry) {
+    const size_t size = entrySize(entry);
+    if (size > maxStripeSize) {
+        // Too big to cache; other streams compress it again.
+        return;
+    }
+    while (!stripe.order.empty() && stripe.size + size > maxStripeSize) {
+        auto oldest = stripe.entries.find(stripe.order.front());
+        stripe.order.pop_front();
+        if (oldest != stripe.entries.end()) {
+            const size_t oldSize = entrySize(oldest->second);
+            stripe.size -= oldSize;
+            memoryUsed -= oldSize;
+            stripe.entries.erase(oldest);
+            ++evictions;
+        }
+    }
+    stripe.entries.emplace(key, std::move(entry));
+    stripe.order.push_back(key);
+    stripe.size += size;
+    memoryUsed += size;
+}
+
+void CompressedValueCache::addStats(ADD_STAT add_stat, const void* c) const {
+    add_casted_stat("ep_dcp_compress_hits", hits.load(), add_stat, c);
+    add_casted_stat("ep_dcp_compress_misses", misses.load(), add_stat, c);
+    add_casted_stat("ep_dcp_compress_skipped", skipped.load(), add_stat, c);
+    add_casted_stat(
+            "ep_dcp_compress_bytes_saved", bytesSaved.load(), add_stat, c);
+    add_casted_stat(
+            "ep_dcp_compress_time", compressTime.load() / 1000, add_stat, c);
+    add_casted_stat(
+            "ep_dcp_compress_evictions", evictions.load(), add_stat, c);
+    add_casted_stat("ep_dcp_compress_cache_size",
+                    memoryUsed.load(),
+                    add_stat,
+                    c);
+}
@@ -0,0 +1,136 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "item.h"
+
+#include <memcached/engine.h>
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Snappy-compresses the values DCP producers with value compression enabled
+ * send, at most once per mutation: the compressed value is kept in a bounded
+ * cache keyed by the mutation's vBucket and seqno, and shared by every
+ * stream sending it (whether from a checkpoint or a backfill).
+ *
+ * The cache holds at most (about) maxSize bytes; once full, the entries added
+ * first are evicted first - streams send a vBucket's mutations in seqno
+ * order, so the oldest are the least likely to be sent again. Entries are
+ * checked against the mutation's CAS and revSeqno, so one left over from a
+ * rolled back seqno is never used.
+ *
+ * Whether a value compresses well enough is decided against the
+ * dcp_min_compression_ratio in effect when it is first compressed.
+ */
+class CompressedValueCache {
+public:
+    explicit CompressedValueCache(size_t maxSize);
+
+    /**
+     * Replace the value of copy - a copy of item, about to be sent - with
+     * the compressed form of item's value, compressing (and caching) it if
+     * that hasn't been done yet. copy's value is left as it is if it is
+     * empty or compressed already, or if compressing it doesn't achieve
+     * minCompressionRatio.
+     *
+     * @return false if compression failed.
+     */
+    bool compress(const Item& item, Item& copy, float minCompressionRatio);
+
+    void addStats(ADD_STAT add_stat, const void* c) const;
+
+    // Number of values found compressed (or not worth compressing) already.
+    size_t getHits() const {
+        return hits.load();
+    }
+
+    // Number of values compressed.
+    size_t getMisses() const {
+        return misses.load();
+    }
+
+    // Total bytes by which compression reduced the values sent.
+    size_t getBytesSaved() const {
+        return bytesSaved.load();
+    }
+
+    // Bytes currently held by the cache.
+    size_t getMemoryUsed() const {
+        return memoryUsed.load();
+    }
+
+private:
+    struct Key {
+        bool operator==(const Key& other) const {
+            return vbid == other.vbid && seqno == other.seqno;
+        }
+
+        uint16_t vbid;
+        int64_t seqno;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<int64_t>()(key.seqno) ^
+                   (size_t(key.vbid) << 48);
+        }
+    };
+
+    struct Entry {
+        uint64_t cas;
+        uint64_t revSeqno;
+        // Null if the value doesn't compress well enough.
+        value_t value;
+    };
+
+    // Each stripe caches its share of the mutations, evicting in the order
+    // they were added; its mutex also serialises compressing a mutation.
+    struct Stripe {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        std::deque<Key> order;
+        size_t size = 0;
+    };
+
+    // The size accounted for an entry.
+    static size_t entrySize(const Entry& entry);
+
+    // Add an entry to the stripe, evicting the oldest to make room.
+    void insert(Stripe& stripe, const Key& key, Entry entry);
+
+    static const size_t numStripes = 64;
+    std::array<Stripe, numStripes> stripes;
+    const size_t maxStripeSize;
+
+    std::atomic<size_t> hits{0};
+    std::atomic<size_t> misses{0};
+    std::atomic<size_t> skipped{0};
+    std::atomic<size_t> bytesSaved{0};
+    std::atomic<size_t> evictions{0};
+    std::atomic<size_t> memoryUsed{0};
+    // Time spent compressing, in nanoseconds.
+    std::atomic<uint64_t> compressTime{0};
+};
@@ -107,6 +107,7 @@ DcpConsumer::DcpConsumer(EventuallyPersistentEngine &engine, const void *cookie,
       opaqueCounter(0),
       processorTaskId(0),
       processorTaskState(all_processed),
+      vbReady(engine.getConfiguration().getMaxVbuckets()),
       processorNotification(false),
       backoffs(0),
       dcpIdleTimeout(engine.getConfiguration().getDcpIdleTimeout()),
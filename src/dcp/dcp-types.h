@@ -24,11 +24,11 @@
 #pragma once
 
 #include <atomic>
-#include <mutex>
-#include <queue>
-#include <unordered_set>
-
-#include "locks.h"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 template <class S> class SingleThreadedRCPtr;
 template <class C> class RCPtr;
@@ -54,35 +54,93 @@ class PassiveStream;
 typedef RCPtr<PassiveStream> passive_stream_t;
 
 /**
- * DcpReadyQueue is a std::queue wrapper for managing a
- * queue of vbuckets that are ready for a DCP producer/consumer to process.
- * The queue does not allow duplicates and the push_unique method enforces
- * this. The interface is generally customised for the needs of:
+ * DcpReadyQueue tracks the vbuckets that are ready for a DCP
+ * producer/consumer to process. A vbucket is queued at most once; the
+ * pushUnique method enforces this. The interface is generally customised for
+ * the needs of:
  * - getNextItem and is thread safe as the frontend operations and
  *   DCPProducer threads are accessing this data.
  * - processBufferedItems by the processer task of the consumer
  *
- * Internally a std::queue and std::set track the contents and the std::set
- * enables a fast exists method which is used by front-end threads.
+ * It is lock-free: membership is a bitmap of atomic words, one bit per
+ * vbucket, so pushUnique (called by front-end threads for every mutation on
+ * a streamed vbucket) is a single fetch_or and never contends on a lock with
+ * the thread draining the queue.
+ *
+ * Rather than a FIFO, vbuckets are popped round-robin - popFront returns the
+ * next ready vbucket at or after the one following the last popped. A vbucket
+ * pushed back after being popped therefore waits for every other ready
+ * vbucket to be served, as it would at the back of a FIFO.
+ *
+ * Expected to be drained by a single thread at a time (concurrent poppers
+ * are safe, but share the round-robin position).
  */
 class DcpReadyQueue {
 public:
+    /**
+     * @param maxVBuckets One more than the highest vbucket id which may be
+     *        pushed
+     */
+    explicit DcpReadyQueue(
+            size_t maxVBuckets = size_t(std::numeric_limits<uint16_t>::max()) +
+                                 1)
+        : maxVBuckets(maxVBuckets),
+          words((maxVBuckets + BitsPerWord - 1) / BitsPerWord),
+          position(0) {
+        if (maxVBuckets == 0) {
+            throw std::invalid_argument(
+                    "DcpReadyQueue: maxVBuckets must be non-zero");
+        }
+        for (auto& word : words) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
     bool exists(uint16_t vbucket) {
-        LockHolder lh(lock);
-        return (queuedValues.count(vbucket) != 0);
+        checkVBucket(vbucket);
+        return (words[vbucket / BitsPerWord].load() & bit(vbucket)) != 0;
     }
 
     /**
      * Return true and set the ref-param 'frontValue' if the queue is not
-     * empty. frontValue is set to the front of the queue.
+     * empty. frontValue is set to the next ready vbucket in round-robin
+     * order, which is removed from the queue.
      */
     bool popFront(uint16_t &frontValue) {
-        LockHolder lh(lock);
-        if (!readyQueue.empty()) {
-            frontValue = readyQueue.front();
-            readyQueue.pop();
-            queuedValues.erase(frontValue);
-            return true;
+        const size_t start = position.load(std::memory_order_relaxed);
+        const size_t startWord = start / BitsPerWord;
+        const uint64_t startMask = ~uint64_t(0) << (start % BitsPerWord);
+
+        // Visit the start word's bits from the start position, then the
+        // other words, then the start word's bits before the start position.
+        // (The scan can be relaxed; the fetch_and claiming a bit is not.)
+        size_t index = startWord;
+        for (size_t ii = 0; ii <= words.size(); ++ii) {
+            uint64_t mask = ~uint64_t(0);
+            if (ii == 0) {
+                mask = startMask;
+            } else if (ii == words.size()) {
+                mask = ~startMask;
+            }
+
+            uint64_t value =
+                    words[index].load(std::memory_order_relaxed) & mask;
+            while (value != 0) {
+                const uint64_t lowest = value & (~value + 1);
+                if (words[index].fetch_and(~lowest) & lowest) {
+                    const size_t vbucket =
+                            index * BitsPerWord + countTrailingZeros(lowest);
+                    position.store((vbucket + 1) % maxVBuckets,
+                                   std::memory_order_relaxed);
+                    frontValue = static_cast<uint16_t>(vbucket);
+                    return true;
+                }
+                // Popped by another thread; try the next one.
+                value &= ~lowest;
+            }
+            if (++index == words.size()) {
+                index = 0;
+            }
         }
         return false;
     }
@@ -92,11 +150,8 @@ public:
      * Safe to call on an empty list
      */
     void pop() {
-        LockHolder lh(lock);
-        if (!readyQueue.empty()) {
-            queuedValues.erase(readyQueue.front());
-            readyQueue.pop();
-        }
+        uint16_t vbucket;
+        popFront(vbucket);
     }
 
     /**
@@ -104,38 +159,78 @@ public:
      * Return true if the vbucket was added to the queue.
      */
     bool pushUnique(uint16_t vbucket) {
-        LockHolder lh(lock);
-        if (queuedValues.count(vbucket) == 0) {
-            readyQueue.push(vbucket);
-            queuedValues.insert(vbucket);
-            return true;
-        }
-        return false;
+        checkVBucket(vbucket);
+        const uint64_t mask = bit(vbucket);
+        return (words[vbucket / BitsPerWord].fetch_or(mask) & mask) == 0;
     }
 
     /**
      * Size of the queue.
      */
     size_t size() {
-        LockHolder lh(lock);
-        return readyQueue.size();
+        size_t count = 0;
+        for (const auto& word : words) {
+            count += popCount(word.load());
+        }
+        return count;
     }
 
     bool empty() {
-        LockHolder lh(lock);
-        return readyQueue.empty();
+        for (const auto& word : words) {
+            if (word.load() != 0) {
+                return false;
+            }
+        }
+        return true;
     }
 
 private:
-    std::mutex lock;
+    static const size_t BitsPerWord = 64;
 
-    /* a queue of vbuckets that are ready for producing */
-    std::queue<uint16_t> readyQueue;
+    static uint64_t bit(uint16_t vbucket) {
+        return uint64_t(1) << (vbucket % BitsPerWord);
+    }
 
-    /**
-     * maintain a std::unordered_set of values that are in the readyQueue.
-     * find() is performed by front-end threads so we want it to be
-     * efficient so just a set lookup is required.
-     */
-    std::unordered_set<uint16_t> queuedValues;
+    /// @return the index of the lowest set bit of (non-zero) value.
+    static size_t countTrailingZeros(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(value);
+#else
+        size_t count = 0;
+        while ((value & 1) == 0) {
+            value >>= 1;
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    static size_t popCount(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(value);
+#else
+        size_t count = 0;
+        for (; value != 0; value &= value - 1) {
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    void checkVBucket(uint16_t vbucket) const {
+        if (vbucket >= maxVBuckets) {
+            throw std::invalid_argument(
+                    "DcpReadyQueue: vbucket (which is " +
+                    std::to_string(vbucket) + ") must be less than " +
+                    std::to_string(maxVBuckets));
+        }
+    }
+
+    const size_t maxVBuckets;
+
+    /* bit (vbucket % 64) of words[vbucket / 64] is set if vbucket is ready */
+    std::vector<std::atomic<uint64_t>> words;
+
+    /* The vbucket at which the next popFront starts looking */
+    std::atomic<size_t> position;
 };
@@ -35,11 +35,17 @@ const uint8_t DcpConnMap::numBackfillsMemThreshold = 1;
 
 DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     : ConnMap(e),
+      compressedValues(
+              e.getConfiguration().getDcpCompressedValueCacheSize()),
       aggrDcpConsumerBufferSize(0) {
     backfills.numActiveSnoozing = 0;
     updateMaxActiveSnoozingBackfills(engine.getEpStats().getMaxDataSize());
     minCompressionRatioForProducer.store(
                     engine.getConfiguration().getDcpMinCompressionRatio());
+    producerStepBatchItems.store(
+            engine.getConfiguration().getDcpProducerStepBatchItems());
+    producerStepBatchBytes.store(
+            engine.getConfiguration().getDcpProducerStepBatchBytes());
 
     // Note: these allocations are deleted by ~Configuration
     engine.getConfiguration().
@@ -48,6 +54,12 @@ DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     engine.getConfiguration().
         addValueChangedListener("dcp_consumer_process_buffered_messages_batch_size",
                                 new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_producer_step_batch_items",
+                                new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_producer_step_batch_bytes",
+                                new DcpConfigChangeListener(*this));
 }
 
 DcpConsumer *DcpConnMap::newConsumer(const void* cookie,
@@ -429,9 +441,12 @@ void DcpConnMap::updateMaxActiveSnoozingBackfills(size_t maxDataSize)
 }
 
 void DcpConnMap::addStats(ADD_STAT add_stat, const void *c) {
-    LockHolder lh(connsLock);
-    add_casted_stat("ep_dcp_dead_conn_count", deadConnections.size(), add_stat,
-                    c);
+    {
+        LockHolder lh(connsLock);
+        add_casted_stat("ep_dcp_dead_conn_count", deadConnections.size(),
+                        add_stat, c);
+    }
+    compressedValues.addStats(add_stat, c);
 }
 
 void DcpConnMap::updateMinCompressionRatioForProducers(float value) {
@@ -451,6 +466,10 @@ void DcpConnMap::DcpConfigChangeListener::sizeValueChanged(const std::string &ke
         myConnMap.consumerYieldConfigChanged(value);
     } else if (key == "dcp_consumer_process_buffered_messages_batch_size") {
         myConnMap.consumerBatchSizeConfigChanged(value);
+    } else if (key == "dcp_producer_step_batch_items") {
+        myConnMap.producerStepBatchItems.store(value);
+    } else if (key == "dcp_producer_step_batch_bytes") {
+        myConnMap.producerStepBatchBytes.store(value);
     }
 }
 
@@ -29,6 +29,7 @@
 #include "syncobject.h"
 #include "atomicqueue.h"
 #include "connmap.h"
+#include "dcp/compressed_value_cache.h"
 #include "dcp/consumer.h"
 #include "dcp/producer.h"
 
@@ -126,6 +127,22 @@ public:
 
     float getMinCompressionRatio();
 
+    /* The compressed values shared by all producers with value compression
+     * enabled */
+    CompressedValueCache& getCompressedValues() {
+        return compressedValues;
+    }
+
+    /* The maximum number of responses, and (approximate) bytes of them, a
+     * producer drains from a stream under one lock acquisition */
+    size_t getProducerStepBatchItems() {
+        return producerStepBatchItems.load();
+    }
+
+    size_t getProducerStepBatchBytes() {
+        return producerStepBatchBytes.load();
+    }
+
     connection_t findByName(const std::string &name);
 
     bool isConnections() {
@@ -190,6 +207,11 @@ protected:
 
     std::atomic<float> minCompressionRatioForProducer;
 
+    std::atomic<size_t> producerStepBatchItems;
+    std::atomic<size_t> producerStepBatchBytes;
+
+    CompressedValueCache compressedValues;
+
     /* Total memory used by all DCP consumer buffers */
     std::atomic<size_t> aggrDcpConsumerBufferSize;
 
@@ -136,9 +136,11 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine& e,
                          MutationType mutType)
     : Producer(e, cookie, name),
       rejectResp(NULL),
+      stepBatchVBucket(0),
       notifyOnly(isNotifier),
       lastSendTime(ep_current_time()),
       log(*this),
+      ready(e.getConfiguration().getMaxVbuckets()),
       itemsSent(0),
       totalBytesSent(0),
       mutationType(mutType) {
@@ -206,6 +208,9 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine& e,
 DcpProducer::~DcpProducer() {
     backfillMgr.reset();
     delete rejectResp;
+    for (auto* resp : stepBatch) {
+        delete resp;
+    }
 
     if (checkpointCreatorTask) {
         ExecutorPool::get()->cancel(checkpointCreatorTask->getId());
@@ -281,6 +286,7 @@ ENGINE_ERROR_CODE DcpProducer::streamRequest(uint32_t flags,
                 return ENGINE_KEY_EEXISTS;
             } else {
                 streams.erase(vbucket, guard);
+                discardStepBatch(vbucket);
 
                 // Don't need to add an entry to vbucket-to-conns map
                 add_vb_conn_map = false;
@@ -469,11 +475,15 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
              * If value compression is enabled, the producer will need
              * to snappy-compress the document before transmitting.
              * Compression will obviously be done only if the datatype
-             * indicates that the value isn't compressed already.
+             * indicates that the value isn't compressed already, and is
+             * done once per mutation - shared by every stream sending it.
              */
             uint32_t sizeBefore = itmCpy->getNBytes();
-            if (!itmCpy->compressValue(
-                            engine_.getDcpConnMap().getMinCompressionRatio())) {
+            auto& connMap = engine_.getDcpConnMap();
+            if (!connMap.getCompressedValues().compress(
+                        *mutationResponse->getItem(),
+                        *itmCpy,
+                        connMap.getMinCompressionRatio())) {
                 LOG(EXTENSION_LOG_WARNING,
                     "%s Failed to snappy compress an uncompressed value!",
                     logHeader());
@@ -759,6 +769,7 @@ ENGINE_ERROR_CODE DcpProducer::closeStream(uint32_t opaque, uint16_t vbucket) {
     }
 
     auto it = streams.erase(vbucket);
+    discardStepBatch(vbucket);
 
     ENGINE_ERROR_CODE ret;
     if (!it.second) {
@@ -788,12 +799,14 @@ void DcpProducer::notifyBackfillManager() {
     backfillMgr->wakeUpTask();
 }
 
-bool DcpProducer::recordBackfillManagerBytesRead(size_t bytes, bool force) {
+bool DcpProducer::recordBackfillManagerBytesRead(uint16_t vbucket,
+                                                 size_t bytes,
+                                                 bool force) {
     if (force) {
-        backfillMgr->bytesForceRead(bytes);
+        backfillMgr->bytesForceRead(vbucket, bytes);
         return true;
     }
-    return backfillMgr->bytesCheckAndRead(bytes);
+    return backfillMgr->bytesCheckAndRead(vbucket, bytes);
 }
 
 void DcpProducer::recordBackfillManagerBytesSent(size_t bytes) {
@@ -955,6 +968,47 @@ const char* DcpProducer::getType() const {
 }
 
 DcpResponse* DcpProducer::getNextItem() {
+    if (stepBatch.empty() && !fillStepBatch()) {
+        return NULL;
+    }
+
+    DcpResponse* op = stepBatch.front();
+    stepBatch.pop_front();
+
+    switch (op->getEvent()) {
+        case DcpResponse::Event::SnapshotMarker:
+        case DcpResponse::Event::Mutation:
+        case DcpResponse::Event::Deletion:
+        case DcpResponse::Event::Expiration:
+        case DcpResponse::Event::StreamEnd:
+        case DcpResponse::Event::SetVbucket:
+        case DcpResponse::Event::SystemEvent:
+            break;
+        default:
+            throw std::logic_error(
+                    std::string("DcpProducer::getNextItem: "
+                    "Producer (") + logHeader() + ") is attempting to "
+                    "write an unexpected event:" +
+                    op->to_string());
+    }
+
+    if (op->getEvent() == DcpResponse::Event::Mutation ||
+        op->getEvent() == DcpResponse::Event::Deletion ||
+        op->getEvent() == DcpResponse::Event::Expiration ||
+        op->getEvent() == DcpResponse::Event::SystemEvent) {
+        itemsSent++;
+    }
+
+    totalBytesSent.fetch_add(op->getMessageSize());
+
+    return op;
+}
+
+bool DcpProducer::fillStepBatch() {
+    auto& connMap = engine_.getDcpConnMap();
+    const size_t maxItems = connMap.getProducerStepBatchItems();
+    const size_t maxBytes = connMap.getProducerStepBatchBytes();
+
     do {
         setPaused(false);
 
@@ -962,54 +1016,22 @@ DcpResponse* DcpProducer::getNextItem() {
         while (ready.popFront(vbucket)) {
             if (log.pauseIfFull()) {
                 ready.pushUnique(vbucket);
-                return NULL;
+                return false;
             }
 
-            DcpResponse* op = NULL;
-            stream_t stream;
-            {
-                stream = findStream(vbucket);
-                if (!stream) {
-                    continue;
-                }
+            stream_t stream = findStream(vbucket);
+            if (!stream) {
+                continue;
             }
 
-            op = stream->next();
-
-            if (!op) {
+            if (stream->nextBatch(stepBatch, maxItems, maxBytes) == 0) {
                 // stream is empty, try another vbucket.
                 continue;
             }
 
-            switch (op->getEvent()) {
-                case DcpResponse::Event::SnapshotMarker:
-                case DcpResponse::Event::Mutation:
-                case DcpResponse::Event::Deletion:
-                case DcpResponse::Event::Expiration:
-                case DcpResponse::Event::StreamEnd:
-                case DcpResponse::Event::SetVbucket:
-                case DcpResponse::Event::SystemEvent:
-                    break;
-                default:
-                    throw std::logic_error(
-                            std::string("DcpProducer::getNextItem: "
-                            "Producer (") + logHeader() + ") is attempting to "
-                            "write an unexpected event:" +
-                            op->to_string());
-            }
-
+            stepBatchVBucket = vbucket;
             ready.pushUnique(vbucket);
-
-            if (op->getEvent() == DcpResponse::Event::Mutation ||
-                op->getEvent() == DcpResponse::Event::Deletion ||
-                op->getEvent() == DcpResponse::Event::Expiration ||
-                op->getEvent() == DcpResponse::Event::SystemEvent) {
-                itemsSent++;
-            }
-
-            totalBytesSent.fetch_add(op->getMessageSize());
-
-            return op;
+            return true;
         }
 
         // flag we are paused
@@ -1020,7 +1042,19 @@ DcpResponse* DcpProducer::getNextItem() {
         // paused = false, so reloop so we don't miss an operation.
     } while(!ready.empty());
 
-    return NULL;
+    return false;
+}
+
+void DcpProducer::discardStepBatch(uint16_t vbucket) {
+    if (stepBatchVBucket != vbucket) {
+        return;
+    }
+    for (auto* resp : stepBatch) {
+        // Return the flow control space the stream reserved for it.
+        log.acknowledge(resp->getMessageSize());
+        delete resp;
+    }
+    stepBatch.clear();
 }
 
 void DcpProducer::setDisconnect(bool disconnect) {
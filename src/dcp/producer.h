@@ -24,6 +24,8 @@
 #include "dcp/dcp-types.h"
 #include "tapconnection.h"
 
+#include <deque>
+
 class BackfillManager;
 class DcpResponse;
 
@@ -138,7 +140,9 @@ enum class MutationType {
     void notifyStreamReady(uint16_t vbucket);
 
     void notifyBackfillManager();
-    bool recordBackfillManagerBytesRead(size_t bytes, bool force);
+    bool recordBackfillManagerBytesRead(uint16_t vbucket,
+                                        size_t bytes,
+                                        bool force);
     void recordBackfillManagerBytesSent(size_t bytes);
     void scheduleBackfillManager(VBucket& vb,
                                  const active_stream_t& s,
@@ -295,6 +299,20 @@ protected:
 
     DcpResponse* getNextItem();
 
+    /**
+     * Drain the next batch of responses from the first ready stream into
+     * stepBatch.
+     *
+     * @return true if any responses were drained
+     */
+    bool fillStepBatch();
+
+    /**
+     * Delete any responses in stepBatch drained from the given vBucket's
+     * stream, so a closed or replaced stream sends no more messages.
+     */
+    void discardStepBatch(uint16_t vbucket);
+
     size_t getItemsRemaining();
     stream_t findStreamByVbid(uint16_t vbid);
 
@@ -302,6 +320,14 @@ protected:
 
     DcpResponse *rejectResp; // stash response for retry if E2BIG was hit
 
+    /*
+     * Responses drained from a single stream (stepBatchVBucket's) by one
+     * stream lock acquisition, and handed to memcached one per step().
+     * Like rejectResp, only accessed from the connection's front-end thread.
+     */
+    std::deque<DcpResponse*> stepBatch;
+    uint16_t stepBatchVBucket;
+
     bool notifyOnly;
 
     Couchbase::RelaxedAtomic<bool> enableExtMetaData;
@@ -137,6 +137,23 @@ bool Stream::isTakeoverWait() const {
     return state_.load() == StreamState::TakeoverWait;
 }
 
+size_t Stream::nextBatch(std::deque<DcpResponse*>& responses,
+                         size_t maxItems,
+                         size_t maxBytes) {
+    size_t items = 0;
+    size_t bytes = 0;
+    while (items < maxItems && bytes < maxBytes) {
+        DcpResponse* response = next();
+        if (!response) {
+            break;
+        }
+        responses.push_back(response);
+        ++items;
+        bytes += response->getMessageSize();
+    }
+    return items;
+}
+
 void Stream::clear_UNLOCKED() {
     while (!readyQ.empty()) {
         DcpResponse* resp = readyQ.front();
@@ -313,6 +330,24 @@ DcpResponse* ActiveStream::next() {
     return next(lh);
 }
 
+size_t ActiveStream::nextBatch(std::deque<DcpResponse*>& responses,
+                               size_t maxItems,
+                               size_t maxBytes) {
+    std::lock_guard<std::mutex> lh(streamMutex);
+    size_t items = 0;
+    size_t bytes = 0;
+    while (items < maxItems && bytes < maxBytes) {
+        DcpResponse* response = next(lh);
+        if (!response) {
+            break;
+        }
+        responses.push_back(response);
+        ++items;
+        bytes += response->getMessageSize();
+    }
+    return items;
+}
+
 DcpResponse* ActiveStream::next(std::lock_guard<std::mutex>& lh) {
     DcpResponse* response = NULL;
 
@@ -431,7 +466,7 @@ bool ActiveStream::backfillReceived(std::unique_ptr<Item> itm,
             queued_item qi(std::move(itm));
             std::unique_ptr<DcpResponse> resp(makeResponseFromItem(qi));
             if (!producer->recordBackfillManagerBytesRead(
-                        resp->getApproximateSize(), force)) {
+                        vb_, resp->getApproximateSize(), force)) {
                 // Deleting resp may also delete itm (which is owned by resp)
                 resp.reset();
                 return false;
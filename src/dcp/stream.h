@@ -29,6 +29,7 @@
 
 #include <atomic>
 #include <climits>
+#include <deque>
 #include <queue>
 
 class EventuallyPersistentEngine;
@@ -112,6 +113,16 @@ public:
 
     virtual DcpResponse* next() = 0;
 
+    /**
+     * Move the stream's next responses onto the back of the given queue -
+     * up to maxItems of them, stopping once they total maxBytes or more.
+     *
+     * @return the number of responses added
+     */
+    virtual size_t nextBatch(std::deque<DcpResponse*>& responses,
+                             size_t maxItems,
+                             size_t maxBytes);
+
     virtual uint32_t setDead(end_stream_status_t status) = 0;
 
     virtual void notifySeqnoAvailable(uint64_t seqno) {}
@@ -227,6 +238,14 @@ public:
 
     DcpResponse* next();
 
+    /**
+     * As Stream::nextBatch, but taking the streamMutex once for the whole
+     * batch rather than once per response.
+     */
+    size_t nextBatch(std::deque<DcpResponse*>& responses,
+                     size_t maxItems,
+                     size_t maxBytes) override;
+
     void setActive() {
         LockHolder lh(streamMutex);
         if (isPending()) {
@@ -98,7 +98,8 @@ bool DefragmentVisitor::visit(StoredValue& v) {
         // reference to the blob reallocate, otherwise increment it's age.
         // It may be possible to add a reference to the blob without holding
         // any locks, therefore the check is somewhat of an estimate which
-        // should be good enough.
+        // should be good enough. (A non-zero valuelen means the value is
+        // not inline, so getValue() is non-null.)
         if (v.getValue()->getAge() >= age_threshold &&
             v.getValue().refCount() < 2) {
             v.reallocate();
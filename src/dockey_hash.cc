@@ -0,0 +1,218 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "dockey_hash.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define DOCKEY_HASH_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+static const uint64_t kMul = 0x9ddfea08eb382d69ULL;
+
+static inline uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/// Load the final len (< 8) bytes at p, zero-extended.
+static inline uint64_t loadTail(const uint8_t* p, size_t len) {
+    uint64_t v = 0;
+    std::memcpy(&v, p, len);
+    return v;
+}
+
+/// MurmurHash3's 64-bit finalizer.
+static inline uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t hash64Scalar(const uint8_t* data, size_t len, uint64_t seed) {
+    uint64_t h = seed ^ (len * kMul);
+    while (len >= 8) {
+        h = (h ^ load64(data)) * kMul;
+        h ^= h >> 47;
+        data += 8;
+        len -= 8;
+    }
+    if (len) {
+        h = (h ^ loadTail(data, len)) * kMul;
+    }
+    return fmix64(h);
+}
+
+static bool equalScalar(const uint8_t* a, const uint8_t* b, size_t len) {
+    return std::memcmp(a, b, len) == 0;
+}
+
+#ifdef DOCKEY_HASH_X86_DISPATCH
+
+/**
+ * Hash 8 bytes per CRC32 instruction, in two independent streams (so the
+ * instruction's latency is overlapped), then mix the two 32-bit results.
+ */
+__attribute__((target("sse4.2"))) static uint64_t hash64Crc(
+        const uint8_t* data, size_t len, uint64_t seed) {
+    const uint64_t lenMix = len * kMul;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed ^ kMul;
+    while (len >= 16) {
+        h1 = _mm_crc32_u64(h1, load64(data));
+        h2 = _mm_crc32_u64(h2, load64(data + 8));
+        data += 16;
+        len -= 16;
+    }
+    if (len >= 8) {
+        h1 = _mm_crc32_u64(h1, load64(data));
+        data += 8;
+        len -= 8;
+    }
+    if (len) {
+        h2 = _mm_crc32_u64(h2, loadTail(data, len));
+    }
+    return fmix64((h1 | (h2 << 32)) ^ lenMix);
+}
+
+/// Compare len (< 32) bytes using (baseline x86-64) SSE2 and overlapping
+/// loads.
+static inline bool equalSmall(const uint8_t* a, const uint8_t* b, size_t len) {
+    if (len >= 16) {
+        const auto a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a));
+        const auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+        const auto a1 = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(a + len - 16));
+        const auto b1 = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(b + len - 16));
+        const auto eq = _mm_and_si128(_mm_cmpeq_epi8(a0, b0),
+                                      _mm_cmpeq_epi8(a1, b1));
+        return _mm_movemask_epi8(eq) == 0xffff;
+    }
+    if (len >= 8) {
+        return ((load64(a) ^ load64(b)) |
+                (load64(a + len - 8) ^ load64(b + len - 8))) == 0;
+    }
+    if (len >= 4) {
+        return ((load32(a) ^ load32(b)) |
+                (load32(a + len - 4) ^ load32(b + len - 4))) == 0;
+    }
+    for (size_t ii = 0; ii < len; ++ii) {
+        if (a[ii] != b[ii]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool equalSse2(const uint8_t* a, const uint8_t* b, size_t len) {
+    if (len < 32) {
+        return equalSmall(a, b, len);
+    }
+    return std::memcmp(a, b, len) == 0;
+}
+
+/// Compare 32 bytes at a time, finishing with an overlapping 32 byte load.
+__attribute__((target("avx2"))) static bool equalAvx2(const uint8_t* a,
+                                                      const uint8_t* b,
+                                                      size_t len) {
+    if (len < 32) {
+        return equalSmall(a, b, len);
+    }
+    size_t ii = 0;
+    for (; ii + 32 <= len; ii += 32) {
+        const auto va =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + ii));
+        const auto vb =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + ii));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) != -1) {
+            return false;
+        }
+    }
+    if (ii < len) {
+        const auto va = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(a + len - 32));
+        const auto vb = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(b + len - 32));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)) == -1;
+    }
+    return true;
+}
+
+#endif // DOCKEY_HASH_X86_DISPATCH
+
+namespace {
+
+using HashFn = uint64_t (*)(const uint8_t*, size_t, uint64_t);
+using EqualFn = bool (*)(const uint8_t*, const uint8_t*, size_t);
+
+/// The implementation in use, selected on first use.
+struct Impl {
+    Impl() : hash(hash64Scalar), equal(equalScalar), name("scalar") {
+#ifdef DOCKEY_HASH_X86_DISPATCH
+        __builtin_cpu_init();
+        equal = equalSse2;
+        if (__builtin_cpu_supports("sse4.2")) {
+            hash = hash64Crc;
+            name = "sse4.2";
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            equal = equalAvx2;
+            name = hash == hash64Crc ? "sse4.2+avx2" : "avx2";
+        }
+#endif
+    }
+
+    HashFn hash;
+    EqualFn equal;
+    const char* name;
+};
+
+const Impl& getImpl() {
+    static const Impl impl;
+    return impl;
+}
+
+} // namespace
+
+namespace DocKeyHash {
+
+uint64_t hash64(const uint8_t* data, size_t len, uint64_t seed) {
+    return getImpl().hash(data, len, seed);
+}
+
+bool equal(const uint8_t* a, const uint8_t* b, size_t len) {
+    return getImpl().equal(a, b, len);
+}
+
+const char* getImplementation() {
+    return getImpl().name;
+}
+
+} // namespace DocKeyHash
@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Hashing and comparison kernels for document keys, used by the HashTable,
+ * the checkpoint key index and BloomFilter.
+ *
+ * On x86-64 the implementation is selected at runtime: hashing uses the
+ * SSE4.2 CRC32 instruction and comparison uses AVX2 where the CPU supports
+ * them. Otherwise (and on other platforms) portable scalar implementations
+ * are used.
+ *
+ * Hash values are only consistent within a process (the implementation may
+ * differ between machines), so must not be persisted.
+ */
+namespace DocKeyHash {
+
+/**
+ * @return a 64-bit hash of the len bytes at data, with the given seed.
+ */
+uint64_t hash64(const uint8_t* data, size_t len, uint64_t seed);
+
+/**
+ * @return true if the len bytes at a and b are equal.
+ */
+bool equal(const uint8_t* a, const uint8_t* b, size_t len);
+
+/**
+ * @return the name of the implementation in use (e.g. "scalar" or
+ *         "sse4.2+avx2").
+ */
+const char* getImplementation();
+
+/**
+ * @return the 32-bit hash of a key (StoredDocKey, SerialisedDocKey or
+ *         DocKey), including its namespace.
+ */
+template <class Key>
+uint32_t hash(const Key& key) {
+    const uint64_t h =
+            hash64(key.data(), key.size(), uint64_t(key.getDocNamespace()));
+    return static_cast<uint32_t>(h ^ (h >> 32));
+}
+
+/**
+ * Hash functor for unordered containers keyed by document keys.
+ */
+struct Hasher {
+    template <class Key>
+    size_t operator()(const Key& key) const {
+        return hash(key);
+    }
+};
+
+/**
+ * Equality functor for unordered containers keyed by document keys.
+ */
+struct KeyEqual {
+    template <class Key1, class Key2>
+    bool operator()(const Key1& a, const Key2& b) const {
+        return a.size() == b.size() &&
+               a.getDocNamespace() == b.getDocNamespace() &&
+               equal(a.data(), b.data(), a.size());
+    }
+};
+
+} // namespace DocKeyHash
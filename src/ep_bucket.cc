@@ -22,6 +22,7 @@
 #include "ep_vb.h"
 #include "failover-table.h"
 #include "flusher.h"
+#include "mutation_journal.h"
 
 EPBucket::EPBucket(EventuallyPersistentEngine& theEngine)
     : KVBucket(theEngine) {
@@ -46,6 +47,16 @@ bool EPBucket::initialize() {
     }
     startFlusher();
 
+    // With warmup, each shard's journal is started once it has been
+    // replayed (see Warmup::replayJournals).
+    if (!engine.getConfiguration().isWarmup()) {
+        for (const auto& shard : vbMap.shards) {
+            if (auto* journal = shard->getJournal()) {
+                journal->start();
+            }
+        }
+    }
+
     return true;
 }
 
@@ -53,6 +64,12 @@ void EPBucket::deinitialize() {
     stopFlusher();
     stopBgFetcher();
 
+    for (const auto& shard : vbMap.shards) {
+        if (auto* journal = shard->getJournal()) {
+            journal->stop();
+        }
+    }
+
     KVBucket::deinitialize();
 }
 
@@ -406,6 +406,8 @@ protocol_binary_response_status EventuallyPersistentEngine::setCheckpointParam(
             getConfiguration().setKeepClosedChks(cb_stob(valz));
         } else if (strcmp(keyz, "enable_chk_merge") == 0) {
             getConfiguration().setEnableChkMerge(cb_stob(valz));
+        } else if (strcmp(keyz, "chk_expel_enabled") == 0) {
+            getConfiguration().setChkExpelEnabled(cb_stob(valz));
         } else {
             msg = "Unknown config param";
             rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -448,6 +450,15 @@ protocol_binary_response_status EventuallyPersistentEngine::setFlushParam(
             getConfiguration().setBgFetchDelay(std::stoull(valz));
         } else if (strcmp(keyz, "flushall_enabled") == 0) {
             getConfiguration().setFlushallEnabled(cb_stob(valz));
+        } else if (strcmp(keyz, "flusher_adaptive_batch_enabled") == 0) {
+            getConfiguration().setFlusherAdaptiveBatchEnabled(cb_stob(valz));
+        } else if (strcmp(keyz, "flusher_min_batch_size") == 0) {
+            getConfiguration().setFlusherMinBatchSize(std::stoull(valz));
+        } else if (strcmp(keyz, "flusher_pipelined_commit") == 0) {
+            getConfiguration().setFlusherPipelinedCommit(cb_stob(valz));
+        } else if (strcmp(keyz, "flusher_target_persist_latency") == 0) {
+            getConfiguration().setFlusherTargetPersistLatency(
+                    std::stoull(valz));
         } else if (strcmp(keyz, "max_size") == 0) {
             size_t vsize = std::stoull(valz);
 
@@ -622,6 +633,14 @@ protocol_binary_response_status EventuallyPersistentEngine::setDcpParam(
             validate(v, size_t(1), std::numeric_limits<size_t>::max());
             getConfiguration().setDcpConsumerProcessBufferedMessagesBatchSize(
                     v);
+        } else if (strcmp(keyz, "dcp_producer_step_batch_items") == 0) {
+            size_t v = atoi(valz);
+            checkNumeric(valz);
+            getConfiguration().setDcpProducerStepBatchItems(v);
+        } else if (strcmp(keyz, "dcp_producer_step_batch_bytes") == 0) {
+            size_t v = atoi(valz);
+            checkNumeric(valz);
+            getConfiguration().setDcpProducerStepBatchBytes(v);
         } else {
             msg = "Unknown config param";
             rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -3148,6 +3167,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_storedval_overhead", "unknown", add_stat, cookie);
 #endif
     add_casted_stat("ep_storedval_num", stats.numStoredVal, add_stat, cookie);
+    add_casted_stat("ep_storedval_inline_num", stats.numInlineStoredVal,
+                    add_stat, cookie);
+    add_casted_stat("ep_storedval_inline_saved", stats.inlineStoredValSaved,
+                    add_stat, cookie);
+    add_casted_stat("ep_storedval_slab_size", stats.storedValSlabSize,
+                    add_stat, cookie);
     add_casted_stat("ep_overhead", stats.memOverhead, add_stat, cookie);
     add_casted_stat("ep_item_num", stats.numItem, add_stat, cookie);
 
@@ -3177,6 +3202,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_items_rm_from_checkpoints",
                     epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
+    add_casted_stat("ep_items_expelled_from_checkpoints",
+                    epstats.itemsExpelledFromCheckpoints,
+                    add_stat, cookie);
+    add_casted_stat("ep_mem_freed_by_checkpoint_item_expel",
+                    epstats.memFreedByCheckpointItemExpel,
+                    add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects,
                     add_stat, cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects,
@@ -3359,6 +3390,17 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                                  KVBucketIface::KVSOption::BOTH)) {
         add_casted_stat("ep_io_compaction_write_bytes",  value, add_stat, cookie);
     }
+    size_t numSyncs = 0;
+    size_t numWrites = 0;
+    if (kvBucket->getKVStoreStat("io_num_sync", numSyncs,
+                                 KVBucketIface::KVSOption::RW) &&
+        kvBucket->getKVStoreStat("io_num_write", numWrites,
+                                 KVBucketIface::KVSOption::RW)) {
+        add_casted_stat("ep_io_num_sync", numSyncs, add_stat, cookie);
+        add_casted_stat("ep_io_items_per_sync",
+                        numSyncs ? double(numWrites) / numSyncs : 0.0,
+                        add_stat, cookie);
+    }
     if (kvBucket->getKVStoreStat("Block_cache_hits", value,
                                  KVBucketIface::KVSOption::RW)) {
         add_casted_stat("ep_block_cache_hits", value, add_stat, cookie);
@@ -3403,6 +3445,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
     add_casted_stat("ep_storedval_overhead", "unknown", add_stat, cookie);
 #endif
     add_casted_stat("ep_storedval_num", stats.numStoredVal, add_stat, cookie);
+    add_casted_stat("ep_storedval_inline_num", stats.numInlineStoredVal,
+                    add_stat, cookie);
+    add_casted_stat("ep_storedval_inline_saved", stats.inlineStoredValSaved,
+                    add_stat, cookie);
+    add_casted_stat("ep_storedval_slab_size", stats.storedValSlabSize,
+                    add_stat, cookie);
     add_casted_stat("ep_item_num", stats.numItem, add_stat, cookie);
 
     std::map<std::string, size_t> alloc_stats;
@@ -3536,8 +3584,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doHashStats(const void *cookie,
                 add_casted_stat(buf, depthVisitor.size, add_stat, cookie);
                 checked_snprintf(buf, sizeof(buf), "vb_%d:resized", vbid);
                 add_casted_stat(buf, vb->ht.getNumResizes(), add_stat, cookie);
+                checked_snprintf(buf, sizeof(buf), "vb_%d:resize_remaining",
+                                 vbid);
+                add_casted_stat(buf, vb->ht.getNumResizeBucketsRemaining(),
+                                add_stat, cookie);
+                checked_snprintf(buf, sizeof(buf),
+                                 "vb_%d:resize_hold_p99", vbid);
+                add_casted_stat(buf, vb->ht.getResizeLockHoldP99(), add_stat,
+                                cookie);
                 checked_snprintf(buf, sizeof(buf), "vb_%d:mem_size", vbid);
-                add_casted_stat(buf, vb->ht.memSize, add_stat, cookie);
+                add_casted_stat(buf, vb->ht.getItemMemory(), add_stat, cookie);
                 checked_snprintf(buf, sizeof(buf), "vb_%d:mem_size_counted",
                                  vbid);
                 add_casted_stat(buf, depthVisitor.memUsed, add_stat, cookie);
@@ -22,10 +22,29 @@
 #include "executorpool.h"
 #include "failover-table.h"
 #include "kvshard.h"
+#include "mutation_journal.h"
 #include "stored_value_factories.h"
 #include "tasks.h"
 #include "vbucketdeletiontask.h"
 
+/**
+ * Create the StoredValue factory for an EPVBucket's HashTable, holding small
+ * values inline and/or allocating from per-vBucket slabs if configured to.
+ */
+static std::unique_ptr<AbstractStoredValueFactory> makeStoredValueFactory(
+        EPStats& st, Configuration& config) {
+    std::unique_ptr<SlabAllocator> slabs;
+    if (config.isHtSlabAllocator()) {
+        slabs = std::make_unique<SlabAllocator>(st);
+    }
+    const size_t inlineThreshold = config.getHtInlineValueThreshold();
+    if (inlineThreshold > 0) {
+        return std::make_unique<CompactStoredValueFactory>(
+                st, inlineThreshold, std::move(slabs));
+    }
+    return std::make_unique<StoredValueFactory>(st, std::move(slabs));
+}
+
 EPVBucket::EPVBucket(id_type i,
                      vbucket_state_t newState,
                      EPStats& st,
@@ -52,7 +71,7 @@ EPVBucket::EPVBucket(id_type i,
               lastSnapEnd,
               std::move(table),
               flusherCb,
-              std::make_unique<StoredValueFactory>(st),
+              makeStoredValueFactory(st, config),
               std::move(newSeqnoCb),
               config,
               evictionPolicy,
@@ -197,10 +216,25 @@ HighPriorityVBReqStatus EPVBucket::checkAddHighPriorityVBEntry(
         uint64_t seqnoOrChkId,
         const void* cookie,
         HighPriorityVBNotify reqType) {
+    MutationJournal* journal = shard ? shard->getJournal() : nullptr;
+    const bool journaled = journal &&
+                           reqType == HighPriorityVBNotify::Seqno &&
+                           getState() == vbucket_state_active;
+    if (journaled && journal->getDurableSeqno(getId(), getPersistenceSeqno()) >=
+                             seqnoOrChkId) {
+        return HighPriorityVBReqStatus::RequestNotScheduled;
+    }
+
     if (shard) {
         ++shard->highPriorityCount;
     }
     addHighPriorityVBEntry(seqnoOrChkId, cookie, reqType);
+
+    if (journaled) {
+        // Satisfied by the next journal sync, rather than waiting for the
+        // flusher to commit the seqno.
+        journal->requestSync(getId());
+    }
     return HighPriorityVBReqStatus::RequestScheduled;
 }
 
@@ -520,6 +554,65 @@ void EPVBucket::bgFetch(const DocKey& key,
     }
 }
 
+void EPVBucket::bgFetchMulti(vb_bgfetch_queue_t& fetches,
+                             EventuallyPersistentEngine& engine,
+                             const int bgFetchDelay) {
+    if (!multiBGFetchEnabled) {
+        // As bgFetch(), but each task keeps the item's notify group.
+        ExecutorPool* iom = ExecutorPool::get();
+        for (auto& fetch : fetches) {
+            for (auto& item : fetch.second.bgfetched_list) {
+                ++stats.numRemainingBgJobs;
+                stats.maxRemainingBgJobs.store(
+                        std::max(stats.maxRemainingBgJobs.load(),
+                                 stats.numRemainingBgJobs.load()));
+                ExTask task = new SingleBGFetcherTask(&engine,
+                                                      fetch.first,
+                                                      getId(),
+                                                      item->cookie,
+                                                      item->metaDataOnly,
+                                                      bgFetchDelay,
+                                                      false,
+                                                      item->notifyGroup);
+                iom->schedule(task);
+            }
+        }
+        fetches.clear();
+        return;
+    }
+
+    // Merge the batch into the pending fetches of this vbucket (as
+    // queueBGFetchItem() does for a single item) under one acquisition of
+    // the lock, then notify the BgFetcher once.
+    size_t bgfetch_size;
+    {
+        LockHolder lh(pendingBGFetchesLock);
+        for (auto& fetch : fetches) {
+            vb_bgfetch_item_ctx_t& bgfetch_itm_ctx =
+                    pendingBGFetches[fetch.first];
+            for (auto& item : fetch.second.bgfetched_list) {
+                if (bgfetch_itm_ctx.bgfetched_list.empty()) {
+                    bgfetch_itm_ctx.isMetaOnly = true;
+                }
+                if (!item->metaDataOnly) {
+                    bgfetch_itm_ctx.isMetaOnly = false;
+                }
+                bgfetch_itm_ctx.bgfetched_list.push_back(std::move(item));
+            }
+        }
+        bgfetch_size = pendingBGFetches.size();
+    }
+    fetches.clear();
+
+    if (getShard()) {
+        getShard()->getBgFetcher()->addPendingVB(getId());
+        getShard()->getBgFetcher()->notifyBGEvent();
+    }
+    LOG(EXTENSION_LOG_DEBUG,
+        "Queued a batch of background fetches, now at %" PRIu64,
+        uint64_t(bgfetch_size));
+}
+
 /* [TBD]: Get rid of std::unique_lock<std::mutex> lock */
 ENGINE_ERROR_CODE
 EPVBucket::addTempItemAndBGFetch(HashTable::HashBucketLock& hbl,
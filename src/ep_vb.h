@@ -166,6 +166,10 @@ private:
                  int bgFetchDelay,
                  bool isMeta = false) override;
 
+    void bgFetchMulti(vb_bgfetch_queue_t& fetches,
+                      EventuallyPersistentEngine& engine,
+                      int bgFetchDelay) override;
+
     ENGINE_ERROR_CODE
     addTempItemAndBGFetch(HashTable::HashBucketLock& hbl,
                           const DocKey& key,
@@ -87,7 +87,7 @@ bool EphemeralVBucket::pageOut(const HashTable::HashBucketLock& lh,
     if (getState() != vbucket_state_active) {
         return false;
     }
-    if (v->isDeleted() && !v->getValue()) {
+    if (v->isDeleted() && !v->hasValue()) {
         // If the item has already been deleted (and doesn't have a value
         // associated with it) then there's no further deletion possible,
         // until the deletion marker (tombstone) is later purged at the
@@ -533,6 +533,14 @@ void EphemeralVBucket::bgFetch(const DocKey& key,
             std::string(reinterpret_cast<const char*>(key.data()), key.size()));
 }
 
+void EphemeralVBucket::bgFetchMulti(vb_bgfetch_queue_t& fetches,
+                                    EventuallyPersistentEngine& engine,
+                                    const int bgFetchDelay) {
+    throw std::logic_error(
+            "EphemeralVBucket::bgFetchMulti() is not valid. Called on vb " +
+            std::to_string(getId()));
+}
+
 ENGINE_ERROR_CODE
 EphemeralVBucket::addTempItemAndBGFetch(HashTable::HashBucketLock& hbl,
                                         const DocKey& key,
@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "flush_batch_controller.h"
+
+#include "statwriter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const size_t FlushBatchController::MaxBoost;
+
+FlushBatchController::FlushBatchController()
+    : targetLatency(1000000),
+      minBatchSize(0),
+      meanItems(0),
+      meanDuration(0),
+      meanItemsSq(0),
+      meanItemsDuration(0),
+      numSamples(0),
+      lastDirtyTotal(0),
+      lastDirtyLate(0),
+      modelled(false),
+      itemCost(0),
+      commitOverhead(0),
+      boost(1),
+      batchLimit(0),
+      lateItems(0) {
+}
+
+void FlushBatchController::recordFlush(size_t numItems, hrtime_t duration) {
+    if (numItems == 0) {
+        return;
+    }
+
+    const double x = numItems;
+    const double y = duration;
+    if (numSamples == 0) {
+        meanItems = x;
+        meanDuration = y;
+        meanItemsSq = x * x;
+        meanItemsDuration = x * y;
+    } else {
+        meanItems += Alpha * (x - meanItems);
+        meanDuration += Alpha * (y - meanDuration);
+        meanItemsSq += Alpha * (x * x - meanItemsSq);
+        meanItemsDuration += Alpha * (x * y - meanItemsDuration);
+    }
+    ++numSamples;
+
+    // Least-squares fit of duration = commitOverhead + numItems * itemCost.
+    // Only possible once recent batch sizes differ enough to tell the two
+    // apart; until then keep the previous fit.
+    const double variance = meanItemsSq - meanItems * meanItems;
+    if (variance > 0.01 * meanItems * meanItems) {
+        const double cost = std::max(
+                (meanItemsDuration - meanItems * meanDuration) / variance,
+                0.0);
+        itemCost.store(cost);
+        commitOverhead.store(std::max(meanDuration - cost * meanItems, 0.0));
+        modelled.store(true);
+    }
+}
+
+void FlushBatchController::updateDirtyAge(Histogram<hrtime_t>& dirtyAgeHisto) {
+    const hrtime_t target = targetLatency.load();
+    size_t total = 0;
+    size_t late = 0;
+    for (const auto& bin : dirtyAgeHisto) {
+        total += bin->count();
+        if (bin->start() >= target) {
+            late += bin->count();
+        }
+    }
+
+    if (total < lastDirtyTotal || late < lastDirtyLate) {
+        // The histogram has been reset.
+        lastDirtyTotal = total;
+        lastDirtyLate = late;
+        return;
+    }
+
+    const size_t recentTotal = total - lastDirtyTotal;
+    const size_t recentLate = late - lastDirtyLate;
+    lastDirtyTotal = total;
+    lastDirtyLate = late;
+    if (recentTotal == 0) {
+        return;
+    }
+
+    lateItems.fetch_add(recentLate);
+    if (recentLate * 100 > recentTotal) {
+        boost.store(std::min(boost.load() * 2, MaxBoost));
+    } else {
+        boost.store(std::max(boost.load() / 2, size_t(1)));
+    }
+}
+
+size_t FlushBatchController::getBatchLimit(size_t queueDepth) {
+    size_t limit = 0;
+    if (modelled.load()) {
+        const double target = targetLatency.load();
+        const double drainTime = queueDepth * itemCost.load();
+        if (drainTime < target) {
+            const double size = std::ceil(queueDepth * commitOverhead.load() /
+                                          (target - drainTime));
+            // Saturate rather than overflow when scaled by the boost.
+            const double max = std::numeric_limits<size_t>::max() / MaxBoost;
+            limit = std::max(size_t(std::min(size, max)), minBatchSize.load());
+            limit = std::max(limit, size_t(1)) * boost.load();
+        }
+    }
+    batchLimit.store(limit);
+    return limit;
+}
+
+void FlushBatchController::addStats(const std::string& prefix,
+                                    ADD_STAT add_stat,
+                                    const void* cookie) const {
+    add_casted_stat((prefix + ":target_latency").c_str(), targetLatency,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":batch_limit").c_str(), batchLimit,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":item_cost").c_str(), itemCost,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":commit_overhead").c_str(), commitOverhead,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":boost").c_str(), boost, add_stat, cookie);
+    add_casted_stat((prefix + ":late_items").c_str(), lateItems,
+                    add_stat, cookie);
+}
@@ -0,0 +1,128 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <memcached/engine_common.h>
+#include <platform/histogram.h>
+
+#include <atomic>
+#include <string>
+
+/**
+ * Sizes a flusher's batches - the number of items taken for each commit -
+ * so as to persist the outstanding items within a target latency while
+ * making commits as small as that allows.
+ *
+ * The cost of a flush is modelled as a fixed per-commit overhead plus a
+ * per-item cost, both estimated from the durations of recent flushes.
+ * Draining a queue of Q items in batches of B then takes about
+ * Q * itemCost + (Q / B) * commitOverhead, so the smallest batch meeting the
+ * target T is Q * commitOverhead / (T - Q * itemCost). If even a single
+ * commit can't meet the target the batch is unlimited, to drain as fast as
+ * possible.
+ *
+ * As a check on the model, the dirty age of the persisted items (how long
+ * they waited to be flushed) is fed back: while more than 1% of recently
+ * persisted items waited longer than the target, the batch is scaled up
+ * (doubling each time), and scaled back down once they no longer do.
+ */
+class FlushBatchController {
+public:
+    FlushBatchController();
+
+    void setTargetLatency(hrtime_t usec) {
+        targetLatency.store(usec);
+    }
+
+    hrtime_t getTargetLatency() const {
+        return targetLatency.load();
+    }
+
+    void setMinBatchSize(size_t size) {
+        minBatchSize.store(size);
+    }
+
+    /**
+     * Record a completed flush.
+     * @param numItems the number of items flushed
+     * @param duration the time (usec) the flush took, including its commit
+     */
+    void recordFlush(size_t numItems, hrtime_t duration);
+
+    /**
+     * Feed back the dirty ages of the items persisted since the last call.
+     * @param dirtyAgeHisto histogram of dirty ages (usec) of the items
+     *        persisted by the flusher (see KVShard::getDirtyAgeHisto).
+     */
+    void updateDirtyAge(Histogram<hrtime_t>& dirtyAgeHisto);
+
+    /**
+     * @param queueDepth the number of items waiting to be flushed
+     * @return the maximum number of items the next commit should take, or
+     *         zero if there should be no limit.
+     */
+    size_t getBatchLimit(size_t queueDepth);
+
+    /// Add the controller's current state as stats named "<prefix>:<stat>".
+    void addStats(const std::string& prefix,
+                  ADD_STAT add_stat,
+                  const void* cookie) const;
+
+    /// @return the batch limit last returned by getBatchLimit.
+    size_t getLastBatchLimit() const {
+        return batchLimit.load();
+    }
+
+    /// @return the current factor the modelled batch size is scaled by.
+    size_t getBoost() const {
+        return boost.load();
+    }
+
+    /// Maximum factor the modelled batch size may be scaled up by.
+    static const size_t MaxBoost = 64;
+
+private:
+    // Weight given to each new flush in the moving averages.
+    static constexpr double Alpha = 0.2;
+
+    std::atomic<hrtime_t> targetLatency;
+    std::atomic<size_t> minBatchSize;
+
+    // Exponentially weighted moments of recent flushes' (numItems,
+    // duration), from which the cost model is fitted. Only accessed by the
+    // flusher.
+    double meanItems;
+    double meanDuration;
+    double meanItemsSq;
+    double meanItemsDuration;
+    size_t numSamples;
+
+    // Dirty age histogram totals as of the last updateDirtyAge().
+    size_t lastDirtyTotal;
+    size_t lastDirtyLate;
+
+    // Current model and decisions (read by stats).
+    std::atomic<bool> modelled;
+    std::atomic<double> itemCost;
+    std::atomic<double> commitOverhead;
+    std::atomic<size_t> boost;
+    std::atomic<size_t> batchLimit;
+    std::atomic<size_t> lateItems;
+};
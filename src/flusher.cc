@@ -18,6 +18,7 @@
 #include "flusher.h"
 
 #include "common.h"
+#include "ep_engine.h"
 #include "tasks.h"
 
 #include <stdlib.h>
@@ -267,11 +268,18 @@ void Flusher::flushVB(void) {
         LOG(EXTENSION_LOG_INFO,
             "Flusher::flushVB: Trying to flush but no vbuckets exist");
         return;
+    } else if (store->isFlusherPipelinedCommitEnabled()) {
+        flushVBPipelined();
     } else if (!hpVbs.empty()) {
+        // High priority requests are waiting; flush everything.
         uint16_t vbid = hpVbs.front();
         hpVbs.pop();
-        if (store->flushVBucket(vbid) == RETRY_FLUSH_VBUCKET) {
+        const hrtime_t flushStart = gethrtime();
+        const int flushed = store->flushVBucket(vbid);
+        if (flushed == RETRY_FLUSH_VBUCKET) {
             hpVbs.push(vbid);
+        } else {
+            recordFlush(flushed, flushStart);
         }
     } else {
         if (doHighPriority && --numHighPriority == 0) {
@@ -279,8 +287,64 @@ void Flusher::flushVB(void) {
         }
         uint16_t vbid = lpVbs.front();
         lpVbs.pop();
-        if (store->flushVBucket(vbid) == RETRY_FLUSH_VBUCKET) {
+        const size_t limit = getBatchLimit();
+        const hrtime_t flushStart = gethrtime();
+        const int flushed = store->flushVBucket(vbid, limit);
+        if (flushed == RETRY_FLUSH_VBUCKET) {
             lpVbs.push(vbid);
+        } else {
+            recordFlush(flushed, flushStart);
         }
     }
 }
+
+std::queue<uint16_t>& Flusher::takeQueuedVBuckets(
+        std::vector<uint16_t>& vbids) {
+    const bool highPriority = !hpVbs.empty();
+    std::queue<uint16_t>& vbs = highPriority ? hpVbs : lpVbs;
+    vbids.reserve(vbs.size());
+    while (!vbs.empty()) {
+        vbids.push_back(vbs.front());
+        vbs.pop();
+    }
+
+    if (!highPriority) {
+        doHighPriority = false;
+    }
+    return vbs;
+}
+
+void Flusher::flushVBPipelined() {
+    // Flush all of the queued vbuckets (the high priority ones, if any),
+    // each one's commit overlapping with preparing the next. The commits
+    // overlap so aren't fed to the batch controller, nor limited by it.
+    std::vector<uint16_t> vbids;
+    std::queue<uint16_t>& vbs = takeQueuedVBuckets(vbids);
+
+    std::vector<uint16_t> retry;
+    store->flushVBucketsPipelined(*shard, vbids, retry);
+    for (auto vbid : retry) {
+        vbs.push(vbid);
+    }
+}
+
+size_t Flusher::getBatchLimit() {
+    if (!store->isFlusherAdaptiveBatchEnabled()) {
+        return 0;
+    }
+
+    batchController.setTargetLatency(
+            store->getFlusherTargetPersistLatency() * 1000);
+    batchController.setMinBatchSize(store->getFlusherMinBatchSize());
+
+    // Only this shard's items count: other shards' flushers drain theirs.
+    batchController.updateDirtyAge(shard->getDirtyAgeHisto());
+    return batchController.getBatchLimit(shard->getDirtyQueueSize());
+}
+
+void Flusher::recordFlush(int itemsFlushed, hrtime_t flushStart) {
+    if (itemsFlushed > 0 && store->isFlusherAdaptiveBatchEnabled()) {
+        batchController.recordFlush(itemsFlushed,
+                                    (gethrtime() - flushStart) / 1000);
+    }
+}
@@ -27,6 +27,7 @@
 
 #include "kv_bucket.h"
 #include "executorthread.h"
+#include "flush_batch_controller.h"
 #include "utility.h"
 
 #define NO_VBUCKETS_INSTANTIATED 0xFFFF
@@ -84,6 +85,13 @@ public:
     }
     void setTaskId(size_t newId) { taskId = newId; }
 
+    /// Add stats on the adaptive batch sizing, named "<prefix>:<stat>".
+    void addStats(const std::string& prefix,
+                  ADD_STAT add_stat,
+                  const void* cookie) const {
+        batchController.addStats(prefix, add_stat, cookie);
+    }
+
 private:
     enum class State {
         Initializing,
@@ -97,11 +105,25 @@ private:
     bool transitionState(State to);
     bool validTransition(State to) const;
     void flushVB();
+    void flushVBPipelined();
+
+    /// Move the queued high priority vbuckets (or if there are none, the
+    /// low priority ones) to vbids.
+    /// @return the queue they were taken from.
+    std::queue<uint16_t>& takeQueuedVBuckets(std::vector<uint16_t>& vbids);
     void completeFlush();
     void initialize();
     void schedule_UNLOCKED();
     double computeMinSleepTime();
 
+    /// @return the maximum number of items the next (low priority) flush
+    ///         should take, or zero if there is no limit.
+    size_t getBatchLimit();
+
+    /// Feed the duration of a flush (started at flushStart) of the given
+    /// number of items back to the batch controller.
+    void recordFlush(int itemsFlushed, hrtime_t flushStart);
+
     const char* stateName(State st) const;
 
     bool canSnooze(void) {
@@ -123,6 +145,7 @@ private:
     bool doHighPriority;
     size_t numHighPriority;
     std::atomic<bool> pendingMutation;
+    FlushBatchController batchController;
 
     KVShard *shard;
 
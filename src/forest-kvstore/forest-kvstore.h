@@ -173,7 +173,8 @@ class ForestKVStore : public KVStore
     bool commit() override;
 
     /**
-     * Rollback a transaction (unless not currently in one).
+     * Rollback a transaction (unless not currently in one), discarding its
+     * requests without completing them.
      */
     void rollback(void) override {
         if (isReadOnly()) {
@@ -181,6 +182,10 @@ class ForestKVStore : public KVStore
                     "read-only object.");
         }
         if (intransaction) {
+            for (auto* req : pendingReqsQ) {
+                delete req;
+            }
+            pendingReqsQ.clear();
             intransaction = false;
         }
     }
@@ -0,0 +1,96 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "hash_bucket_index.h"
+
+#include "dockey_hash.h"
+#include "stored-value.h"
+
+#include <cstring>
+
+HashBucketIndex::HashBucketIndex(size_t numBuckets)
+    : numBuckets(numBuckets),
+      storage(new uint8_t[(numBuckets + 1) * sizeof(Bucket)]) {
+    auto addr = reinterpret_cast<uintptr_t>(storage.get());
+    addr = (addr + sizeof(Bucket) - 1) & ~(uintptr_t(sizeof(Bucket)) - 1);
+    buckets = reinterpret_cast<Bucket*>(addr);
+    clear();
+}
+
+StoredValue* HashBucketIndex::find(size_t bucket,
+                                   uint32_t hash,
+                                   const DocKey& key,
+                                   bool& overflowed) const {
+    const Bucket& b = buckets[bucket];
+    const uint8_t fp = fingerprint(hash);
+    const size_t count = b.count();
+    for (size_t i = 0; i < count; ++i) {
+        if (b.fingerprints[i] == fp && b.entries[i]->hasKey(key)) {
+            overflowed = false;
+            return b.entries[i];
+        }
+    }
+    overflowed = b.overflowed();
+    return nullptr;
+}
+
+void HashBucketIndex::insert(size_t bucket, uint32_t hash, StoredValue* v) {
+    Bucket& b = buckets[bucket];
+    const size_t count = b.count();
+    if (count == Capacity) {
+        b.state |= overflowFlag;
+        return;
+    }
+    b.entries[count] = v;
+    b.fingerprints[count] = fingerprint(hash);
+    ++b.state;
+}
+
+void HashBucketIndex::remove(size_t bucket,
+                             const StoredValue* v,
+                             StoredValue* chain) {
+    Bucket& b = buckets[bucket];
+    if (b.overflowed()) {
+        // v may not even be indexed; re-populate from what remains.
+        rebuild(bucket, chain);
+        return;
+    }
+
+    const size_t count = b.count();
+    for (size_t i = 0; i < count; ++i) {
+        if (b.entries[i] == v) {
+            b.entries[i] = b.entries[count - 1];
+            b.fingerprints[i] = b.fingerprints[count - 1];
+            --b.state;
+            return;
+        }
+    }
+}
+
+void HashBucketIndex::rebuild(size_t bucket, StoredValue* chain) {
+    buckets[bucket].state = 0;
+    for (StoredValue* v = chain; v; v = v->getNext().get()) {
+        insert(bucket, DocKeyHash::hash(v->getKey()), v);
+        if (buckets[bucket].overflowed()) {
+            break;
+        }
+    }
+}
+
+void HashBucketIndex::clear() {
+    std::memset(buckets, 0, numBuckets * sizeof(Bucket));
+}
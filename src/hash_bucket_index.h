@@ -0,0 +1,149 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <memcached/dockey.h>
+
+#include <cstdint>
+#include <memory>
+
+class StoredValue;
+
+/**
+ * A cache-line bucketed index over the hash chains of a HashTable.
+ *
+ * For every hash bucket this holds a 64-byte (one cache line) record of up
+ * to Capacity StoredValue pointers, each with an 8-bit fingerprint of the
+ * key's hash. A lookup compares the fingerprints of a single cache line and
+ * only dereferences the StoredValues whose fingerprint matches - so most
+ * misses touch no StoredValue at all, and most hits touch exactly one -
+ * instead of dereferencing every StoredValue in the chain.
+ *
+ * The StoredValues remain owned by the HashTable's chains; the index only
+ * mirrors them. If a chain grows beyond Capacity the bucket is marked as
+ * overflowed, and lookups which miss in the index must fall back to
+ * walking the chain.
+ *
+ * The index is not thread-safe; each bucket must be guarded by the same lock
+ * as the corresponding HashTable bucket.
+ */
+class HashBucketIndex {
+public:
+    static const size_t Capacity = 7;
+
+    /**
+     * @param numBuckets number of hash buckets to index.
+     */
+    explicit HashBucketIndex(size_t numBuckets);
+
+    size_t getNumBuckets() const {
+        return numBuckets;
+    }
+
+    /**
+     * @return the number of bytes of memory used by this index.
+     */
+    size_t memorySize() const {
+        return sizeof(HashBucketIndex) + (numBuckets + 1) * sizeof(Bucket);
+    }
+
+    /**
+     * Search the given bucket for key.
+     *
+     * @param bucket the hash bucket to search
+     * @param hash the hash of key
+     * @param key the key to search for
+     * @param[out] overflowed set to true if the bucket's chain holds more
+     *             StoredValues than the index does, in which case a nullptr
+     *             return is not authoritative.
+     * @return the indexed StoredValue with the given key, or nullptr.
+     */
+    StoredValue* find(size_t bucket,
+                      uint32_t hash,
+                      const DocKey& key,
+                      bool& overflowed) const;
+
+    /**
+     * Hint that the given bucket will be searched shortly.
+     */
+    void prefetch(size_t bucket) const {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(&buckets[bucket]);
+#endif
+    }
+
+    /**
+     * Add a StoredValue which has just been linked into bucket's chain.
+     */
+    void insert(size_t bucket, uint32_t hash, StoredValue* v);
+
+    /**
+     * Remove a StoredValue which has just been unlinked from bucket's chain.
+     *
+     * @param bucket the hash bucket v was in
+     * @param v the StoredValue removed
+     * @param chain the head of bucket's chain (after v was unlinked); used
+     *        to re-populate the bucket if it had overflowed.
+     */
+    void remove(size_t bucket, const StoredValue* v, StoredValue* chain);
+
+    /**
+     * Re-populate bucket from the given chain.
+     */
+    void rebuild(size_t bucket, StoredValue* chain);
+
+    /**
+     * Empty all buckets.
+     */
+    void clear();
+
+private:
+    struct Bucket {
+        StoredValue* entries[Capacity];
+        uint8_t fingerprints[Capacity];
+        // Bits 0-6: number of valid entries, bit 7: chain has overflowed.
+        uint8_t state;
+
+        size_t count() const {
+            return state & countMask;
+        }
+
+        bool overflowed() const {
+            return (state & overflowFlag) != 0;
+        }
+    };
+    static_assert(sizeof(Bucket) == 64,
+                  "HashBucketIndex::Bucket should occupy one cache line");
+
+    static const uint8_t countMask = 0x7f;
+    static const uint8_t overflowFlag = 0x80;
+
+    static uint8_t fingerprint(uint32_t hash) {
+        // The low bits select the bucket, so take the fingerprint from the
+        // high bits.
+        return static_cast<uint8_t>(hash >> 24);
+    }
+
+    const size_t numBuckets;
+    // Raw allocation, over-sized by one Bucket so the buckets can be aligned
+    // to a cache line boundary.
+    std::unique_ptr<uint8_t[]> storage;
+    Bucket* buckets;
+};
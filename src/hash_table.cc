@@ -19,7 +19,16 @@
 
 #include "stored_value_factories.h"
 
+#include <platform/make_unique.h>
+
+#include <algorithm>
 #include <cstring>
+#include <tuple>
+
+const size_t HashTable::SampleChainDepth;
+const size_t HashTable::MaxSampleProbesPerItem;
+const size_t HashTable::KeyPrefetchDistance;
+const size_t HashTable::VisitPrefetchDistance;
 
 static const ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3079, 6143, 12289, 24571, 49157,
@@ -34,34 +43,65 @@ std::ostream& operator<<(std::ostream& os, const HashTable::Position& pos) {
     return os;
 }
 
+/**
+ * Round size up to the next multiple of locks.
+ */
+static size_t roundUpToMultiple(size_t size, size_t locks) {
+    return ((size + locks - 1) / locks) * locks;
+}
+
+class HashTable::AllStripesLock {
+public:
+    explicit AllStripesLock(HashTable& ht)
+        : ht(ht), mlh(ht.mutexes, ht.n_locks) {
+        for (size_t i = 0; i < ht.n_locks; ++i) {
+            ht.stripes[i]->enterWriter();
+        }
+    }
+
+    ~AllStripesLock() {
+        for (size_t i = 0; i < ht.n_locks; ++i) {
+            ht.stripes[i]->exitWriter();
+        }
+    }
+
+private:
+    HashTable& ht;
+    MultiLockHolder mlh;
+};
+
 HashTable::HashTable(EPStats& st,
                      std::unique_ptr<AbstractStoredValueFactory> svFactory,
                      size_t initialSize,
-                     size_t locks)
+                     size_t locks,
+                     ResizeMode mode,
+                     BucketLayout layout)
     : maxDeletedRevSeqno(0),
-      numTotalItems(0),
-      numNonResidentItems(0),
-      numDeletedItems(0),
-      datatypeCounts(),
-      numEjects(0),
-      memSize(0),
-      cacheSize(0),
-      metaDataMemory(0),
-      initialSize(initialSize),
-      size(initialSize),
+      resizeMode(mode),
+      initialSize(mode == ResizeMode::Incremental
+                          ? roundUpToMultiple(initialSize, locks)
+                          : initialSize),
+      size(this->initialSize),
       n_locks(locks),
+      oldSize(0),
+      migrateCursor(0),
       stats(st),
       valFact(std::move(svFactory)),
       visitors(0),
-      numItems(0),
-      numResizes(0),
-      numTempItems(0) {
+      numResizes(0) {
     values.resize(size);
+    if (layout == BucketLayout::CacheLine) {
+        index = std::make_unique<HashBucketIndex>(size);
+    }
     mutexes = new std::mutex[n_locks];
+    stripes.reset(new cb::CachelinePadded<StripeAccess>[n_locks]);
     activeState = true;
 }
 
 HashTable::~HashTable() {
+    // Every StoredValue is about to be freed, along with the factory which
+    // created them; let it release their memory wholesale.
+    valFact->releaseAll();
     // Use unlocked clear for the destructor, avoids lock inversions on VBucket
     // delete
     clear_UNLOCKED(true);
@@ -84,7 +124,7 @@ void HashTable::clear(bool deactivate) {
                     "non-active object");
         }
     }
-    MultiLockHolder mlh(mutexes, n_locks);
+    AllStripesLock asl(*this);
     clear_UNLOCKED(deactivate);
 }
 
@@ -104,16 +144,31 @@ void HashTable::clear_UNLOCKED(bool deactivate) {
             values[i] = std::move(v->getNext());
         }
     }
+    if (index) {
+        index->clear();
+    }
+    // Any in-progress incremental resize is left to complete (trivially)
+    // against the now empty old bucket array.
+    for (auto& chain : oldValues) {
+        while (chain) {
+            auto v = std::move(chain);
+            clearedMemSize += v->size();
+            clearedValSize += v->valuelen();
+            chain = std::move(v->getNext());
+        }
+    }
 
     stats.currentSize.fetch_sub(clearedMemSize - clearedValSize);
 
-    datatypeCounts.fill(0);
-    numTotalItems.store(0);
-    numItems.store(0);
-    numTempItems.store(0);
-    numNonResidentItems.store(0);
-    memSize.store(0);
-    cacheSize.store(0);
+    for (size_t ii = DatatypeCountsBase; ii < NumCounters; ++ii) {
+        counters.set(ii, 0);
+    }
+    counters.set(NumTotalItems, 0);
+    counters.set(NumItems, 0);
+    counters.set(NumTempItems, 0);
+    counters.set(NumNonResidentItems, 0);
+    counters.set(MemSize, 0);
+    counters.set(CacheSize, 0);
 }
 
 static size_t distance(size_t a, size_t b) {
@@ -148,7 +203,9 @@ void HashTable::resize() {
         new_size = initialSize;
     } else if (0 == i) {
         new_size = prime_size_table[i];
-    }else if (isCurrently(size, prime_size_table[i-1], prime_size_table[i])) {
+    } else if (isCurrently(size,
+                           alignSize(prime_size_table[i - 1]),
+                           alignSize(prime_size_table[i]))) {
         // If one of the candidate sizes is the current size, maintain
         // the current size in order to remain stable.
         new_size = size;
@@ -172,13 +229,31 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
+    newSize = alignSize(newSize);
+
     // Don't resize to the same size, either.
     if (newSize == size) {
         return;
     }
 
-    MultiLockHolder mlh(mutexes, n_locks);
-    if (visitors.load() > 0) {
+    // An incremental resize must complete before another can begin.
+    if (isResizing()) {
+        return;
+    }
+
+    // Get a place for the new items. For incremental resizes this is done
+    // before taking the locks, so the allocation isn't made under them.
+    table_type newValues;
+    std::unique_ptr<HashBucketIndex> newIndex;
+    if (resizeMode == ResizeMode::Incremental) {
+        newValues.resize(newSize);
+        if (index) {
+            newIndex = std::make_unique<HashBucketIndex>(newSize);
+        }
+    }
+
+    AllStripesLock asl(*this);
+    if (visitors.load() > 0 || isResizing()) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
         // visitors cannot start doing meaningful work (we own all
@@ -186,8 +261,28 @@ void HashTable::resize(size_t newSize) {
         return;
     }
 
-    // Get a place for the new items.
-    table_type newValues(newSize);
+    const hrtime_t start = gethrtime();
+
+    if (resizeMode == ResizeMode::Incremental) {
+        // Install the new (empty) bucket array in front of the existing
+        // one; the items are moved across by migrateBuckets().
+        stats.memOverhead->fetch_sub(memorySize());
+        ++numResizes;
+        oldValues = std::move(values);
+        values = std::move(newValues);
+        index = std::move(newIndex);
+        migrateCursor = 0;
+        oldSize.store(size);
+        size.store(newSize);
+        stats.memOverhead->fetch_add(memorySize());
+        resizeLockHoldHisto.add((gethrtime() - start) / 1000);
+        return;
+    }
+
+    newValues.resize(newSize);
+    if (index) {
+        newIndex = std::make_unique<HashBucketIndex>(newSize);
+    }
 
     stats.memOverhead->fetch_sub(memorySize());
     ++numResizes;
@@ -204,7 +299,7 @@ void HashTable::resize(size_t newSize) {
             values[i] = std::move(v->getNext());
 
             // And re-link it into the correct place in newValues.
-            int newBucket = getBucketForHash(v->getKey().hash());
+            int newBucket = getBucketForHash(DocKeyHash::hash(v->getKey()));
             v->setNext(std::move(newValues[newBucket]));
             newValues[newBucket] = std::move(v);
         }
@@ -212,8 +307,117 @@ void HashTable::resize(size_t newSize) {
 
     // Finally assign the new table to values.
     values = std::move(newValues);
+    if (newIndex) {
+        for (size_t i = 0; i < newSize; i++) {
+            newIndex->rebuild(i, values[i].get());
+        }
+        index = std::move(newIndex);
+    }
 
     stats.memOverhead->fetch_add(memorySize());
+    resizeLockHoldHisto.add((gethrtime() - start) / 1000);
+}
+
+bool HashTable::migrateBuckets(size_t maxBuckets) {
+    if (!isActive()) {
+        throw std::logic_error("HashTable::migrateBuckets: Cannot call on a "
+                "non-active object");
+    }
+
+    for (size_t migrated = 0; isResizing() && migrated < maxBuckets;
+         ++migrated) {
+        // Visitors register themselves under mutexes[0] (see visit()), so
+        // holding it while checking {visitors} ensures no visitor can start
+        // while the bucket is being moved (which could cause it to see an
+        // item twice or not at all).
+        HashBucketLock lh(0, mutexes[0], *stripes[0]);
+        if (visitors.load() > 0 || migrateCursor >= oldSize) {
+            break;
+        }
+
+        const size_t bucket = migrateCursor;
+        const size_t lock = bucket % n_locks;
+        HashBucketLock stripeLock;
+        if (lock != 0) {
+            stripeLock = HashBucketLock(bucket, mutexes[lock], *stripes[lock]);
+        }
+
+        const hrtime_t start = gethrtime();
+        auto& chain = oldValues[bucket];
+        while (chain) {
+            // unlink the front element from the old hash chain, and re-link
+            // it into the correct place in the new bucket array (which is
+            // guarded by the same lock, as size is a multiple of n_locks).
+            auto v = std::move(chain);
+            chain = std::move(v->getNext());
+
+            const int hash = DocKeyHash::hash(v->getKey());
+            int newBucket = getBucketForHash(hash);
+            v->setNext(std::move(values[newBucket]));
+            values[newBucket] = std::move(v);
+            if (index) {
+                index->insert(newBucket, hash, values[newBucket].get());
+            }
+        }
+        ++migrateCursor;
+        resizeLockHoldHisto.add((gethrtime() - start) / 1000);
+    }
+
+    finishIncrementalResize();
+    return isResizing();
+}
+
+void HashTable::finishIncrementalResize() {
+    table_type drained;
+    {
+        std::unique_lock<std::mutex> lh(mutexes[0]);
+        if (!isResizing() || migrateCursor < oldSize) {
+            return;
+        }
+    }
+
+    {
+        AllStripesLock asl(*this);
+        if (visitors.load() > 0 || !isResizing() || migrateCursor < oldSize) {
+            return;
+        }
+        const hrtime_t start = gethrtime();
+        stats.memOverhead->fetch_sub(memorySize());
+        drained.swap(oldValues);
+        oldSize.store(0);
+        migrateCursor = 0;
+        stats.memOverhead->fetch_add(memorySize());
+        resizeLockHoldHisto.add((gethrtime() - start) / 1000);
+    }
+    // {drained} (now all empty chains) is freed here, outside of the locks.
+}
+
+size_t HashTable::getNumResizeBucketsRemaining() {
+    LockHolder lh(mutexes[0]);
+    return oldSize - migrateCursor;
+}
+
+hrtime_t HashTable::getResizeLockHoldP99() {
+    const size_t total = resizeLockHoldHisto.total();
+    if (total == 0) {
+        return 0;
+    }
+    const size_t threshold = (total * 99 + 99) / 100;
+    size_t seen = 0;
+    for (const auto& bin : resizeLockHoldHisto) {
+        seen += bin->count();
+        if (seen >= threshold) {
+            return bin->end();
+        }
+    }
+    return 0;
+}
+
+size_t HashTable::alignSize(size_t s) const {
+    if (resizeMode == ResizeMode::Incremental) {
+        return roundUpToMultiple(s, n_locks);
+    }
+    return s;
 }
 
 StoredValue* HashTable::find(const DocKey& key,
@@ -227,8 +431,30 @@ StoredValue* HashTable::find(const DocKey& key,
     return unlocked_find(key, hbl.getBucketNum(), wantsDeleted, trackReference);
 }
 
+/**
+ * Visitor which converts the first item it visits to an Item.
+ */
+class RandomKeyVisitor : public HashTableVisitor {
+public:
+    void visit(const HashTable::HashBucketLock& lh, StoredValue* v) override {
+        item = v->toItem(false, 0);
+    }
+
+    std::unique_ptr<Item> item;
+};
+
 std::unique_ptr<Item> HashTable::getRandomKey(long rnd) {
-    /* Try to locate a partition */
+    if (getNumInMemoryItems() == 0) {
+        return nullptr;
+    }
+
+    RandomKeyVisitor visitor;
+    if (visitRandomSample(visitor, 1, rnd)) {
+        return std::move(visitor.item);
+    }
+
+    // Sampling failed (the table is sparse); fall back to scanning from a
+    // random partition.
     size_t start = rnd % size;
     size_t curr = start;
     std::unique_ptr<Item> ret;
@@ -243,6 +469,113 @@ std::unique_ptr<Item> HashTable::getRandomKey(long rnd) {
     return ret;
 }
 
+/// SplitMix64; a small, fast generator to derive sample positions from rnd.
+static uint64_t nextRandom(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+size_t HashTable::visitRandomSample(HashTableVisitor& visitor,
+                                    size_t count,
+                                    long rnd) {
+    if (count == 0 || !isActive() || getNumInMemoryItems() == 0) {
+        return 0;
+    }
+
+    uint64_t state = static_cast<uint64_t>(rnd);
+    size_t visited = 0;
+    for (size_t probes = count * MaxSampleProbesPerItem;
+         probes > 0 && visited < count && visitor.shouldContinue();
+         --probes) {
+        const uint64_t r = nextRandom(state);
+        const size_t bucket = (r >> 8) % size;
+        size_t position = r % SampleChainDepth;
+
+        auto lh = getLockedBucket(bucket);
+        if (bucket >= size) {
+            // Table shrunk since the bucket was chosen.
+            continue;
+        }
+        StoredValue* v = values[bucket].get();
+        for (; v && position > 0; --position) {
+            v = v->getNext().get();
+        }
+        if (v && !v->isTempItem() && !v->isDeleted() && v->isResident()) {
+            visitor.visit(lh, v);
+            ++visited;
+        }
+    }
+    return visited;
+}
+
+void HashTable::visitKeysLocked(
+        const std::vector<DocKey>& keys,
+        std::function<void(HashBucketLock&, size_t)> func) {
+    if (!isActive()) {
+        throw std::logic_error("HashTable::visitKeysLocked: Cannot call on a "
+                "non-active object");
+    }
+
+    struct KeyEntry {
+        int hash;
+        size_t lock;
+        int bucket;
+        size_t key;
+    };
+
+    // Order the keys by the lock (and bucket) guarding them as of now. If
+    // the table is resized before the locks are taken the order is merely
+    // less effective; each key's bucket is recalculated under the lock.
+    std::vector<KeyEntry> order;
+    order.reserve(keys.size());
+    const size_t currSize = size;
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        const int hash = DocKeyHash::hash(keys[ii]);
+        const int bucket = getBucketForHash(hash, currSize);
+        order.push_back({hash, bucket % n_locks, bucket, ii});
+    }
+    std::sort(order.begin(),
+              order.end(),
+              [](const KeyEntry& a, const KeyEntry& b) {
+                  return std::tie(a.lock, a.bucket, a.key) <
+                         std::tie(b.lock, b.bucket, b.key);
+              });
+
+    HashBucketLock hbl;
+    size_t heldLock = n_locks;
+    for (size_t ii = 0; ii < order.size(); ++ii) {
+        const int hash = order[ii].hash;
+        if (heldLock != n_locks) {
+            // The table can't be resized while we hold one of its locks, so
+            // the bucket calculated here is stable.
+            const int bucket = getBucketForHash(hash);
+            if (hbl.getHTLock().owns_lock() &&
+                mutexForBucket(bucket) == heldLock) {
+                hbl = HashBucketLock(bucket, std::move(hbl));
+            } else {
+                hbl = HashBucketLock();
+                heldLock = n_locks;
+            }
+        }
+        if (heldLock == n_locks) {
+            hbl = getLockedBucketForHash(hash);
+            heldLock = mutexForBucket(hbl.getBucketNum());
+        }
+
+        if (ii + KeyPrefetchDistance < order.size()) {
+            const int next =
+                    getBucketForHash(order[ii + KeyPrefetchDistance].hash);
+            if (mutexForBucket(next) == heldLock) {
+                prefetchBucket(next);
+            }
+        }
+
+        func(hbl, order[ii].key);
+    }
+}
+
 MutationStatus HashTable::set(Item& val) {
     if (!StoredValue::hasAvailableSpace(stats, val, false)) {
         return MutationStatus::NoMem;
@@ -284,23 +617,23 @@ MutationStatus HashTable::unlocked_updateStoredValue(
     }
 
     if (v.isTempItem()) {
-        --numTempItems;
-        ++numItems;
-        ++numTotalItems;
+        counters.decrement(NumTempItems);
+        counters.increment(NumItems);
+        counters.increment(NumTotalItems);
     }
 
     if (v.isDeleted() && !itm.isDeleted()) {
-        --numDeletedItems;
+        counters.decrement(NumDeletedItems);
     }
     if (!v.isDeleted() && itm.isDeleted()) {
-        ++numDeletedItems;
+        counters.increment(NumDeletedItems);
     }
 
     // If the item we are replacing is resident then we need to make sure we
     // appropriately alter the datatype stats.
     if (v.getDatatype() != itm.getDataType()) {
-        --datatypeCounts[v.getDatatype()];
-        ++datatypeCounts[itm.getDataType()];
+        counters.decrement(DatatypeCountsBase + v.getDatatype());
+        counters.increment(DatatypeCountsBase + itm.getDataType());
     }
 
     /* setValue() will mark v as undeleted if required */
@@ -329,18 +662,24 @@ StoredValue* HashTable::unlocked_addNewStoredValue(const HashBucketLock& hbl,
     increaseCacheSize(v->size());
 
     if (v->isTempItem()) {
-        ++numTempItems;
+        counters.increment(NumTempItems);
     } else {
-        ++numItems;
-        ++numTotalItems;
-        ++datatypeCounts[v->getDatatype()];
+        counters.increment(NumItems);
+        counters.increment(NumTotalItems);
+        counters.increment(DatatypeCountsBase + v->getDatatype());
     }
     if (v->isDeleted()) {
-        ++numDeletedItems;
+        counters.increment(NumDeletedItems);
     }
     values[hbl.getBucketNum()] = std::move(v);
 
-    return values[hbl.getBucketNum()].get();
+    StoredValue* added = values[hbl.getBucketNum()].get();
+    if (index) {
+        index->insert(hbl.getBucketNum(),
+                      DocKeyHash::hash(added->getKey()),
+                      added);
+    }
+    return added;
 }
 
 std::pair<StoredValue*, StoredValue::UniquePtr>
@@ -365,14 +704,19 @@ HashTable::unlocked_replaceByCopy(const HashBucketLock& hbl,
     auto newSv = valFact->copyStoredValue(
             vToCopy, std::move(values[hbl.getBucketNum()]));
     if (newSv->isTempItem()) {
-        ++numTempItems;
+        counters.increment(NumTempItems);
     } else {
-        ++numItems;
-        ++numTotalItems;
+        counters.increment(NumItems);
+        counters.increment(NumTotalItems);
     }
     values[hbl.getBucketNum()] = std::move(newSv);
 
-    return {values[hbl.getBucketNum()].get(), std::move(releasedSv)};
+    StoredValue* copy = values[hbl.getBucketNum()].get();
+    if (index) {
+        index->insert(
+                hbl.getBucketNum(), DocKeyHash::hash(copy->getKey()), copy);
+    }
+    return {copy, std::move(releasedSv)};
 }
 
 void HashTable::unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
@@ -383,15 +727,15 @@ void HashTable::unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
         decrNumNonResidentItems();
     }
 
-    --datatypeCounts[v.getDatatype()];
+    counters.decrement(DatatypeCountsBase + v.getDatatype());
 
     if (onlyMarkDeleted) {
         v.markDeleted();
     } else {
         if (v.isTempItem()) {
-            --numTempItems;
-            ++numItems;
-            ++numTotalItems;
+            counters.decrement(NumTempItems);
+            counters.increment(NumItems);
+            counters.increment(NumTotalItems);
         }
         size_t len = v.valuelen();
         if (v.del()) {
@@ -399,24 +743,56 @@ void HashTable::unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
         }
     }
     if (!alreadyDeleted) {
-        ++numDeletedItems;
+        counters.increment(NumDeletedItems);
     }
 }
 
+StoredValue* HashTable::findInChain(StoredValue* chain, const DocKey& key) {
+    for (StoredValue* v = chain; v; v = v->getNext().get()) {
+        if (v->hasKey(key)) {
+            return v;
+        }
+    }
+    return nullptr;
+}
+
+StoredValue* HashTable::findInBucket(int bucket_num, const DocKey& key) {
+    if (index) {
+        bool overflowed;
+        StoredValue* v = index->find(
+                bucket_num, DocKeyHash::hash(key), key, overflowed);
+        if (v || !overflowed) {
+            return v;
+        }
+    }
+    return findInChain(values[bucket_num].get(), key);
+}
+
+StoredValue* HashTable::unlocked_findAny(const DocKey& key, int bucket_num) {
+    StoredValue* v = findInBucket(bucket_num, key);
+    if (!v && isResizing()) {
+        // Not yet migrated by an in-progress incremental resize?
+        v = findInChain(
+                oldValues[getBucketForHash(DocKeyHash::hash(key), oldSize)]
+                        .get(),
+                key);
+    }
+    return v;
+}
+
 StoredValue* HashTable::unlocked_find(const DocKey& key,
                                       int bucket_num,
                                       WantsDeleted wantsDeleted,
                                       TrackReference trackReference) {
-    for (StoredValue* v = values[bucket_num].get(); v; v = v->getNext().get()) {
-        if (v->hasKey(key)) {
-            if (trackReference == TrackReference::Yes && !v->isDeleted()) {
-                v->referenced();
-            }
-            if (wantsDeleted == WantsDeleted::Yes || !v->isDeleted()) {
-                return v;
-            } else {
-                return NULL;
-            }
+    StoredValue* v = unlocked_findAny(key, bucket_num);
+    if (v) {
+        if (trackReference == TrackReference::Yes && !v->isDeleted()) {
+            v->referenced();
+        }
+        if (wantsDeleted == WantsDeleted::Yes || !v->isDeleted()) {
+            return v;
+        } else {
+            return NULL;
         }
     }
     return NULL;
@@ -441,8 +817,9 @@ StoredValue::UniquePtr HashTable::unlocked_release(
     }
 
     // Remove the first (should only be one) StoredValue with the given key.
-    auto released = hashChainRemoveFirst(
-            values[hbl.getBucketNum()],
+    auto released = unlocked_removeFirst(
+            hbl.getBucketNum(),
+            DocKeyHash::hash(key),
             [key](const StoredValue* v) { return v->hasKey(key); });
 
     if (!released) {
@@ -457,20 +834,20 @@ StoredValue::UniquePtr HashTable::unlocked_release(
     reduceCacheSize(released->size());
     reduceMetaDataSize(stats, released->metaDataSize());
     if (released->isTempItem()) {
-        --numTempItems;
+        counters.decrement(NumTempItems);
     } else {
         decrNumItems();
         decrNumTotalItems();
-        --datatypeCounts[released->getDatatype()];
+        counters.decrement(DatatypeCountsBase + released->getDatatype());
         if (released->isDeleted()) {
-            --numDeletedItems;
+            counters.decrement(NumDeletedItems);
         }
     }
     return released;
 }
 
 void HashTable::visit(HashTableVisitor &visitor) {
-    if ((numItems.load() + numTempItems.load()) == 0 || !isActive()) {
+    if ((getNumInMemoryItems() + getNumTempItems()) == 0 || !isActive()) {
         return;
     }
 
@@ -483,18 +860,23 @@ void HashTable::visit(HashTableVisitor &visitor) {
 
     bool aborted = !visitor.shouldContinue();
     size_t visited = 0;
+    // No resize can start or complete while we are registered as a visitor,
+    // so the span (covering any old bucket array) is stable.
+    const int span = static_cast<int>(visitSpan());
     for (int l = 0; isActive() && !aborted && l < static_cast<int>(n_locks);
          l++) {
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+        for (int i = l; i < span; i+= n_locks) {
             // (re)acquire mutex on each HashBucket, to minimise any impact
             // on front-end threads.
-            HashBucketLock lh(i, mutexes[l]);
+            HashBucketLock lh(i, mutexes[l], *stripes[l]);
+            prefetchForVisit(i, span);
 
-            StoredValue* v = values[i].get();
+            StoredValue* v = chainAt(i).get();
             if (v) {
                 // TODO: Perf: This check seems costly - do we think it's still
                 // worth keeping?
-                auto hashbucket = getBucketForHash(v->getKey().hash());
+                auto hashbucket = expectedIndexForHash(
+                        DocKeyHash::hash(v->getKey()), i);
                 if (i != hashbucket) {
                     throw std::logic_error("HashTable::visit: inconsistency "
                             "between StoredValue's calculated hashbucket "
@@ -503,10 +885,26 @@ void HashTable::visit(HashTableVisitor &visitor) {
                             std::to_string(i) + ")");
                 }
             }
-            while (v) {
-                StoredValue* tmp = v->getNext().get();
-                visitor.visit(lh, v);
-                v = tmp;
+            if (i < static_cast<int>(size)) {
+                while (v) {
+                    StoredValue* tmp = v->getNext().get();
+                    visitor.visit(lh, v);
+                    v = tmp;
+                }
+            } else {
+                // Items not yet migrated by an incremental resize are
+                // presented with the bucket they hash to in the current
+                // bucket array (guarded by the same lock), so the visitor
+                // can operate on them as it would any other item.
+                while (v) {
+                    StoredValue* tmp = v->getNext().get();
+                    HashBucketLock itemLock(
+                            getBucketForHash(DocKeyHash::hash(v->getKey())),
+                            std::move(lh));
+                    visitor.visit(itemLock, v);
+                    lh = std::move(itemLock);
+                    v = tmp;
+                }
             }
             ++visited;
         }
@@ -515,21 +913,25 @@ void HashTable::visit(HashTableVisitor &visitor) {
 }
 
 void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
-    if (numItems.load() == 0 || !isActive()) {
+    if (getNumInMemoryItems() == 0 || !isActive()) {
         return;
     }
     size_t visited = 0;
+    std::unique_lock<std::mutex> lh(mutexes[0]);
     VisitorTracker vt(&visitors);
+    const int span = static_cast<int>(visitSpan());
+    lh.unlock();
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
-        for (int i = l; i < static_cast<int>(size); i+= n_locks) {
+        for (int i = l; i < span; i+= n_locks) {
             size_t depth = 0;
-            StoredValue* p = values[i].get();
+            StoredValue* p = chainAt(i).get();
             if (p) {
                 // TODO: Perf: This check seems costly - do we think it's still
                 // worth keeping?
-                auto hashbucket = getBucketForHash(p->getKey().hash());
+                auto hashbucket = expectedIndexForHash(
+                        DocKeyHash::hash(p->getKey()), i);
                 if (i != hashbucket) {
                     throw std::logic_error("HashTable::visit: inconsistency "
                             "between StoredValue's calculated hashbucket "
@@ -553,7 +955,7 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
 HashTable::Position
 HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
                             Position& start_pos) {
-    if ((numItems.load() + numTempItems.load()) == 0 || !isActive()) {
+    if ((getNumInMemoryItems() + getNumTempItems()) == 0 || !isActive()) {
         // Nothing to visit
         return endPosition();
     }
@@ -573,6 +975,9 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
     //avoids the race as if visitors >0 then Resizer will not attempt to resize.
     std::unique_lock<std::mutex> lh(mutexes[0]);
     VisitorTracker vt(&visitors);
+    // Buckets of any old bucket array (from an in-progress incremental resize)
+    // are visited after the current ones; see visitSpan().
+    const size_t span = visitSpan();
     lh.unlock();
 
     // Start from the requested lock number if in range.
@@ -585,18 +990,19 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
         // recorded bucket (as long as we haven't resized).
         hash_bucket = lock;
         if (start_pos.lock == lock &&
-            start_pos.ht_size == size &&
-            start_pos.hash_bucket < size) {
+            start_pos.ht_size == span &&
+            start_pos.hash_bucket < span) {
             hash_bucket = start_pos.hash_bucket;
         }
 
         // Iterate across all values in the hash buckets owned by this lock.
         // Note: we don't record how far into the bucket linked-list we
         // pause at; so any restart will begin from the next bucket.
-        for (; !paused && hash_bucket < size; hash_bucket += n_locks) {
-            LockHolder lh(mutexes[lock]);
+        for (; !paused && hash_bucket < span; hash_bucket += n_locks) {
+            HashBucketLock lh(hash_bucket, mutexes[lock], *stripes[lock]);
+            prefetchForVisit(hash_bucket, span);
 
-            StoredValue* v = values[hash_bucket].get();
+            StoredValue* v = chainAt(hash_bucket).get();
             while (!paused && v) {
                 StoredValue* tmp = v->getNext().get();
                 paused = !visitor.visit(*v);
@@ -607,21 +1013,22 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
         // If the visitor paused us before we visited all hash buckets owned
         // by this lock, we don't want to skip the remaining hash buckets, so
         // stop the outer for loop from advancing to the next lock.
-        if (paused && hash_bucket < size) {
+        if (paused && hash_bucket < span) {
             break;
         }
 
-        // Finished all buckets owned by this lock. Set hash_bucket to 'size'
+        // Finished all buckets owned by this lock. Set hash_bucket to 'span'
         // to give a consistent marker for "end of lock".
-        hash_bucket = size;
+        hash_bucket = span;
     }
 
     // Return the *next* location that should be visited.
-    return HashTable::Position(size, lock, hash_bucket);
+    return HashTable::Position(span, lock, hash_bucket);
 }
 
 HashTable::Position HashTable::endPosition() const  {
-    return HashTable::Position(size, n_locks, size);
+    const size_t span = visitSpan();
+    return HashTable::Position(span, n_locks, span);
 }
 
 bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
@@ -635,8 +1042,8 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
             reduceCacheSize(vptr->valuelen());
             vptr->ejectValue();
             ++stats.numValueEjects;
-            ++numNonResidentItems;
-            ++numEjects;
+            counters.increment(NumNonResidentItems);
+            counters.increment(NumEjects);
             return true;
         } else {
             ++stats.numFailedEjects;
@@ -646,12 +1053,14 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
         if (vptr->eligibleForEviction(policy)) {
             reduceMetaDataSize(stats, vptr->metaDataSize());
             reduceCacheSize(vptr->size());
-            int bucket_num = getBucketForHash(vptr->getKey().hash());
+            const int hash = DocKeyHash::hash(vptr->getKey());
+            int bucket_num = getBucketForHash(hash);
 
             // Remove the item from the hash table.
-            auto removed = hashChainRemoveFirst(
-                    values[bucket_num],
-                    [vptr](const StoredValue* v) { return v == vptr; });
+            auto removed = unlocked_removeFirst(
+                    bucket_num, hash, [vptr](const StoredValue* v) {
+                        return v == vptr;
+                    });
 
             if (removed->isResident()) {
                 ++stats.numValueEjects;
@@ -661,8 +1070,8 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                                            // fully evicted.
             }
             decrNumItems(); // Decrement because the item is fully evicted.
-            --datatypeCounts[vptr->getDatatype()];
-            ++numEjects;
+            counters.decrement(DatatypeCountsBase + vptr->getDatatype());
+            counters.increment(NumEjects);
             updateMaxDeletedRevSeqno(vptr->getRevSeqno());
 
             return true;
@@ -675,11 +1084,25 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
 
 std::unique_ptr<Item> HashTable::getRandomKeyFromSlot(int slot) {
     auto lh = getLockedBucket(slot);
+    if (static_cast<size_t>(slot) >= size) {
+        // Table shrunk since the slot was chosen.
+        return nullptr;
+    }
     for (StoredValue* v = values[slot].get(); v; v = v->getNext().get()) {
         if (!v->isTempItem() && !v->isDeleted() && v->isResident()) {
             return v->toItem(false, 0);
         }
     }
+    // The same index of the old bucket array (if any) is guarded by the
+    // same lock.
+    if (static_cast<size_t>(slot) < oldSize) {
+        for (StoredValue* v = oldValues[slot].get(); v;
+             v = v->getNext().get()) {
+            if (!v->isTempItem() && !v->isDeleted() && v->isResident()) {
+                return v->toItem(false, 0);
+            }
+        }
+    }
 
     return nullptr;
 }
@@ -693,19 +1116,19 @@ bool HashTable::unlocked_restoreValue(
     }
 
     if (v.isTempInitialItem()) { // Regular item with the full eviction
-        --numTempItems;
-        ++numItems;
+        counters.decrement(NumTempItems);
+        counters.increment(NumItems);
         /* set it back to false as we created a temp item by setting it to true
            when bg fetch is scheduled (full eviction mode). */
         v.setNewCacheItem(false);
-        ++datatypeCounts[itm.getDataType()];
+        counters.increment(DatatypeCountsBase + itm.getDataType());
     } else {
         decrNumNonResidentItems();
     }
 
     v.restoreValue(itm);
 
-    increaseCacheSize(v.getValue()->length());
+    increaseCacheSize(v.valuelen());
     return true;
 }
 
@@ -726,30 +1149,30 @@ void HashTable::unlocked_restoreMeta(const std::unique_lock<std::mutex>& htLock,
 
     v.restoreMeta(itm);
     if (!itm.isDeleted()) {
-        --numTempItems;
-        ++numItems;
-        ++numNonResidentItems;
-        ++datatypeCounts[v.getDatatype()];
+        counters.decrement(NumTempItems);
+        counters.increment(NumItems);
+        counters.increment(NumNonResidentItems);
+        counters.increment(DatatypeCountsBase + v.getDatatype());
     }
 }
 
 void HashTable::increaseCacheSize(size_t by) {
-    cacheSize.fetch_add(by);
-    memSize.fetch_add(by);
+    counters.add(CacheSize, by);
+    counters.add(MemSize, by);
 }
 
 void HashTable::reduceCacheSize(size_t by) {
-    cacheSize.fetch_sub(by);
-    memSize.fetch_sub(by);
+    counters.add(CacheSize, -int64_t(by));
+    counters.add(MemSize, -int64_t(by));
 }
 
 void HashTable::increaseMetaDataSize(EPStats& st, size_t by) {
-    metaDataMemory.fetch_add(by);
+    counters.add(MetaDataMemory, by);
     st.currentSize.fetch_add(by);
 }
 
 void HashTable::reduceMetaDataSize(EPStats &st, size_t by) {
-    metaDataMemory.fetch_sub(by);
+    counters.add(MetaDataMemory, -int64_t(by));
     st.currentSize.fetch_sub(by);
 }
 
@@ -764,11 +1187,13 @@ std::ostream& operator<<(std::ostream& os, const HashTable& ht) {
        << " numInMemory:" << ht.getNumInMemoryItems()
        << " numDeleted:" << ht.getNumDeletedItems()
        << " values: " << std::endl;
-    for (const auto& chain : ht.values) {
-        if (chain) {
-            for (StoredValue* sv = chain.get(); sv != nullptr;
-                 sv = sv->getNext().get()) {
-                os << "    " << *sv << std::endl;
+    for (const auto* table : {&ht.values, &ht.oldValues}) {
+        for (const auto& chain : *table) {
+            if (chain) {
+                for (StoredValue* sv = chain.get(); sv != nullptr;
+                     sv = sv->getNext().get()) {
+                    os << "    " << *sv << std::endl;
+                }
             }
         }
     }
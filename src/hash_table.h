@@ -18,10 +18,18 @@
 #pragma once
 
 #include "config.h"
+#include "dockey_hash.h"
+#include "hash_bucket_index.h"
+#include "sharded_counters.h"
 #include "storeddockey.h"
 #include "stored-value.h"
+#include <platform/cacheline_padded.h>
 #include <platform/non_negative_counter.h>
 
+#include <functional>
+#include <thread>
+#include <vector>
+
 class AbstractStoredValueFactory;
 class HashTableStatVisitor;
 class HashTableVisitor;
@@ -62,7 +70,8 @@ enum class AddStatus : uint16_t {
  * It supports a limited degree of concurrent access - the underlying
  * HashTable buckets are guarded by N ht_locks; where N is typically of the
  * order of the number of CPUs. Essentially ht bucket B is guarded by
- * mutex B mod N.
+ * mutex B mod N. Read-only lookups may instead use findShared(), which
+ * excludes only writers of the stripe, not other readers.
  *
  * StoredValue objects can have their value (Blob object) ejected, making the
  * value non-resident. Such StoredValues are still in the HashTable, and their
@@ -125,27 +134,110 @@ public:
         friend std::ostream& operator<<(std::ostream& os, const Position& pos);
     };
 
+    /**
+     * Tracks who is accessing one ht_lock stripe, so lookups can read the
+     * stripe's buckets without taking its mutex (see findShared()).
+     *
+     * Writers - holders of the stripe's mutex, via HashBucketLock - count
+     * themselves in {writers} and then wait for {readers} to drain; shared
+     * readers count themselves in {readers} and then back off if {writers}
+     * is non-zero. As each side publishes its own count before checking the
+     * other's (with sequentially consistent atomics), a reader and a writer
+     * can never both proceed.
+     */
+    class StripeAccess {
+    public:
+        StripeAccess() : readers(0), writers(0) {
+        }
+
+        /**
+         * Attempt to enter the stripe as a shared reader.
+         * @return true if entered (must be paired with exitShared()), false
+         *         if a writer holds the stripe.
+         */
+        bool tryEnterShared() {
+            readers.fetch_add(1);
+            if (writers.load() == 0) {
+                return true;
+            }
+            readers.fetch_sub(1);
+            return false;
+        }
+
+        void exitShared() {
+            readers.fetch_sub(1);
+        }
+
+        /**
+         * Enter the stripe as a writer; the caller must hold the stripe's
+         * mutex. Returns once any shared readers have left.
+         */
+        void enterWriter() {
+            writers.fetch_add(1);
+            while (readers.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+
+        void exitWriter() {
+            writers.fetch_sub(1);
+        }
+
+    private:
+        std::atomic<uint32_t> readers;
+        // A count (not a flag) as a writer remains registered until its
+        // HashBucketLock is destroyed, which may be after it has unlocked the
+        // mutex and another writer has acquired it.
+        std::atomic<uint32_t> writers;
+    };
+
     /**
      * Represents a locked hash bucket that provides RAII semantics for the lock
      *
      * A simple container which holds a lock and the bucket_num of the
-     * hashtable bucket it has the lock for.
+     * hashtable bucket it has the lock for. While it exists it also excludes
+     * shared readers from the stripe (see StripeAccess).
      */
     class HashBucketLock {
     public:
         HashBucketLock()
-            : bucketNum(-1) {}
+            : bucketNum(-1), access(nullptr) {}
+
+        HashBucketLock(int bucketNum, std::mutex& mutex, StripeAccess& access)
+            : bucketNum(bucketNum), htLock(mutex), access(&access) {
+            access.enterWriter();
+        }
 
-        HashBucketLock(int bucketNum, std::mutex& mutex)
-            : bucketNum(bucketNum), htLock(mutex) {
+        HashBucketLock(int bucketNum, HashBucketLock&& other)
+            : bucketNum(bucketNum),
+              htLock(std::move(other.htLock)),
+              access(other.access) {
+            other.access = nullptr;
         }
 
         HashBucketLock(HashBucketLock&& other)
-            : bucketNum(other.bucketNum), htLock(std::move(other.htLock)) {
+            : HashBucketLock(other.bucketNum, std::move(other)) {
         }
 
         HashBucketLock(const HashBucketLock& other) = delete;
 
+        HashBucketLock& operator=(HashBucketLock&& other) {
+            if (access) {
+                access->exitWriter();
+            }
+            bucketNum = other.bucketNum;
+            htLock = std::move(other.htLock);
+            access = other.access;
+            other.access = nullptr;
+            return *this;
+        }
+
+        ~HashBucketLock() {
+            if (access) {
+                access->exitWriter();
+            }
+        }
+
         int getBucketNum() const {
             return bucketNum;
         }
@@ -161,8 +253,42 @@ public:
     private:
         int bucketNum;
         std::unique_lock<std::mutex> htLock;
+        StripeAccess* access;
     };
 
+    /**
+     * How the HashTable moves its StoredValues when it changes size.
+     */
+    enum class ResizeMode {
+        /// Rehash every item in one go, with all ht_locks held.
+        Blocking,
+        /**
+         * Allocate the new bucket array up front and migrate buckets from the
+         * old array a few at a time (see migrateBuckets()). Lookups consult
+         * both arrays until the migration completes. Table sizes are rounded
+         * up to a multiple of the number of locks, so a key is guarded by the
+         * same lock in both the old and the new array.
+         */
+        Incremental
+    };
+
+    /**
+     * How lookups locate a StoredValue within a hash bucket.
+     */
+    enum class BucketLayout {
+        /// Walk the bucket's chain of StoredValues, comparing each key.
+        Chained,
+        /**
+         * Consult a cache-line sized record of key-hash fingerprints and
+         * StoredValue pointers for the bucket first (see HashBucketIndex),
+         * only walking the chain if the bucket has overflowed.
+         */
+        CacheLine
+    };
+
+    /// Count of items for each datatype.
+    using DatatypeCounts = std::array<size_t, mcbp::datatype::highest + 1>;
+
     /**
      * Create a HashTable.
      *
@@ -170,18 +296,25 @@ public:
      * @param svFactory Factory to use for constructing stored values
      * @param initialSize the number of hash table buckets to initially create.
      * @param locks the number of locks in the hash table
+     * @param mode how the table should be resized
+     * @param layout how StoredValues are located within a bucket
      */
     HashTable(EPStats& st,
               std::unique_ptr<AbstractStoredValueFactory> svFactory,
               size_t initialSize,
-              size_t locks);
+              size_t locks,
+              ResizeMode mode = ResizeMode::Blocking,
+              BucketLayout layout = BucketLayout::Chained);
 
     ~HashTable();
 
     size_t memorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(std::mutex));
+            + ((size + oldSize) * sizeof(StoredValue*))
+            + (n_locks * sizeof(std::mutex))
+            + (n_locks * sizeof(cb::CachelinePadded<StripeAccess>))
+            + (index ? index->memorySize() : 0)
+            + counters.memorySize();
     }
 
     /**
@@ -199,20 +332,22 @@ public:
      * this hash table.
      */
     size_t getNumInMemoryItems() const {
-        return numItems;
+        return counters.getNonNegative(NumItems);
     }
 
     /**
      * Get the number of deleted items in the hash table.
      */
     size_t getNumDeletedItems() const {
-        return numDeletedItems;
+        return counters.getNonNegative(NumDeletedItems);
     }
 
     /**
      * Get the number of in-memory non-resident items within this hash table.
      */
-    size_t getNumInMemoryNonResItems() const { return numNonResidentItems; }
+    size_t getNumInMemoryNonResItems() const {
+        return counters.getNonNegative(NumNonResidentItems);
+    }
 
     /**
      * Get the number of non-resident and resident items managed by
@@ -221,34 +356,68 @@ public:
      * VALUE_ONLY_EVICTION is chosen as a cache management.
      */
     size_t getNumItems(void) const {
-        return numTotalItems;
+        return counters.getNonNegative(NumTotalItems);
     }
 
     void setNumTotalItems(size_t totalItems) {
-        numTotalItems = totalItems;
+        counters.set(NumTotalItems, totalItems);
     }
 
     void decrNumItems() {
-        --numItems;
+        counters.decrement(NumItems);
     }
 
     void decrNumTotalItems() {
-        --numTotalItems;
+        counters.decrement(NumTotalItems);
+    }
+
+    void incrNumNonResidentItems() {
+        counters.increment(NumNonResidentItems);
     }
 
     void decrNumNonResidentItems() {
-        --numNonResidentItems;
+        counters.decrement(NumNonResidentItems);
     }
 
     /**
      * Get the number of items whose values are ejected from this hash table.
      */
-    size_t getNumEjects(void) { return numEjects; }
+    size_t getNumEjects(void) const {
+        return counters.getNonNegative(NumEjects);
+    }
 
     /**
      * Get the total item memory size in this hash table.
      */
-    size_t getItemMemory(void) { return memSize; }
+    size_t getItemMemory(void) const {
+        return counters.getNonNegative(MemSize);
+    }
+
+    /**
+     * Get the memory used by resident items (keys, metadata and values) in
+     * this hash table.
+     */
+    size_t getCacheSize() const {
+        return counters.getNonNegative(CacheSize);
+    }
+
+    /**
+     * Get the memory used by item metadata in this hash table.
+     */
+    size_t getMetaDataMemory() const {
+        return counters.getNonNegative(MetaDataMemory);
+    }
+
+    /**
+     * Get the number of items of each datatype in this hash table.
+     */
+    DatatypeCounts getDatatypeCounts() const {
+        DatatypeCounts result;
+        for (size_t ii = 0; ii < result.size(); ++ii) {
+            result[ii] = counters.getNonNegative(DatatypeCountsBase + ii);
+        }
+        return result;
+    }
 
     /**
      * Clear the hash table.
@@ -265,7 +434,9 @@ public:
     /**
      * Get the number of temp. items within this hash table.
      */
-    size_t getNumTempItems(void) { return numTempItems; }
+    size_t getNumTempItems(void) const {
+        return counters.getNonNegative(NumTempItems);
+    }
 
     /**
      * Automatically resize to fit the current data.
@@ -274,9 +445,42 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * In ResizeMode::Incremental this only installs the new bucket array;
+     * the items are moved across by subsequent calls to migrateBuckets().
      */
     void resize(size_t to);
 
+    /**
+     * Migrate up to the given number of buckets from the old bucket array
+     * to the new one, if an incremental resize is in progress. Each bucket
+     * is moved while holding only the lock which guards it.
+     *
+     * @param maxBuckets the maximum number of old buckets to migrate
+     * @return true if the resize is still in progress after this call
+     */
+    bool migrateBuckets(size_t maxBuckets);
+
+    /**
+     * @return true if an incremental resize has been started but the old
+     *         bucket array has not been fully migrated yet.
+     */
+    bool isResizing() const {
+        return oldSize.load() != 0;
+    }
+
+    /**
+     * Get the number of old buckets still to be migrated by an in-progress
+     * incremental resize (zero if none is in progress).
+     */
+    size_t getNumResizeBucketsRemaining();
+
+    /**
+     * Get the 99th percentile (in microseconds) of the time ht_locks were
+     * held by resize operations on this HashTable.
+     */
+    hrtime_t getResizeLockHoldP99();
+
     /**
      * Find the item with the given key.
      *
@@ -290,6 +494,45 @@ public:
                       TrackReference trackReference,
                       WantsDeleted wantsDeleted);
 
+    /**
+     * Look up the item with the given key without excluding other readers of
+     * its ht_lock stripe - only writers (holders of a HashBucketLock on the
+     * stripe) are excluded. This allows concurrent reads of the same (hot)
+     * keys to proceed in parallel.
+     *
+     * func is called with the StoredValue for key, or nullptr if there is
+     * none (deleted and temp items are passed as-is). It must only read the
+     * StoredValue: no reference tracking, expiry or other modification of
+     * the item or the HashTable - anything which needs to do so must use
+     * the exclusive path (getLockedBucket()) instead.
+     *
+     * @param key the key to find
+     * @param func function to invoke with the StoredValue found
+     * @return true if func was called; false if a writer currently holds the
+     *         stripe, in which case the caller should use the exclusive path.
+     */
+    template <typename Func>
+    bool findShared(const DocKey& key, Func func) {
+        if (!isActive()) {
+            throw std::logic_error("HashTable::findShared: Cannot call on a "
+                    "non-active object");
+        }
+        const int hash = DocKeyHash::hash(key);
+        const int bucket = getBucketForHash(hash);
+        StripeAccess& access = *stripes[mutexForBucket(bucket)];
+        if (!access.tryEnterShared()) {
+            return false;
+        }
+        // A resize (which enters every stripe as a writer) may have changed
+        // the size between choosing the bucket and entering the stripe.
+        const bool found = bucket == getBucketForHash(hash);
+        if (found) {
+            func(static_cast<const StoredValue*>(unlocked_findAny(key, bucket)));
+        }
+        access.exitShared();
+        return found;
+    }
+
     /**
      * Find a resident item
      *
@@ -298,6 +541,36 @@ public:
      */
     std::unique_ptr<Item> getRandomKey(long rnd);
 
+    /**
+     * Visit a random sample of resident, non-deleted, non-temporary items.
+     *
+     * Rather than scanning from a random bucket, each probe picks a random
+     * bucket and a random position within the first SampleChainDepth
+     * elements of its chain, visiting the item found there (if any). Every
+     * item within that depth is equally likely to be visited, and as the
+     * table is sized to hold about one item per bucket the expected cost
+     * is O(count) probes, independent of the table size. Items are sampled
+     * with replacement, so the same item may be visited more than once.
+     *
+     * Only the current bucket array is sampled; items yet to be migrated by
+     * an incremental resize are not visited.
+     *
+     * @param visitor visitor to call (with the bucket lock held) for each
+     *        sampled item
+     * @param count number of items to visit
+     * @param rnd a randomization input
+     * @return the number of items visited - less than count if no eligible
+     *         item was found after count * MaxSampleProbesPerItem probes
+     *         (e.g. if the table is nearly empty).
+     */
+    size_t visitRandomSample(HashTableVisitor& visitor, size_t count, long rnd);
+
+    /// Number of chain positions per bucket considered by visitRandomSample.
+    static const size_t SampleChainDepth = 4;
+
+    /// Maximum number of probes visitRandomSample makes per requested item.
+    static const size_t MaxSampleProbesPerItem = 64;
+
     /**
      * Set an Item into the this hashtable
      *
@@ -398,7 +671,8 @@ public:
      * @return HashBucektLock which contains a lock and the hash bucket number
      */
     inline HashBucketLock getLockedBucket(int bucket) {
-        return HashBucketLock(bucket, mutexes[mutexForBucket(bucket)]);
+        const size_t lock = mutexForBucket(bucket);
+        return HashBucketLock(bucket, mutexes[lock], *stripes[lock]);
     }
 
     /**
@@ -415,7 +689,7 @@ public:
                         "Cannot call on a non-active object");
             }
             int bucket = getBucketForHash(h);
-            HashBucketLock rv(bucket, mutexes[mutexForBucket(bucket)]);
+            HashBucketLock rv = getLockedBucket(bucket);
             if (bucket == getBucketForHash(h)) {
                 return rv;
             }
@@ -434,9 +708,35 @@ public:
             throw std::logic_error("HashTable::getLockedBucket: Cannot call on a "
                     "non-active object");
         }
-        return getLockedBucketForHash(key.hash());
+        return getLockedBucketForHash(DocKeyHash::hash(key));
     }
 
+    /**
+     * Call func(hbl, i) for each keys[i], with hbl locking the bucket the
+     * key hashes to.
+     *
+     * Keys are processed grouped by the lock which guards them (and in
+     * bucket order for each lock), so each lock is taken once per batch
+     * rather than once per key, and the buckets of the following keys are
+     * prefetched while each key is processed. func may release the lock
+     * (e.g. to schedule a background fetch); it is re-acquired for the next
+     * key.
+     *
+     * @param keys the keys to process
+     * @param func function to call for each key
+     */
+    void visitKeysLocked(const std::vector<DocKey>& keys,
+                         std::function<void(HashBucketLock&, size_t)> func);
+
+    /// How many keys ahead visitKeysLocked() prefetches buckets.
+    static const size_t KeyPrefetchDistance = 4;
+
+    /**
+     * How many buckets ahead (of those guarded by the same lock) visit() and
+     * pauseResumeVisit() prefetch the chain head StoredValues.
+     */
+    static const size_t VisitPrefetchDistance = 4;
+
     /**
      * Delete a key from the cache without trying to lock the cache first
      * (Please note that you <b>MUST</b> acquire the mutex before calling
@@ -581,20 +881,31 @@ public:
                                                   const DocKey& key);
 
     std::atomic<uint64_t>     maxDeletedRevSeqno;
-    std::atomic<size_t>       numTotalItems;
-    cb::NonNegativeCounter<size_t> numNonResidentItems;
-    cb::NonNegativeCounter<size_t> numDeletedItems;
-    std::array<cb::NonNegativeCounter<size_t>, mcbp::datatype::highest + 1>
-            datatypeCounts;
-    std::atomic<size_t>       numEjects;
-    //! Memory consumed by items in this hashtable.
-    std::atomic<size_t>       memSize;
-    //! Cache size.
-    std::atomic<size_t>       cacheSize;
-    //! Meta-data size.
-    std::atomic<size_t>       metaDataMemory;
 
 private:
+    /**
+     * Item counts and memory sizes, indexing {counters}. These are updated
+     * by every mutation (from every front-end thread), so are sharded to
+     * avoid contention, and summed when read (e.g. for stats).
+     */
+    enum Counter : size_t {
+        NumItems,
+        NumTotalItems,
+        NumNonResidentItems,
+        NumDeletedItems,
+        NumTempItems,
+        NumEjects,
+        //! Memory consumed by items in this hashtable.
+        MemSize,
+        //! Cache size.
+        CacheSize,
+        //! Meta-data size.
+        MetaDataMemory,
+        //! First of the per-datatype item counts.
+        DatatypeCountsBase,
+        NumCounters = DatatypeCountsBase + mcbp::datatype::highest + 1
+    };
+
     // The container for actually holding the StoredValues.
     using table_type = std::vector<StoredValue::UniquePtr>;
 
@@ -604,25 +915,150 @@ private:
     inline bool isActive() const { return activeState; }
     inline void setActiveState(bool newv) { activeState = newv; }
 
+    const ResizeMode resizeMode;
+
     // The initial (and minimum) size of the HashTable.
     const size_t initialSize;
 
     std::atomic<size_t> size;
     size_t               n_locks;
     table_type values;
+    // During an incremental resize, the bucket array being migrated from
+    // (and its size); empty / zero otherwise. Only (re)assigned with all
+    // ht_locks held; individual buckets are guarded by the usual stripe lock.
+    table_type oldValues;
+    std::atomic<size_t> oldSize;
+    // Index over the chains of {values}, if using BucketLayout::CacheLine.
+    // (Not maintained for {oldValues}, which are searched by chain walk.)
+    std::unique_ptr<HashBucketIndex> index;
+    // Next bucket of oldValues to migrate. Guarded by mutexes[0].
+    size_t migrateCursor;
+    // Time (us) ht_locks were held for each resize / bucket migration.
+    Histogram<hrtime_t> resizeLockHoldHisto;
     std::mutex               *mutexes;
+    // Reader / writer tracking for each stripe, indexed as {mutexes}.
+    std::unique_ptr<cb::CachelinePadded<StripeAccess>[]> stripes;
     EPStats&             stats;
     std::unique_ptr<AbstractStoredValueFactory> valFact;
     std::atomic<size_t>       visitors;
-    cb::NonNegativeCounter<size_t> numItems;
+    ShardedCounters<NumCounters> counters;
     std::atomic<size_t>       numResizes;
-    std::atomic<size_t>       numTempItems;
     bool                 activeState;
 
+    static int getBucketForHash(int h, size_t tableSize) {
+        return abs(h % static_cast<int>(tableSize));
+    }
+
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        return getBucketForHash(h, size);
     }
 
+    /**
+     * Round the given table size up as required by the resize mode.
+     */
+    size_t alignSize(size_t s) const;
+
+    /**
+     * Number of bucket indices a visitor must walk: the current bucket array
+     * followed by the old one while an incremental resize is in progress.
+     * Index i in [size, size + oldSize) refers to oldValues[i - size]; as
+     * size is a multiple of n_locks in that mode, index i is always guarded
+     * by mutexes[i % n_locks].
+     */
+    size_t visitSpan() const {
+        return size + oldSize;
+    }
+
+    StoredValue::UniquePtr& chainAt(size_t index) {
+        return index < size ? values[index] : oldValues[index - size];
+    }
+
+    /// The visitSpan() index an item with hash h found at index should have.
+    int expectedIndexForHash(int h, int index) {
+        if (index < static_cast<int>(size)) {
+            return getBucketForHash(h);
+        }
+        return static_cast<int>(size) + getBucketForHash(h, oldSize);
+    }
+
+    /// Hint to the CPU that the memory at addr will be read shortly.
+    static void prefetch(const void* addr) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(addr);
+#endif
+    }
+
+    /// Hint that the given bucket of {values} will be searched shortly.
+    void prefetchBucket(int bucket_num) const {
+        prefetch(&values[bucket_num]);
+        if (index) {
+            index->prefetch(bucket_num);
+        }
+    }
+
+    /**
+     * Prefetch ahead of a visitor at the given visitSpan() index, which
+     * must be locked: the heads of the chains VisitPrefetchDistance
+     * buckets further on (guarded by the same lock, so safe to read), and
+     * the chain slots of the buckets twice as far on, so that they are
+     * cached by the time their heads are read.
+     */
+    void prefetchForVisit(size_t index, size_t span) {
+        const size_t slot = index + 2 * VisitPrefetchDistance * n_locks;
+        if (slot < span) {
+            prefetch(&chainAt(slot));
+        }
+        const size_t head = index + VisitPrefetchDistance * n_locks;
+        if (head < span) {
+            prefetch(chainAt(head).get());
+        }
+    }
+
+    /// Search for key in the given chain, ignoring deleted / reference flags.
+    static StoredValue* findInChain(StoredValue* chain, const DocKey& key);
+
+    /**
+     * Search for key in the given bucket of {values}, via the index if
+     * using BucketLayout::CacheLine.
+     */
+    StoredValue* findInBucket(int bucket_num, const DocKey& key);
+
+    /**
+     * Search for key in bucket_num, and in the old bucket array if an
+     * incremental resize is in progress, ignoring deleted / reference flags.
+     */
+    StoredValue* unlocked_findAny(const DocKey& key, int bucket_num);
+
+    /// RAII holder of every ht_lock, as a writer of every stripe.
+    class AllStripesLock;
+
+    /**
+     * Unlink the first StoredValue matching p from the chain for bucket_num,
+     * falling back to the old bucket array during an incremental resize.
+     */
+    template <typename Pred>
+    StoredValue::UniquePtr unlocked_removeFirst(int bucket_num,
+                                                int hash,
+                                                Pred p) {
+        StoredValue::UniquePtr removed;
+        if (values[bucket_num]) {
+            removed = hashChainRemoveFirst(values[bucket_num], p);
+            if (removed && index) {
+                index->remove(
+                        bucket_num, removed.get(), values[bucket_num].get());
+            }
+        }
+        if (!removed && isResizing()) {
+            auto& oldChain = oldValues[getBucketForHash(hash, oldSize)];
+            if (oldChain) {
+                removed = hashChainRemoveFirst(oldChain, p);
+            }
+        }
+        return removed;
+    }
+
+    void finishIncrementalResize();
+
     inline size_t mutexForBucket(size_t bucket_num) {
         if (!isActive()) {
             throw std::logic_error("HashTable::mutexForBucket: Cannot call on a "
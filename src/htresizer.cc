@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include "ep_engine.h"
+#include "executorpool.h"
 #include "htresizer.h"
 #include "kv_bucket_iface.h"
 
@@ -28,14 +29,39 @@
 
 /**
  * Look at all the hash tables and make sure they're sized appropriately.
+ *
+ * For hash tables using incremental resizing, this also migrates up to
+ * migrationBatch buckets of any in-progress resize. If any resize is still
+ * in progress once all vBuckets have been visited, the resizer task is woken
+ * so the migration continues without waiting for the next resize interval.
  */
 class ResizingVisitor : public VBucketVisitor {
 public:
-    ResizingVisitor() { }
+    ResizingVisitor(size_t migrationBatch, size_t resizerTaskId)
+        : migrationBatch(migrationBatch),
+          resizerTaskId(resizerTaskId),
+          migrationPending(false) {
+    }
 
     void visitBucket(VBucketPtr &vb) override {
-        vb->ht.resize();
+        if (!vb->ht.isResizing()) {
+            vb->ht.resize();
+        }
+        if (vb->ht.isResizing() && vb->ht.migrateBuckets(migrationBatch)) {
+            migrationPending = true;
+        }
     }
+
+    void complete() override {
+        if (migrationPending) {
+            ExecutorPool::get()->wake(resizerTaskId);
+        }
+    }
+
+private:
+    const size_t migrationBatch;
+    const size_t resizerTaskId;
+    bool migrationPending;
 };
 
 HashtableResizerTask::HashtableResizerTask(KVBucketIface* s, double sleepTime)
@@ -48,7 +74,8 @@ HashtableResizerTask::HashtableResizerTask(KVBucketIface* s, double sleepTime)
 
 bool HashtableResizerTask::run(void) {
     TRACE_EVENT0("ep-engine/task", "HashtableResizerTask");
-    auto pv = std::make_unique<ResizingVisitor>();
+    auto pv = std::make_unique<ResizingVisitor>(
+            engine->getConfiguration().getHtResizeMigrationBatch(), getId());
     store->visit(std::move(pv),
                  "Hashtable resizer",
                  TaskId::HashtableResizerVisitorTask);
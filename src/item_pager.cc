@@ -23,6 +23,7 @@
 #include "ep_engine.h"
 #include "tapconnmap.h"
 
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
@@ -42,8 +43,9 @@ enum pager_type_t {
 };
 
 /**
- * As part of the ItemPager, visit all of the objects in memory and
- * eject some within a constrained probability
+ * As part of the ItemPager, visit all of the objects in memory (or, in the
+ * random phase, a random sample of them) and eject some within a constrained
+ * probability
  */
 class PagingVisitor : public VBucketVisitor,
                       public HashTableVisitor {
@@ -88,17 +90,14 @@ public:
             return;
         }
 
-        // always evict unreferenced items, or randomly evict referenced item
-        double r = *pager_phase == PAGING_UNREFERENCED ?
-            1 :
-            static_cast<double>(std::rand()) / static_cast<double>(RAND_MAX);
-
-        if (*pager_phase == PAGING_UNREFERENCED &&
-            v->getNRUValue() == MAX_NRU_VALUE) {
-            doEviction(lh, v);
-        } else if (*pager_phase == PAGING_RANDOM &&
-                   v->incrNRUValue() == MAX_NRU_VALUE &&
-                   r <= percent) {
+        // always evict unreferenced items, or randomly evict referenced
+        // items - the random phase only visits a random sample of the
+        // items, so every item it visits is an eviction candidate.
+        if (*pager_phase == PAGING_UNREFERENCED) {
+            if (v->getNRUValue() == MAX_NRU_VALUE) {
+                doEviction(lh, v);
+            }
+        } else if (v->incrNRUValue() == MAX_NRU_VALUE) {
             doEviction(lh, v);
         }
     }
@@ -145,7 +144,15 @@ public:
             adjustPercent(p, vb->getState());
             if (vBucketFilter(vb->getId())) {
                 currentBucket = vb;
-                vb->ht.visit(*this);
+                if (*pager_phase == PAGING_RANDOM) {
+                    // Visit just the percentage of items we want to evict,
+                    // rather than walking the whole table to pick them.
+                    const size_t sampleSize = static_cast<size_t>(std::ceil(
+                            percent * vb->ht.getNumInMemoryItems()));
+                    vb->ht.visitRandomSample(*this, sampleSize, std::rand());
+                } else {
+                    vb->ht.visit(*this);
+                }
             }
 
         } else { // stop eviction whenever memory usage is below low watermark
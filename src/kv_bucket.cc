@@ -22,6 +22,8 @@
 
 #include <fstream>
 #include <functional>
+#include <condition_variable>
+#include <exception>
 #include <iostream>
 #include <map>
 #include <sstream>
@@ -48,6 +50,7 @@
 #include "kvstore.h"
 #include "locks.h"
 #include "mutation_log.h"
+#include "mutation_journal.h"
 #include "replicationthrottle.h"
 #include "statwriter.h"
 #include "tapconnmap.h"
@@ -133,6 +136,10 @@ public:
             store.setCompactionExpMemThreshold(value);
         } else if (key.compare("replication_throttle_cap_pcnt") == 0) {
             store.getEPEngine().getReplicationThrottle().setCapPercent(value);
+        } else if (key.compare("flusher_min_batch_size") == 0) {
+            store.setFlusherMinBatchSize(value);
+        } else if (key.compare("flusher_target_persist_latency") == 0) {
+            store.setFlusherTargetPersistLatency(value);
         } else {
             LOG(EXTENSION_LOG_WARNING,
                 "Failed to change value for unknown variable, %s\n",
@@ -157,6 +164,10 @@ public:
             }
         } else if (key.compare("bfilter_enabled") == 0) {
             store.setAllBloomFilters(value);
+        } else if (key.compare("flusher_adaptive_batch_enabled") == 0) {
+            store.setFlusherAdaptiveBatch(value);
+        } else if (key.compare("flusher_pipelined_commit") == 0) {
+            store.setFlusherPipelinedCommit(value);
         } else if (key.compare("exp_pager_enabled") == 0) {
             if (value) {
                 store.enableExpiryPager();
@@ -351,7 +362,11 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
       bgFetchDelay(0),
       backfillMemoryThreshold(0.95),
       statsSnapshotTaskId(0),
-      lastTransTimePerItem(0) {
+      lastTransTimePerItem(0),
+      flusherPipelinedCommit(false),
+      flusherAdaptiveBatch(false),
+      flusherMinBatchSize(0),
+      flusherTargetPersistLatency(0) {
     cachedResidentRatio.activeRatio.store(0);
     cachedResidentRatio.replicaRatio.store(0);
 
@@ -455,6 +470,22 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
     config.addValueChangedListener("dcp_min_compression_ratio",
                                    new EPStoreValueChangeListener(*this));
 
+    setFlusherPipelinedCommit(config.isFlusherPipelinedCommit());
+    config.addValueChangedListener("flusher_pipelined_commit",
+                                   new EPStoreValueChangeListener(*this));
+
+    setFlusherAdaptiveBatch(config.isFlusherAdaptiveBatchEnabled());
+    config.addValueChangedListener("flusher_adaptive_batch_enabled",
+                                   new EPStoreValueChangeListener(*this));
+
+    setFlusherMinBatchSize(config.getFlusherMinBatchSize());
+    config.addValueChangedListener("flusher_min_batch_size",
+                                   new EPStoreValueChangeListener(*this));
+
+    setFlusherTargetPersistLatency(config.getFlusherTargetPersistLatency());
+    config.addValueChangedListener("flusher_target_persist_latency",
+                                   new EPStoreValueChangeListener(*this));
+
     if (config.isWarmup()) {
         warmupTask = std::make_unique<Warmup>(*this, config);
     }
@@ -1331,7 +1362,8 @@ void KVBucket::completeBGFetch(const DocKey& key,
                                uint16_t vbucket,
                                const void* cookie,
                                ProcessClock::time_point init,
-                               bool isMeta) {
+                               bool isMeta,
+                               std::shared_ptr<BGFetchNotifyGroup> notifyGroup) {
     ProcessClock::time_point startTime(ProcessClock::now());
     // Go find the data
     RememberingCallback<GetValue> gcb;
@@ -1347,15 +1379,17 @@ void KVBucket::completeBGFetch(const DocKey& key,
 
         VBucketPtr vb = getVBucket(vbucket);
         if (vb) {
-            VBucketBGFetchItem item{gcb.val, cookie, init, isMeta};
+            VBucketBGFetchItem item{
+                    gcb.val, cookie, init, isMeta, std::move(notifyGroup)};
             ENGINE_ERROR_CODE status =
                     vb->completeBGFetchForSingleItem(key, item, startTime);
-            engine.notifyIOComplete(item.cookie, status);
+            notifyBGFetchComplete(item, status);
         } else {
             LOG(EXTENSION_LOG_INFO, "vb:%" PRIu16 " file was deleted in the "
                 "middle of a bg fetch for key{%.*s}\n", vbucket, int(key.size()),
                 key.data());
-            engine.notifyIOComplete(cookie, ENGINE_NOT_MY_VBUCKET);
+            VBucketBGFetchItem item{cookie, isMeta, std::move(notifyGroup)};
+            notifyBGFetchComplete(item, ENGINE_NOT_MY_VBUCKET);
         }
     }
 
@@ -1374,7 +1408,7 @@ void KVBucket::completeBGFetchMulti(uint16_t vbId,
             auto* fetched_item = item.second;
             ENGINE_ERROR_CODE status = vb->completeBGFetchForSingleItem(
                     key, *fetched_item, startTime);
-            engine.notifyIOComplete(fetched_item->cookie, status);
+            notifyBGFetchComplete(*fetched_item, status);
         }
         LOG(EXTENSION_LOG_DEBUG,
             "EP Store completes %" PRIu64 " of batched background fetch "
@@ -1382,8 +1416,7 @@ void KVBucket::completeBGFetchMulti(uint16_t vbId,
             uint64_t(fetchedItems.size()), vbId, gethrtime()/1000000);
     } else {
         for (const auto& item : fetchedItems) {
-            engine.notifyIOComplete(item.second->cookie,
-                                    ENGINE_NOT_MY_VBUCKET);
+            notifyBGFetchComplete(*item.second, ENGINE_NOT_MY_VBUCKET);
         }
         LOG(EXTENSION_LOG_WARNING,
             "EP Store completes %d of batched background fetch for "
@@ -1393,6 +1426,15 @@ void KVBucket::completeBGFetchMulti(uint16_t vbId,
     }
 }
 
+void KVBucket::notifyBGFetchComplete(const VBucketBGFetchItem& fetchedItem,
+                                     ENGINE_ERROR_CODE status) {
+    if (fetchedItem.notifyGroup && !fetchedItem.notifyGroup->complete(status)) {
+        // Not the last of its group.
+        return;
+    }
+    engine.notifyIOComplete(fetchedItem.cookie, status);
+}
+
 GetValue KVBucket::getInternal(const DocKey& key, uint16_t vbucket,
                                const void *cookie, vbucket_state_t allowedState,
                                get_options_t options) {
@@ -1665,7 +1707,7 @@ std::string KVBucket::validateKey(const DocKey& key, uint16_t vbucket,
         if (diskItem.getFlags() != v->getFlags()) {
             return "flags_mismatch";
         } else if (v->isResident() && memcmp(diskItem.getData(),
-                                             v->getValue()->getData(),
+                                             v->copyValue()->getData(),
                                              diskItem.getNBytes())) {
             return "data_mismatch";
         } else {
@@ -1895,6 +1937,14 @@ public:
         return vbucket;
     }
 
+    /**
+     * The item's write was discarded from its transaction without being
+     * committed; queue it to be flushed again.
+     */
+    void discarded() {
+        redirty();
+    }
+
 private:
 
     void redirty() {
@@ -1959,219 +2009,512 @@ void KVBucket::flushOneDeleteAll() {
     setDeleteAllComplete();
 }
 
-int KVBucket::flushVBucket(uint16_t vbid) {
-    KVShard *shard = vbMap.getShardByVbId(vbid);
+/**
+ * Commits a pipelined flush's detached transaction (see
+ * KVBucket::flushVBucketsPipelined) on a writer thread.
+ *
+ * Whichever of the task and the flusher claims the commit first runs it: if
+ * the task has not started by the time the flusher needs the commit to be
+ * complete, the flusher runs it itself rather than waiting for a writer
+ * thread, which may be busy flushing another shard.
+ */
+class PipelinedCommitTask : public GlobalTask {
+public:
+    PipelinedCommitTask(EventuallyPersistentEngine* e,
+                        std::function<void()> commit)
+        : GlobalTask(e, TaskId::PipelinedCommitTask, 0, true),
+          commit(std::move(commit)),
+          claimed(false),
+          done(false) {
+    }
+
+    bool run() {
+        if (claim()) {
+            runCommit();
+        }
+        return false;
+    }
+
+    cb::const_char_buffer getDescription() {
+        return "Committing pipelined flush";
+    }
+
+    /**
+     * Wait for the commit to complete, running it on the calling thread if
+     * the task has not already started it. Rethrows anything thrown by the
+     * commit.
+     */
+    void complete() {
+        if (claim()) {
+            runCommit();
+        }
+        std::unique_lock<std::mutex> lh(mutex);
+        cond.wait(lh, [this] { return done; });
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    bool claim() {
+        bool expected = false;
+        return claimed.compare_exchange_strong(expected, true);
+    }
+
+    void runCommit() {
+        std::exception_ptr caught;
+        try {
+            commit();
+        } catch (...) {
+            caught = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lh(mutex);
+        error = caught;
+        done = true;
+        cond.notify_all();
+    }
+
+    const std::function<void()> commit;
+    std::atomic<bool> claimed;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done;
+    std::exception_ptr error;
+};
+
+/**
+ * One vBucket's part of a flush: the items taken from it to be persisted,
+ * and what is needed to complete its flush once they have been committed.
+ */
+struct VBucketFlush {
+    VBucketFlush(VBucketPtr vbucket, std::mutex& vbMutex)
+        : vb(std::move(vbucket)),
+          lock(vbMutex, std::try_to_lock),
+          itemsFlushed(0),
+          moreAvailable(false) {
+    }
+
+    ~VBucketFlush() {
+        if (commitTask) {
+            // The commit task references pendingCommit, so must be complete
+            // before it is freed.
+            try {
+                commitTask->complete();
+            } catch (const std::exception& e) {
+                LOG(EXTENSION_LOG_WARNING,
+                    "VBucketFlush::~VBucketFlush: Commit for vb:%" PRIu16
+                    " failed: %s",
+                    vb->getId(),
+                    e.what());
+            }
+        }
+    }
+
+    VBucketPtr vb;
+    // The vBucket's vb_mutexes entry, held until its flush is complete.
+    std::unique_lock<std::mutex> lock;
+    std::vector<queued_item> items;
+    snapshot_range_t range;
+    int itemsFlushed;
+    // True if items were left behind for a later flush.
+    bool moreAvailable;
+    // Holds any collections manifest to be written in the commit.
+    SystemEventFlush sef;
+    // For a pipelined flush, the written items waiting to be committed and
+    // the task committing them.
+    std::unique_ptr<KVStorePendingCommit> pendingCommit;
+    SingleThreadedRCPtr<PipelinedCommitTask> commitTask;
+};
+
+bool KVBucket::isDeleteAllPending(KVShard& shard) {
     if (diskDeleteAll && !deleteAllTaskCtx.delay) {
-        if (shard->getId() == EP_PRIMARY_SHARD) {
+        if (shard.getId() == EP_PRIMARY_SHARD) {
             flushOneDeleteAll();
         } else {
-            // disk flush is pending just return
-            return 0;
+            // disk flush is pending
+            return true;
         }
     }
+    return false;
+}
+
+int KVBucket::flushVBucket(uint16_t vbid, size_t maxItems) {
+    KVShard *shard = vbMap.getShardByVbId(vbid);
+    if (isDeleteAllPending(*shard)) {
+        return 0;
+    }
 
-    int items_flushed = 0;
     const hrtime_t flush_start = gethrtime();
 
     VBucketPtr vb = vbMap.getBucket(vbid);
-    if (vb) {
-        std::unique_lock<std::mutex> lh(vb_mutexes[vbid], std::try_to_lock);
-        if (!lh.owns_lock()) { // Try another bucket if this one is locked
-            return RETRY_FLUSH_VBUCKET; // to avoid blocking flusher
+    if (!vb) {
+        return 0;
+    }
+
+    VBucketFlush flush(vb, vb_mutexes[vbid]);
+    if (!flush.lock.owns_lock()) { // Try another bucket if this one is locked
+        return RETRY_FLUSH_VBUCKET; // to avoid blocking flusher
+    }
+
+    KVStore *rwUnderlying = getRWUnderlying(vbid);
+    getFlushItems(flush, maxItems);
+
+    if (!flush.items.empty()) {
+        beginFlush(*rwUnderlying);
+        if (!writeFlushItems(*rwUnderlying, flush)) {
+            discardFlushWrites(*rwUnderlying, flush);
+            return RETRY_FLUSH_VBUCKET;
         }
 
-        std::vector<queued_item> items;
-        KVStore *rwUnderlying = getRWUnderlying(vbid);
+        /* Perform an explicit commit to disk if the commit
+         * interval reaches zero and if there is a non-zero number
+         * of items to flush.
+         * Or if there is a manifest item
+         */
+        if (flush.itemsFlushed > 0 || flush.sef.getCollectionsManifestItem()) {
+            commit(*rwUnderlying, flush.sef.getCollectionsManifestItem());
 
-        while (!vb->rejectQueue.empty()) {
-            items.push_back(vb->rejectQueue.front());
-            vb->rejectQueue.pop();
+            // Now the commit is complete, vBucket file must exist.
+            if (vb->setBucketCreation(false)) {
+                LOG(EXTENSION_LOG_INFO, "VBucket %" PRIu16 " created", vbid);
+            }
         }
 
-        // Append any 'backfill' items (mutations added by a TAP stream).
-        vb->getBackfillItems(items);
+        recordFlushTime(flush_start, flush.itemsFlushed);
+        updatePersistedSnapshot(*rwUnderlying, flush);
+    }
+
+    rwUnderlying->pendingTasks();
 
-        // Append all items outstanding for the persistence cursor.
-        snapshot_range_t range;
-        hrtime_t _begin_ = gethrtime();
-        range = vb->checkpointManager.getAllItemsForCursor(
-                CheckpointManager::pCursorName, items);
-        stats.persistenceCursorGetItemsHisto.add((gethrtime() - _begin_) / 1000);
+    if (!completeFlush(flush)) {
+        return RETRY_FLUSH_VBUCKET;
+    }
+    if (flush.moreAvailable) {
+        notifyFlusher(vbid);
+    }
+    return flush.itemsFlushed;
+}
 
-        if (!items.empty()) {
-            while (!rwUnderlying->begin()) {
-                ++stats.beginFailed;
-                LOG(EXTENSION_LOG_WARNING, "Failed to start a transaction!!! "
-                    "Retry in 1 sec ...");
-                sleep(1);
+size_t KVBucket::flushVBucketsPipelined(KVShard& shard,
+                                        const std::vector<uint16_t>& vbids,
+                                        std::vector<uint16_t>& retry) {
+    if (isDeleteAllPending(shard)) {
+        return 0;
+    }
+
+    KVStore* rwUnderlying = shard.getRWUnderlying();
+    if (!rwUnderlying->getStorageProperties().hasDetachedCommit()) {
+        // Can't commit while writing; flush each vBucket in turn.
+        size_t total = 0;
+        for (auto vbid : vbids) {
+            const int flushed = flushVBucket(vbid);
+            if (flushed == RETRY_FLUSH_VBUCKET) {
+                retry.push_back(vbid);
+            } else {
+                total += flushed;
             }
-            rwUnderlying->optimizeWrites(items);
+        }
+        return total;
+    }
 
-            Item *prev = NULL;
-            auto vbstate = vb->getVBucketState();
-            uint64_t maxSeqno = 0;
-            range.start = std::max(range.start, vbstate.lastSnapStart);
+    // Each vBucket's items are written to a transaction of their own, which
+    // is detached and committed by a PipelinedCommitTask on another writer
+    // thread while the next vBucket's items are taken and written. At most
+    // one commit is in flight; it is completed (on this thread, which holds
+    // its vBucket's lock) before the next one is started.
+    const hrtime_t flush_start = gethrtime();
+    std::unique_ptr<VBucketFlush> inFlight;
+    size_t itemsFlushed = 0;
+    for (auto vbid : vbids) {
+        VBucketPtr vb = vbMap.getBucket(vbid);
+        if (!vb) {
+            continue;
+        }
 
-            bool mustCheckpointVBState = false;
-            std::list<PersistenceCallback*>& pcbs = rwUnderlying->getPersistenceCbList();
+        auto flush = std::make_unique<VBucketFlush>(vb, vb_mutexes[vbid]);
+        if (!flush->lock.owns_lock()) {
+            retry.push_back(vbid);
+            continue;
+        }
 
-            SystemEventFlush sef;
+        getFlushItems(*flush, 0);
+        if (!flush->items.empty()) {
+            beginFlush(*rwUnderlying);
+            if (!writeFlushItems(*rwUnderlying, *flush)) {
+                discardFlushWrites(*rwUnderlying, *flush);
+                retry.push_back(vbid);
+                continue;
+            }
+            const Item* manifest = flush->sef.getCollectionsManifestItem();
+            if (flush->itemsFlushed > 0 || manifest) {
+                flush->pendingCommit = rwUnderlying->detachCommit(manifest);
+            }
+        }
 
-            for (const auto& item : items) {
+        if (inFlight) {
+            itemsFlushed += completePipelinedFlush(*rwUnderlying, *inFlight,
+                                                   retry);
+        }
 
-                if (!item->shouldPersist()) {
-                    continue;
-                }
+        if (flush->pendingCommit) {
+            KVStorePendingCommit* pending = flush->pendingCommit.get();
+            flush->commitTask = make_STRCPtr<PipelinedCommitTask>(
+                    &engine, [this, rwUnderlying, pending]() {
+                        commitDetached(*rwUnderlying, *pending);
+                    });
+            ExecutorPool::get()->schedule(flush->commitTask);
+        }
+        inFlight = std::move(flush);
+    }
 
-                // Pass the Item through the SystemEventFlush which may filter
-                // the item away (return Skip).
-                if (sef.process(item) == ProcessStatus::Skip) {
-                    // The item has no further flushing actions i.e. we've
-                    // absorbed it in the process function.
-                    // Update stats and carry-on
-                    --stats.diskQueueSize;
-                    vb->doStatsForFlushing(*item, item->size());
-                    continue;
-                }
+    if (inFlight) {
+        itemsFlushed += completePipelinedFlush(*rwUnderlying, *inFlight, retry);
+    }
 
-                if (item->getOperation() == queue_op::set_vbucket_state) {
-                    // No actual item explicitly persisted to (this op exists
-                    // to ensure a commit occurs with the current vbstate);
-                    // flag that we must trigger a snapshot even if there are
-                    // no 'real' items in the checkpoint.
-                    mustCheckpointVBState = true;
-
-                    // Update queuing stats how this item has logically been
-                    // processed.
-                    --stats.diskQueueSize;
-                    vb->doStatsForFlushing(*item, item->size());
-
-                } else if (!prev || prev->getKey() != item->getKey()) {
-                    prev = item.get();
-                    ++items_flushed;
-                    PersistenceCallback *cb = flushOneDelOrSet(item, vb);
-                    if (cb) {
-                        pcbs.push_back(cb);
-                    }
+    if (itemsFlushed > 0) {
+        recordFlushTime(flush_start, itemsFlushed);
+    }
 
-                    maxSeqno = std::max(maxSeqno, (uint64_t)item->getBySeqno());
-                    vbstate.maxCas = std::max(vbstate.maxCas, item->getCas());
-                    if (item->isDeleted()) {
-                        vbstate.maxDeletedSeqno =
-                                std::max(vbstate.maxDeletedSeqno,
-                                         item->getRevSeqno());
-                    }
-                    ++stats.flusher_todo;
+    rwUnderlying->pendingTasks();
 
-                } else {
-                    // Item is the same key as the previous[1] one - don't need
-                    // to flush to disk.
-                    // [1] Previous here really means 'next' - optimizeWrites()
-                    //     above has actually re-ordered items such that items
-                    //     with the same key are ordered from high->low seqno.
-                    //     This means we only write the highest (i.e. newest)
-                    //     item for a given key, and discard any duplicate,
-                    //     older items.
-                    --stats.diskQueueSize;
-                    vb->doStatsForFlushing(*item, item->size());
-                }
-            }
+    return itemsFlushed;
+}
 
+size_t KVBucket::completePipelinedFlush(KVStore& rwUnderlying,
+                                        VBucketFlush& flush,
+                                        std::vector<uint16_t>& retry) {
+    if (flush.commitTask) {
+        // Rethrows anything thrown by the commit.
+        auto task = std::move(flush.commitTask);
+        task->complete();
+    }
 
-            {
-                ReaderLockHolder rlh(vb->getStateLock());
-                if (vb->getState() == vbucket_state_active) {
-                    if (maxSeqno) {
-                        range.start = maxSeqno;
-                        range.end = maxSeqno;
-                    }
-                }
+    if (!flush.items.empty()) {
+        updatePersistedSnapshot(rwUnderlying, flush);
+    }
 
-                // Update VBstate based on the changes we have just made,
-                // then tell the rwUnderlying the 'new' state
-                // (which will persisted as part of the commit() below).
-                vbstate.lastSnapStart = range.start;
-                vbstate.lastSnapEnd = range.end;
-
-                // Do we need to trigger a persist of the state?
-                // If there are no "real" items to flush, and we encountered
-                // a set_vbucket_state meta-item.
-                auto options = VBStatePersist::VBSTATE_CACHE_UPDATE_ONLY;
-                if ((items_flushed == 0) && mustCheckpointVBState) {
-                    options = VBStatePersist::VBSTATE_PERSIST_WITH_COMMIT;
-                }
+    if (!completeFlush(flush)) {
+        retry.push_back(flush.vb->getId());
+    }
+    return flush.itemsFlushed;
+}
 
-                if (rwUnderlying->snapshotVBucket(vb->getId(), vbstate,
-                                                  options) != true) {
-                    return RETRY_FLUSH_VBUCKET;
-                }
+void KVBucket::getFlushItems(VBucketFlush& flush, size_t maxItems) {
+    VBucket& vb = *flush.vb;
 
-                if (vb->setBucketCreation(false)) {
-                    LOG(EXTENSION_LOG_INFO, "VBucket %" PRIu16 " created", vbid);
-                }
-            }
+    while (!vb.rejectQueue.empty()) {
+        flush.items.push_back(vb.rejectQueue.front());
+        vb.rejectQueue.pop();
+    }
 
-            /* Perform an explicit commit to disk if the commit
-             * interval reaches zero and if there is a non-zero number
-             * of items to flush.
-             * Or if there is a manifest item
-             */
-            if (items_flushed > 0 || sef.getCollectionsManifestItem()) {
-                commit(*rwUnderlying, sef.getCollectionsManifestItem());
+    // Append any 'backfill' items (mutations added by a TAP stream).
+    vb.getBackfillItems(flush.items);
 
-                // Now the commit is complete, vBucket file must exist.
-                if (vb->setBucketCreation(false)) {
-                    LOG(EXTENSION_LOG_INFO, "VBucket %" PRIu16 " created", vbid);
-                }
+    // Append the items outstanding for the persistence cursor (always at
+    // least one, if any, so that a limited flush still makes progress).
+    size_t limit = 0;
+    if (maxItems != 0) {
+        limit = maxItems > flush.items.size() ? maxItems - flush.items.size()
+                                              : 1;
+    }
+    hrtime_t _begin_ = gethrtime();
+    auto cursorItems = vb.checkpointManager.getItemsForCursor(
+            CheckpointManager::pCursorName, flush.items, limit);
+    stats.persistenceCursorGetItemsHisto.add((gethrtime() - _begin_) / 1000);
+    flush.range = cursorItems.range;
+    flush.moreAvailable = cursorItems.moreAvailable;
+}
+
+void KVBucket::beginFlush(KVStore& rwUnderlying) {
+    while (!rwUnderlying.begin()) {
+        ++stats.beginFailed;
+        LOG(EXTENSION_LOG_WARNING, "Failed to start a transaction!!! "
+            "Retry in 1 sec ...");
+        sleep(1);
+    }
+}
+
+bool KVBucket::writeFlushItems(KVStore& rwUnderlying, VBucketFlush& flush) {
+    VBucketPtr& vb = flush.vb;
+    std::vector<queued_item>& items = flush.items;
+    snapshot_range_t& range = flush.range;
+
+    rwUnderlying.optimizeWrites(items);
+
+    Item *prev = NULL;
+    auto vbstate = vb->getVBucketState();
+    uint64_t maxSeqno = 0;
+    range.start = std::max(range.start, vbstate.lastSnapStart);
+
+    bool mustCheckpointVBState = false;
+    std::list<PersistenceCallback*>& pcbs = rwUnderlying.getPersistenceCbList();
+
+    for (const auto& item : items) {
+
+        if (!item->shouldPersist()) {
+            continue;
+        }
+
+        // Pass the Item through the SystemEventFlush which may filter
+        // the item away (return Skip).
+        if (flush.sef.process(item) == ProcessStatus::Skip) {
+            // The item has no further flushing actions i.e. we've
+            // absorbed it in the process function.
+            // Update stats and carry-on
+            --stats.diskQueueSize;
+            vb->doStatsForFlushing(*item, item->size());
+            continue;
+        }
+
+        if (item->getOperation() == queue_op::set_vbucket_state) {
+            // No actual item explicitly persisted to (this op exists
+            // to ensure a commit occurs with the current vbstate);
+            // flag that we must trigger a snapshot even if there are
+            // no 'real' items in the checkpoint.
+            mustCheckpointVBState = true;
+
+            // Update queuing stats how this item has logically been
+            // processed.
+            --stats.diskQueueSize;
+            vb->doStatsForFlushing(*item, item->size());
+
+        } else if (!prev || prev->getKey() != item->getKey()) {
+            prev = item.get();
+            ++flush.itemsFlushed;
+            PersistenceCallback *cb = flushOneDelOrSet(item, vb);
+            if (cb) {
+                pcbs.push_back(cb);
             }
 
-            hrtime_t flush_end = gethrtime();
-            uint64_t trans_time = (flush_end - flush_start) / 1000000;
-
-            lastTransTimePerItem.store((items_flushed == 0) ? 0 :
-                                       static_cast<double>(trans_time) /
-                                       static_cast<double>(items_flushed));
-            stats.cumulativeFlushTime.fetch_add(trans_time);
-            stats.flusher_todo.store(0);
-            stats.totalPersistVBState++;
-
-            if (vb->rejectQueue.empty()) {
-                vb->setPersistedSnapshot(range.start, range.end);
-                uint64_t highSeqno = rwUnderlying->getLastPersistedSeqno(vbid);
-                if (highSeqno > 0 &&
-                    highSeqno != vb->getPersistenceSeqno()) {
-                    vb->setPersistenceSeqno(highSeqno);
-                }
+            maxSeqno = std::max(maxSeqno, (uint64_t)item->getBySeqno());
+            vbstate.maxCas = std::max(vbstate.maxCas, item->getCas());
+            if (item->isDeleted()) {
+                vbstate.maxDeletedSeqno =
+                        std::max(vbstate.maxDeletedSeqno,
+                                 item->getRevSeqno());
             }
-        }
+            ++stats.flusher_todo;
 
-        rwUnderlying->pendingTasks();
+        } else {
+            // Item is the same key as the previous[1] one - don't need
+            // to flush to disk.
+            // [1] Previous here really means 'next' - optimizeWrites()
+            //     above has actually re-ordered items such that items
+            //     with the same key are ordered from high->low seqno.
+            //     This means we only write the highest (i.e. newest)
+            //     item for a given key, and discard any duplicate,
+            //     older items.
+            --stats.diskQueueSize;
+            vb->doStatsForFlushing(*item, item->size());
+        }
+    }
 
-        if (vb->checkpointManager.getNumCheckpoints() > 1) {
-            wakeUpCheckpointRemover();
+    ReaderLockHolder rlh(vb->getStateLock());
+    if (vb->getState() == vbucket_state_active) {
+        if (maxSeqno) {
+            range.start = maxSeqno;
+            range.end = maxSeqno;
         }
+    }
 
-        if (vb->rejectQueue.empty()) {
-            vb->checkpointManager.itemsPersisted();
-            uint64_t seqno = vb->getPersistenceSeqno();
-            uint64_t chkid = vb->checkpointManager.getPersistenceCursorPreChkId();
-            vb->notifyHighPriorityRequests(
-                    engine, seqno, HighPriorityVBNotify::Seqno);
-            vb->notifyHighPriorityRequests(
-                    engine, chkid, HighPriorityVBNotify::ChkPersistence);
-            if (chkid > 0 && chkid != vb->getPersistenceCheckpointId()) {
-                vb->setPersistenceCheckpointId(chkid);
-            }
+    // Update VBstate based on the changes we have just made,
+    // then tell the rwUnderlying the 'new' state
+    // (which will persisted as part of the commit() below).
+    vbstate.lastSnapStart = range.start;
+    vbstate.lastSnapEnd = range.end;
+
+    // Do we need to trigger a persist of the state?
+    // If there are no "real" items to flush, and we encountered
+    // a set_vbucket_state meta-item.
+    auto options = VBStatePersist::VBSTATE_CACHE_UPDATE_ONLY;
+    if ((flush.itemsFlushed == 0) && mustCheckpointVBState) {
+        options = VBStatePersist::VBSTATE_PERSIST_WITH_COMMIT;
+    }
+
+    if (rwUnderlying.snapshotVBucket(vb->getId(), vbstate, options) != true) {
+        return false;
+    }
+
+    if (vb->setBucketCreation(false)) {
+        LOG(EXTENSION_LOG_INFO, "VBucket %" PRIu16 " created", vb->getId());
+    }
+    return true;
+}
+
+void KVBucket::discardFlushWrites(KVStore& rwUnderlying, VBucketFlush& flush) {
+    const uint16_t vbid = flush.vb->getId();
+    LOG(EXTENSION_LOG_WARNING,
+        "KVBucket::discardFlushWrites: Discarding the writes of vb:%" PRIu16
+        " from the transaction, as its state couldn't be snapshotted",
+        vbid);
+
+    // The transaction only holds this vBucket's writes.
+    rwUnderlying.rollback();
+
+    auto& pcbs = rwUnderlying.getPersistenceCbList();
+    for (auto it = pcbs.begin(); it != pcbs.end();) {
+        if ((*it)->getVBucket()->getId() == vbid) {
+            (*it)->discarded();
+            delete *it;
+            it = pcbs.erase(it);
         } else {
-            return RETRY_FLUSH_VBUCKET;
+            ++it;
         }
     }
+}
+
+void KVBucket::recordFlushTime(hrtime_t flushStart, size_t itemsFlushed) {
+    hrtime_t flush_end = gethrtime();
+    uint64_t trans_time = (flush_end - flushStart) / 1000000;
+
+    lastTransTimePerItem.store((itemsFlushed == 0) ? 0 :
+                               static_cast<double>(trans_time) /
+                               static_cast<double>(itemsFlushed));
+    stats.cumulativeFlushTime.fetch_add(trans_time);
+    stats.flusher_todo.store(0);
+}
+
+void KVBucket::updatePersistedSnapshot(KVStore& rwUnderlying,
+                                       VBucketFlush& flush) {
+    VBucket& vb = *flush.vb;
+    stats.totalPersistVBState++;
 
-    return items_flushed;
+    if (vb.rejectQueue.empty()) {
+        vb.setPersistedSnapshot(flush.range.start, flush.range.end);
+        uint64_t highSeqno = rwUnderlying.getLastPersistedSeqno(vb.getId());
+        if (highSeqno > 0 &&
+            highSeqno != vb.getPersistenceSeqno()) {
+            vb.setPersistenceSeqno(highSeqno);
+        }
+    }
+}
+
+bool KVBucket::completeFlush(VBucketFlush& flush) {
+    VBucket& vb = *flush.vb;
+
+    if (vb.checkpointManager.getNumCheckpoints() > 1) {
+        wakeUpCheckpointRemover();
+    }
+
+    if (!vb.rejectQueue.empty()) {
+        return false;
+    }
+
+    vb.checkpointManager.itemsPersisted();
+    uint64_t seqno = vb.getPersistenceSeqno();
+    uint64_t chkid = vb.checkpointManager.getPersistenceCursorPreChkId();
+    vb.notifyHighPriorityRequests(
+            engine, seqno, HighPriorityVBNotify::Seqno);
+    vb.notifyHighPriorityRequests(
+            engine, chkid, HighPriorityVBNotify::ChkPersistence);
+    if (chkid > 0 && chkid != vb.getPersistenceCheckpointId()) {
+        vb.setPersistenceCheckpointId(chkid);
+    }
+    return true;
 }
 
 void KVBucket::commit(KVStore& kvstore, const Item* collectionsManifest) {
-    std::list<PersistenceCallback*>& pcbs = kvstore.getPersistenceCbList();
     BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
     hrtime_t commit_start = gethrtime();
 
@@ -2182,6 +2525,27 @@ void KVBucket::commit(KVStore& kvstore, const Item* collectionsManifest) {
         sleep(1);
     }
 
+    completeCommit(kvstore.getPersistenceCbList(), commit_start);
+}
+
+void KVBucket::commitDetached(KVStore& kvstore,
+                              KVStorePendingCommit& pendingCommit) {
+    BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
+    hrtime_t commit_start = gethrtime();
+
+    while (!kvstore.commitDetached(pendingCommit)) {
+        ++stats.commitFailed;
+        LOG(EXTENSION_LOG_WARNING,
+            "KVBucket::commitDetached: kvstore.commitDetached failed!!! Retry "
+            "in 1 sec...");
+        sleep(1);
+    }
+
+    completeCommit(pendingCommit.persistenceCallbacks, commit_start);
+}
+
+void KVBucket::completeCommit(std::list<PersistenceCallback*>& pcbs,
+                              hrtime_t commit_start) {
     //Update the total items in the case of full eviction
     if (getItemEvictionPolicy() == FULL_EVICTION) {
         std::unordered_set<uint16_t> vbSet;
@@ -2223,6 +2587,10 @@ PersistenceCallback* KVBucket::flushOneDelOrSet(const queued_item &qi,
 
     int dirtyAge = ep_current_time() - queued;
     stats.dirtyAgeHisto.add(dirtyAge * 1000000);
+    KVShard* shard = vb->getShard();
+    if (shard) {
+        shard->getDirtyAgeHisto().add(dirtyAge * 1000000);
+    }
     stats.dirtyAge.store(dirtyAge);
     stats.dirtyAgeHighWat.store(std::max(stats.dirtyAge.load(),
                                          stats.dirtyAgeHighWat.load()));
@@ -2630,6 +2998,16 @@ void KVBucket::addKVStoreStats(ADD_STAT add_stat, const void* cookie) {
         for (auto* store : underlyingSet) {
             store->addStats(add_stat, cookie);
         }
+
+        Flusher* flusher = vbMap.shards[i]->getFlusher();
+        if (flusher) {
+            flusher->addStats("flusher_" + std::to_string(i), add_stat, cookie);
+        }
+
+        MutationJournal* journal = vbMap.shards[i]->getJournal();
+        if (journal) {
+            journal->addStats("journal_" + std::to_string(i), add_stat, cookie);
+        }
     }
 }
 
@@ -2702,6 +3080,12 @@ ENGINE_ERROR_CODE KVBucket::rollback(uint16_t vbid, uint64_t rollbackSeqno) {
                                         */) {
                 rollbackUnpersistedItems(*vb, result.highSeqno);
                 vb->postProcessRollback(result, prevHighSeqno);
+                // Anything journaled while the vBucket was active is now
+                // of a different history.
+                auto* journal = vbMap.getShardByVbId(vbid)->getJournal();
+                if (journal) {
+                    journal->resetVBucket(vbid);
+                }
                 return ENGINE_SUCCESS;
             }
         }
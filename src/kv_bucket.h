@@ -30,6 +30,7 @@
 #include <deque>
 
 class VBucketCountVisitor;
+struct VBucketFlush;
 
 /**
  * VBucket visitor callback adaptor.
@@ -299,7 +300,8 @@ public:
                          uint16_t vbucket,
                          const void* cookie,
                          ProcessClock::time_point init,
-                         bool isMeta);
+                         bool isMeta,
+                         std::shared_ptr<BGFetchNotifyGroup> notifyGroup);
     /**
      * Complete a batch of background fetch of a non resident value or metadata.
      *
@@ -611,12 +613,64 @@ public:
     /**
      * Flushes all items waiting for persistence in a given vbucket
      * @param vbid The id of the vbucket to flush
+     * @param maxItems If non-zero, flush (about) this many items at most,
+     *        notifying the flusher if more remain
      * @return The number of items flushed
      */
-    int flushVBucket(uint16_t vbid);
+    int flushVBucket(uint16_t vbid, size_t maxItems = 0);
 
     void commit(KVStore& kvstore, const Item* collectionsManifest);
 
+    /**
+     * Flushes all items waiting for persistence in the given vbuckets of a
+     * shard, one vbucket at a time, overlapping each vbucket's commit with
+     * taking and writing the next one's items (if the shard's KVStore
+     * supports it).
+     * @param shard The shard the vbuckets belong to
+     * @param vbids The ids of the vbuckets to flush
+     * @param retry Set to the ids of the vbuckets which must be retried
+     * @return The number of items flushed
+     */
+    size_t flushVBucketsPipelined(KVShard& shard,
+                                  const std::vector<uint16_t>& vbids,
+                                  std::vector<uint16_t>& retry);
+
+    /// Commit writes detached from kvstore, retrying until it succeeds.
+    void commitDetached(KVStore& kvstore, KVStorePendingCommit& pendingCommit);
+
+    bool isFlusherPipelinedCommitEnabled() const {
+        return flusherPipelinedCommit.load();
+    }
+
+    void setFlusherPipelinedCommit(bool enabled) {
+        flusherPipelinedCommit.store(enabled);
+    }
+
+    bool isFlusherAdaptiveBatchEnabled() const {
+        return flusherAdaptiveBatch.load();
+    }
+
+    void setFlusherAdaptiveBatch(bool enabled) {
+        flusherAdaptiveBatch.store(enabled);
+    }
+
+    size_t getFlusherMinBatchSize() const {
+        return flusherMinBatchSize.load();
+    }
+
+    void setFlusherMinBatchSize(size_t size) {
+        flusherMinBatchSize.store(size);
+    }
+
+    /// @return the target time (ms) for a mutation to be persisted.
+    size_t getFlusherTargetPersistLatency() const {
+        return flusherTargetPersistLatency.load();
+    }
+
+    void setFlusherTargetPersistLatency(size_t ms) {
+        flusherTargetPersistLatency.store(ms);
+    }
+
     void addKVStoreStats(ADD_STAT add_stat, const void* cookie);
 
     void addKVStoreTimingStats(ADD_STAT add_stat, const void* cookie);
@@ -763,6 +817,64 @@ protected:
     PersistenceCallback* flushOneDelOrSet(const queued_item &qi,
                                           VBucketPtr &vb);
 
+    /**
+     * Perform any outstanding disk flush_all, if this is the primary shard.
+     * @return true if another shard's flush_all is still pending, so
+     *         nothing may be flushed yet.
+     */
+    bool isDeleteAllPending(KVShard& shard);
+
+    /// Take the items waiting for persistence from flush's vbucket, up to
+    /// (about) maxItems of them if non-zero.
+    void getFlushItems(VBucketFlush& flush, size_t maxItems);
+
+    /// Begin a transaction on rwUnderlying, retrying until it succeeds.
+    void beginFlush(KVStore& rwUnderlying);
+
+    /**
+     * Write flush's items (and the vbucket's state) to rwUnderlying's
+     * transaction.
+     * @return false if the vbucket's state couldn't be snapshotted.
+     */
+    bool writeFlushItems(KVStore& rwUnderlying, VBucketFlush& flush);
+
+    /**
+     * Remove the writes of flush's vbucket from rwUnderlying's transaction
+     * after writeFlushItems() failed, re-queueing its items to be flushed
+     * again.
+     */
+    void discardFlushWrites(KVStore& rwUnderlying, VBucketFlush& flush);
+
+    void recordFlushTime(hrtime_t flushStart, size_t itemsFlushed);
+
+    /// Notify a completed background fetch's cookie - unless it belongs to
+    /// a group of fetches of which it isn't the last to complete.
+    void notifyBGFetchComplete(const VBucketBGFetchItem& fetchedItem,
+                               ENGINE_ERROR_CODE status);
+
+    /// Once flush's items are committed, advance its persisted snapshot and
+    /// seqno.
+    void updatePersistedSnapshot(KVStore& rwUnderlying, VBucketFlush& flush);
+
+    /**
+     * Notify those waiting on flush's vbucket being persisted.
+     * @return false if the flush must be retried (items were rejected).
+     */
+    bool completeFlush(VBucketFlush& flush);
+
+    /**
+     * Wait for the commit of a pipelined flush, then complete it.
+     * @return the number of items flushed.
+     */
+    size_t completePipelinedFlush(KVStore& rwUnderlying,
+                                  VBucketFlush& flush,
+                                  std::vector<uint16_t>& retry);
+
+    /// Once a commit is complete, delete its persistence callbacks and
+    /// update the commit stats.
+    void completeCommit(std::list<PersistenceCallback*>& pcbs,
+                        hrtime_t commit_start);
+
     GetValue getInternal(const DocKey& key, uint16_t vbucket, const void *cookie,
                          vbucket_state_t allowedState,
                          get_options_t options = TRACK_REFERENCE);
@@ -855,6 +967,10 @@ protected:
     } cachedResidentRatio;
     size_t statsSnapshotTaskId;
     std::atomic<size_t> lastTransTimePerItem;
+    std::atomic<bool> flusherPipelinedCommit;
+    std::atomic<bool> flusherAdaptiveBatch;
+    std::atomic<size_t> flusherMinBatchSize;
+    std::atomic<size_t> flusherTargetPersistLatency;
     item_eviction_policy_t eviction_policy;
 
     std::mutex compactionLock;
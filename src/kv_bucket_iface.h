@@ -424,12 +424,16 @@ public:
      * @param init the timestamp of when the request came in
      * @param isMeta whether the fetch is for a non-resident value or metadata of
      *               a (possibly) deleted item
+     * @param notifyGroup if non-null, the group of fetches the cookie is to
+     *                    be notified of together
      */
-    virtual void completeBGFetch(const DocKey& key,
-                                 uint16_t vbucket,
-                                 const void* cookie,
-                                 ProcessClock::time_point init,
-                                 bool isMeta) = 0;
+    virtual void completeBGFetch(
+            const DocKey& key,
+            uint16_t vbucket,
+            const void* cookie,
+            ProcessClock::time_point init,
+            bool isMeta,
+            std::shared_ptr<BGFetchNotifyGroup> notifyGroup) = 0;
     /**
      * Complete a batch of background fetch of a non resident value or metadata.
      *
@@ -708,9 +712,23 @@ public:
     /**
      * Flushes all items waiting for persistence in a given vbucket
      * @param vbid The id of the vbucket to flush
+     * @param maxItems If non-zero, flush (about) this many items at most,
+     *        notifying the flusher if more remain
      * @return The number of items flushed
      */
-    virtual int flushVBucket(uint16_t vbid) = 0;
+    virtual int flushVBucket(uint16_t vbid, size_t maxItems = 0) = 0;
+
+    /**
+     * Flushes all items waiting for persistence in the given vbuckets of a
+     * shard, overlapping each vbucket's commit with preparing the next.
+     * @param shard The shard the vbuckets belong to
+     * @param vbids The ids of the vbuckets to flush
+     * @param retry Set to the ids of the vbuckets which must be retried
+     * @return The number of items flushed
+     */
+    virtual size_t flushVBucketsPipelined(KVShard& shard,
+                                          const std::vector<uint16_t>& vbids,
+                                          std::vector<uint16_t>& retry) = 0;
 
     virtual void commit(KVStore& kvstore, const Item* collectionsManifest) = 0;
 
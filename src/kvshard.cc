@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include <functional>
+#include <limits>
 
 #include <platform/make_unique.h>
 
@@ -26,11 +27,13 @@
 #include "ep_engine.h"
 #include "flusher.h"
 #include "kvshard.h"
+#include "mutation_journal.h"
 
 /* [EPHE TODO]: Consider not using KVShard for ephemeral bucket */
 KVShard::KVShard(uint16_t id, KVBucket& kvBucket)
     : kvConfig(kvBucket.getEPEngine().getConfiguration(), id),
       vbuckets(kvConfig.getMaxVBuckets()),
+      dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
       highPriorityCount(0) {
     const std::string backend = kvConfig.getBackend();
 
@@ -50,9 +53,51 @@ KVShard::KVShard(uint16_t id, KVBucket& kvBucket)
         "persistent") {
         flusher = std::make_unique<Flusher>(&kvBucket, this);
         bgFetcher = std::make_unique<BgFetcher>(kvBucket, *this);
+
+        Configuration& config = kvBucket.getEPEngine().getConfiguration();
+        if (config.isJournalEnabled()) {
+            if (config.isCollectionsPrototypeEnabled()) {
+                // Collections' system events aren't journaled.
+                LOG(EXTENSION_LOG_WARNING,
+                    "KVShard::KVShard: journal_enabled is not supported "
+                    "with collections_prototype_enabled; not journaling "
+                    "shard:%" PRIu16,
+                    id);
+            } else {
+                createJournal(kvBucket);
+            }
+        }
     }
 }
 
+void KVShard::createJournal(KVBucket& kvBucket) {
+    EventuallyPersistentEngine* engine = &kvBucket.getEPEngine();
+    journal = std::make_unique<MutationJournal>(
+            kvConfig.getDBName(),
+            getId(),
+            kvConfig.getMaxVBuckets(),
+            engine->getConfiguration().getJournalSegmentSize(),
+            engine,
+            [this, engine](uint16_t vbid) {
+                VBucketPtr vb = getBucket(vbid);
+                if (vb && vb->getState() == vbucket_state_active) {
+                    vb->notifyHighPriorityRequests(
+                            *engine,
+                            journal->getDurableSeqno(
+                                    vbid, vb->getPersistenceSeqno()),
+                            HighPriorityVBNotify::Seqno);
+                }
+            },
+            [this](uint16_t vbid) -> uint64_t {
+                // Only active vBuckets are journaled (or replayed).
+                VBucketPtr vb = getBucket(vbid);
+                if (vb && vb->getState() == vbucket_state_active) {
+                    return vb->getPersistenceSeqno();
+                }
+                return std::numeric_limits<uint64_t>::max();
+            });
+}
+
 // Non-inline destructor so we can destruct
 // unique_ptrs of forward-declared items
 KVShard::~KVShard() = default;
@@ -83,6 +128,9 @@ void KVShard::dropVBucketAndSetupDeferredDeletion(VBucket::id_type id,
     auto vbPtr = vb.get();
     vbPtr->setupDeferredDeletion(cookie);
     vb.reset();
+    if (journal) {
+        journal->resetVBucket(id);
+    }
 }
 
 std::vector<VBucket::id_type> KVShard::getVBucketsSortedByState() {
@@ -113,6 +161,18 @@ std::vector<VBucket::id_type> KVShard::getVBuckets() {
     return rv;
 }
 
+size_t KVShard::getDirtyQueueSize() {
+    size_t rv = 0;
+    for (const auto& b : vbuckets) {
+        auto vb = b.lock();
+        auto vbPtr = vb.get();
+        if (vbPtr) {
+            rv += vbPtr->dirtyQueueSize;
+        }
+    }
+    return rv;
+}
+
 void NotifyFlusherCB::callback(uint16_t &vb) {
     if (shard->getBucket(vb)) {
         shard->getFlusher()->notifyFlushEvent();
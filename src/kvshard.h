@@ -47,6 +47,7 @@
  *   |                                 |
  *   | flusher: Flusher                |
  *   | BGFetcher: bgFetcher            |
+ *   | journal: MutationJournal        |
  *   |                                 |
  *   | rwUnderlying: KVStore (write)   |----> (CouchKVStore)
  *   | roUnderlying: KVStore (read)    |----> (CouchKVStore)
@@ -56,6 +57,7 @@
 class BgFetcher;
 class Flusher;
 class KVBucket;
+class MutationJournal;
 
 class KVShard {
 public:
@@ -78,6 +80,11 @@ public:
     Flusher *getFlusher();
     BgFetcher *getBgFetcher();
 
+    /// @return the shard's mutation journal, if journal_enabled.
+    MutationJournal* getJournal() {
+        return journal.get();
+    }
+
     VBucketPtr getBucket(VBucket::id_type id) const;
     void setBucket(VBucketPtr vb);
 
@@ -102,7 +109,19 @@ public:
     std::vector<VBucket::id_type> getVBucketsSortedByState();
     std::vector<VBucket::id_type> getVBuckets();
 
+    /// @return the number of items waiting to be persisted in the shard's
+    ///         vbuckets (locks each vbucket's map entry in turn).
+    size_t getDirtyQueueSize();
+
+    /// @return the dirty ages (usec) of the items persisted by this shard -
+    ///         its share of EPStats::dirtyAgeHisto.
+    Histogram<hrtime_t>& getDirtyAgeHisto() {
+        return dirtyAgeHisto;
+    }
+
 private:
+    void createJournal(KVBucket& kvBucket);
+
     KVStoreConfig kvConfig;
 
     /**
@@ -195,6 +214,9 @@ private:
 
     std::unique_ptr<Flusher> flusher;
     std::unique_ptr<BgFetcher> bgFetcher;
+    std::unique_ptr<MutationJournal> journal;
+
+    Histogram<hrtime_t> dirtyAgeHisto;
 
 public:
     std::atomic<size_t> highPriorityCount;
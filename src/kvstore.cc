@@ -244,6 +244,7 @@ void KVStore::addStats(ADD_STAT add_stat, const void *c) {
     addStat(prefix, "io_num_write", st.io_num_write, add_stat, c);
     addStat(prefix, "io_read_bytes", st.io_read_bytes, add_stat, c);
     addStat(prefix, "io_write_bytes", st.io_write_bytes, add_stat, c);
+    addStat(prefix, "io_num_sync", st.fsStats.totalSyncs, add_stat, c);
 
     const size_t read = st.fsStats.totalBytesRead.load() +
                         st.fsStatsCompaction.totalBytesRead.load();
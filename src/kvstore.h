@@ -20,9 +20,11 @@
 #include "config.h"
 
 #include <cJSON.h>
+#include <atomic>
 #include <cstring>
 #include <list>
 #include <map>
+#include <memory>
 #include <relaxed_atomic.h>
 #include <string>
 #include <unordered_map>
@@ -33,25 +35,69 @@
 #include "configuration.h"
 #include "item.h"
 #include "logger.h"
+#include "queued_item_sort.h"
 
 /* Forward declarations */
 class KVStore;
 class PersistenceCallback;
 class RollbackResult;
 
+/**
+ * Shared by the background fetches issued together for one request (see
+ * VBucket::getMulti), so that its cookie is notified once - when the last of
+ * them completes - rather than once per fetch.
+ */
+class BGFetchNotifyGroup {
+public:
+    explicit BGFetchNotifyGroup(size_t fetches) : remaining(fetches) {
+    }
+
+    /**
+     * Record the completion of one of the group's fetches.
+     *
+     * @param status the fetch's status; if this was the last fetch, set to
+     *        the status to notify the cookie with (the first failure, if
+     *        any fetch failed)
+     * @return true if this was the last fetch, and the cookie should be
+     *         notified.
+     */
+    bool complete(ENGINE_ERROR_CODE& status) {
+        if (status != ENGINE_SUCCESS) {
+            ENGINE_ERROR_CODE expected = ENGINE_SUCCESS;
+            firstError.compare_exchange_strong(expected, status);
+        }
+        if (--remaining != 0) {
+            return false;
+        }
+        status = firstError.load();
+        return true;
+    }
+
+private:
+    std::atomic<size_t> remaining;
+    std::atomic<ENGINE_ERROR_CODE> firstError{ENGINE_SUCCESS};
+};
+
 class VBucketBGFetchItem {
 public:
-    VBucketBGFetchItem(const void* c, bool meta_only)
-        : cookie(c), initTime(ProcessClock::now()), metaDataOnly(meta_only) {
+    VBucketBGFetchItem(const void* c,
+                       bool meta_only,
+                       std::shared_ptr<BGFetchNotifyGroup> group = nullptr)
+        : cookie(c),
+          initTime(ProcessClock::now()),
+          metaDataOnly(meta_only),
+          notifyGroup(std::move(group)) {
     }
     VBucketBGFetchItem(const GetValue& value_,
                        const void* c,
                        const ProcessClock::time_point& init_time,
-                       bool meta_only)
+                       bool meta_only,
+                       std::shared_ptr<BGFetchNotifyGroup> group = nullptr)
         : value(value_),
           cookie(c),
           initTime(init_time),
-          metaDataOnly(meta_only) {
+          metaDataOnly(meta_only),
+          notifyGroup(std::move(group)) {
     }
 
     ~VBucketBGFetchItem() {}
@@ -65,6 +111,8 @@ public:
     const void * cookie;
     ProcessClock::time_point initTime;
     bool metaDataOnly;
+    // If set, the cookie is notified once the whole group has completed.
+    std::shared_ptr<BGFetchNotifyGroup> notifyGroup;
 };
 
 const size_t CONFLICT_RES_META_LEN = 1;
@@ -320,7 +368,8 @@ public:
         readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
         writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
         totalBytesRead(0),
-        totalBytesWritten(0) { }
+        totalBytesWritten(0),
+        totalSyncs(0) { }
 
     //Read time length
     Histogram<hrtime_t> readTimeHisto;
@@ -339,6 +388,8 @@ public:
     std::atomic<size_t> totalBytesRead;
     // Total bytes written to disk.
     std::atomic<size_t> totalBytesWritten;
+    // Total number of syncs (fsyncs) issued.
+    std::atomic<size_t> totalSyncs;
 
     void reset() {
         readTimeHisto.reset();
@@ -349,6 +400,7 @@ public:
         syncTimeHisto.reset();
         totalBytesRead = 0;
         totalBytesWritten = 0;
+        totalSyncs = 0;
     }
 };
 
@@ -506,11 +558,17 @@ public:
         No
     };
 
+    enum class DetachedCommit {
+        Yes,
+        No
+    };
+
     StorageProperties(EfficientVBDump evb, EfficientVBDeletion evd, PersistedDeletion pd,
-                      EfficientGet eget, ConcurrentWriteCompact cwc)
+                      EfficientGet eget, ConcurrentWriteCompact cwc,
+                      DetachedCommit dc = DetachedCommit::No)
         : efficientVBDump(evb), efficientVBDeletion(evd),
           persistedDeletions(pd), efficientGet(eget),
-          concWriteCompact(cwc) {}
+          concWriteCompact(cwc), detachedCommit(dc) {}
 
     /* True if we can efficiently dump a single vbucket */
     bool hasEfficientVBDump() const {
@@ -538,12 +596,32 @@ public:
         return (concWriteCompact == ConcurrentWriteCompact::Yes);
     }
 
+    /* True if a transaction can be committed while the next one is written
+     * (see KVStore::detachCommit) */
+    bool hasDetachedCommit() const {
+        return (detachedCommit == DetachedCommit::Yes);
+    }
+
 private:
     EfficientVBDump efficientVBDump;
     EfficientVBDeletion efficientVBDeletion;
     PersistedDeletion persistedDeletions;
     EfficientGet efficientGet;
     ConcurrentWriteCompact concWriteCompact;
+    DetachedCommit detachedCommit;
+};
+
+/**
+ * The writes of a KVStore transaction which has been ended by
+ * KVStore::detachCommit, waiting to be committed by KVStore::commitDetached.
+ */
+class KVStorePendingCommit {
+public:
+    virtual ~KVStorePendingCommit() {}
+
+    /* The persistence callbacks of the writes (moved from the KVStore's
+     * getPersistenceCbList()), to be deleted once they are committed. */
+    std::list<PersistenceCallback*> persistenceCallbacks;
 };
 
 class RollbackCB;
@@ -743,7 +821,36 @@ public:
     virtual bool commit(const Item* collectionsManifest) = 0;
 
     /**
-     * Rollback the current transaction.
+     * End the current transaction without committing it, detaching its
+     * writes so that they can be committed by commitDetached() - possibly on
+     * another thread - while the next transaction is begun and written. The
+     * next transaction mustn't write to the vbucket of the detached writes
+     * until they are committed. Only valid if
+     * getStorageProperties().hasDetachedCommit().
+     *
+     * @param collectionsManifest as for commit()
+     * @return the detached writes
+     */
+    virtual std::unique_ptr<KVStorePendingCommit> detachCommit(
+            const Item* collectionsManifest) {
+        throw std::logic_error("KVStore::detachCommit: Not supported by this "
+                               "KVStore");
+    }
+
+    /**
+     * Commit writes detached by detachCommit(), making them durable before
+     * returning.
+     *
+     * @return false if the commit fails
+     */
+    virtual bool commitDetached(KVStorePendingCommit& pendingCommit) {
+        throw std::logic_error("KVStore::commitDetached: Not supported by "
+                               "this KVStore");
+    }
+
+    /**
+     * Rollback the current transaction. The persistence callbacks of its
+     * writes are left in getPersistenceCbList() for the caller to deal with.
      */
     virtual void rollback() = 0;
 
@@ -896,8 +1003,7 @@ public:
             return;
         }
 
-        CompareQueuedItemsBySeqnoAndKey cq;
-        std::sort(items.begin(), items.end(), cq);
+        sortQueuedItemsByKey(items);
     }
 
     std::list<PersistenceCallback *>& getPersistenceCbList() {
@@ -0,0 +1,534 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "mutation_journal.h"
+
+#include "ep_engine.h"
+#include "objectregistry.h"
+#include "statwriter.h"
+
+extern "C" {
+#include "crc32.h"
+}
+
+#include <platform/dirutils.h>
+#include <platform/strerror.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#ifdef WIN32
+#include <io.h>
+#endif
+
+// How often the sync thread wakes when not asked to, to write out whatever
+// has been journaled and to check for segments which can be removed.
+static const std::chrono::milliseconds SyncInterval(100);
+
+// Pending size at which the sync thread is woken to write it out.
+static const size_t SyncBufferSize = 1024 * 1024;
+
+// Size of a record's crc32 and length fields.
+static const size_t RecordHeaderSize = sizeof(uint32_t) * 2;
+
+template <typename T>
+static void appendField(std::string& buf, T value) {
+    buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static T readField(const char*& ptr) {
+    T value;
+    std::memcpy(&value, ptr, sizeof(value));
+    ptr += sizeof(value);
+    return value;
+}
+
+static bool syncFile(FILE* file) {
+    if (fflush(file) != 0) {
+        return false;
+    }
+#ifdef WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    int ret;
+    while ((ret = fsync(fileno(file))) == -1 && errno == EINTR) {
+    }
+    return ret == 0;
+#endif
+}
+
+MutationJournal::MutationJournal(const std::string& dir,
+                                 uint16_t shardId,
+                                 size_t maxVBuckets,
+                                 size_t segmentSize,
+                                 EventuallyPersistentEngine* engine,
+                                 SyncedCallback syncedCb,
+                                 PersistedSeqnoFn persistedSeqnoFn)
+    : dir(dir),
+      shardId(shardId),
+      segmentSize(segmentSize),
+      engine(engine),
+      syncedCb(syncedCb),
+      persistedSeqnoFn(persistedSeqnoFn),
+      pendingBytes(0),
+      syncRequested(false),
+      stopping(false),
+      failed(false),
+      segmentFile(nullptr),
+      segmentId(0),
+      segmentBytes(0),
+      lastSeqnos(maxVBuckets),
+      firstSeqnos(maxVBuckets),
+      syncedSeqnos(maxVBuckets),
+      numRecords(0),
+      numSyncs(0),
+      bytesWritten(0),
+      syncTime(0),
+      numSegments(0) {
+}
+
+MutationJournal::~MutationJournal() {
+    stop();
+}
+
+MutationJournal::RecoveredItems MutationJournal::recover() {
+    RecoveredItems items;
+
+    for (const auto id : findSegments()) {
+        const std::string path = segmentPath(id);
+        std::ifstream file(path, std::ios::binary);
+        const std::string data((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+        if (!file.good() && !file.eof()) {
+            LOG(EXTENSION_LOG_WARNING,
+                "MutationJournal::recover: Failed to read %s",
+                path.c_str());
+            continue;
+        }
+
+        Segment segment{path, {}};
+        size_t offset = 0;
+        while (offset + RecordHeaderSize <= data.size()) {
+            const char* ptr = data.data() + offset;
+            const auto crc = readField<uint32_t>(ptr);
+            const auto length = readField<uint32_t>(ptr);
+            if (length > data.size() - offset - RecordHeaderSize ||
+                crc != crc32buf(reinterpret_cast<uint8_t*>(
+                                        const_cast<char*>(ptr)),
+                                length)) {
+                break;
+            }
+            offset += RecordHeaderSize + length;
+
+            const auto type = RecordType(readField<uint8_t>(ptr));
+            const auto vbid = readField<uint16_t>(ptr);
+            if (type == RecordType::Reset) {
+                items.erase(vbid);
+                segment.seqnos.erase(vbid);
+                for (auto& closed : closedSegments) {
+                    closed.seqnos.erase(vbid);
+                }
+                continue;
+            }
+
+            const auto seqno = readField<uint64_t>(ptr);
+            const auto revSeqno = readField<uint64_t>(ptr);
+            const auto cas = readField<uint64_t>(ptr);
+            const auto flags = readField<uint32_t>(ptr);
+            const auto exptime = readField<uint32_t>(ptr);
+            uint8_t extMeta[EXT_META_LEN];
+            extMeta[0] = readField<uint8_t>(ptr);
+            const auto ns = readField<uint8_t>(ptr);
+            const auto keylen = readField<uint16_t>(ptr);
+            const auto valuelen = readField<uint32_t>(ptr);
+            const DocKey key(reinterpret_cast<const uint8_t*>(ptr),
+                             keylen,
+                             DocNamespace(ns));
+            ptr += keylen;
+
+            queued_item item(new Item(key,
+                                      flags,
+                                      exptime,
+                                      valuelen ? ptr : nullptr,
+                                      valuelen,
+                                      extMeta,
+                                      EXT_META_LEN,
+                                      cas,
+                                      seqno,
+                                      vbid,
+                                      revSeqno));
+            if (type == RecordType::Deletion) {
+                item->setDeleted();
+            }
+            items[vbid].push_back(item);
+            segment.seqnos[vbid] = seqno;
+        }
+
+        if (offset != data.size()) {
+            LOG(EXTENSION_LOG_WARNING,
+                "MutationJournal::recover: Ignoring %" PRIu64
+                " bytes of torn or corrupt records at offset %" PRIu64
+                " of %s",
+                uint64_t(data.size() - offset),
+                uint64_t(offset),
+                path.c_str());
+        }
+
+        closedSegments.push_back(std::move(segment));
+        segmentId = id + 1;
+    }
+
+    return items;
+}
+
+void MutationJournal::start() {
+    // Discard any segments which weren't recovered.
+    for (const auto id : findSegments()) {
+        const std::string path = segmentPath(id);
+        const bool recovered =
+                std::any_of(closedSegments.begin(),
+                            closedSegments.end(),
+                            [&path](const Segment& s) {
+                                return s.path == path;
+                            });
+        if (!recovered) {
+            remove(path.c_str());
+        }
+        segmentId = std::max(segmentId, id + 1);
+    }
+
+    if (!openSegment()) {
+        throw std::runtime_error(
+                "MutationJournal::start: Failed to open " +
+                segmentPath(segmentId) + ": " + cb_strerror());
+    }
+    syncThread = std::thread(&MutationJournal::run, this);
+}
+
+void MutationJournal::stop() {
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        if (!syncThread.joinable()) {
+            return;
+        }
+        stopping = true;
+        cond.notify_one();
+    }
+    syncThread.join();
+
+    if (segmentFile) {
+        fclose(segmentFile);
+        segmentFile = nullptr;
+    }
+}
+
+void MutationJournal::append(const queued_item& qi) {
+    RecordType type;
+    switch (qi->getOperation()) {
+    case queue_op::set:
+        type = RecordType::Mutation;
+        break;
+    case queue_op::del:
+        type = RecordType::Deletion;
+        break;
+    default:
+        return;
+    }
+
+    const uint16_t vbid = qi->getVBucketId();
+    const uint64_t seqno = qi->getBySeqno();
+
+    std::lock_guard<std::mutex> lh(mutex);
+    if (lastSeqnos[vbid] != 0 && seqno != lastSeqnos[vbid] + 1) {
+        // The vBucket has had mutations which weren't journaled.
+        resetVBucket_UNLOCKED(vbid);
+    }
+    if (firstSeqnos[vbid] == 0) {
+        firstSeqnos[vbid] = seqno;
+    }
+    lastSeqnos[vbid] = seqno;
+
+    pending.push_back({type, vbid, qi});
+    pendingBytes += qi->getKey().size() + qi->getNBytes();
+    pendingSeqnos[vbid] = seqno;
+    ++numRecords;
+
+    if (pendingBytes >= SyncBufferSize) {
+        cond.notify_one();
+    }
+}
+
+void MutationJournal::resetVBucket(uint16_t vbid) {
+    std::lock_guard<std::mutex> lh(mutex);
+    resetVBucket_UNLOCKED(vbid);
+}
+
+void MutationJournal::resetVBucket_UNLOCKED(uint16_t vbid) {
+    pending.push_back({RecordType::Reset, vbid, queued_item()});
+    pendingSeqnos.erase(vbid);
+    pendingResets.insert(vbid);
+    lastSeqnos[vbid] = 0;
+    firstSeqnos[vbid] = 0;
+    syncedSeqnos[vbid] = 0;
+}
+
+void MutationJournal::requestSync(uint16_t vbid) {
+    std::lock_guard<std::mutex> lh(mutex);
+    syncWaiters.insert(vbid);
+    syncRequested = true;
+    cond.notify_one();
+}
+
+uint64_t MutationJournal::getDurableSeqno(uint16_t vbid,
+                                          uint64_t persistedSeqno) const {
+    // Until the mutations before the first one journaled are persisted, the
+    // journal doesn't make any later ones durable.
+    const uint64_t first = firstSeqnos[vbid].load();
+    if (first == 0 || persistedSeqno + 1 < first) {
+        return persistedSeqno;
+    }
+    return std::max(persistedSeqno, syncedSeqnos[vbid].load());
+}
+
+void MutationJournal::addStats(const std::string& prefix,
+                               ADD_STAT add_stat,
+                               const void* cookie) const {
+    add_casted_stat((prefix + ":records").c_str(), numRecords,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":syncs").c_str(), numSyncs, add_stat, cookie);
+    add_casted_stat((prefix + ":bytes_written").c_str(), bytesWritten,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":sync_time").c_str(), syncTime,
+                    add_stat, cookie);
+    add_casted_stat((prefix + ":segments").c_str(), numSegments,
+                    add_stat, cookie);
+}
+
+void MutationJournal::run() {
+    ObjectRegistry::onSwitchThread(engine);
+
+    std::vector<PendingRecord> records;
+    std::string data;
+    std::unordered_map<uint16_t, uint64_t> seqnos;
+    std::set<uint16_t> resets;
+    std::set<uint16_t> waiters;
+
+    std::unique_lock<std::mutex> lh(mutex);
+    while (true) {
+        cond.wait_for(lh, SyncInterval, [this] {
+            return stopping || syncRequested ||
+                   pendingBytes >= SyncBufferSize;
+        });
+        const bool stop = stopping;
+        records.swap(pending);
+        pendingBytes = 0;
+        seqnos.swap(pendingSeqnos);
+        resets.swap(pendingResets);
+        waiters.swap(syncWaiters);
+        syncRequested = false;
+        lh.unlock();
+
+        for (const auto& record : records) {
+            encodeRecord(data, record);
+        }
+        records.clear();
+
+        bool synced = false;
+        if (!data.empty() && !failed) {
+            synced = writeSegment(data, resets, seqnos);
+        }
+        removePersistedSegments();
+
+        lh.lock();
+        if (synced) {
+            for (const auto& vb : seqnos) {
+                // Skip any vBucket reset while its mutations were written.
+                if (pendingResets.count(vb.first) == 0) {
+                    syncedSeqnos[vb.first] = vb.second;
+                }
+            }
+        }
+        lh.unlock();
+
+        for (const auto& vb : seqnos) {
+            waiters.insert(vb.first);
+        }
+        for (const auto vbid : waiters) {
+            syncedCb(vbid);
+        }
+        data.clear();
+        seqnos.clear();
+        resets.clear();
+        waiters.clear();
+
+        lh.lock();
+        if (stop) {
+            break;
+        }
+    }
+    lh.unlock();
+
+    ObjectRegistry::onSwitchThread(nullptr);
+}
+
+void MutationJournal::encodeRecord(std::string& buf,
+                                   const PendingRecord& record) {
+    const size_t start = buf.size();
+    // Placeholders for the crc32 and length.
+    appendField(buf, uint32_t(0));
+    appendField(buf, uint32_t(0));
+
+    appendField(buf, uint8_t(record.type));
+    appendField(buf, record.vbid);
+    if (record.item) {
+        const Item& item = *record.item;
+        const auto& key = item.getKey();
+        const uint32_t valuelen = item.getNBytes();
+        appendField(buf, uint64_t(item.getBySeqno()));
+        appendField(buf, item.getRevSeqno());
+        appendField(buf, item.getCas());
+        appendField(buf, item.getFlags());
+        appendField(buf, uint32_t(item.getExptime()));
+        appendField(buf, uint8_t(item.getDataType()));
+        appendField(buf, uint8_t(key.getDocNamespace()));
+        appendField(buf, uint16_t(key.size()));
+        appendField(buf, valuelen);
+        buf.append(reinterpret_cast<const char*>(key.data()), key.size());
+        if (valuelen) {
+            buf.append(item.getData(), valuelen);
+        }
+    }
+
+    char* ptr = &buf[start];
+    const uint32_t length = buf.size() - start - RecordHeaderSize;
+    const uint32_t crc = crc32buf(
+            reinterpret_cast<uint8_t*>(ptr + RecordHeaderSize), length);
+    std::memcpy(ptr, &crc, sizeof(crc));
+    std::memcpy(ptr + sizeof(crc), &length, sizeof(length));
+}
+
+bool MutationJournal::writeSegment(
+        const std::string& data,
+        const std::set<uint16_t>& resets,
+        const std::unordered_map<uint16_t, uint64_t>& seqnos) {
+    const hrtime_t start = gethrtime();
+    if (fwrite(data.data(), 1, data.size(), segmentFile) != data.size() ||
+        !syncFile(segmentFile)) {
+        LOG(EXTENSION_LOG_WARNING,
+            "MutationJournal::writeSegment: Failed to write %s: %s; "
+            "no longer syncing the journal of shard %" PRIu16,
+            segmentPath(segmentId).c_str(),
+            cb_strerror().c_str(),
+            shardId);
+        failed = true;
+        return false;
+    }
+    syncTime.fetch_add((gethrtime() - start) / 1000);
+    bytesWritten.fetch_add(data.size());
+    ++numSyncs;
+    segmentBytes += data.size();
+
+    // Records before a reset no longer keep a segment around.
+    for (const auto vbid : resets) {
+        segmentSeqnos.erase(vbid);
+        for (auto& closed : closedSegments) {
+            closed.seqnos.erase(vbid);
+        }
+    }
+    for (const auto& vb : seqnos) {
+        segmentSeqnos[vb.first] = vb.second;
+    }
+
+    if (segmentBytes >= segmentSize) {
+        closeSegment();
+        if (!openSegment()) {
+            LOG(EXTENSION_LOG_WARNING,
+                "MutationJournal::writeSegment: Failed to open %s: %s; "
+                "no longer syncing the journal of shard %" PRIu16,
+                segmentPath(segmentId).c_str(),
+                cb_strerror().c_str(),
+                shardId);
+            failed = true;
+        }
+    }
+    return true;
+}
+
+bool MutationJournal::openSegment() {
+    segmentFile = fopen(segmentPath(segmentId).c_str(), "ab");
+    segmentBytes = 0;
+    numSegments.store(closedSegments.size() + 1);
+    return segmentFile != nullptr;
+}
+
+void MutationJournal::closeSegment() {
+    fclose(segmentFile);
+    segmentFile = nullptr;
+    closedSegments.push_back(
+            Segment{segmentPath(segmentId), std::move(segmentSeqnos)});
+    segmentSeqnos.clear();
+    ++segmentId;
+}
+
+void MutationJournal::removePersistedSegments() {
+    // Segments are removed oldest first, so that a reset record is never
+    // removed while records it supersedes remain.
+    while (!closedSegments.empty()) {
+        const Segment& segment = closedSegments.front();
+        const bool persisted = std::all_of(
+                segment.seqnos.begin(),
+                segment.seqnos.end(),
+                [this](const std::pair<const uint16_t, uint64_t>& vb) {
+                    return persistedSeqnoFn(vb.first) >= vb.second;
+                });
+        if (!persisted) {
+            break;
+        }
+        remove(segment.path.c_str());
+        closedSegments.pop_front();
+    }
+    numSegments.store(closedSegments.size() + (segmentFile ? 1 : 0));
+}
+
+std::string MutationJournal::segmentPath(uint64_t id) const {
+    std::stringstream ss;
+    ss << dir << "/journal." << shardId << "." << id;
+    return ss.str();
+}
+
+std::vector<uint64_t> MutationJournal::findSegments() const {
+    std::stringstream prefix;
+    prefix << dir << "/journal." << shardId << ".";
+
+    std::vector<uint64_t> ids;
+    for (const auto& path : cb::io::findFilesWithPrefix(prefix.str())) {
+        const std::string suffix = path.substr(path.rfind('.') + 1);
+        if (suffix.empty() ||
+            suffix.find_first_not_of("0123456789") != std::string::npos) {
+            continue;
+        }
+        ids.push_back(std::stoull(suffix));
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
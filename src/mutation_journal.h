@@ -0,0 +1,245 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "item.h"
+
+#include <memcached/engine_common.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class EventuallyPersistentEngine;
+
+/**
+ * Write-ahead journal of the mutations queued to the active vBuckets of one
+ * shard.
+ *
+ * Each mutation (set or delete, including its value) is appended as it is
+ * queued into the vBucket's checkpoint - under the CheckpointManager's
+ * queueLock, so the mutations of each vBucket are journaled in seqno order.
+ * Appending only takes a reference to the queued item; the sync thread
+ * encodes the pending records (copying their keys and values) outside of any
+ * lock the front end holds, then writes and fsyncs them to the current
+ * segment file whenever a seqno persistence request is waiting (or enough
+ * has been appended, or periodically), so concurrent requests share a single
+ * fsync. Once synced, a vBucket's mutations survive a crash even though the
+ * flusher may not have committed them to the KVStore yet, and the
+ * SyncedCallback is invoked so that waiting requests can be notified.
+ *
+ * The journal only vouches for a vBucket's seqnos once everything before the
+ * first one it holds has been persisted (see getDurableSeqno()). A vBucket's
+ * seqnos are expected to be contiguous while it is active; if they aren't
+ * (it was a replica in between, say) the journal restarts for it from the
+ * new seqno, as it does after resetVBucket().
+ *
+ * When a segment reaches segmentSize a new one is started; the old segment
+ * is deleted once every vBucket has persisted the highest seqno it recorded
+ * (and the segments before it have been deleted).
+ * On warmup, recover() reads back the segments left behind so that their
+ * mutations can be re-applied to any vBucket which hadn't persisted them.
+ *
+ * Segments are named <dir>/journal.<shard>.<n>. Each record is:
+ *
+ *     crc32 (4) | length (4) | type (1) | vbid (2) | seqno (8) | revSeqno (8)
+ *     | cas (8) | flags (4) | exptime (4) | datatype (1) | namespace (1)
+ *     | keylen (2) | valuelen (4) | key | value
+ *
+ * in host byte order, where length counts the bytes after it and the crc
+ * covers them. A torn record at the end of a segment (from a crash mid-write)
+ * ends recovery of that segment.
+ */
+class MutationJournal {
+public:
+    /// Invoked by the sync thread for a vBucket whose durable seqno may have
+    /// advanced.
+    typedef std::function<void(uint16_t vbid)> SyncedCallback;
+
+    /// Returns the seqno up to which a vBucket has been persisted.
+    typedef std::function<uint64_t(uint16_t vbid)> PersistedSeqnoFn;
+
+    /// Mutations recovered per vBucket, each in seqno order.
+    typedef std::unordered_map<uint16_t, std::vector<queued_item>>
+            RecoveredItems;
+
+    MutationJournal(const std::string& dir,
+                    uint16_t shardId,
+                    size_t maxVBuckets,
+                    size_t segmentSize,
+                    EventuallyPersistentEngine* engine,
+                    SyncedCallback syncedCb,
+                    PersistedSeqnoFn persistedSeqnoFn);
+
+    ~MutationJournal();
+
+    /**
+     * Read the mutations recorded in the segments left by a previous run.
+     * Records for a vBucket preceding a resetVBucket() of it are dropped.
+     * Must be called before start(); the segments read are deleted once the
+     * mutations in them have been persisted again.
+     */
+    RecoveredItems recover();
+
+    /**
+     * Start a new segment and the sync thread. Any segments which weren't
+     * recover()ed are discarded.
+     */
+    void start();
+
+    /// Sync anything outstanding and stop the sync thread.
+    void stop();
+
+    /**
+     * Record a queued mutation. Items other than sets and deletes are
+     * ignored. Must be called in seqno order for each vBucket. The item is
+     * referenced (not copied) until the sync thread has encoded it.
+     */
+    void append(const queued_item& qi);
+
+    /**
+     * Forget everything journaled for the given vBucket (e.g. because it has
+     * been deleted or rolled back); its subsequent mutations are journaled
+     * afresh.
+     */
+    void resetVBucket(uint16_t vbid);
+
+    /**
+     * Ask for a sync as soon as possible; the SyncedCallback is invoked for
+     * the vBucket once it completes, even if nothing new was journaled for
+     * it.
+     */
+    void requestSync(uint16_t vbid);
+
+    /**
+     * @param persistedSeqno the seqno the vBucket has persisted up to
+     * @return the seqno up to which the vBucket's mutations are durable,
+     *         either persisted or synced to the journal.
+     */
+    uint64_t getDurableSeqno(uint16_t vbid, uint64_t persistedSeqno) const;
+
+    /// Add the journal's stats named "<prefix>:<stat>".
+    void addStats(const std::string& prefix,
+                  ADD_STAT add_stat,
+                  const void* cookie) const;
+
+private:
+    enum class RecordType : uint8_t { Mutation = 1, Deletion = 2, Reset = 3 };
+
+    /// A closed segment, and the highest seqno of each vBucket in it.
+    struct Segment {
+        std::string path;
+        std::unordered_map<uint16_t, uint64_t> seqnos;
+    };
+
+    /// A record appended but not yet encoded by the sync thread.
+    struct PendingRecord {
+        RecordType type;
+        uint16_t vbid;
+        queued_item item; // null for a Reset.
+    };
+
+    void run();
+
+    /// Encode a record onto the end of buf.
+    static void encodeRecord(std::string& buf, const PendingRecord& record);
+
+    /// Restart the vBucket's journal, with the mutex held.
+    void resetVBucket_UNLOCKED(uint16_t vbid);
+
+    /**
+     * Write (and fsync) data to the current segment; called by the sync
+     * thread without the mutex held.
+     * @param resets vBuckets reset before the pending seqnos were recorded
+     * @param seqnos highest seqno of each vBucket in data
+     * @return whether data was synced.
+     */
+    bool writeSegment(const std::string& data,
+                      const std::set<uint16_t>& resets,
+                      const std::unordered_map<uint16_t, uint64_t>& seqnos);
+
+    /// Open segmentId as the current segment; false if it can't be.
+    bool openSegment();
+
+    /// Close the current segment, moving on to the next segmentId.
+    void closeSegment();
+
+    /// Delete the oldest closed segments whose mutations have all been
+    /// persisted.
+    void removePersistedSegments();
+
+    std::string segmentPath(uint64_t id) const;
+
+    /// @return the ids of the segments in the journal directory, in order.
+    std::vector<uint64_t> findSegments() const;
+
+    const std::string dir;
+    const uint16_t shardId;
+    const size_t segmentSize;
+    EventuallyPersistentEngine* engine;
+    SyncedCallback syncedCb;
+    PersistedSeqnoFn persistedSeqnoFn;
+
+    // Guards everything up to syncThread.
+    std::mutex mutex;
+    std::condition_variable cond;
+    // Records not yet written, and (roughly) their encoded size.
+    std::vector<PendingRecord> pending;
+    size_t pendingBytes;
+    // Highest seqno of each vBucket in pending.
+    std::unordered_map<uint16_t, uint64_t> pendingSeqnos;
+    // vBuckets reset since the sync thread last took the pending records (so
+    // their seqnos in any it is writing are stale).
+    std::set<uint16_t> pendingResets;
+    // vBuckets whose waiters need notifying after the next sync.
+    std::set<uint16_t> syncWaiters;
+    bool syncRequested;
+    bool stopping;
+    // Set by the sync thread if a write fails; nothing more is synced.
+    bool failed;
+    std::thread syncThread;
+
+    // Only accessed by the sync thread (or before it starts).
+    FILE* segmentFile;
+    uint64_t segmentId;
+    size_t segmentBytes;
+    std::unordered_map<uint16_t, uint64_t> segmentSeqnos;
+    std::deque<Segment> closedSegments;
+
+    // Per vBucket: the last seqno appended (guarded by mutex), the first
+    // seqno of its current journal (0 if none) and the last seqno synced.
+    std::vector<uint64_t> lastSeqnos;
+    std::vector<std::atomic<uint64_t>> firstSeqnos;
+    std::vector<std::atomic<uint64_t>> syncedSeqnos;
+
+    std::atomic<size_t> numRecords;
+    std::atomic<size_t> numSyncs;
+    std::atomic<size_t> bytesWritten;
+    std::atomic<size_t> syncTime;
+    std::atomic<size_t> numSegments;
+};
@@ -21,6 +21,7 @@
 
 #include "threadlocal.h"
 #include "ep_engine.h"
+#include "slab_allocator.h"
 #include "stored-value.h"
 
 #if 1
@@ -115,7 +116,8 @@ void ObjectRegistry::onCreateStoredValue(const StoredValue *sv)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(sv);
+       size_t size = sv->isSlabAllocated() ? SlabAllocator::getAllocSize(sv)
+                                           : getAllocSize(sv);
        if (size == 0) {
            size = sv->getObjectSize();
        } else {
@@ -123,6 +125,10 @@ void ObjectRegistry::onCreateStoredValue(const StoredValue *sv)
        }
        stats.numStoredVal++;
        stats.totalStoredValSize.fetch_add(size);
+       if (sv->hasInlineValueBuffer()) {
+           stats.numInlineStoredVal++;
+           stats.inlineStoredValSaved.fetch_add(sv->getInlineSavedBytes());
+       }
    }
 }
 
@@ -131,7 +137,8 @@ void ObjectRegistry::onDeleteStoredValue(const StoredValue *sv)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(sv);
+       size_t size = sv->isSlabAllocated() ? SlabAllocator::getAllocSize(sv)
+                                           : getAllocSize(sv);
        if (size == 0) {
            size = sv->getObjectSize();
        } else {
@@ -139,6 +146,10 @@ void ObjectRegistry::onDeleteStoredValue(const StoredValue *sv)
        }
        stats.totalStoredValSize.fetch_sub(size);
        stats.numStoredVal--;
+       if (sv->hasInlineValueBuffer()) {
+           stats.numInlineStoredVal--;
+           stats.inlineStoredValSaved.fetch_sub(sv->getInlineSavedBytes());
+       }
    }
 }
 
@@ -0,0 +1,195 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "queued_item_sort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+// Below this many entries (in a batch, or a run of equal prefixes) a
+// comparison sort is cheaper than another round of radix passes.
+static const size_t MinRadixSortSize = 64;
+
+// Number of key bytes in each prefix.
+static const size_t PrefixBytes = sizeof(uint64_t);
+
+namespace {
+
+struct Entry {
+    uint64_t prefix;
+    uint32_t index;
+};
+
+class QueuedItemSorter {
+public:
+    QueuedItemSorter(std::vector<queued_item>& items)
+        : items(items), entries(items.size()), scratch(items.size()) {
+    }
+
+    void sort() {
+        for (size_t ii = 0; ii < items.size(); ++ii) {
+            entries[ii].prefix = keyPrefix(ii, 0);
+            entries[ii].index = static_cast<uint32_t>(ii);
+        }
+        sortRange(0, entries.size(), 0);
+
+        std::vector<queued_item> sorted;
+        sorted.reserve(items.size());
+        for (const auto& entry : entries) {
+            sorted.push_back(items[entry.index]);
+        }
+        items.swap(sorted);
+    }
+
+private:
+    /**
+     * @return bytes [offset, offset + PrefixBytes) of the item's key
+     *         (including its namespace byte), zero padded, as a big-endian
+     *         integer - so prefixes order as the keys do.
+     */
+    uint64_t keyPrefix(size_t index, size_t offset) const {
+        const StoredDocKey& key = items[index]->getKey();
+        const uint8_t* data = key.getDocNameSpacedData();
+        const size_t size = key.getDocNameSpacedSize();
+        if (offset + PrefixBytes <= size) {
+            uint64_t prefix;
+            std::memcpy(&prefix, data + offset, sizeof(prefix));
+            return ntohll(prefix);
+        }
+        uint64_t prefix = 0;
+        for (size_t ii = 0; ii < PrefixBytes; ++ii) {
+            prefix <<= 8;
+            if (offset + ii < size) {
+                prefix |= data[offset + ii];
+            }
+        }
+        return prefix;
+    }
+
+    /**
+     * Sort entries [begin, end), which share their first offset key bytes.
+     */
+    void sortRange(size_t begin, size_t end, size_t offset) {
+        if (end - begin < MinRadixSortSize) {
+            comparisonSort(begin, end);
+            return;
+        }
+
+        if (offset > 0) {
+            for (size_t ii = begin; ii < end; ++ii) {
+                entries[ii].prefix = keyPrefix(entries[ii].index, offset);
+            }
+        }
+        radixSort(begin, end);
+
+        // Finish each run of entries with equal prefixes: on their next
+        // prefixes if any of them has more key, otherwise on their keys
+        // (which may still differ in length) and seqnos.
+        const size_t nextOffset = offset + PrefixBytes;
+        size_t run = begin;
+        while (run < end) {
+            size_t runEnd = run + 1;
+            bool moreKey = hasMoreKey(run, nextOffset);
+            while (runEnd < end &&
+                   entries[runEnd].prefix == entries[run].prefix) {
+                moreKey = moreKey || hasMoreKey(runEnd, nextOffset);
+                ++runEnd;
+            }
+            if (runEnd - run > 1) {
+                if (moreKey) {
+                    sortRange(run, runEnd, nextOffset);
+                } else {
+                    comparisonSort(run, runEnd);
+                }
+            }
+            run = runEnd;
+        }
+    }
+
+    bool hasMoreKey(size_t entry, size_t offset) const {
+        return items[entries[entry].index]->getKey().getDocNameSpacedSize() >
+               offset;
+    }
+
+    /**
+     * LSD radix sort entries [begin, end) on their prefixes, a byte at a
+     * time, skipping bytes which are the same in every entry.
+     */
+    void radixSort(size_t begin, size_t end) {
+        const size_t count = end - begin;
+        std::memset(counts, 0, sizeof(counts));
+        for (size_t ii = begin; ii < end; ++ii) {
+            const uint64_t prefix = entries[ii].prefix;
+            for (size_t digit = 0; digit < PrefixBytes; ++digit) {
+                ++counts[digit][(prefix >> (digit * 8)) & 0xff];
+            }
+        }
+
+        Entry* src = &entries[begin];
+        Entry* dst = &scratch[begin];
+        for (size_t digit = 0; digit < PrefixBytes; ++digit) {
+            const size_t shift = digit * 8;
+            size_t* digitCounts = counts[digit];
+            if (digitCounts[(src->prefix >> shift) & 0xff] == count) {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (size_t value = 0; value < 256; ++value) {
+                const size_t valueCount = digitCounts[value];
+                digitCounts[value] = offset;
+                offset += valueCount;
+            }
+            for (size_t ii = 0; ii < count; ++ii) {
+                dst[digitCounts[(src[ii].prefix >> shift) & 0xff]++] = src[ii];
+            }
+            std::swap(src, dst);
+        }
+
+        if (src != &entries[begin]) {
+            std::copy(src, src + count, &entries[begin]);
+        }
+    }
+
+    void comparisonSort(size_t begin, size_t end) {
+        CompareQueuedItemsBySeqnoAndKey cq;
+        std::sort(entries.begin() + begin,
+                  entries.begin() + end,
+                  [this, &cq](const Entry& a, const Entry& b) {
+                      return cq(items[a.index], items[b.index]);
+                  });
+    }
+
+    std::vector<queued_item>& items;
+    std::vector<Entry> entries;
+    std::vector<Entry> scratch;
+    size_t counts[PrefixBytes][256];
+};
+
+} // anonymous namespace
+
+void sortQueuedItemsByKey(std::vector<queued_item>& items) {
+    if (items.size() < MinRadixSortSize ||
+        items.size() > std::numeric_limits<uint32_t>::max()) {
+        CompareQueuedItemsBySeqnoAndKey cq;
+        std::sort(items.begin(), items.end(), cq);
+        return;
+    }
+
+    QueuedItemSorter(items).sort();
+}
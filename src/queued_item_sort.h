@@ -0,0 +1,43 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "item.h"
+
+#include <vector>
+
+/**
+ * Sort a flusher batch into the order given by
+ * CompareQueuedItemsBySeqnoAndKey - by key, and for each key from the highest
+ * seqno to the lowest - so that de-duplicating it is a matter of persisting
+ * the first item of each run of equal keys.
+ *
+ * Rather than comparison sorting the queued_items (where every comparison
+ * dereferences two items and every move of a queued_item adjusts a
+ * reference count), an (8 byte key prefix, index) entry is built for each
+ * item and the entries are radix sorted on the prefixes. Entries whose
+ * prefixes are equal are sorted on the next 8 bytes of their keys, and so on
+ * (most significant digit first); runs which are small, or whose keys are
+ * exhausted, are finished with CompareQueuedItemsBySeqnoAndKey. The items are
+ * then permuted into the sorted order once.
+ *
+ * Small batches are simply sorted with CompareQueuedItemsBySeqnoAndKey.
+ */
+void sortQueuedItemsByKey(std::vector<queued_item>& items);
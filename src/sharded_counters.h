@@ -0,0 +1,146 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <platform/cacheline_padded.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+
+/**
+ * A fixed-size array of N counters, each sharded across threads so that
+ * concurrent updates from many threads don't contend on (ping-pong) the same
+ * cache line.
+ *
+ * Each thread updates the shard selected by a hash of its thread id; a shard
+ * holds all N counters in its own cache line(s). Reading a counter sums it
+ * across all shards, so reads are considerably more expensive than updates -
+ * this suits counters which are updated on every operation but only read
+ * when stats are requested.
+ *
+ * As a counter may be decremented by a different thread (and hence in a
+ * different shard) to the one which incremented it, individual shards may go
+ * negative; only the total is meaningful.
+ */
+template <size_t N>
+class ShardedCounters {
+public:
+    ShardedCounters()
+        : shards(new cb::CachelinePadded<Shard>[getNumShards()]) {
+        for (size_t ii = 0; ii < getNumShards(); ++ii) {
+            for (auto& value : shards[ii]->values) {
+                value.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void add(size_t counter, int64_t delta) {
+        localShard().values[counter].fetch_add(delta,
+                                               std::memory_order_relaxed);
+    }
+
+    void increment(size_t counter) {
+        add(counter, 1);
+    }
+
+    void decrement(size_t counter) {
+        add(counter, -1);
+    }
+
+    /**
+     * @return the total of the given counter across all shards.
+     */
+    int64_t get(size_t counter) const {
+        int64_t total = 0;
+        for (size_t ii = 0; ii < getNumShards(); ++ii) {
+            total += shards[ii]->values[counter].load(
+                    std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    /**
+     * @return the total of the given counter, or zero if it is negative
+     *         (for counters which should never go below zero).
+     */
+    size_t getNonNegative(size_t counter) const {
+        return static_cast<size_t>(std::max(get(counter), int64_t(0)));
+    }
+
+    /**
+     * Set the total of the given counter. Not atomic with respect to
+     * concurrent updates of the same counter.
+     */
+    void set(size_t counter, int64_t value) {
+        shards[0]->values[counter].store(value, std::memory_order_relaxed);
+        for (size_t ii = 1; ii < getNumShards(); ++ii) {
+            shards[ii]->values[counter].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @return the number of shards: the number of hardware threads rounded
+     *         up to a power of two, capped at MaxShards.
+     */
+    static size_t getNumShards() {
+        static const size_t numShards = calculateNumShards();
+        return numShards;
+    }
+
+    /**
+     * @return the number of bytes of memory used by the shards.
+     */
+    static size_t memorySize() {
+        return getNumShards() * sizeof(cb::CachelinePadded<Shard>);
+    }
+
+    static const size_t MaxShards = 32;
+
+private:
+    struct Shard {
+        std::atomic<int64_t> values[N];
+    };
+
+    static size_t calculateNumShards() {
+        const size_t threads =
+                std::max(std::thread::hardware_concurrency(), 1u);
+        size_t numShards = 1;
+        while (numShards < threads && numShards < MaxShards) {
+            numShards *= 2;
+        }
+        return numShards;
+    }
+
+    Shard& localShard() {
+        // Thread ids are often addresses (e.g. pthread_t), so mix the bits
+        // before selecting a shard.
+        uint64_t h = std::hash<std::thread::id>()(std::this_thread::get_id());
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return *shards[h & (getNumShards() - 1)];
+    }
+
+    std::unique_ptr<cb::CachelinePadded<Shard>[]> shards;
+};
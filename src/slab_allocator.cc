@@ -0,0 +1,186 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "slab_allocator.h"
+
+#include "stats.h"
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+const size_t SlabAllocator::SlabSize;
+const size_t SlabAllocator::SlabsPerChunk;
+const size_t SlabAllocator::Granularity;
+const size_t SlabAllocator::MaxObjectSize;
+const size_t SlabAllocator::NumStripes;
+
+static const size_t ChunkSize =
+        (SlabAllocator::SlabsPerChunk + 1) * SlabAllocator::SlabSize;
+
+SlabAllocator::SlabAllocator(EPStats& stats)
+    : stats(stats), freeSlabs(nullptr), released(false) {
+}
+
+SlabAllocator::~SlabAllocator() {
+    stats.storedValSlabSize.fetch_sub(chunks.size() * ChunkSize);
+}
+
+void* SlabAllocator::allocate(size_t size) {
+    if (!canAllocate(size)) {
+        throw std::invalid_argument(
+                "SlabAllocator::allocate: size (which is " +
+                std::to_string(size) + ") must be in the range [1, " +
+                std::to_string(MaxObjectSize) + "]");
+    }
+    const size_t cls = sizeClass(size);
+
+    Stripe& stripe = localStripe();
+    std::lock_guard<std::mutex> lh(stripe.mutex);
+    Slab* slab = stripe.partial[cls];
+    if (slab == nullptr) {
+        slab = takeFreeSlab(stripe, cls);
+        push(stripe.partial[cls], slab);
+    }
+
+    void* ptr;
+    if (slab->freeList) {
+        ptr = slab->freeList;
+        slab->freeList = *static_cast<void**>(ptr);
+    } else {
+        ptr = slab->slot(slab->unallocated++);
+    }
+    if (++slab->used == slab->numSlots) {
+        unlink(stripe.partial[cls], slab);
+    }
+    stripe.usedBytes += slab->slotSize;
+    return ptr;
+}
+
+void SlabAllocator::deallocate(void* ptr) {
+    Slab* slab = slabOf(ptr);
+    SlabAllocator& owner = *slab->owner;
+    if (owner.released.load(std::memory_order_relaxed)) {
+        // The whole allocator is about to be freed.
+        return;
+    }
+    // The slab cannot change stripe while it holds an allocated object, so
+    // it is safe to read without a lock.
+    Stripe& stripe = *slab->stripe;
+    const size_t cls = sizeClass(slab->slotSize);
+
+    std::lock_guard<std::mutex> lh(stripe.mutex);
+    *static_cast<void**>(ptr) = slab->freeList;
+    slab->freeList = ptr;
+    stripe.usedBytes -= slab->slotSize;
+
+    if (slab->used-- == slab->numSlots) {
+        // Was full, so isn't in the partial list.
+        push(stripe.partial[cls], slab);
+    }
+    if (slab->used == 0) {
+        unlink(stripe.partial[cls], slab);
+        owner.returnFreeSlab(slab);
+    }
+}
+
+void SlabAllocator::releaseAll() {
+    released.store(true);
+}
+
+size_t SlabAllocator::getAllocSize(const void* ptr) {
+    return slabOf(ptr)->slotSize;
+}
+
+size_t SlabAllocator::getAllocatedBytes() const {
+    std::lock_guard<std::mutex> lh(poolMutex);
+    return chunks.size() * ChunkSize;
+}
+
+size_t SlabAllocator::getUsedBytes() const {
+    size_t usedBytes = 0;
+    for (auto& stripe : stripes) {
+        std::lock_guard<std::mutex> lh(stripe->mutex);
+        usedBytes += stripe->usedBytes;
+    }
+    return usedBytes;
+}
+
+SlabAllocator::Stripe& SlabAllocator::localStripe() {
+    const size_t index =
+            std::hash<std::thread::id>()(std::this_thread::get_id()) %
+            NumStripes;
+    return *stripes[index];
+}
+
+void SlabAllocator::unlink(Slab*& list, Slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = nullptr;
+}
+
+void SlabAllocator::push(Slab*& list, Slab* slab) {
+    slab->prev = nullptr;
+    slab->next = list;
+    if (list) {
+        list->prev = slab;
+    }
+    list = slab;
+}
+
+SlabAllocator::Slab* SlabAllocator::takeFreeSlab(Stripe& stripe, size_t cls) {
+    Slab* slab;
+    {
+        std::lock_guard<std::mutex> lh(poolMutex);
+        if (freeSlabs == nullptr) {
+            chunks.emplace_back(new uint8_t[ChunkSize]);
+            stats.storedValSlabSize.fetch_add(ChunkSize);
+
+            auto addr = reinterpret_cast<uintptr_t>(chunks.back().get());
+            addr = (addr + SlabSize - 1) & ~(uintptr_t(SlabSize) - 1);
+            for (size_t ii = 0; ii < SlabsPerChunk; ++ii) {
+                auto* chunkSlab = reinterpret_cast<Slab*>(addr + ii * SlabSize);
+                chunkSlab->owner = this;
+                push(freeSlabs, chunkSlab);
+            }
+        }
+        slab = freeSlabs;
+        unlink(freeSlabs, slab);
+    }
+
+    slab->stripe = &stripe;
+    slab->freeList = nullptr;
+    slab->slotSize = static_cast<uint16_t>((cls + 1) * Granularity);
+    slab->numSlots =
+            static_cast<uint16_t>((SlabSize - HeaderSize) / slab->slotSize);
+    slab->used = 0;
+    slab->unallocated = 0;
+    return slab;
+}
+
+void SlabAllocator::returnFreeSlab(Slab* slab) {
+    std::lock_guard<std::mutex> lh(poolMutex);
+    slab->stripe = nullptr;
+    push(freeSlabs, slab);
+}
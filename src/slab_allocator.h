@@ -0,0 +1,212 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <platform/cacheline_padded.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class EPStats;
+
+/**
+ * A size-class slab allocator, used to allocate the StoredValues of a single
+ * vBucket.
+ *
+ * Memory is obtained from the heap in chunks, which are carved into
+ * SlabSize-aligned slabs. Each slab holds objects of a single size class
+ * (a multiple of Granularity, up to MaxObjectSize), so objects of similar
+ * size are packed together rather than scattered across the heap, and a
+ * freed object's slot is reused by the next allocation of that size class.
+ * A slab whose objects have all been freed is returned to the allocator's
+ * pool of free slabs, for use by any size class.
+ *
+ * To avoid serialising every front-end thread on one mutex, slabs in use are
+ * split across NumStripes stripes, each with its own mutex and lists of
+ * partially-used slabs. A thread allocates from the stripe selected by its
+ * thread id; an object is freed back to the stripe which owns its slab. Only
+ * taking a slab from (or returning one to) the shared pool of free slabs
+ * takes the allocator-wide mutex.
+ *
+ * Chunks are only returned to the heap when the allocator is destroyed -
+ * i.e. when the owning vBucket is dropped. Before that the owner calls
+ * releaseAll(), after which the objects being destroyed are not returned to
+ * their slabs at all; their memory is freed a chunk at a time instead.
+ *
+ * Objects must not outlive their allocator. allocate() and deallocate() are
+ * thread-safe.
+ */
+class SlabAllocator {
+public:
+    /// Size (and alignment) of a slab.
+    static const size_t SlabSize = 8192;
+    /// Number of slabs allocated from the heap at once.
+    static const size_t SlabsPerChunk = 16;
+    /// Object sizes are rounded up to a multiple of this.
+    static const size_t Granularity = 16;
+    /// Largest object which can be allocated from slabs.
+    static const size_t MaxObjectSize = 1024;
+    /// Number of stripes slabs in use are split across.
+    static const size_t NumStripes = 8;
+
+    /**
+     * @param stats EPStats to account the allocator's memory against
+     *        (storedValSlabSize).
+     */
+    explicit SlabAllocator(EPStats& stats);
+
+    ~SlabAllocator();
+
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    /**
+     * @return true if an object of the given size can be allocated from
+     *         slabs.
+     */
+    static bool canAllocate(size_t size) {
+        return size > 0 && size <= MaxObjectSize;
+    }
+
+    /**
+     * Allocate an object of the given size, which must satisfy
+     * canAllocate().
+     */
+    void* allocate(size_t size);
+
+    /**
+     * Free an object previously returned by allocate() of any
+     * SlabAllocator.
+     */
+    static void deallocate(void* ptr);
+
+    /**
+     * Prepare for all objects allocated by this allocator to be freed, prior
+     * to destroying it. Objects subsequently passed to deallocate() are not
+     * returned to their slab; their memory is released (a chunk at a time)
+     * by the destructor. No objects may be allocated after this.
+     */
+    void releaseAll();
+
+    /**
+     * @return the size of the slot allocated for the given object (its size
+     *         rounded up to its size class).
+     */
+    static size_t getAllocSize(const void* ptr);
+
+    /**
+     * @return the number of bytes of memory allocated from the heap.
+     */
+    size_t getAllocatedBytes() const;
+
+    /**
+     * @return the number of bytes of objects currently allocated (rounded
+     *         up to their size class).
+     */
+    size_t getUsedBytes() const;
+
+private:
+    struct Stripe;
+
+    /// Header at the start of each slab.
+    struct Slab {
+        SlabAllocator* owner;
+        // Stripe which the slab is currently assigned to (while it has a
+        // size class).
+        Stripe* stripe;
+        // Links in the stripe's list of partially-used slabs of this slab's
+        // size class (or, if unused, the owner's list of free slabs).
+        Slab* prev;
+        Slab* next;
+        // Singly-linked list of freed slots.
+        void* freeList;
+        uint16_t slotSize;
+        uint16_t numSlots;
+        // Number of allocated slots.
+        uint16_t used;
+        // Slots at index >= this have never been allocated.
+        uint16_t unallocated;
+
+        char* slot(size_t index) {
+            return reinterpret_cast<char*>(this) + HeaderSize +
+                   index * slotSize;
+        }
+    };
+
+    static const size_t HeaderSize =
+            (sizeof(Slab) + Granularity - 1) & ~(Granularity - 1);
+    static const size_t NumSizeClasses = MaxObjectSize / Granularity;
+
+    /// Slabs in use by a subset of threads.
+    struct Stripe {
+        mutable std::mutex mutex;
+        // For each size class, the slabs which have at least one free slot.
+        Slab* partial[NumSizeClasses] = {};
+        size_t usedBytes = 0;
+    };
+
+    static size_t sizeClass(size_t size) {
+        return (size - 1) / Granularity;
+    }
+
+    static Slab* slabOf(const void* ptr) {
+        return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) &
+                                       ~(uintptr_t(SlabSize) - 1));
+    }
+
+    /// @return the stripe the calling thread allocates from.
+    Stripe& localStripe();
+
+    /// Remove slab from the given list. Caller must hold the list's mutex.
+    static void unlink(Slab*& list, Slab* slab);
+
+    /// Push slab onto the given list. Caller must hold the list's mutex.
+    static void push(Slab*& list, Slab* slab);
+
+    /**
+     * Return a free slab initialised for the given size class and assigned
+     * to the given stripe, allocating a new chunk if necessary. Caller must
+     * hold the stripe's mutex.
+     */
+    Slab* takeFreeSlab(Stripe& stripe, size_t cls);
+
+    /// Return an empty slab to the pool of free slabs.
+    void returnFreeSlab(Slab* slab);
+
+    EPStats& stats;
+
+    std::array<cb::CachelinePadded<Stripe>, NumStripes> stripes;
+
+    // Guards freeSlabs and chunks. Acquired after a stripe's mutex.
+    mutable std::mutex poolMutex;
+    // Slabs not currently assigned to a size class.
+    Slab* freeSlabs;
+    // Memory allocated from the heap; each chunk is over-sized by one slab
+    // so its slabs can be aligned to SlabSize.
+    std::vector<std::unique_ptr<uint8_t[]>> chunks;
+
+    // Set by releaseAll(); objects are no longer returned to their slabs.
+    std::atomic<bool> released;
+};
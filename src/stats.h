@@ -99,6 +99,8 @@ public:
         pagerRuns(0),
         expiryPagerRuns(0),
         itemsRemovedFromCheckpoints(0),
+        itemsExpelledFromCheckpoints(0),
+        memFreedByCheckpointItemExpel(0),
         numValueEjects(0),
         numFailedEjects(0),
         numNotMyVBuckets(0),
@@ -109,6 +111,9 @@ public:
         numStoredVal(0),
         totalStoredValSize(0),
         storedValOverhead(0),
+        numInlineStoredVal(0),
+        inlineStoredValSaved(0),
+        storedValSlabSize(0),
         memOverhead(0),
         numItem(0),
         totalMemory(0),
@@ -316,6 +321,10 @@ public:
     Counter expiryPagerRuns;
     //! Number of items removed from closed unreferenced checkpoints.
     Counter itemsRemovedFromCheckpoints;
+    //! Number of items expelled from referenced checkpoints.
+    Counter itemsExpelledFromCheckpoints;
+    //! Memory freed by expelling items from referenced checkpoints.
+    Counter memFreedByCheckpointItemExpel;
     //! Number of times a value is ejected
     Counter numValueEjects;
     //! Number of times a value could not be ejected
@@ -336,6 +345,12 @@ public:
     Counter totalStoredValSize;
     //! Total size of StoredVal memory overhead
     Counter storedValOverhead;
+    //! The number of storedVal objects allocated with an inline value buffer
+    Counter numInlineStoredVal;
+    //! Estimated memory saved by storing values inline in storedVal objects
+    Counter inlineStoredValSaved;
+    //! Memory allocated for slabs of storedVal objects (see SlabAllocator)
+    Counter storedValSlabSize;
     //! Amount of memory used to track items and what-not.
     cb::CachelinePadded<Counter> memOverhead;
     //! Total number of Item objects
@@ -610,6 +625,8 @@ public:
         cursorsDropped.store(0);
         pagerRuns.store(0);
         itemsRemovedFromCheckpoints.store(0);
+        itemsExpelledFromCheckpoints.store(0);
+        memFreedByCheckpointItemExpel.store(0);
         numValueEjects.store(0);
         numFailedEjects.store(0);
         numNotMyVBuckets.store(0);
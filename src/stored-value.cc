@@ -19,6 +19,11 @@
 #include <platform/cb_malloc.h>
 #include "stored-value.h"
 
+#include "slab_allocator.h"
+
+#include <cstring>
+#include <limits>
+
 double StoredValue::mutation_mem_threshold = 0.9;
 const int64_t StoredValue::state_deleted_key = -3;
 const int64_t StoredValue::state_non_existent_key = -4;
@@ -28,7 +33,8 @@ const int64_t StoredValue::state_collection_open = -6;
 StoredValue::StoredValue(const Item& itm,
                          UniquePtr n,
                          EPStats& stats,
-                         bool isOrdered)
+                         bool isOrdered,
+                         bool slabAllocated)
     : value(itm.getValue()),
       chain_next_or_replacement(std::move(n)),
       cas(itm.getCas()),
@@ -42,7 +48,10 @@ StoredValue::StoredValue(const Item& itm,
       newCacheItem(true),
       isOrdered(isOrdered),
       nru(itm.getNRUValue()),
-      stale(false) {
+      hasInlineBuffer(false),
+      inlineValue(false),
+      stale(false),
+      slabAllocated(slabAllocated) {
     // Placement-new the key which lives in memory directly after this
     // object.
     new (key()) SerialisedDocKey(itm.getKey());
@@ -60,10 +69,71 @@ StoredValue::StoredValue(const Item& itm,
     ObjectRegistry::onCreateStoredValue(this);
 }
 
+StoredValue::StoredValue(const Item& itm,
+                         UniquePtr n,
+                         EPStats& stats,
+                         size_t inlineCapacity,
+                         bool slabAllocated)
+    : value(itm.getValue()),
+      chain_next_or_replacement(std::move(n)),
+      cas(itm.getCas()),
+      revSeqno(itm.getRevSeqno()),
+      bySeqno(itm.getBySeqno()),
+      lock_expiry_or_delete_time(0),
+      exptime(itm.getExptime()),
+      flags(itm.getFlags()),
+      datatype(itm.getDataType()),
+      deleted(itm.isDeleted()),
+      newCacheItem(true),
+      isOrdered(false),
+      nru(itm.getNRUValue()),
+      hasInlineBuffer(true),
+      inlineValue(false),
+      stale(false),
+      slabAllocated(slabAllocated) {
+    if (inlineCapacity > std::numeric_limits<uint8_t>::max()) {
+        throw std::invalid_argument(
+                "StoredValue(): inlineCapacity (which is " +
+                std::to_string(inlineCapacity) + ") must be at most 255");
+    }
+    new (key()) SerialisedDocKey(itm.getKey());
+
+    auto* buffer = inlineBuffer();
+    buffer->capacity = static_cast<uint8_t>(inlineCapacity);
+    buffer->length = 0;
+    buffer->extLen = 0;
+    buffer->savedBytes = 0;
+
+    if (isTempInitialItem()) {
+        markClean();
+    } else {
+        markDirty();
+    }
+
+    if (isTempItem()) {
+        markNotResident();
+    }
+    moveValueInline();
+
+    if (inlineValue) {
+        // Estimate the saving compared to a separate Blob for the value: the
+        // Blob's allocation (rounded up to the allocator's 16 byte
+        // granularity), less the space the inline buffer adds to ours.
+        const size_t separateSize = (sizeof(Blob) + buffer->length + 15) & ~15;
+        const size_t inlineSize = sizeof(InlineBuffer) + inlineCapacity;
+        if (separateSize > inlineSize) {
+            buffer->savedBytes =
+                    static_cast<uint8_t>(separateSize - inlineSize);
+        }
+    }
+
+    ObjectRegistry::onCreateStoredValue(this);
+}
+
 StoredValue::StoredValue(const StoredValue& other,
                          UniquePtr n,
                          EPStats& stats)
-    : value(other.value),
+    : value(other.copyValue()),
       chain_next_or_replacement(std::move(n)),
       cas(other.cas),
       revSeqno(other.revSeqno),
@@ -77,7 +147,10 @@ StoredValue::StoredValue(const StoredValue& other,
       newCacheItem(other.newCacheItem),
       isOrdered(other.isOrdered),
       nru(other.nru),
-      stale(false) {
+      hasInlineBuffer(false),
+      inlineValue(false),
+      stale(false),
+      slabAllocated(false) {
     // Placement-new the key which lives in memory directly after this
     // object.
     StoredDocKey sKey(other.getKey());
@@ -99,6 +172,32 @@ void StoredValue::ejectValue() {
     value = nullptr;
 }
 
+void StoredValue::moveValueInline() {
+    if (!hasInlineBuffer || !value) {
+        return;
+    }
+    auto* buffer = inlineBuffer();
+    if (value->length() > buffer->capacity) {
+        return;
+    }
+    std::memcpy(buffer->data(), value->getBlob(), value->length());
+    buffer->length = static_cast<uint8_t>(value->length());
+    buffer->extLen = value->getExtLen();
+    value.reset();
+    inlineValue = true;
+}
+
+value_t StoredValue::copyInlineValue() const {
+    const auto* buffer = inlineBuffer();
+    const char* extMeta = buffer->data() + FLEX_DATA_OFFSET;
+    const char* data = extMeta + buffer->extLen;
+    return value_t(Blob::New(
+            data,
+            buffer->length - FLEX_DATA_OFFSET - buffer->extLen,
+            reinterpret_cast<uint8_t*>(const_cast<char*>(extMeta)),
+            buffer->extLen));
+}
+
 void StoredValue::referenced() {
     if (nru > MIN_NRU_VALUE) {
         --nru;
@@ -135,6 +234,8 @@ void StoredValue::restoreValue(const Item& itm) {
     datatype = itm.getDataType();
     deleted = itm.isDeleted();
     value = itm.getValue();
+    inlineValue = false;
+    moveValueInline();
 }
 
 void StoredValue::restoreMeta(const Item& itm) {
@@ -186,18 +287,19 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm,
 }
 
 std::unique_ptr<Item> StoredValue::toItem(bool lck, uint16_t vbucket) const {
+    value_t itemValue = copyValue();
     auto itm =
             std::make_unique<Item>(getKey(),
                                    getFlags(),
                                    getExptime(),
-                                   value,
+                                   itemValue,
                                    lck ? static_cast<uint64_t>(-1) : getCas(),
                                    bySeqno,
                                    vbucket,
                                    getRevSeqno());
 
     // This is a partial item...
-    if (value.get() == nullptr) {
+    if (itemValue.get() == nullptr) {
         itm->setDataType(datatype);
     }
 
@@ -237,6 +339,9 @@ void StoredValue::reallocate() {
 void StoredValue::Deleter::operator()(StoredValue* val) {
     if (val->isOrdered) {
         delete static_cast<OrderedStoredValue*>(val);
+    } else if (val->slabAllocated) {
+        val->~StoredValue();
+        SlabAllocator::deallocate(val);
     } else {
         delete val;
     }
@@ -268,7 +373,7 @@ bool StoredValue::operator==(const StoredValue& other) const {
 }
 
 bool StoredValue::deleteImpl() {
-    if (isDeleted() && !getValue()) {
+    if (isDeleted() && !isResident()) {
         // SV is already marked as deleted and has no value - no further
         // deletion possible.
         return false;
@@ -284,6 +389,7 @@ bool StoredValue::deleteImpl() {
 
 void StoredValue::setValueImpl(const Item& itm) {
     value = itm.getValue();
+    inlineValue = false;
     deleted = itm.isDeleted();
     flags = itm.getFlags();
     datatype = itm.getDataType();
@@ -305,6 +411,7 @@ void StoredValue::setValueImpl(const Item& itm) {
     if (isTempItem()) {
         markNotResident();
     }
+    moveValueInline();
 }
 
 std::ostream& operator<<(std::ostream& os, const StoredValue& sv) {
@@ -337,15 +444,19 @@ std::ostream& operator<<(std::ostream& os, const StoredValue& sv) {
     os << " exp:" << sv.getExptime();
 
     os << " vallen:" << sv.valuelen();
-    if (sv.getValue().get()) {
+    if (sv.isValueInline()) {
+        os << " inline";
+    }
+    const value_t value = sv.copyValue();
+    if (value.get()) {
         os << " val:\"";
-        const char* data = sv.getValue()->getData();
+        const char* data = value->getData();
         // print up to first 40 bytes of value.
-        const size_t limit = std::min(size_t(40), sv.getValue()->vlength());
+        const size_t limit = std::min(size_t(40), value->vlength());
         for (size_t ii = 0; ii < limit; ii++) {
             os << data[ii];
         }
-        if (limit < sv.getValue()->vlength()) {
+        if (limit < value->vlength()) {
             os << " <cut>";
         }
         os << "\"";
@@ -71,6 +71,21 @@ class OrderedStoredValue;
  *   length  {   | ...               |
  *               +-------------------+
  *
+ * StoredValues created by CompactStoredValueFactory may additionally have an
+ * inline buffer allocated after the key. Small values are copied into it
+ * (instead of the StoredValue referencing a separately allocated Blob),
+ * saving the Blob's header and allocation. The value is not shared: every
+ * read which needs it as a value_t (toItem(), copyValue()) allocates a new
+ * Blob copy, so inline values trade an allocation per read for the memory
+ * saved per item:
+ *
+ *               + - - - - - - - - - +
+ *  variable {   | key[]             |
+ *   length  {   | ...               |
+ *           {   | InlineBuffer      | capacity, length, ext meta length
+ *           {   | value data[]      | (copy of the Blob's data)
+ *               +-------------------+
+ *
  * OrderedStoredValue is a "subclass" of StoredValue, which is used by
  * Ephemeral buckets as it supports maintaining a seqno ordering of items in
  * memory (for Persistent buckets this ordering is maintained on-disk).
@@ -156,7 +171,10 @@ public:
 
     bool eligibleForEviction(item_eviction_policy_t policy) {
         if (policy == VALUE_ONLY) {
-            return isResident() && !isDirty() && !isDeleted();
+            // An inline value shares the StoredValue's allocation, so
+            // ejecting it would not free any memory.
+            return isResident() && !isDirty() && !isDeleted() &&
+                   !inlineValue;
         } else {
             return !isDirty() && !isDeleted();
         }
@@ -194,12 +212,68 @@ public:
     }
 
     /**
-     * Get this item's value.
+     * Get this item's separately allocated value.
+     *
+     * A value held inline (see CompactStoredValueFactory) is not referenced
+     * by a value_t, so this returns null for it; callers which may see
+     * inline values should use hasValue() and copyValue() instead.
      */
-    const value_t &getValue() const {
+    const value_t& getValue() const {
         return value;
     }
 
+    /**
+     * Get a copy of this item's value, whether held inline or not.
+     *
+     * For an inline value this allocates a new Blob holding a copy of it,
+     * so should be kept off hot paths; otherwise it just adds a reference
+     * to the existing Blob.
+     */
+    value_t copyValue() const {
+        if (inlineValue) {
+            return copyInlineValue();
+        }
+        return value;
+    }
+
+    /**
+     * True if this item has a value (held inline or separately allocated).
+     */
+    bool hasValue() const {
+        return value.get() != nullptr || inlineValue;
+    }
+
+    /**
+     * True if this item was allocated with an inline value buffer.
+     */
+    bool hasInlineValueBuffer() const {
+        return hasInlineBuffer;
+    }
+
+    /**
+     * True if this item was allocated by a SlabAllocator (and hence must be
+     * freed by it).
+     */
+    bool isSlabAllocated() const {
+        return slabAllocated;
+    }
+
+    /**
+     * True if this item's value is held in its inline buffer.
+     */
+    bool isValueInline() const {
+        return inlineValue;
+    }
+
+    /**
+     * Get the estimated number of bytes this item saves by having an inline
+     * buffer, compared to holding its value in a separate Blob (zero if it
+     * has no inline buffer).
+     */
+    size_t getInlineSavedBytes() const {
+        return hasInlineBuffer ? inlineBuffer()->savedBytes : 0;
+    }
+
     /**
      * Get the expiration time of this item.
      *
@@ -391,8 +465,13 @@ public:
 
      }
 
+    /**
+     * Get the length of this item's separately allocated value. An inline
+     * value is accounted as part of the object size (getObjectSize()), so
+     * has a valuelen of zero.
+     */
     size_t valuelen() const {
-        if (!isResident()) {
+        if (!isResident() || inlineValue) {
             return 0;
         }
         return value->length();
@@ -434,11 +513,12 @@ public:
      * True if this value is resident in memory currently.
      */
     bool isResident() const {
-        return value.get() != NULL;
+        return hasValue();
     }
 
     void markNotResident() {
         value.reset();
+        inlineValue = false;
     }
 
     /**
@@ -586,6 +666,26 @@ public:
                SerialisedDocKey::getObjectSize(item.getKey().size());
     }
 
+    /**
+     * Return how many bytes are needed to store Item as a StoredValue with
+     * an inline buffer of the given capacity.
+     */
+    static size_t getRequiredStorage(const Item& item, size_t inlineCapacity) {
+        return getRequiredStorage(item) + sizeof(InlineBuffer) +
+               inlineCapacity;
+    }
+
+    /**
+     * Return the inline buffer capacity to use for a StoredValue of Item
+     * whose value is valueLength bytes: the value length plus whatever
+     * would otherwise be padding at the end of the (8-byte rounded)
+     * allocation, so the value can grow a little in place.
+     */
+    static size_t getInlineCapacity(const Item& item, size_t valueLength) {
+        const size_t used = getRequiredStorage(item, valueLength);
+        return valueLength + ((8 - (used % 8)) % 8);
+    }
+
 protected:
     /**
      * Constructor - protected as allocation needs to be done via
@@ -598,11 +698,33 @@ protected:
      *           which the new item is being inserted).
      * @param stats EPStats to update for this new StoredValue
      * @param isOrdered Are we constructing an OrderedStoredValue?
+     * @param slabAllocated Is this being constructed in memory allocated by
+     *        a SlabAllocator?
      */
     StoredValue(const Item& itm,
                 UniquePtr n,
                 EPStats& stats,
-                bool isOrdered);
+                bool isOrdered,
+                bool slabAllocated = false);
+
+    /**
+     * Constructor for a StoredValue with an inline buffer - protected as
+     * allocation needs to be done via CompactStoredValueFactory.
+     *
+     * @param itm Item to base this StoredValue on.
+     * @param n The StoredValue which will follow the new stored value in
+     *           the hash bucket chain.
+     * @param stats EPStats to update for this new StoredValue
+     * @param inlineCapacity the number of value bytes the inline buffer
+     *        (allocated after the key) can hold; at most 255.
+     * @param slabAllocated Is this being constructed in memory allocated by
+     *        a SlabAllocator?
+     */
+    StoredValue(const Item& itm,
+                UniquePtr n,
+                EPStats& stats,
+                size_t inlineCapacity,
+                bool slabAllocated);
 
     // Destructor. protected, as needs to be carefully deleted (via
     // StoredValue::Destructor) depending on the value of isOrdered flag.
@@ -633,6 +755,47 @@ protected:
      */
     inline SerialisedDocKey* key();
 
+    /**
+     * Header of the inline buffer, which is followed by {capacity} bytes of
+     * value data - a copy of the data of the value's Blob (Blob::getBlob()).
+     */
+    struct InlineBuffer {
+        uint8_t capacity; //!< Bytes of value data available.
+        uint8_t length; //!< Bytes of value data in use (Blob::length()).
+        uint8_t extLen; //!< Blob::getExtLen() of the value.
+        uint8_t savedBytes; //!< See getInlineSavedBytes().
+
+        char* data() {
+            return reinterpret_cast<char*>(this + 1);
+        }
+
+        const char* data() const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+    };
+
+    /**
+     * Get the address of the inline buffer (located after the key). Only
+     * valid if hasInlineBuffer is set.
+     */
+    InlineBuffer* inlineBuffer() {
+        return reinterpret_cast<InlineBuffer*>(
+                reinterpret_cast<char*>(key()) + getKey().getObjectSize());
+    }
+
+    const InlineBuffer* inlineBuffer() const {
+        return const_cast<StoredValue&>(*this).inlineBuffer();
+    }
+
+    /**
+     * If this StoredValue has an inline buffer and {value} fits in it, copy
+     * {value} into the buffer and release the Blob.
+     */
+    void moveValueInline();
+
+    /// Allocate a new Blob holding a copy of the inline value.
+    value_t copyInlineValue() const;
+
     /**
      * Logically mark this SV as deleted.
      * Implementation for StoredValue instances (dispatched to by del() based
@@ -646,6 +809,7 @@ protected:
     void setValueImpl(const Item& itm);
 
     friend class StoredValueFactory;
+    friend class CompactStoredValueFactory;
 
     value_t            value;          // 8 bytes
 
@@ -671,7 +835,10 @@ protected:
     bool               newCacheItem : 1;
     const bool isOrdered : 1; //!< Is this an instance of OrderedStoredValue?
     uint8_t            nru       :  2; //!< True if referenced since last sweep
-    bool unused : 2; // Unused bits in first byte of bitfields.
+    //! Was this allocated with an inline buffer (see InlineBuffer)?
+    const bool hasInlineBuffer : 1;
+    //! Is the value currently held in the inline buffer ({value} is null)?
+    bool inlineValue : 1;
 
     // Indicates if a newer instance of the item is added. Logically part of
     // OSV, but is physically located in SV as there are spare bytes here.
@@ -686,6 +853,9 @@ protected:
     // Note (2): Only 1 bit of this is currently used; rest is "spare".
     std::atomic<bool> stale;
 
+    //! Was this allocated by a SlabAllocator (see isSlabAllocated())?
+    const bool slabAllocated;
+
     static double mutation_mem_threshold;
 
     friend std::ostream& operator<<(std::ostream& os, const StoredValue& sv);
@@ -837,5 +1007,9 @@ size_t StoredValue::getObjectSize() const {
     if (isOrdered) {
         return sizeof(OrderedStoredValue) + getKey().getObjectSize();
     }
+    if (hasInlineBuffer) {
+        return sizeof(*this) + getKey().getObjectSize() +
+               sizeof(InlineBuffer) + inlineBuffer()->capacity;
+    }
     return sizeof(*this) + getKey().getObjectSize();
 }
@@ -21,8 +21,11 @@
  * Factories for creating StoredValue and subclasses of StoredValue.
  */
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 
+#include "slab_allocator.h"
 #include "stored-value.h"
 
 /**
@@ -54,6 +57,29 @@ public:
      */
     virtual StoredValue::UniquePtr copyStoredValue(const StoredValue& other,
                                                    StoredValue::UniquePtr next) = 0;
+
+    /**
+     * Called when every StoredValue created by this factory is about to be
+     * destroyed, before the factory itself is; no more are created after
+     * this. Allows their memory to be released wholesale rather than one
+     * object at a time.
+     */
+    virtual void releaseAll() {
+    }
+
+protected:
+    /**
+     * Allocate size bytes for a StoredValue - from slabs if non-null and the
+     * StoredValue fits in a slab, otherwise from the heap.
+     *
+     * @param[out] slabAllocated set to true if allocated from slabs.
+     */
+    static void* allocate(size_t size,
+                          SlabAllocator* slabs,
+                          bool& slabAllocated) {
+        slabAllocated = slabs && SlabAllocator::canAllocate(size);
+        return slabAllocated ? slabs->allocate(size) : ::operator new(size);
+    }
 };
 
 /**
@@ -63,7 +89,13 @@ class StoredValueFactory : public AbstractStoredValueFactory {
 public:
     using value_type = StoredValue;
 
-    StoredValueFactory(EPStats& s) : stats(&s) {
+    /**
+     * @param s EPStats to update for new StoredValues.
+     * @param slabs If non-null, allocate StoredValues from the given
+     *        SlabAllocator (owned by this factory), otherwise from the heap.
+     */
+    StoredValueFactory(EPStats& s, std::unique_ptr<SlabAllocator> slabs = {})
+        : stats(&s), slabs(std::move(slabs)) {
     }
 
     /**
@@ -73,12 +105,89 @@ public:
                                       StoredValue::UniquePtr next) override {
         // Allocate a buffer to store the StoredValue and any trailing bytes
         // that maybe required.
-        return StoredValue::UniquePtr(
-                new (::operator new(StoredValue::getRequiredStorage(itm)))
-                        StoredValue(itm,
-                                    std::move(next),
-                                    *stats,
-                                    /*isOrdered*/ false));
+        bool slabAllocated;
+        void* buffer = allocate(StoredValue::getRequiredStorage(itm),
+                                slabs.get(),
+                                slabAllocated);
+        return StoredValue::UniquePtr(new (buffer) StoredValue(
+                itm, std::move(next), *stats, /*isOrdered*/ false,
+                slabAllocated));
+    }
+
+    StoredValue::UniquePtr copyStoredValue(const StoredValue& other,
+                                           StoredValue::UniquePtr next) override {
+        throw std::logic_error("Copy of StoredValue is not supported");
+    }
+
+    void releaseAll() override {
+        if (slabs) {
+            slabs->releaseAll();
+        }
+    }
+
+private:
+    EPStats* stats;
+    std::unique_ptr<SlabAllocator> slabs;
+};
+
+/**
+ * Creator of StoredValue instances which hold small values inline.
+ *
+ * Items whose value is no larger than the inline threshold are given an
+ * inline buffer sized for their value, so the value is stored in the same
+ * allocation as the StoredValue and key rather than in a separate Blob.
+ * Larger items are created as normal StoredValues.
+ *
+ * Reading an inline value copies it into a new Blob (see
+ * StoredValue::copyValue()), so this suits many small, rarely read items
+ * rather than a small hot set.
+ */
+class CompactStoredValueFactory : public AbstractStoredValueFactory {
+public:
+    using value_type = StoredValue;
+
+    /**
+     * @param s EPStats to update for new StoredValues.
+     * @param inlineThreshold Largest value (Blob::length()) to hold inline;
+     *        at most 255.
+     * @param slabs If non-null, allocate StoredValues from the given
+     *        SlabAllocator (owned by this factory), otherwise from the heap.
+     */
+    CompactStoredValueFactory(EPStats& s,
+                              size_t inlineThreshold,
+                              std::unique_ptr<SlabAllocator> slabs = {})
+        : stats(&s),
+          inlineThreshold(inlineThreshold),
+          slabs(std::move(slabs)) {
+        if (inlineThreshold > std::numeric_limits<uint8_t>::max()) {
+            throw std::invalid_argument(
+                    "CompactStoredValueFactory(): inlineThreshold (which "
+                    "is " + std::to_string(inlineThreshold) +
+                    ") must be at most 255");
+        }
+    }
+
+    StoredValue::UniquePtr operator()(const Item& itm,
+                                      StoredValue::UniquePtr next) override {
+        const auto& value = itm.getValue();
+        bool slabAllocated;
+        if (!value || value->length() > inlineThreshold) {
+            void* buffer = allocate(StoredValue::getRequiredStorage(itm),
+                                    slabs.get(),
+                                    slabAllocated);
+            return StoredValue::UniquePtr(new (buffer) StoredValue(
+                    itm, std::move(next), *stats, /*isOrdered*/ false,
+                    slabAllocated));
+        }
+
+        const size_t capacity = std::min(
+                StoredValue::getInlineCapacity(itm, value->length()),
+                size_t(std::numeric_limits<uint8_t>::max()));
+        void* buffer = allocate(StoredValue::getRequiredStorage(itm, capacity),
+                                slabs.get(),
+                                slabAllocated);
+        return StoredValue::UniquePtr(new (buffer) StoredValue(
+                itm, std::move(next), *stats, capacity, slabAllocated));
     }
 
     StoredValue::UniquePtr copyStoredValue(const StoredValue& other,
@@ -86,8 +195,16 @@ public:
         throw std::logic_error("Copy of StoredValue is not supported");
     }
 
+    void releaseAll() override {
+        if (slabs) {
+            slabs->releaseAll();
+        }
+    }
+
 private:
     EPStats* stats;
+    const size_t inlineThreshold;
+    std::unique_ptr<SlabAllocator> slabs;
 };
 
 /**
@@ -24,6 +24,7 @@
 
 #include <memcached/dockey.h>
 
+#include "dockey_hash.h"
 #include "ep_types.h"
 
 class SerialisedDocKey;
@@ -189,7 +190,7 @@ public:
     bool operator==(const DocKey rhs) const {
         return size() == rhs.size() &&
                getDocNamespace() == rhs.getDocNamespace() &&
-               std::memcmp(data(), rhs.data(), size()) == 0;
+               DocKeyHash::equal(data(), rhs.data(), size());
     }
 
     /**
@@ -72,7 +72,7 @@ bool VKeyStatBGFetchTask::run() {
 bool SingleBGFetcherTask::run() {
     TRACE_EVENT("ep-engine/task", "SingleBGFetcherTask", cookie, vbucket);
     engine->getKVBucket()->completeBGFetch(key, vbucket, cookie, init,
-                                           metaFetch);
+                                           metaFetch, notifyGroup);
     return false;
 }
 
@@ -57,6 +57,7 @@ TASK(BackfillManagerTask, AUXIO_TASK_IDX, 8)
 TASK(RollbackTask, WRITER_TASK_IDX, 1)
 TASK(CompactVBucketTask, WRITER_TASK_IDX, 2)
 TASK(FlusherTask, WRITER_TASK_IDX, 5)
+TASK(PipelinedCommitTask, WRITER_TASK_IDX, 4)
 TASK(StatSnap, WRITER_TASK_IDX, 9)
 
 // Non-IO tasks
@@ -183,7 +183,8 @@ public:
                         const void* c,
                         bool isMeta,
                         int sleeptime = 0,
-                        bool completeBeforeShutdown = false)
+                        bool completeBeforeShutdown = false,
+                        std::shared_ptr<BGFetchNotifyGroup> group = nullptr)
         : GlobalTask(e,
                      TaskId::SingleBGFetcherTask,
                      sleeptime,
@@ -193,6 +194,7 @@ public:
           cookie(c),
           metaFetch(isMeta),
           init(ProcessClock::now()),
+          notifyGroup(std::move(group)),
           description("Fetching item from disk: key{" +
                       std::string(key.c_str()) + "}, vb:" +
                       std::to_string(vbucket)) {
@@ -210,6 +212,7 @@ private:
     const void*                cookie;
     bool                       metaFetch;
     ProcessClock::time_point   init;
+    std::shared_ptr<BGFetchNotifyGroup> notifyGroup;
     const std::string description;
 };
 
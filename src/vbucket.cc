@@ -150,7 +150,16 @@ VBucket::VBucket(id_type i,
                  uint64_t purgeSeqno,
                  uint64_t maxCas,
                  const std::string& collectionsManifest)
-    : ht(st, std::move(valFact), config.getHtSize(), config.getHtLocks()),
+    : ht(st,
+         std::move(valFact),
+         config.getHtSize(),
+         config.getHtLocks(),
+         config.getHtResizeMode() == "incremental"
+                 ? HashTable::ResizeMode::Incremental
+                 : HashTable::ResizeMode::Blocking,
+         config.getHtBucketLayout() == "cacheline"
+                 ? HashTable::BucketLayout::CacheLine
+                 : HashTable::BucketLayout::Chained),
       checkpointManager(st,
                         i,
                         chkConfig,
@@ -366,8 +375,8 @@ void VBucket::addStat(const char *nm, const T &val, ADD_STAT add_stat,
 }
 
 void VBucket::handlePreExpiry(StoredValue& v) {
-    value_t value = v.getValue();
-    if (value) {
+    if (v.hasValue()) {
+        const value_t value = v.copyValue();
         std::unique_ptr<Item> itm(v.toItem(false, id));
         item_info itm_info;
         EventuallyPersistentEngine* engine = ObjectRegistry::getCurrentEngine();
@@ -381,11 +390,11 @@ void VBucket::handlePreExpiry(StoredValue& v) {
          * value after pre-expiry is performed.
          */
         if (sapi->document->pre_expiry(itm_info)) {
-            char* extMeta = const_cast<char *>(v.getValue()->getExtMeta());
+            char* extMeta = const_cast<char *>(value->getExtMeta());
             Item new_item(v.getKey(), v.getFlags(), v.getExptime(),
                           itm_info.value[0].iov_base, itm_info.value[0].iov_len,
                           reinterpret_cast<uint8_t*>(extMeta),
-                          v.getValue()->getExtLen(), v.getCas(),
+                          value->getExtLen(), v.getCas(),
                           v.getBySeqno(), id, v.getRevSeqno(),
                           v.getNRUValue());
 
@@ -856,22 +865,36 @@ ENGINE_ERROR_CODE VBucket::replace(Item& itm,
 
 ENGINE_ERROR_CODE VBucket::addBackfillItem(Item& itm,
                                            const GenerateBySeqno genBySeqno) {
+    // Note that this function is only called on replica or pending vbuckets.
+    VBQueueItemCtx queueItmCtx(genBySeqno,
+                               GenerateCas::No,
+                               TrackCasDrift::No,
+                               /*isBackfillItem*/ true,
+                               nullptr /* No pre link should happen */);
+    return setItemWithMetaData(itm, queueItmCtx, "addBackfillItem");
+}
+
+ENGINE_ERROR_CODE VBucket::replayItem(Item& itm) {
+    VBQueueItemCtx queueItmCtx(GenerateBySeqno::No,
+                               GenerateCas::No,
+                               TrackCasDrift::No,
+                               /*isBackfillItem*/ false,
+                               nullptr /* No pre link should happen */);
+    return setItemWithMetaData(itm, queueItmCtx, "replayItem");
+}
+
+ENGINE_ERROR_CODE VBucket::setItemWithMetaData(
+        Item& itm, const VBQueueItemCtx& queueItmCtx, const char* caller) {
     auto hbl = ht.getLockedBucket(itm.getKey());
     StoredValue* v = ht.unlocked_find(itm.getKey(),
                                       hbl.getBucketNum(),
                                       WantsDeleted::Yes,
                                       TrackReference::No);
 
-    // Note that this function is only called on replica or pending vbuckets.
     if (v && v->isLocked(ep_current_time())) {
         v->unlock();
     }
 
-    VBQueueItemCtx queueItmCtx(genBySeqno,
-                               GenerateCas::No,
-                               TrackCasDrift::No,
-                               /*isBackfillItem*/ true,
-                               nullptr /* No pre link should happen */);
     MutationStatus status;
     VBNotifyCtx notifyCtx;
     std::tie(status, notifyCtx) = processSet(hbl,
@@ -906,8 +929,8 @@ ENGINE_ERROR_CODE VBucket::addBackfillItem(Item& itm,
     } break;
     case MutationStatus::NeedBgFetch:
         throw std::logic_error(
-                "VBucket::addBackfillItem: "
-                "SET on a non-active vbucket should not require a "
+                std::string("VBucket::") + caller +
+                ": SET without a CAS should not require a "
                 "bg_metadata_fetch.");
     }
 
@@ -1529,7 +1552,7 @@ MutationStatus VBucket::insertFromWarmup(Item& itm,
             /* For now ht stats are updated from outside ht. This seems to be
                a better option for now than passing a flag to
                addNewStoredValue() just for this func */
-            ++(ht.numNonResidentItems);
+            ht.incrNumNonResidentItems();
         }
         /* For now ht stats are updated from outside ht. This seems to be
            a better option for now than passing a flag to
@@ -1577,6 +1600,32 @@ GetValue VBucket::getInternal(const DocKey& key,
                                                   ? TrackReference::Yes
                                                   : TrackReference::No;
     const bool getDeletedValue = (options & GET_DELETED_VALUE);
+
+    // A live, resident item whose reference doesn't need recording (its NRU
+    // is already the minimum) can be read without excluding other readers
+    // of the bucket; anything else takes the exclusive path below.
+    GetValue shared;
+    bool servedShared = false;
+    ht.findShared(key, [&](const StoredValue* v) {
+        if (!v || v->isDeleted() || v->isTempItem() || !v->isResident() ||
+            v->isExpired(ep_real_time()) ||
+            (trackReference == TrackReference::Yes &&
+             v->getNRUValue() != MIN_NRU_VALUE)) {
+            return;
+        }
+        const bool hide_cas =
+                (options & HIDE_LOCKED_CAS) && v->isLocked(ep_current_time());
+        shared = GetValue(v->toItem(hide_cas, getId()).release(),
+                          ENGINE_SUCCESS,
+                          v->getBySeqno(),
+                          false,
+                          v->getNRUValue());
+        servedShared = true;
+    });
+    if (servedShared) {
+        return shared;
+    }
+
     auto hbl = ht.getLockedBucket(key);
     StoredValue* v = fetchValidValue(
             hbl, key, WantsDeleted::Yes, trackReference, QueueExpired::Yes);
@@ -1629,6 +1678,137 @@ GetValue VBucket::getInternal(const DocKey& key,
     }
 }
 
+std::vector<GetValue> VBucket::getMulti(const std::vector<DocKey>& keys,
+                                        const void* cookie,
+                                        EventuallyPersistentEngine& engine,
+                                        int bgFetchDelay,
+                                        get_options_t options,
+                                        bool diskFlushAll) {
+    const TrackReference trackReference = (options & TRACK_REFERENCE)
+                                                  ? TrackReference::Yes
+                                                  : TrackReference::No;
+    const bool getDeletedValue = (options & GET_DELETED_VALUE);
+    const bool queueBgFetch = (options & QUEUE_BG_FETCH);
+
+    // Background fetches are collected here rather than queued per key, so
+    // we look up non-resident values without QUEUE_BG_FETCH (and hence
+    // without ALLOW_META_ONLY, which is only honoured in its absence).
+    const auto nonResidentOptions =
+            queueBgFetch ? static_cast<get_options_t>(
+                                   options & ~(QUEUE_BG_FETCH | ALLOW_META_ONLY))
+                         : options;
+    vb_bgfetch_queue_t fetches;
+    auto addFetch = [&fetches, cookie](const DocKey& key) {
+        fetches[StoredDocKey(key)].bgfetched_list.push_back(
+                std::make_unique<VBucketBGFetchItem>(cookie, false));
+    };
+
+    std::vector<GetValue> results(keys.size());
+    ht.visitKeysLocked(keys, [&](HashTable::HashBucketLock& hbl, size_t i) {
+        const DocKey& key = keys[i];
+        StoredValue* v = fetchValidValue(
+                hbl, key, WantsDeleted::Yes, trackReference, QueueExpired::Yes);
+        if (v) {
+            if (v->isDeleted() && !getDeletedValue) {
+                return;
+            }
+            if (v->isTempDeletedItem() || v->isTempNonExistentItem()) {
+                if (options & DELETE_TEMP) {
+                    deleteStoredValue(hbl, *v);
+                }
+                return;
+            }
+
+            if (!v->isResident()) {
+                results[i] = getInternalNonResident(
+                        key, cookie, engine, bgFetchDelay, nonResidentOptions, *v);
+                if (queueBgFetch &&
+                    results[i].getStatus() == ENGINE_EWOULDBLOCK) {
+                    addFetch(key);
+                }
+                return;
+            }
+
+            const bool hide_cas = (options & HIDE_LOCKED_CAS) &&
+                                  v->isLocked(ep_current_time());
+            results[i] = GetValue(v->toItem(hide_cas, getId()).release(),
+                                  ENGINE_SUCCESS,
+                                  v->getBySeqno(),
+                                  false,
+                                  v->getNRUValue());
+            return;
+        }
+
+        if (!getDeletedValue && (eviction == VALUE_ONLY || diskFlushAll)) {
+            return;
+        }
+        if (!maybeKeyExistsInFilter(key)) {
+            return;
+        }
+        ENGINE_ERROR_CODE ec = ENGINE_EWOULDBLOCK;
+        if (queueBgFetch) {
+            // Full eviction; add a temp item as addTempItemAndBGFetch()
+            // does, but defer the fetch.
+            const AddStatus rv = addTempStoredValue(hbl, key);
+            switch (rv) {
+            case AddStatus::NoMem:
+                ec = ENGINE_ENOMEM;
+                break;
+            case AddStatus::BgFetch:
+                addFetch(key);
+                break;
+            case AddStatus::Exists:
+            case AddStatus::UnDel:
+            case AddStatus::Success:
+            case AddStatus::AddTmpAndBgFetch:
+                // Since the hashtable bucket is locked, we shouldn't get here
+                throw std::logic_error(
+                        "VBucket::getMulti: Invalid result from "
+                        "addTempStoredValue: " +
+                        std::to_string(static_cast<uint16_t>(rv)));
+            }
+        }
+        results[i] = GetValue(NULL, ec, -1, true);
+    });
+
+    if (!fetches.empty()) {
+        // The cookie is notified once, when the last of the batch's fetches
+        // completes, rather than once per fetch.
+        size_t numFetches = 0;
+        for (const auto& fetch : fetches) {
+            numFetches += fetch.second.bgfetched_list.size();
+        }
+        auto group = std::make_shared<BGFetchNotifyGroup>(numFetches);
+        for (auto& fetch : fetches) {
+            for (auto& item : fetch.second.bgfetched_list) {
+                item->notifyGroup = group;
+            }
+        }
+        bgFetchMulti(fetches, engine, bgFetchDelay);
+    }
+    return results;
+}
+
+void VBucket::readMetaData(const StoredValue& v,
+                           ItemMetaData& metadata,
+                           uint32_t& deleted,
+                           uint8_t& datatype) {
+    if (v.isTempDeletedItem() || v.isDeleted() ||
+        v.isExpired(ep_real_time())) {
+        deleted |= GET_META_ITEM_DELETED_FLAG;
+    }
+
+    if (v.isLocked(ep_current_time())) {
+        metadata.cas = static_cast<uint64_t>(-1);
+    } else {
+        metadata.cas = v.getCas();
+    }
+    metadata.flags = v.getFlags();
+    metadata.exptime = v.getExptime();
+    metadata.revSeqno = v.getRevSeqno();
+    datatype = v.getDatatype();
+}
+
 ENGINE_ERROR_CODE VBucket::getMetaData(const DocKey& key,
                                        const void* cookie,
                                        EventuallyPersistentEngine& engine,
@@ -1637,6 +1817,22 @@ ENGINE_ERROR_CODE VBucket::getMetaData(const DocKey& key,
                                        uint32_t& deleted,
                                        uint8_t& datatype) {
     deleted = 0;
+
+    // Metadata of an item already in memory can be read without excluding
+    // other readers of the bucket.
+    bool servedShared = false;
+    ht.findShared(key, [&](const StoredValue* v) {
+        if (!v || v->isTempInitialItem() || v->isTempNonExistentItem()) {
+            return;
+        }
+        readMetaData(*v, metadata, deleted, datatype);
+        servedShared = true;
+    });
+    if (servedShared) {
+        stats.numOpsGetMeta++;
+        return ENGINE_SUCCESS;
+    }
+
     auto hbl = ht.getLockedBucket(key);
     StoredValue* v = ht.unlocked_find(
             key, hbl.getBucketNum(), WantsDeleted::Yes, TrackReference::No);
@@ -1651,21 +1847,7 @@ ENGINE_ERROR_CODE VBucket::getMetaData(const DocKey& key,
             metadata.cas = v->getCas();
             return ENGINE_KEY_ENOENT;
         } else {
-            if (v->isTempDeletedItem() || v->isDeleted() ||
-                v->isExpired(ep_real_time())) {
-                deleted |= GET_META_ITEM_DELETED_FLAG;
-            }
-
-            if (v->isLocked(ep_current_time())) {
-                metadata.cas = static_cast<uint64_t>(-1);
-            } else {
-                metadata.cas = v->getCas();
-            }
-            metadata.flags = v->getFlags();
-            metadata.exptime = v->getExptime();
-            metadata.revSeqno = v->getRevSeqno();
-            datatype = v->getDatatype();
-
+            readMetaData(*v, metadata, deleted, datatype);
             return ENGINE_SUCCESS;
         }
     } else {
@@ -1871,7 +2053,7 @@ void VBucket::_addStats(bool details, ADD_STAT add_stat, const void* c) {
         addStat("num_non_resident", getNumNonResidentItems(), add_stat, c);
         addStat("ht_memory", ht.memorySize(), add_stat, c);
         addStat("ht_item_memory", ht.getItemMemory(), add_stat, c);
-        addStat("ht_cache_size", ht.cacheSize.load(), add_stat, c);
+        addStat("ht_cache_size", ht.getCacheSize(), add_stat, c);
         addStat("ht_size", ht.getSize(), add_stat, c);
         addStat("num_ejects", ht.getNumEjects(), add_stat, c);
         addStat("ops_create", opsCreate.load(), add_stat, c);
@@ -2185,9 +2367,8 @@ VBucket::processExpiredItem(const HashTable::HashBucketLock& hbl,
      * but functionally correct and for performance reasons
      * only the system xattrs need to be stored.
      */
-    value_t value = v.getValue();
     bool onlyMarkDeleted =
-            value && mcbp::datatype::is_xattr(value->getDataType());
+            v.hasValue() && mcbp::datatype::is_xattr(v.getDatatype());
     v.setRevSeqno(v.getRevSeqno() + 1);
     VBNotifyCtx notifyCtx;
     StoredValue* newSv;
@@ -2406,10 +2587,9 @@ std::unique_ptr<Item> VBucket::pruneXattrDocument(
     // Need to take a copy of the value, prune it, and add it back
 
     // Create work-space document
-    std::vector<uint8_t> workspace(v.getValue()->vlength());
-    std::copy_n(v.getValue()->getData(),
-                v.getValue()->vlength(),
-                workspace.begin());
+    const value_t value = v.copyValue();
+    std::vector<uint8_t> workspace(value->vlength());
+    std::copy_n(value->getData(), value->vlength(), workspace.begin());
 
     // Now attach to the XATTRs in the document
     auto sz = cb::xattr::get_body_offset(
@@ -2426,8 +2606,8 @@ std::unique_ptr<Item> VBucket::pruneXattrDocument(
                 Blob::New(reinterpret_cast<const char*>(prunedXattrs.data()),
                           prunedXattrs.size(),
                           const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(
-                                  v.getValue()->getExtMeta())),
-                          v.getValue()->getExtLen());
+                                  value->getExtMeta())),
+                          value->getExtLen());
 
         return std::make_unique<Item>(v.getKey(),
                                       itemMeta.flags,
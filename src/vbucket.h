@@ -507,8 +507,9 @@ public:
      * 'sees' beyond a certain sequence number or when a certain checkpoint
      * is persisted.
      * Depending on the vbucket type, the meaning 'seeing' a sequence number
-     * changes. That is, it could mean persisted in case of EPVBucket and
-     * added to the sequenced data structure in case of EphemeralVBucket.
+     * changes. That is, it could mean persisted (or synced to the shard's
+     * MutationJournal) in case of EPVBucket and added to the sequenced data
+     * structure in case of EphemeralVBucket.
      *
      * @param seqnoOrChkId seqno to be seen or checkpoint id to be persisted
      * @param cookie cookie of conn to be notified
@@ -836,6 +837,19 @@ public:
      */
     ENGINE_ERROR_CODE addBackfillItem(Item& itm, GenerateBySeqno genBySeqno);
 
+    /**
+     * Add an item recovered from the mutation journal to this (active)
+     * vbucket, queueing it on the open checkpoint with its original seqno and
+     * CAS - so that it is persisted, and seen by in-memory DCP cursors, like
+     * the front-end mutation it replays.
+     *
+     * @param itm Item to be replayed; must have the seqno following the
+     *            vbucket's high seqno
+     *
+     * @return the result of the operation
+     */
+    ENGINE_ERROR_CODE replayItem(Item& itm);
+
     /**
      * Set an item in the store from a non-front end operation (DCP, XDCR)
      *
@@ -1050,6 +1064,32 @@ public:
                          get_options_t options,
                          bool diskFlushAll);
 
+    /**
+     * Get metadata and values for a batch of keys.
+     *
+     * Equivalent to calling getInternal() for each key, except that the
+     * keys are looked up grouped by hash table lock (see
+     * HashTable::visitKeysLocked), and any background fetches required are
+     * submitted to the BgFetcher together once all keys have been looked up.
+     * The cookie is notified once, when the last of those fetches completes
+     * (see BGFetchNotifyGroup), after which the batch should be retried.
+     *
+     * @param keys keys for which metadata and values should be retrieved
+     * @param cookie the cookie representing the client
+     * @param engine Reference to ep engine
+     * @param bgFetchDelay
+     * @param options flags indicating some retrieval related info
+     * @param diskFlushAll
+     *
+     * @return the result for each key, in the same order as keys
+     */
+    std::vector<GetValue> getMulti(const std::vector<DocKey>& keys,
+                                   const void* cookie,
+                                   EventuallyPersistentEngine& engine,
+                                   int bgFetchDelay,
+                                   get_options_t options,
+                                   bool diskFlushAll);
+
     /**
      * Retrieve the meta data for given key
      *
@@ -1462,12 +1502,30 @@ protected:
 private:
     void fireAllOps(EventuallyPersistentEngine& engine, ENGINE_ERROR_CODE code);
 
+    /**
+     * Set an item which already has its metadata (and, unless queueItmCtx
+     * generates one, its seqno) - the common part of addBackfillItem() and
+     * replayItem().
+     */
+    ENGINE_ERROR_CODE setItemWithMetaData(Item& itm,
+                                          const VBQueueItemCtx& queueItmCtx,
+                                          const char* caller);
+
     void decrDirtyQueueMem(size_t decrementBy);
 
     void decrDirtyQueueAge(uint32_t decrementBy);
 
     void decrDirtyQueuePendingWrites(size_t decrementBy);
 
+    /**
+     * Fill in the outputs of getMetaData() from the given (non temp-initial,
+     * non temp-non-existent) StoredValue.
+     */
+    static void readMetaData(const StoredValue& v,
+                             ItemMetaData& metadata,
+                             uint32_t& deleted,
+                             uint8_t& datatype);
+
     /**
      * Updates an existing StoredValue in in-memory data structures like HT.
      * Assumes that HT bucket lock is grabbed.
@@ -1593,6 +1651,18 @@ private:
                          int bgFetchDelay,
                          bool isMeta = false) = 0;
 
+    /**
+     * Enqueue background fetches for a batch of keys, as a single
+     * submission to the BgFetcher.
+     *
+     * @param fetches the fetches to enqueue; moved from
+     * @param engine Reference to ep engine
+     * @param bgFetchDelay Delay in secs before we run the bgFetch task
+     */
+    virtual void bgFetchMulti(vb_bgfetch_queue_t& fetches,
+                              EventuallyPersistentEngine& engine,
+                              int bgFetchDelay) = 0;
+
     /**
      * Get metadata and value for a non-resident key
      *
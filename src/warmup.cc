@@ -21,6 +21,8 @@
 #include "connmap.h"
 #include "ep_engine.h"
 #include "failover-table.h"
+#include "kvshard.h"
+#include "mutation_journal.h"
 #include "mutation_log.h"
 #define STATWRITER_NAMESPACE warmup
 #include "statwriter.h"
@@ -280,6 +282,7 @@ public:
 
     bool run() {
         TRACE_EVENT0("ep-engine/task", "WarmupCompletion");
+        _warmup->replayJournals();
         _warmup->done();
         _warmup->removeFromTaskSet(uid);
         return false;
@@ -575,8 +578,11 @@ void LoadStorageKVPairCallback::callback(GetValue &val) {
 
     if (stopLoading) {
         // warmup has completed, return ENGINE_ENOMEM to
-        // cancel remaining data dumps from couchstore
-        if (epstore.getWarmup()->setComplete()) {
+        // cancel remaining data dumps from couchstore. With journaling,
+        // warmup isn't complete until the Done state has replayed the
+        // journals (see Warmup::replayJournals).
+        if (!epstore.getEPEngine().getConfiguration().isJournalEnabled() &&
+            epstore.getWarmup()->setComplete()) {
             epstore.getWarmup()->setWarmupTime();
             epstore.warmupCompleted();
             LOG(EXTENSION_LOG_NOTICE, "Warmup completed in %s",
@@ -845,7 +851,7 @@ void Warmup::estimateDatabaseItemCount(uint16_t shardId)
                                                         getItemCount(vbid);
         VBucketPtr vb = store.getVBucket(vbid);
         if (vb) {
-            vb->ht.numTotalItems = vbItemCount;
+            vb->ht.setNumTotalItems(vbItemCount);
         }
         item_count += vbItemCount;
     }
@@ -1165,6 +1171,62 @@ void Warmup::scheduleCompletion() {
     ExecutorPool::get()->schedule(task);
 }
 
+void Warmup::replayJournals() {
+    for (size_t shardId = 0; shardId < store.vbMap.getNumShards(); ++shardId) {
+        MutationJournal* journal = store.vbMap.getShard(shardId)->getJournal();
+        if (!journal) {
+            continue;
+        }
+
+        size_t replayed = 0;
+        for (const auto& entry : journal->recover()) {
+            const uint16_t vbid = entry.first;
+            VBucketPtr vb = store.getVBucket(vbid);
+            if (!vb || vb->getState() != vbucket_state_active) {
+                journal->resetVBucket(vbid);
+                continue;
+            }
+
+            // The mutations are replayed onto the open checkpoint, keeping
+            // their seqnos and CAS, and only from the first seqno the vBucket
+            // hadn't persisted - so the flusher persists them and DCP cursors
+            // stream them as they would have the original mutations.
+            // Deletions go the same way so that they keep their value (i.e.
+            // any xattrs).
+            uint64_t nextSeqno = vb->getPersistenceSeqno() + 1;
+            for (const auto& item : entry.second) {
+                const uint64_t seqno = item->getBySeqno();
+                if (seqno < nextSeqno) {
+                    continue;
+                }
+
+                ENGINE_ERROR_CODE ret = ENGINE_EINVAL;
+                if (seqno == nextSeqno) {
+                    ret = vb->replayItem(*item);
+                }
+
+                if (ret != ENGINE_SUCCESS) {
+                    LOG(EXTENSION_LOG_WARNING,
+                        "Warmup::replayJournals: vb:%" PRIu16 " stopping "
+                        "replay at seqno %" PRIu64 " (expected %" PRIu64
+                        ", status %d); later journaled mutations are lost",
+                        vbid, seqno, nextSeqno, ret);
+                    journal->resetVBucket(vbid);
+                    break;
+                }
+                ++nextSeqno;
+                ++replayed;
+            }
+        }
+
+        LOG(EXTENSION_LOG_NOTICE,
+            "Warmup::replayJournals: shard %" PRIu64 " replayed %" PRIu64
+            " journaled mutations",
+            uint64_t(shardId), uint64_t(replayed));
+        journal->start();
+    }
+}
+
 void Warmup::done()
 {
     if (setComplete()) {
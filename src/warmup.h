@@ -164,6 +164,14 @@ public:
     void loadDataforShard(uint16_t shardId);
     void done();
 
+    /**
+     * Re-apply the mutations in each shard's MutationJournal (if it has one)
+     * which its active vBuckets hadn't persisted, then start the journals.
+     * Run once the data has been loaded and before warmup completes, so the
+     * replayed mutations win over the older values loaded from disk.
+     */
+    void replayJournals();
+
 private:
     template <typename T>
     void addStat(const char *nm, const T &val, ADD_STAT add_stat, const void *c) const;
@@ -37,6 +37,7 @@
 #include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <ctime>
 #include <fstream>
 #include <iterator>
 #include <mutex>
@@ -1047,14 +1048,16 @@ struct Ret_vals {
 
 /*
  * Performs a single DCP latency / bandwidth test with the given parameters.
- * Returns vectors of item timings and recived bytes.
+ * Returns vectors of item timings and recived bytes, and sets recv_duration
+ * to the time between the first and last items being received.
  */
 static std::pair<std::vector<hrtime_t>,
                  std::vector<size_t>>
 single_dcp_latency_bw_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
                            uint16_t vb, size_t item_count,
                            Doc_format typeOfData, const std::string& name,
-                           uint32_t opaque, bool retrieveCompressed) {
+                           uint32_t opaque, bool retrieveCompressed,
+                           hrtime_t& recv_duration) {
     std::vector<size_t> received;
 
     check(set_vbucket_state(h, h1, vb, vbucket_state_active),
@@ -1073,6 +1076,9 @@ single_dcp_latency_bw_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
     load_thread.join();
     dcp_thread.join();
 
+    recv_duration = recv_times.empty() ? 0
+                                       : recv_times.back() - recv_times.front();
+
     std::vector<hrtime_t> timings;
     for (size_t j = 0; j < insert_times.size(); ++j) {
         if (insert_times[j] < recv_times[j]) {
@@ -1101,16 +1107,20 @@ static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
     std::vector<struct Ret_vals> iterations;
 
     // For Loader & DCP client to get documents as is from vbucket 0
+    hrtime_t as_is_duration;
     auto as_is_results =
             single_dcp_latency_bw_test(h, h1, /*vb*/0, item_count, typeOfData,
-                                       "As_is", /*opaque*/0xFFFFFF00, false);
+                                       "As_is", /*opaque*/0xFFFFFF00, false,
+                                       as_is_duration);
     all_timings.push_back({"As_is", &as_is_results.first});
     all_sizes.push_back({"As_s", &as_is_results.second});
 
     // For Loader & DCP client to get documents compressed from vbucket 1
+    hrtime_t compress_duration;
     auto compress_results =
             single_dcp_latency_bw_test(h, h1, /*vb*/1, item_count, typeOfData,
-                                      "Compress", /*opaque*/0xFF000000, true);
+                                      "Compress", /*opaque*/0xFF000000, true,
+                                      compress_duration);
     all_timings.push_back({"Compress", &compress_results.first});
     all_sizes.push_back({"Compress", &compress_results.second});
 
@@ -1131,6 +1141,16 @@ static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
     output_result(title, "Latency", all_timings, "µs");
     printf("\n\n");
 
+    if (testHarness.output_format == OutputFormat::Text) {
+        const size_t batch_items =
+                get_int_stat(h, h1, "ep_dcp_producer_step_batch_items");
+        printf("%s throughput (step batch %zu): As_is %.0f items/s, "
+               "Compress %.0f items/s\n\n",
+               title.c_str(), batch_items,
+               as_is_duration ? item_count * 1e9 / as_is_duration : 0.0,
+               compress_duration ? item_count * 1e9 / compress_duration : 0.0);
+    }
+
     return SUCCESS;
 }
 
@@ -1155,6 +1175,14 @@ static enum test_result perf_dcp_latency_with_random_binary(ENGINE_HANDLE *h,
                             Doc_format::BINARY_RANDOM, ITERATIONS / 20);
 }
 
+static enum test_result perf_dcp_latency_with_batched_step(ENGINE_HANDLE *h,
+                                                           ENGINE_HANDLE_V1 *h1) {
+    return perf_dcp_latency_and_bandwidth(h, h1,
+                            "DCP In-memory (JSON-PADDED) batched step "
+                            "[As_is vs. Compress]",
+                            Doc_format::JSON_PADDED, ITERATIONS / 10);
+}
+
 static enum test_result perf_multi_thread_latency(engine_test_t* test) {
     return perf_latency_baseline_multi_thread_bucket(test,
                                                      1, /* bucket */
@@ -1410,6 +1438,206 @@ static enum test_result perf_slow_stat_latency_100vb_sets_and_dcp(
                                      BackgroundWork::Dcp), 100);
 }
 
+/*
+ * Benchmark persisting small batches spread over many vbuckets: each round
+ * queues a few mutations to every vbucket (with persistence stopped) and then
+ * times how long the flusher takes to write them all out. Also reports the
+ * number of commits and syncs each round took, and the CPU time per item.
+ */
+static enum test_result perf_flush_latency(ENGINE_HANDLE *h,
+                                           ENGINE_HANDLE_V1 *h1,
+                                           const char* title,
+                                           int num_vbuckets) {
+    const int items_per_vbucket = 10;
+    const int rounds = 20;
+
+    for (int vb = 0; vb < num_vbuckets; vb++) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed set_vbucket_state for vbucket");
+    }
+    wait_for_stat_to_be(h, h1, "ep_persist_vbstate_total", num_vbuckets);
+
+    const int start_commits = get_int_stat(h, h1, "ep_commit_num");
+    const int start_syncs = get_int_stat(h, h1, "ep_io_num_sync");
+
+    const std::string data(100, 'x');
+    std::vector<hrtime_t> flush_timings;
+    flush_timings.reserve(rounds);
+    // CPU time of the whole process while flushing; with the front end idle
+    // that is almost all the flusher's.
+    std::clock_t flush_cpu = 0;
+    for (int round = 0; round < rounds; ++round) {
+        stop_persistence(h, h1);
+        for (int vb = 0; vb < num_vbuckets; vb++) {
+            for (int i = 0; i < items_per_vbucket; i++) {
+                const std::string key("key_" + std::to_string(i));
+                checkeq(ENGINE_SUCCESS,
+                        storeCasVb11(h, h1, nullptr, OPERATION_SET,
+                                     key.c_str(), data.c_str(), data.length(),
+                                     /*flags*/0, /*out*/nullptr, /*cas*/0,
+                                     vb),
+                        "Failed to set a value");
+            }
+        }
+
+        const hrtime_t start = gethrtime();
+        const std::clock_t cpu_start = std::clock();
+        start_persistence(h, h1);
+        wait_for_flusher_to_settle(h, h1);
+        flush_cpu += std::clock() - cpu_start;
+        flush_timings.push_back(gethrtime() - start);
+    }
+
+    const int commits = get_int_stat(h, h1, "ep_commit_num") - start_commits;
+    const int syncs = get_int_stat(h, h1, "ep_io_num_sync") - start_syncs;
+    const int items = rounds * num_vbuckets * items_per_vbucket;
+    if (testHarness.output_format == OutputFormat::Text) {
+        printf("%s: %d items, %.1f commits/round, %.1f syncs/round, "
+               "%.1f items/sync, %.2f CPU µs/item\n",
+               title, items, double(commits) / rounds, double(syncs) / rounds,
+               syncs ? double(items) / syncs : 0.0,
+               double(flush_cpu) * 1000000 / CLOCKS_PER_SEC / items);
+    }
+
+    std::string description(std::string("Flush latency [") + title + "] - " +
+                            std::to_string(rounds) + " rounds (µs)");
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    all_timings.push_back(std::make_pair("Flush", &flush_timings));
+    output_result(title, description, all_timings, "µs");
+    return SUCCESS;
+}
+
+/* Benchmark flushing 100 vbuckets, committing one vbucket at a time */
+static enum test_result perf_flush_latency_100vb(ENGINE_HANDLE *h,
+                                                 ENGINE_HANDLE_V1 *h1) {
+    return perf_flush_latency(h, h1, "100 vbuckets", 100);
+}
+
+/*
+ * Streams every vbucket from disk on one DCP connection, returning the
+ * bytes of values received and setting duration to the time taken.
+ */
+static size_t dcp_backfill_all(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                               const std::string& name, uint16_t num_vbuckets,
+                               uint64_t end_seqno, hrtime_t& duration) {
+    const void *cookie = testHarness.create_cookie();
+    uint32_t opaque = 0;
+    checkeq(h1->dcp.open(h, cookie, ++opaque, 0, DCP_OPEN_PRODUCER, name, {}),
+            ENGINE_SUCCESS,
+            "Failed dcp producer open connection");
+
+    const hrtime_t start = gethrtime();
+    for (uint16_t vb = 0; vb < num_vbuckets; ++vb) {
+        const std::string uuid("vb_" + std::to_string(vb) + ":0:id");
+        uint64_t rollback = 0;
+        checkeq(h1->dcp.stream_req(h, cookie, 0, ++opaque, vb, 0, end_seqno,
+                                   get_ull_stat(h, h1, uuid.c_str(),
+                                                "failovers"),
+                                   0, 0, &rollback,
+                                   mock_dcp_add_failover_log),
+                ENGINE_SUCCESS,
+                "Failed to initiate stream request");
+    }
+
+    std::unique_ptr<dcp_message_producers> producers(get_dcp_producers(h, h1));
+    size_t bytes = 0;
+    uint16_t streams_ended = 0;
+    while (streams_ended < num_vbuckets) {
+        ENGINE_ERROR_CODE err = h1->dcp.step(h, cookie, producers.get());
+        if (err == ENGINE_SUCCESS) {
+            // Wait for the backfills to notify us of more items.
+            testHarness.lock_cookie(cookie);
+            testHarness.waitfor_cookie(cookie);
+            testHarness.unlock_cookie(cookie);
+            continue;
+        }
+        checkeq(ENGINE_WANT_MORE, err, "Unhandled dcp->step() result");
+        switch (dcp_last_op) {
+        case PROTOCOL_BINARY_CMD_DCP_MUTATION:
+            bytes += dcp_last_value.length();
+            break;
+        case PROTOCOL_BINARY_CMD_DCP_STREAM_END:
+            ++streams_ended;
+            break;
+        default:
+            break;
+        }
+        dcp_last_op = 0;
+    }
+    duration = gethrtime() - start;
+
+    testHarness.destroy_cookie(cookie);
+    return bytes;
+}
+
+/*
+ * Measures the rate a DCP connection backfills many vbuckets from disk, for
+ * the configured dcp_backfill_tasks.
+ */
+static enum test_result perf_dcp_backfill_throughput(ENGINE_HANDLE *h,
+                                                     ENGINE_HANDLE_V1 *h1) {
+    const uint16_t num_vbuckets = 16;
+    const int items_per_vbucket = ITERATIONS / 50;
+    const int rounds = 5;
+
+    for (uint16_t vb = 0; vb < num_vbuckets; vb++) {
+        check(set_vbucket_state(h, h1, vb, vbucket_state_active),
+              "Failed set_vbucket_state for vbucket");
+    }
+    wait_for_stat_to_be(h, h1, "ep_persist_vbstate_total", num_vbuckets);
+
+    const std::string data(1024, 'x');
+    for (uint16_t vb = 0; vb < num_vbuckets; vb++) {
+        for (int i = 0; i < items_per_vbucket; i++) {
+            const std::string key("key_" + std::to_string(i));
+            checkeq(ENGINE_SUCCESS,
+                    storeCasVb11(h, h1, nullptr, OPERATION_SET, key.c_str(),
+                                 data.c_str(), data.length(), /*flags*/0,
+                                 /*out*/nullptr, /*cas*/0, vb),
+                    "Failed to set a value");
+        }
+    }
+    wait_for_flusher_to_settle(h, h1);
+
+    // Restart so the checkpoints are empty and every stream has to backfill;
+    // the test config stops warmup loading the values, so they are read from
+    // disk.
+    testHarness.reload_engine(&h, &h1, testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, false);
+    wait_for_warmup_complete(h, h1);
+
+    std::vector<hrtime_t> timings;
+    size_t total_bytes = 0;
+    for (int round = 0; round < rounds; ++round) {
+        hrtime_t duration;
+        total_bytes += dcp_backfill_all(h, h1,
+                                        "backfill_" + std::to_string(round),
+                                        num_vbuckets, items_per_vbucket,
+                                        duration);
+        timings.push_back(duration);
+    }
+
+    const size_t tasks = get_int_stat(h, h1, "ep_dcp_backfill_tasks");
+    std::string title("DCP backfill " + std::to_string(tasks) + " task(s)");
+    if (testHarness.output_format == OutputFormat::Text) {
+        hrtime_t total_duration = 0;
+        for (auto t : timings) {
+            total_duration += t;
+        }
+        printf("%s: %d vbuckets, %d items: %.1f MB/s\n", title.c_str(),
+               num_vbuckets, num_vbuckets * items_per_vbucket,
+               total_duration ? total_bytes * 1e3 / total_duration : 0.0);
+    }
+
+    std::string description("Backfill [" + title + "] - " +
+                            std::to_string(rounds) + " rounds (µs)");
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    all_timings.push_back(std::make_pair("Backfill", &timings));
+    output_result(title, description, all_timings, "µs");
+    return SUCCESS;
+}
+
 /*****************************************************************************
  * List of testcases
  *****************************************************************************/
@@ -1453,6 +1681,13 @@ BaseTestCase testsuite_testcases[] = {
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209",
                  prepare, cleanup),
+        TestCase("DCP latency (Padded JSON, batched step)",
+                 perf_dcp_latency_with_batched_step,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209"
+                 // Drain up to 64 messages per stream lock.
+                 ";dcp_producer_step_batch_items=64",
+                 prepare, cleanup),
         TestCaseV2("Multi thread latency", perf_multi_thread_latency,
                    NULL, NULL,
                    "backend=couchdb;ht_size=393209",
@@ -1493,6 +1728,30 @@ BaseTestCase testsuite_testcases[] = {
                  perf_slow_stat_latency_100vb_sets_and_dcp, test_setup,
                  teardown, "backend=couchdb;ht_size=393209", prepare, cleanup),
 
+        TestCase("DCP backfill throughput with 1 task",
+                 perf_dcp_backfill_throughput,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;num_auxio_threads=8"
+                 ";warmup_min_items_threshold=0;dcp_backfill_tasks=1",
+                 prepare, cleanup),
+        TestCase("DCP backfill throughput with 4 tasks",
+                 perf_dcp_backfill_throughput,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;num_auxio_threads=8"
+                 ";warmup_min_items_threshold=0;dcp_backfill_tasks=4",
+                 prepare, cleanup),
+        TestCase("DCP backfill throughput with 8 tasks",
+                 perf_dcp_backfill_throughput,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209;num_auxio_threads=8"
+                 ";warmup_min_items_threshold=0;dcp_backfill_tasks=8",
+                 prepare, cleanup),
+
+        TestCase("Flush latency with 100 vbuckets",
+                 perf_flush_latency_100vb,
+                 test_setup, teardown, "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
+
         TestCase(NULL, NULL, NULL, NULL,
                  "backend=couchdb", prepare, cleanup)
 };
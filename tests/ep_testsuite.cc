@@ -4330,6 +4330,112 @@ static enum test_result test_observe_seqno_failover(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+/*
+ * Mutations which were journaled but never flushed are replayed by warmup
+ * after a crash, keeping their seqnos (and a deletion its system xattrs).
+ */
+static enum test_result test_journal_replay_on_warmup(ENGINE_HANDLE* h,
+                                                      ENGINE_HANDLE_V1* h1) {
+    if (!isWarmupEnabled(h, h1)) {
+        return SKIPPED;
+    }
+
+    item* it = nullptr;
+    checkeq(ENGINE_SUCCESS,
+            store(h, h1, nullptr, OPERATION_SET, "persisted", "value", &it),
+            "Failed to store persisted");
+    h1->release(h, nullptr, it);
+    wait_for_flusher_to_settle(h, h1);
+
+    stop_persistence(h, h1);
+
+    const int num_items = 10;
+    for (int j = 0; j < num_items; ++j) {
+        const std::string key = "key" + std::to_string(j);
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, nullptr, OPERATION_SET, key.c_str(),
+                      ("value" + std::to_string(j)).c_str(), &it),
+                "Failed to store journaled item");
+        h1->release(h, nullptr, it);
+    }
+
+    cb::xattr::Blob blob;
+    blob.set(to_const_byte_buffer("_sync"),
+             to_const_byte_buffer("{\"cas\":\"0xdeadbeefcafefeed\"}"));
+    blob.set(to_const_byte_buffer("user"),
+             to_const_byte_buffer("{\"author\":\"bubba\"}"));
+    auto xattr_value = blob.finalize();
+    std::vector<char> data(xattr_value.buf, xattr_value.buf + xattr_value.len);
+    const std::string body("body");
+    data.insert(data.end(), body.begin(), body.end());
+
+    checkeq(ENGINE_SUCCESS,
+            storeCasVb11(h, h1, nullptr, OPERATION_SET, "xattr_key",
+                         data.data(), data.size(), 0, &it, 0, 0, 0,
+                         PROTOCOL_BINARY_DATATYPE_XATTR),
+            "Failed to store xattr document");
+    h1->release(h, nullptr, it);
+    checkeq(ENGINE_SUCCESS, del(h, h1, "xattr_key", 0, 0),
+            "Failed to delete xattr document");
+
+    const auto high_seqno =
+            get_int_stat(h, h1, "vb_0:high_seqno", "vbucket-seqno");
+    checkeq(1,
+            get_int_stat(h, h1, "vb_0:last_persisted_seqno", "vbucket-seqno"),
+            "Expected only the first mutation to be persisted");
+
+    // Acknowledged once the journal (not the flusher) has synced them.
+    checkeq(ENGINE_SUCCESS,
+            seqnoPersistence(h, h1, nullptr, 0, high_seqno),
+            "Expected the journaled mutations to be durable");
+
+    // Crash, without flushing, and warm up again.
+    testHarness.reload_engine(&h, &h1,
+                              testHarness.engine_path,
+                              testHarness.get_current_testcase()->cfg,
+                              true, true);
+    wait_for_warmup_complete(h, h1);
+
+    checkeq(high_seqno,
+            get_int_stat(h, h1, "vb_0:high_seqno", "vbucket-seqno"),
+            "Expected the journaled mutations' seqnos to be replayed");
+    check_key_value(h, h1, "persisted", "value", 5);
+    for (int j = 0; j < num_items; ++j) {
+        const std::string key = "key" + std::to_string(j);
+        const std::string value = "value" + std::to_string(j);
+        check_key_value(h, h1, key.c_str(), value.c_str(), value.size());
+    }
+
+    checkeq(ENGINE_SUCCESS,
+            get(h, h1, nullptr, &it, "xattr_key", 0,
+                DocStateFilter::AliveOrDeleted),
+            "Unable to get the deleted item");
+    item_info info;
+    check(h1->get_item_info(h, nullptr, it, &info),
+          "Unable to retrieve item info");
+    cb::byte_buffer value_buf{static_cast<uint8_t*>(info.value[0].iov_base),
+                              info.value[0].iov_len};
+    cb::xattr::Blob deleted_blob(value_buf);
+    checkeq(std::string("{\"cas\":\"0xdeadbeefcafefeed\"}"),
+            to_string(deleted_blob.get(to_const_byte_buffer("_sync"))),
+            "Expected the deletion to keep its system xattr");
+    h1->release(h, nullptr, it);
+
+    // The replayed mutations (one per key) are queued on the checkpoint, so
+    // in-memory DCP cursors see them too.
+    checkge(get_int_stat(h, h1, "vb_0:num_checkpoint_items", "checkpoint"),
+            num_items + 1,
+            "Expected the replayed mutations to be in the checkpoint");
+
+    // The replayed mutations are flushed like any others.
+    wait_for_flusher_to_settle(h, h1);
+    checkeq(high_seqno,
+            get_int_stat(h, h1, "vb_0:last_persisted_seqno", "vbucket-seqno"),
+            "Expected the replayed mutations to be persisted");
+
+    return SUCCESS;
+}
+
 static enum test_result test_observe_seqno_error(ENGINE_HANDLE *h,
                                                  ENGINE_HANDLE_V1 *h1) {
 
@@ -6297,6 +6403,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "vb_0:mem_size_counted",
                 "vb_0:min_depth",
                 "vb_0:reported",
+                "vb_0:resize_hold_p99",
+                "vb_0:resize_remaining",
                 "vb_0:resized",
                 "vb_0:size",
                 "vb_0:state"
@@ -6382,10 +6490,12 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         {"checkpoint",
             {
                 "vb_0:last_closed_checkpoint_id",
+                "vb_0:mem_freed_by_expel",
                 "vb_0:mem_usage",
                 "vb_0:num_checkpoint_items",
                 "vb_0:num_checkpoints",
                 "vb_0:num_conn_cursors",
+                "vb_0:num_expelled_items",
                 "vb_0:num_items_for_persistence",
                 "vb_0:num_open_checkpoint_items",
                 "vb_0:open_checkpoint_id",
@@ -6395,10 +6505,12 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
         {"checkpoint 0",
             {
                 "vb_0:last_closed_checkpoint_id",
+                "vb_0:mem_freed_by_expel",
                 "vb_0:mem_usage",
                 "vb_0:num_checkpoint_items",
                 "vb_0:num_checkpoints",
                 "vb_0:num_conn_cursors",
+                "vb_0:num_expelled_items",
                 "vb_0:num_items_for_persistence",
                 "vb_0:num_open_checkpoint_items",
                 "vb_0:open_checkpoint_id",
@@ -6434,6 +6546,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_bg_fetch_delay",
                 "ep_bucket_type",
                 "ep_cache_size",
+                "ep_chk_expel_enabled",
                 "ep_chk_max_items",
                 "ep_chk_period",
                 "ep_chk_remover_stime",
@@ -6449,6 +6562,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_tasks",
+                "ep_dcp_compressed_value_cache_size",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
@@ -6462,6 +6577,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_dcp_idle_timeout",
                 "ep_dcp_noop_tx_interval",
                 "ep_dcp_producer_snapshot_marker_yield_limit",
+                "ep_dcp_producer_step_batch_bytes",
+                "ep_dcp_producer_step_batch_items",
                 "ep_dcp_consumer_process_buffered_messages_yield_limit",
                 "ep_dcp_consumer_process_buffered_messages_batch_size",
                 "ep_dcp_scan_byte_limit",
@@ -6478,15 +6595,26 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_exp_pager_stime",
                 "ep_failpartialwarmup",
                 "ep_flushall_enabled",
+                "ep_flusher_adaptive_batch_enabled",
+                "ep_flusher_min_batch_size",
+                "ep_flusher_pipelined_commit",
+                "ep_flusher_target_persist_latency",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
                 "ep_hlc_drift_ahead_threshold_us",
                 "ep_hlc_drift_behind_threshold_us",
+                "ep_ht_bucket_layout",
+                "ep_ht_inline_value_threshold",
                 "ep_ht_locks",
                 "ep_ht_resize_interval",
+                "ep_ht_resize_migration_batch",
+                "ep_ht_resize_mode",
                 "ep_ht_size",
+                "ep_ht_slab_allocator",
                 "ep_initfile",
                 "ep_item_num_based_new_chk",
+                "ep_journal_enabled",
+                "ep_journal_segment_size",
                 "ep_keep_closed_chks",
                 "ep_max_checkpoints",
                 "ep_max_failover_entries",
@@ -6602,6 +6730,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_bucket_priority",
                 "ep_bucket_type",
                 "ep_cache_size",
+                "ep_chk_expel_enabled",
                 "ep_chk_max_items",
                 "ep_chk_period",
                 "ep_chk_persistence_remains",
@@ -6622,6 +6751,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_tasks",
+                "ep_dcp_compressed_value_cache_size",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
@@ -6637,6 +6768,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_dcp_min_compression_ratio",
                 "ep_dcp_noop_tx_interval",
                 "ep_dcp_producer_snapshot_marker_yield_limit",
+                "ep_dcp_producer_step_batch_bytes",
+                "ep_dcp_producer_step_batch_items",
                 "ep_dcp_scan_byte_limit",
                 "ep_dcp_scan_item_limit",
                 "ep_dcp_takeover_max_time",
@@ -6665,20 +6798,34 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_flush_all",
                 "ep_flush_duration_total",
                 "ep_flushall_enabled",
+                "ep_flusher_adaptive_batch_enabled",
+                "ep_flusher_min_batch_size",
+                "ep_flusher_pipelined_commit",
+                "ep_flusher_target_persist_latency",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
                 "ep_hlc_drift_ahead_threshold_us",
                 "ep_hlc_drift_behind_threshold_us",
+                "ep_ht_bucket_layout",
+                "ep_ht_inline_value_threshold",
                 "ep_ht_locks",
                 "ep_ht_resize_interval",
+                "ep_ht_resize_migration_batch",
+                "ep_ht_resize_mode",
                 "ep_ht_size",
+                "ep_ht_slab_allocator",
                 "ep_initfile",
                 "ep_io_compaction_read_bytes",
                 "ep_io_compaction_write_bytes",
+                "ep_io_items_per_sync",
+                "ep_io_num_sync",
                 "ep_io_total_read_bytes",
                 "ep_io_total_write_bytes",
                 "ep_item_num",
                 "ep_item_num_based_new_chk",
+                "ep_journal_enabled",
+                "ep_journal_segment_size",
+                "ep_items_expelled_from_checkpoints",
                 "ep_items_rm_from_checkpoints",
                 "ep_keep_closed_chks",
                 "ep_kv_size",
@@ -6696,6 +6843,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_max_size",
                 "ep_max_threads",
                 "ep_max_vbuckets",
+                "ep_mem_freed_by_checkpoint_item_expel",
                 "ep_mem_high_wat",
                 "ep_mem_high_wat_percent",
                 "ep_mem_low_wat",
@@ -6758,8 +6906,11 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_startup_time",
                 "ep_storage_age",
                 "ep_storage_age_highwat",
+                "ep_storedval_inline_num",
+                "ep_storedval_inline_saved",
                 "ep_storedval_num",
                 "ep_storedval_overhead",
+                "ep_storedval_slab_size",
                 "ep_storedval_size",
                 "ep_tap",
                 "ep_tap_bg_fetch_requeued",
@@ -7126,8 +7277,11 @@ static enum test_result test_mb19687_variable(ENGINE_HANDLE* h,
                 "ep_mem_low_wat_percent",
                 "ep_oom_errors",
                 "ep_overhead",
+                "ep_storedval_inline_num",
+                "ep_storedval_inline_saved",
                 "ep_storedval_num",
                 "ep_storedval_overhead",
+                "ep_storedval_slab_size",
                 "ep_storedval_size",
                 "ep_tmp_oom_errors",
                 "ep_value_size",
@@ -7505,6 +7659,9 @@ BaseTestCase testsuite_testcases[] = {
                  test_setup, teardown, NULL, prepare, cleanup),
         TestCase("test observe seqno failover", test_observe_seqno_failover,
                  test_setup, teardown, NULL, prepare, cleanup),
+        TestCase("test journal replay on warmup",
+                 test_journal_replay_on_warmup, test_setup, teardown,
+                 "journal_enabled=true", prepare_ep_bucket, cleanup),
         TestCase("test observe seqno error", test_observe_seqno_error,
                  test_setup, teardown, NULL, prepare, cleanup),
         TestCase("test item pager", test_item_pager, test_setup,
@@ -93,6 +93,10 @@ public:
         return backfillItems.memory + backfillItems.disk;
     }
 
+    int getNumBackfillItemsFromMemory() const {
+        return backfillItems.memory;
+    }
+
     int getLastReadSeqno() const {
         return lastReadSeqno;
     }
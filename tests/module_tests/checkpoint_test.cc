@@ -792,6 +792,37 @@ TYPED_TEST(CheckpointTest, ItemsForCheckpointCursor) {
     EXPECT_EQ(2 * MIN_CHECKPOINT_ITEMS + 3, items.size());
 }
 
+// Test getItemsForCursor() stops at its limit, resuming from where it stopped.
+TYPED_TEST(CheckpointTest, ItemsForCheckpointCursorLimited) {
+    for (unsigned int ii = 0; ii < 10; ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+
+    /* op_ckpt_start and the first 3 items */
+    std::vector<queued_item> items;
+    auto result = this->manager->getItemsForCursor(
+            CheckpointManager::pCursorName, items, 4);
+    EXPECT_EQ(4, items.size());
+    EXPECT_TRUE(result.moreAvailable);
+    EXPECT_EQ(0, result.range.start);
+    EXPECT_EQ(1010, result.range.end);
+    EXPECT_EQ(7,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+
+    /* The remaining 7 items */
+    items.clear();
+    result = this->manager->getItemsForCursor(
+            CheckpointManager::pCursorName, items, 0);
+    EXPECT_EQ(7, items.size());
+    EXPECT_FALSE(result.moreAvailable);
+    EXPECT_EQ(1004, items.front()->getBySeqno());
+    EXPECT_EQ(1010, items.back()->getBySeqno());
+    EXPECT_EQ(0,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+}
+
 // Test the checkpoint cursor movement
 TYPED_TEST(CheckpointTest, CursorMovement) {
     /* We want to have items across 2 checkpoints. Size down the default number
@@ -1231,3 +1262,277 @@ TYPED_TEST(CheckpointTest,
     // Test - second item (duplicate key) should return false.
     EXPECT_FALSE(this->queueNewItem("key"));
 }
+
+// Test that CheckpointQueue iteration skips erased items (tombstones), and
+// that positions remain valid as further chunks are appended.
+TEST(CheckpointQueueTest, EraseAndAppend) {
+    const size_t numItems = 3 * CheckpointQueue::ChunkSize + 1;
+    CheckpointQueue queue;
+    std::vector<CheckpointQueue::iterator> positions;
+    for (size_t i = 0; i < numItems; ++i) {
+        queue.push_back(queued_item(new Item(
+                makeStoredDocKey("key" + std::to_string(i)), 0,
+                queue_op::set, 0, i)));
+        positions.push_back(--queue.end());
+    }
+    ASSERT_EQ(numItems, queue.size());
+
+    // Erase every item with an odd seqno.
+    for (size_t i = 1; i < numItems; i += 2) {
+        queue.erase(positions[i]);
+    }
+    EXPECT_EQ(numItems / 2 + 1, queue.size());
+    EXPECT_EQ(numItems / 2, queue.getNumTombstones());
+
+    int64_t expected = 0;
+    for (const auto& qi : queue) {
+        EXPECT_EQ(expected, qi->getBySeqno());
+        expected += 2;
+    }
+    EXPECT_EQ(int64_t(numItems + 1), expected);
+
+    // Positions of the remaining items still refer to them, in both
+    // directions.
+    auto pos = positions[2];
+    EXPECT_EQ(2, (*pos)->getBySeqno());
+    EXPECT_EQ(4, (*++pos)->getBySeqno());
+    EXPECT_EQ(2, (*--pos)->getBySeqno());
+    EXPECT_EQ(0, (*--pos)->getBySeqno());
+    EXPECT_EQ(int64_t(numItems - 1), queue.back()->getBySeqno());
+}
+
+// Test that repeatedly de-duplicating the same keys (which compacts the
+// checkpoint's queue once it is mostly tombstones) leaves the cursor and key
+// index referring to the correct items.
+TYPED_TEST(CheckpointTest, DedupCompaction) {
+    const size_t numKeys = 10;
+    for (size_t i = 0; i < numKeys; ++i) {
+        ASSERT_TRUE(this->queueNewItem("key" + std::to_string(i)));
+    }
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(numKeys + 1, items.size());
+
+    // Enough de-duplicated items to compact the queue many times over.
+    const size_t rounds = 4 * CheckpointQueue::ChunkSize;
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < numKeys; ++i) {
+            this->queueNewItem("key" + std::to_string(i));
+        }
+    }
+    EXPECT_EQ(numKeys + 1, this->manager->getNumOpenChkItems());
+    EXPECT_EQ(numKeys,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+
+    // Cursor should see just the latest version of each key, in order.
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(numKeys, items.size());
+    const int64_t lastSeqno = this->manager->getHighSeqno();
+    for (size_t i = 0; i < numKeys; ++i) {
+        EXPECT_EQ(makeStoredDocKey("key" + std::to_string(i)),
+                  items[i]->getKey());
+        EXPECT_EQ(lastSeqno - int64_t(numKeys - 1 - i),
+                  items[i]->getBySeqno());
+    }
+
+    // The key index must still be correct for further de-duplication: the
+    // first of these is re-persisted, the second de-duplicated.
+    EXPECT_TRUE(this->queueNewItem("key0"));
+    EXPECT_FALSE(this->queueNewItem("key0"));
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(1, items.size());
+    EXPECT_EQ(makeStoredDocKey("key0"), items[0]->getKey());
+}
+
+// Test that items queued concurrently by many threads are each assigned a
+// unique seqno, in order, and are all seen by a concurrent cursor.
+TYPED_TEST(CheckpointTest, ConcurrentQueueDirty) {
+    const size_t numThreads = 4;
+    const size_t itemsPerThread = 1000;
+    std::vector<std::thread> writers;
+    for (size_t t = 0; t < numThreads; ++t) {
+        writers.emplace_back([this, t]() {
+            int64_t lastSeqno = 0;
+            for (size_t i = 0; i < itemsPerThread; ++i) {
+                queued_item qi{new Item(
+                        makeStoredDocKey("t" + std::to_string(t) + "_" +
+                                         std::to_string(i)),
+                        this->vbucket->getId(),
+                        queue_op::set,
+                        /*revSeq*/ 0,
+                        /*bySeq*/ 0)};
+                EXPECT_TRUE(this->manager->queueDirty(
+                        *this->vbucket,
+                        qi,
+                        GenerateBySeqno::Yes,
+                        GenerateCas::Yes,
+                        /*preLinkDocCtx*/ nullptr));
+                EXPECT_GT(qi->getBySeqno(), lastSeqno);
+                lastSeqno = qi->getBySeqno();
+            }
+        });
+    }
+
+    // Drain the persistence cursor while the writers run.
+    std::set<int64_t> seqnos;
+    std::vector<queued_item> items;
+    while (seqnos.size() < numThreads * itemsPerThread) {
+        items.clear();
+        this->manager->getAllItemsForCursor(CheckpointManager::pCursorName,
+                                            items);
+        for (const auto& qi : items) {
+            if (!qi->isCheckPointMetaItem()) {
+                EXPECT_TRUE(seqnos.insert(qi->getBySeqno()).second)
+                        << "Duplicate seqno:" << qi->getBySeqno();
+            }
+        }
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+
+    EXPECT_EQ(1001, *seqnos.begin());
+    EXPECT_EQ(int64_t(1000 + numThreads * itemsPerThread), *seqnos.rbegin());
+}
+
+// Test CheckpointIndex lookup, update and removal (including removal from
+// the middle of a probe sequence) as it grows.
+TEST(CheckpointIndexTest, InsertFindErase) {
+    const int numKeys = 1000;
+    CheckpointQueue queue;
+    CheckpointIndex index;
+    for (int i = 0; i < numKeys; ++i) {
+        queue.push_back(queued_item(
+                new Item(makeStoredDocKey("key" + std::to_string(i)),
+                         0,
+                         queue_op::set,
+                         0,
+                         i)));
+        index.insert(--queue.end(), i);
+    }
+    ASSERT_EQ(numKeys, index.size());
+    EXPECT_EQ(nullptr, index.find(makeStoredDocKey("missing")));
+
+    // Remove every other key.
+    for (int i = 0; i < numKeys; i += 2) {
+        EXPECT_TRUE(index.erase(makeStoredDocKey("key" + std::to_string(i))));
+    }
+    EXPECT_FALSE(index.erase(makeStoredDocKey("key0")));
+    EXPECT_EQ(numKeys / 2, index.size());
+
+    for (int i = 0; i < numKeys; ++i) {
+        const auto key = makeStoredDocKey("key" + std::to_string(i));
+        auto* entry = index.find(key);
+        if (i % 2) {
+            ASSERT_NE(nullptr, entry) << "key:" << i;
+            EXPECT_EQ(i, entry->mutation_id);
+            EXPECT_EQ(key, (*entry->position)->getKey());
+        } else {
+            EXPECT_EQ(nullptr, entry) << "key:" << i;
+        }
+    }
+
+    // Set updates an existing entry in place.
+    queue.push_back(queued_item(new Item(
+            makeStoredDocKey("key1"), 0, queue_op::set, 0, numKeys)));
+    index.set(--queue.end(), numKeys);
+    EXPECT_EQ(numKeys / 2, index.size());
+    EXPECT_EQ(numKeys, index.find(makeStoredDocKey("key1"))->mutation_id);
+}
+
+// Test that expelling the items every cursor has processed keeps the memory
+// used by the checkpoint flat while a lagging cursor references it, and that
+// a cursor subsequently registered for an expelled seqno is told to start
+// after the expelled items.
+TYPED_TEST(CheckpointTest, ExpelItemsWithLaggingCursor) {
+    // Never create a new checkpoint during the test, so the lagging cursor
+    // keeps referencing the single open checkpoint.
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MAX_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 2,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ false,
+                                               /*persistenceEnabled*/ true,
+                                               /*expelEnabled*/ true);
+    this->createManager();
+    const std::string dcpCursor(DCP_CURSOR_PREFIX + std::to_string(0));
+    this->manager->registerCursorBySeqno(
+            dcpCursor, 1000, MustSendCheckpointEnd::NO);
+
+    const size_t itemsPerRound = 100;
+    const size_t numRounds = 20;
+    size_t key = 0;
+    size_t memUsage = 0;
+    std::vector<queued_item> items;
+    for (size_t round = 0; round < numRounds; ++round) {
+        const int64_t prevHighSeqno = this->manager->getHighSeqno();
+        for (size_t i = 0; i < itemsPerRound; ++i) {
+            // Equal length keys, so every item uses the same memory.
+            ASSERT_TRUE(this->queueNewItem(std::to_string(1000000 + key++)));
+        }
+
+        // Persistence keeps up...
+        items.clear();
+        this->manager->getAllItemsForCursor(CheckpointManager::pCursorName,
+                                            items);
+        this->vbucket->setPersistenceSeqno(this->manager->getHighSeqno());
+
+        // ... but the DCP cursor is a round behind.
+        int64_t dcpSeqno = 0;
+        while (round > 0 && dcpSeqno < prevHighSeqno) {
+            bool isLastMutationItem;
+            auto qi = this->manager->nextItem(dcpCursor, isLastMutationItem);
+            ASSERT_NE(queue_op::empty, qi->getOperation());
+            dcpSeqno = qi->getBySeqno();
+        }
+
+        this->manager->expelUnreferencedCheckpointItems(*this->vbucket);
+        if (round == 1) {
+            memUsage = this->manager->getMemoryUsage();
+        } else if (round > 1) {
+            EXPECT_EQ(memUsage, this->manager->getMemoryUsage())
+                    << "round:" << round;
+        }
+    }
+    EXPECT_EQ(1, this->manager->getNumCheckpoints());
+
+    // Everything up to (but excluding) the item the DCP cursor is at has
+    // been expelled.
+    const int64_t dcpSeqno = 1000 + (numRounds - 1) * itemsPerRound;
+    const size_t expelled = dcpSeqno - 1001;
+    EXPECT_EQ(expelled,
+              this->global_stats.itemsExpelledFromCheckpoints.load());
+    EXPECT_LT(0, this->global_stats.memFreedByCheckpointItemExpel.load());
+    // The item the DCP cursor is at and those after it, plus checkpoint_start.
+    EXPECT_EQ(itemsPerRound + 2, this->manager->getNumOpenChkItems());
+    EXPECT_EQ(itemsPerRound, this->manager->getNumItemsForCursor(dcpCursor));
+    EXPECT_EQ(0,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+
+    // Items read by the persistence cursor but not yet persisted are kept.
+    const int64_t persistedSeqno = this->manager->getHighSeqno();
+    for (size_t i = 0; i < 10; ++i) {
+        ASSERT_TRUE(this->queueNewItem(std::to_string(1000000 + key++)));
+    }
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    items.clear();
+    this->manager->getAllItemsForCursor(dcpCursor, items);
+    EXPECT_EQ(size_t(persistedSeqno - dcpSeqno + 1),
+              this->manager->expelUnreferencedCheckpointItems(*this->vbucket));
+
+    // A new cursor from before the expelled items must backfill them.
+    auto result = this->manager->registerCursorBySeqno(
+            "late-cursor", 1000, MustSendCheckpointEnd::NO);
+    EXPECT_EQ(uint64_t(persistedSeqno + 1), result.first);
+    items.clear();
+    this->manager->getAllItemsForCursor("late-cursor", items);
+    ASSERT_EQ(11, items.size());
+    EXPECT_EQ(queue_op::checkpoint_start, items[0]->getOperation());
+    EXPECT_EQ(persistedSeqno + 1, items[1]->getBySeqno());
+}
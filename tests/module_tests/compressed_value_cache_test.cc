@@ -0,0 +1,168 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the CompressedValueCache class.
+ */
+
+#include "config.h"
+
+#include "dcp/compressed_value_cache.h"
+#include "tests/module_tests/test_helpers.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+class CompressedValueCacheTest : public ::testing::Test {
+protected:
+    const std::string value = "{\"product\": \"" + std::string(1000, 'x') +
+                              "\"}";
+    Item makeItem(int64_t seqno, uint64_t cas = 1) {
+        Item item = make_item(0, makeStoredDocKey("key"), value);
+        item.setBySeqno(seqno);
+        item.setCas(cas);
+        return item;
+    }
+
+    Item item = makeItem(1);
+    CompressedValueCache cache{1024 * 1024};
+};
+
+// The value is compressed once, and the compressed Blob shared by all copies
+// (including those of other Items for the same mutation, as backfills make).
+TEST_F(CompressedValueCacheTest, CompressOnce) {
+    Item copy1(item);
+    ASSERT_TRUE(cache.compress(item, copy1, 1.0));
+    EXPECT_TRUE(mcbp::datatype::is_snappy(copy1.getDataType()));
+    EXPECT_TRUE(mcbp::datatype::is_json(copy1.getDataType()));
+    EXPECT_LT(copy1.getNBytes(), value.size());
+
+    Item other = makeItem(1);
+    Item copy2(other);
+    ASSERT_TRUE(cache.compress(other, copy2, 1.0));
+    EXPECT_EQ(copy1.getData(), copy2.getData());
+
+    EXPECT_EQ(1, cache.getMisses());
+    EXPECT_EQ(1, cache.getHits());
+    EXPECT_EQ(2 * (value.size() - copy1.getNBytes()), cache.getBytesSaved());
+
+    // The shared Item is unchanged.
+    EXPECT_FALSE(mcbp::datatype::is_snappy(item.getDataType()));
+    EXPECT_EQ(value, std::string(item.getData(), item.getNBytes()));
+
+    // And the compressed value decompresses to it.
+    ASSERT_TRUE(copy1.decompressValue());
+    EXPECT_EQ(value, std::string(copy1.getData(), copy1.getNBytes()));
+    EXPECT_TRUE(mcbp::datatype::is_snappy(copy2.getDataType()));
+}
+
+// A value which doesn't achieve the compression ratio is sent as it is, and
+// not compressed again.
+TEST_F(CompressedValueCacheTest, MinCompressionRatio) {
+    Item copy1(item);
+    ASSERT_TRUE(cache.compress(item, copy1, 0.01));
+    EXPECT_FALSE(mcbp::datatype::is_snappy(copy1.getDataType()));
+    EXPECT_EQ(value.size(), copy1.getNBytes());
+
+    Item copy2(item);
+    ASSERT_TRUE(cache.compress(item, copy2, 0.01));
+    EXPECT_EQ(value.size(), copy2.getNBytes());
+    EXPECT_EQ(1, cache.getMisses());
+    EXPECT_EQ(1, cache.getHits());
+    EXPECT_EQ(0, cache.getBytesSaved());
+}
+
+// Key-only copies are left alone.
+TEST_F(CompressedValueCacheTest, KeyOnly) {
+    Item copy(item, true /*copyKeyOnly*/);
+    ASSERT_TRUE(cache.compress(item, copy, 1.0));
+    EXPECT_EQ(0, copy.getNBytes());
+    EXPECT_EQ(0, cache.getMisses());
+    EXPECT_EQ(0, cache.getMemoryUsed());
+}
+
+// A different mutation at the same seqno (after a rollback) isn't given the
+// value cached for the old one.
+TEST_F(CompressedValueCacheTest, StaleEntry) {
+    Item copy1(item);
+    ASSERT_TRUE(cache.compress(item, copy1, 1.0));
+
+    const std::string newValue = "{\"product\": \"" +
+                                 std::string(1000, 'y') + "\"}";
+    Item newItem = make_item(0, makeStoredDocKey("key"), newValue);
+    newItem.setBySeqno(1);
+    newItem.setCas(2);
+    Item copy2(newItem);
+    ASSERT_TRUE(cache.compress(newItem, copy2, 1.0));
+    EXPECT_EQ(2, cache.getMisses());
+    EXPECT_NE(copy1.getData(), copy2.getData());
+
+    ASSERT_TRUE(copy2.decompressValue());
+    EXPECT_EQ(newValue, std::string(copy2.getData(), copy2.getNBytes()));
+}
+
+// The cache stays within its size, evicting the oldest values first.
+TEST_F(CompressedValueCacheTest, Bounded) {
+    CompressedValueCache small(64 * 1024);
+    for (int64_t seqno = 1; seqno <= 10000; ++seqno) {
+        Item mutation = makeItem(seqno);
+        Item copy(mutation);
+        ASSERT_TRUE(small.compress(mutation, copy, 1.0));
+        EXPECT_LE(small.getMemoryUsed(), 64 * 1024);
+    }
+    EXPECT_EQ(10000, small.getMisses());
+    EXPECT_GT(small.getMemoryUsed(), 0);
+
+    // The most recent value is still cached; the first one was evicted.
+    Item last = makeItem(10000);
+    Item copy1(last);
+    ASSERT_TRUE(small.compress(last, copy1, 1.0));
+    EXPECT_EQ(1, small.getHits());
+
+    Item first = makeItem(1);
+    Item copy2(first);
+    ASSERT_TRUE(small.compress(first, copy2, 1.0));
+    EXPECT_EQ(1, small.getHits());
+    EXPECT_EQ(10001, small.getMisses());
+}
+
+// Streams racing to send the same Item compress it once between them.
+TEST_F(CompressedValueCacheTest, ConcurrentStreams) {
+    const int numStreams = 8;
+    std::vector<std::thread> streams;
+    std::vector<std::unique_ptr<Item>> copies;
+    for (int ii = 0; ii < numStreams; ++ii) {
+        copies.emplace_back(new Item(item));
+    }
+    for (int ii = 0; ii < numStreams; ++ii) {
+        streams.emplace_back([this, &copies, ii] {
+            EXPECT_TRUE(cache.compress(item, *copies[ii], 1.0));
+        });
+    }
+    for (auto& stream : streams) {
+        stream.join();
+    }
+
+    EXPECT_EQ(1, cache.getMisses());
+    EXPECT_EQ(numStreams - 1, cache.getHits());
+    for (const auto& copy : copies) {
+        EXPECT_EQ(copies[0]->getData(), copy->getData());
+    }
+}
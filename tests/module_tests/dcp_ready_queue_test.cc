@@ -0,0 +1,137 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the DcpReadyQueue class.
+ */
+
+#include "config.h"
+
+#include "dcp/dcp-types.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+// A vbucket is only queued once.
+TEST(DcpReadyQueueTest, PushUnique) {
+    DcpReadyQueue queue(1024);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_TRUE(queue.pushUnique(5));
+    EXPECT_FALSE(queue.pushUnique(5));
+    EXPECT_TRUE(queue.pushUnique(700));
+    EXPECT_TRUE(queue.exists(5));
+    EXPECT_FALSE(queue.exists(6));
+    EXPECT_EQ(2, queue.size());
+
+    uint16_t vbucket;
+    ASSERT_TRUE(queue.popFront(vbucket));
+    EXPECT_EQ(5, vbucket);
+    EXPECT_FALSE(queue.exists(5));
+    ASSERT_TRUE(queue.popFront(vbucket));
+    EXPECT_EQ(700, vbucket);
+    EXPECT_FALSE(queue.popFront(vbucket));
+    EXPECT_TRUE(queue.empty());
+
+    EXPECT_THROW(queue.pushUnique(1024), std::invalid_argument);
+}
+
+// vbuckets are popped round-robin; one pushed back after being popped waits
+// for all the others.
+TEST(DcpReadyQueueTest, RoundRobin) {
+    DcpReadyQueue queue(200);
+    for (uint16_t vb : {150, 3, 64, 199}) {
+        queue.pushUnique(vb);
+    }
+
+    uint16_t vbucket;
+    ASSERT_TRUE(queue.popFront(vbucket));
+    EXPECT_EQ(3, vbucket);
+    queue.pushUnique(3);
+    queue.pushUnique(1);
+
+    std::vector<uint16_t> popped;
+    while (queue.popFront(vbucket)) {
+        popped.push_back(vbucket);
+    }
+    EXPECT_EQ(std::vector<uint16_t>({64, 150, 199, 1, 3}), popped);
+}
+
+// A vbucket which is always ready doesn't starve the others.
+TEST(DcpReadyQueueTest, Fairness) {
+    const uint16_t numVBuckets = 1024;
+    DcpReadyQueue queue(numVBuckets);
+    for (uint16_t vb = 0; vb < numVBuckets; ++vb) {
+        queue.pushUnique(vb);
+    }
+
+    std::vector<int> pops(numVBuckets);
+    uint16_t vbucket;
+    for (int ii = 0; ii < numVBuckets * 3; ++ii) {
+        ASSERT_TRUE(queue.popFront(vbucket));
+        ++pops[vbucket];
+        queue.pushUnique(vbucket);
+        queue.pushUnique(0);
+    }
+    for (auto count : pops) {
+        EXPECT_EQ(3, count);
+    }
+}
+
+// Every vbucket pushed by concurrent front-end threads is popped exactly
+// once per push which added it.
+TEST(DcpReadyQueueTest, ConcurrentPush) {
+    const uint16_t numVBuckets = 1024;
+    const int numThreads = 4;
+    DcpReadyQueue queue(numVBuckets);
+
+    std::atomic<size_t> added{0};
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (int tt = 0; tt < numThreads; ++tt) {
+        threads.emplace_back([&queue, &added, tt] {
+            for (int ii = 0; ii < 100000; ++ii) {
+                if (queue.pushUnique((ii * 7 + tt) % numVBuckets)) {
+                    ++added;
+                }
+            }
+        });
+    }
+
+    size_t popped = 0;
+    std::thread popper([&queue, &done, &popped] {
+        uint16_t vbucket;
+        while (!done) {
+            while (queue.popFront(vbucket)) {
+                ++popped;
+            }
+        }
+        while (queue.popFront(vbucket)) {
+            ++popped;
+        }
+    });
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    done = true;
+    popper.join();
+
+    EXPECT_EQ(added.load(), popped);
+    EXPECT_TRUE(queue.empty());
+}
@@ -422,6 +422,42 @@ TEST_P(StreamTest, test_mb18625) {
         << "Expected no more messages in the readyQ";
 }
 
+// Check that nextBatch drains responses in order, up to the given number of
+// items or bytes.
+TEST_P(StreamTest, NextBatch) {
+    for (int i = 0; i < 5; ++i) {
+        store_item(vbid, "key" + std::to_string(i), "value");
+    }
+
+    setup_dcp_stream();
+    MockActiveStream* mock_stream = static_cast<MockActiveStream*>(stream.get());
+    mock_stream->nextCheckpointItemTask();
+
+    // A dead stream still sends its queued responses, then its STREAM_END:
+    // a snapshot marker, 5 mutations and the STREAM_END in all.
+    mock_stream->setDead(END_STREAM_CLOSED);
+
+    std::deque<DcpResponse*> responses;
+    EXPECT_EQ(1, mock_stream->nextBatch(responses, 100, /*maxBytes*/1));
+    EXPECT_EQ(3, mock_stream->nextBatch(responses, 3, 1024 * 1024));
+    EXPECT_EQ(3, mock_stream->nextBatch(responses, 100, 1024 * 1024));
+    EXPECT_EQ(0, mock_stream->nextBatch(responses, 100, 1024 * 1024));
+
+    ASSERT_EQ(7, responses.size());
+    EXPECT_EQ(DcpResponse::Event::SnapshotMarker, responses.front()->getEvent());
+    uint64_t seqno = 0;
+    for (size_t i = 1; i < 6; ++i) {
+        EXPECT_EQ(DcpResponse::Event::Mutation, responses[i]->getEvent());
+        EXPECT_LT(seqno, *responses[i]->getBySeqno());
+        seqno = *responses[i]->getBySeqno();
+    }
+    EXPECT_EQ(DcpResponse::Event::StreamEnd, responses.back()->getEvent());
+
+    for (auto* response : responses) {
+        delete response;
+    }
+}
+
 /* Stream items from a DCP backfill */
 TEST_P(StreamTest, BackfillOnly) {
     /* Add 3 items */
@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the DocKeyHash hashing and comparison kernels.
+ */
+
+#include "config.h"
+
+#include "dockey_hash.h"
+#include "storeddockey.h"
+
+#include <gtest/gtest.h>
+
+#include <unordered_set>
+#include <vector>
+
+// Check equal() for every key length (covering each of the vectorised
+// paths and their tails), with a difference at each position.
+TEST(DocKeyHashTest, Equal) {
+    for (size_t len = 0; len <= 256; ++len) {
+        std::vector<uint8_t> a(len), b(len);
+        for (size_t ii = 0; ii < len; ++ii) {
+            a[ii] = b[ii] = uint8_t(ii * 7 + len);
+        }
+        EXPECT_TRUE(DocKeyHash::equal(a.data(), b.data(), len))
+                << "len:" << len;
+        for (size_t ii = 0; ii < len; ++ii) {
+            b[ii] ^= 0x80;
+            EXPECT_FALSE(DocKeyHash::equal(a.data(), b.data(), len))
+                    << "len:" << len << " diff at:" << ii;
+            b[ii] ^= 0x80;
+        }
+    }
+}
+
+TEST(DocKeyHashTest, HashDependsOnEveryByte) {
+    for (size_t len = 1; len <= 256; ++len) {
+        std::vector<uint8_t> key(len, 'k');
+        const auto base = DocKeyHash::hash64(key.data(), len, 0);
+        for (size_t ii = 0; ii < len; ++ii) {
+            key[ii] ^= 1;
+            EXPECT_NE(base, DocKeyHash::hash64(key.data(), len, 0))
+                    << "len:" << len << " diff at:" << ii;
+            key[ii] ^= 1;
+        }
+        EXPECT_NE(base, DocKeyHash::hash64(key.data(), len, 1))
+                << "hash should depend on seed";
+    }
+    // Zero bytes must not hash the same as a shorter key.
+    const uint8_t zeros[8] = {};
+    EXPECT_NE(DocKeyHash::hash64(zeros, 3, 0),
+              DocKeyHash::hash64(zeros, 4, 0));
+}
+
+TEST(DocKeyHashTest, KeyHash) {
+    const StoredDocKey key("key", DocNamespace::DefaultCollection);
+    const StoredDocKey sameKey("key", DocNamespace::DefaultCollection);
+    const StoredDocKey otherNamespace("key", DocNamespace::Collections);
+    EXPECT_EQ(DocKeyHash::hash(key), DocKeyHash::hash(sameKey));
+    EXPECT_EQ(DocKeyHash::hash(key), DocKeyHash::hash(DocKey(key)));
+    EXPECT_NE(DocKeyHash::hash(key), DocKeyHash::hash(otherNamespace));
+
+    EXPECT_TRUE(DocKeyHash::KeyEqual()(key, sameKey));
+    EXPECT_FALSE(DocKeyHash::KeyEqual()(key, otherNamespace));
+    EXPECT_FALSE(DocKeyHash::KeyEqual()(
+            key, StoredDocKey("key2", DocNamespace::DefaultCollection)));
+}
+
+// Basic distribution check - sequential keys should have distinct hashes,
+// spread over the low bits (used to select a HashTable bucket).
+TEST(DocKeyHashTest, Distribution) {
+    const size_t numKeys = 100000;
+    std::unordered_set<uint32_t> hashes;
+    std::unordered_set<uint32_t> buckets;
+    for (size_t ii = 0; ii < numKeys; ++ii) {
+        const auto hash = DocKeyHash::hash(StoredDocKey(
+                "key" + std::to_string(ii), DocNamespace::DefaultCollection));
+        hashes.insert(hash);
+        buckets.insert(hash % 1024);
+    }
+    EXPECT_GT(hashes.size(), numKeys * 0.999);
+    EXPECT_EQ(1024, buckets.size());
+}
@@ -407,6 +407,117 @@ TEST_F(SingleThreadedEPBucketTest, MB22960_cursor_dropping_data_loss) {
     EXPECT_EQ(2, ckpt_mgr.getNumOfCursors());
 }
 
+/*
+ * With dcp_backfill_tasks > 1 a producer's backfills are run by that many
+ * AUXIO tasks, one vbucket per task at a time.
+ */
+class ParallelBackfillTest : public SingleThreadedEPBucketTest {
+protected:
+    void SetUp() override {
+        config_string += "dcp_backfill_tasks=2";
+        SingleThreadedEPBucketTest::SetUp();
+    }
+};
+
+TEST_F(ParallelBackfillTest, BackfillsRunOnSeparateTasks) {
+    dcp_producer_t producer = new MockDcpProducer(*engine,
+                                                  cookie,
+                                                  "test_producer",
+                                                  /*notifyOnly*/false);
+    std::vector<stream_t> streams;
+    for (uint16_t vb : {0, 1}) {
+        setVBucketStateAndRunPersistTask(vb, vbucket_state_active);
+        store_item(vb, makeStoredDocKey("key"), "value");
+        EXPECT_EQ(1, store->flushVBucket(vb));
+
+        // Remove the item's checkpoint so it has to be backfilled from disk.
+        auto vbucket = store->getVBuckets().getBucket(vb);
+        auto& ckpt_mgr = vbucket->checkpointManager;
+        ckpt_mgr.createNewCheckpoint();
+        bool new_ckpt_created;
+        ckpt_mgr.removeClosedUnrefCheckpoints(*vbucket, new_ckpt_created);
+        EXPECT_EQ(1, ckpt_mgr.getNumCheckpoints());
+
+        streams.push_back(new MockActiveStream(
+                static_cast<EventuallyPersistentEngine*>(engine.get()),
+                producer,
+                producer->getName(),
+                /*flags*/0,
+                /*opaque*/0, vb,
+                /*st_seqno*/0,
+                /*en_seqno*/~0,
+                /*vb_uuid*/0xabcd,
+                /*snap_start_seqno*/0,
+                /*snap_end_seqno*/~0));
+        static_cast<MockActiveStream*>(streams.back().get())
+                ->transitionStateToBackfilling();
+    }
+
+    // A task for each backfill.
+    auto& lpAuxioQ = *task_executor->getLpTaskQ()[AUXIO_TASK_IDX];
+    EXPECT_EQ(2, lpAuxioQ.getFutureQueueSize());
+
+    // backfill:create(), backfill:scan() and backfill:complete() for each
+    // vbucket.
+    for (int ii = 0; ii < 6; ++ii) {
+        runNextTask(lpAuxioQ);
+    }
+
+    for (auto& stream : streams) {
+        auto* mock_stream = static_cast<MockActiveStream*>(stream.get());
+        EXPECT_FALSE(mock_stream->public_isBackfillTaskRunning());
+        // Snapshot marker and the mutation.
+        EXPECT_EQ(2, mock_stream->public_readyQ().size());
+    }
+}
+
+/*
+ * A disk backfill sends the items whose values are resident from memory,
+ * only reading the other values from disk.
+ */
+TEST_F(SingleThreadedEPBucketTest, BackfillResidentItemsFromMemory) {
+    setVBucketStateAndRunPersistTask(vbid, vbucket_state_active);
+    store_item(vbid, makeStoredDocKey("resident"), "value");
+    store_item(vbid, makeStoredDocKey("ejected"), "value");
+    EXPECT_EQ(2, store->flushVBucket(vbid));
+    evict_key(vbid, makeStoredDocKey("ejected"));
+
+    // Remove the items' checkpoint so they have to be backfilled.
+    auto vb = store->getVBuckets().getBucket(vbid);
+    auto& ckpt_mgr = vb->checkpointManager;
+    ckpt_mgr.createNewCheckpoint();
+    bool new_ckpt_created;
+    ckpt_mgr.removeClosedUnrefCheckpoints(*vb, new_ckpt_created);
+    EXPECT_EQ(1, ckpt_mgr.getNumCheckpoints());
+
+    dcp_producer_t producer = new MockDcpProducer(*engine,
+                                                  cookie,
+                                                  "test_producer",
+                                                  /*notifyOnly*/false);
+    stream_t stream = new MockActiveStream(
+            static_cast<EventuallyPersistentEngine*>(engine.get()),
+            producer,
+            producer->getName(),
+            /*flags*/0,
+            /*opaque*/0, vbid,
+            /*st_seqno*/0,
+            /*en_seqno*/~0,
+            /*vb_uuid*/0xabcd,
+            /*snap_start_seqno*/0,
+            /*snap_end_seqno*/~0);
+    auto* mock_stream = static_cast<MockActiveStream*>(stream.get());
+    mock_stream->transitionStateToBackfilling();
+
+    // backfill:create(), backfill:scan() and backfill:complete()
+    auto& lpAuxioQ = *task_executor->getLpTaskQ()[AUXIO_TASK_IDX];
+    for (int ii = 0; ii < 3; ++ii) {
+        runNextTask(lpAuxioQ);
+    }
+
+    EXPECT_EQ(2, mock_stream->getNumBackfillItems());
+    EXPECT_EQ(1, mock_stream->getNumBackfillItemsFromMemory());
+}
+
 /**
  * Regression test for MB-22451: When handleSlowStream is called and in
  * StreamBackfilling state and currently have a backfill scheduled (or running)
@@ -40,6 +40,7 @@
 #include <xattr/blob.h>
 #include <xattr/utils.h>
 
+#include <chrono>
 #include <thread>
 
 // Verify that when handling a bucket delete with open DCP
@@ -462,6 +463,131 @@ TEST_P(EPStoreEvictionTest, xattrExpiryOnFullyEvictedItem) {
                 "The foo attribute should be gone";
 }
 
+// Check that the background fetches getMulti queues for non-resident keys
+// share one notification group, so the cookie is notified once - with the
+// first failure, if any - when the last of them completes.
+TEST_P(EPStoreEvictionTest, GetMultiNotifiesOnce) {
+    std::vector<StoredDocKey> storedKeys;
+    for (int ii = 0; ii < 3; ++ii) {
+        storedKeys.push_back(makeStoredDocKey("key" + std::to_string(ii)));
+        store_item(vbid, storedKeys.back(), "value");
+    }
+    flush_vbucket_to_disk(vbid, int(storedKeys.size()));
+    for (const auto& key : storedKeys) {
+        evict_key(vbid, key);
+    }
+
+    const std::vector<DocKey> keys(storedKeys.begin(), storedKeys.end());
+    const auto options = static_cast<get_options_t>(
+            HONOR_STATES | TRACK_REFERENCE | QUEUE_BG_FETCH);
+    auto vb = store->getVBucket(vbid);
+    auto results = vb->getMulti(keys, cookie, *engine, 0, options, false);
+    ASSERT_EQ(keys.size(), results.size());
+    for (const auto& result : results) {
+        EXPECT_EQ(ENGINE_EWOULDBLOCK, result.getStatus());
+        EXPECT_EQ(nullptr, result.getValue());
+    }
+
+    auto fetches = vb->getBGFetchItems();
+    ASSERT_EQ(keys.size(), fetches.size());
+    std::vector<BGFetchNotifyGroup*> groups;
+    for (const auto& fetch : fetches) {
+        for (const auto& item : fetch.second.bgfetched_list) {
+            groups.push_back(item->notifyGroup.get());
+        }
+    }
+    ASSERT_EQ(keys.size(), groups.size());
+    ASSERT_NE(nullptr, groups.front());
+    for (auto* group : groups) {
+        EXPECT_EQ(groups.front(), group);
+    }
+
+    ENGINE_ERROR_CODE status = ENGINE_SUCCESS;
+    EXPECT_FALSE(groups.front()->complete(status));
+    status = ENGINE_KEY_ENOENT;
+    EXPECT_FALSE(groups.front()->complete(status));
+    status = ENGINE_SUCCESS;
+    EXPECT_TRUE(groups.front()->complete(status));
+    EXPECT_EQ(ENGINE_KEY_ENOENT, status);
+}
+
+// Check that a pipelined flush - each vBucket's commit overlapping with taking
+// and writing the next vBucket's items - persists each vBucket's items,
+// vbucket_state and snapshot, and runs all of their persistence callbacks.
+TEST_P(EPStoreEvictionTest, PipelinedFlush) {
+    // Three vBuckets of vbid's shard.
+    KVShard* shard = store->getVBuckets().getShardByVbId(vbid);
+    const size_t numShards = store->getVBuckets().getNumShards();
+    std::vector<uint16_t> vbids;
+    for (size_t ii = 0; ii < 3; ++ii) {
+        vbids.push_back(vbid + ii * numShards);
+        store->setVBucketState(vbids.back(), vbucket_state_active, false);
+    }
+
+    auto flushPipelined = [this, shard](std::vector<uint16_t> toFlush) {
+        size_t flushed = 0;
+        const auto deadline =
+                std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!toFlush.empty() &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::vector<uint16_t> retry;
+            flushed += store->flushVBucketsPipelined(*shard, toFlush, retry);
+            toFlush.swap(retry);
+        }
+        EXPECT_TRUE(toFlush.empty()) << "Timed out retrying the flush";
+        return flushed;
+    };
+
+    auto checkPersisted = [this](uint16_t id) {
+        VBucketPtr vb = store->getVBucket(id);
+        const uint64_t highSeqno = vb->getHighSeqno();
+        EXPECT_EQ(highSeqno, vb->getPersistenceSeqno());
+
+        // The persisted vbucket_state matches the vBucket.
+        vbucket_state* vbstate =
+                store->getRWUnderlying(id)->getVBucketState(id);
+        ASSERT_NE(nullptr, vbstate);
+        EXPECT_EQ(vb->getState(), vbstate->state);
+        EXPECT_EQ(highSeqno, uint64_t(vbstate->highSeqno));
+        EXPECT_EQ(vb->getPersistedSnapshot().start, vbstate->lastSnapStart);
+        EXPECT_EQ(vb->getPersistedSnapshot().end, vbstate->lastSnapEnd);
+        EXPECT_LE(highSeqno, vbstate->lastSnapEnd);
+    };
+
+    for (auto id : vbids) {
+        ASSERT_TRUE(store_items(10, id, makeStoredDocKey("key"), "value"));
+    }
+    EXPECT_EQ(30, flushPipelined(vbids));
+
+    EPStats& stats = engine->getEpStats();
+    EXPECT_EQ(0, stats.diskQueueSize.load());
+    EXPECT_EQ(30, stats.totalPersisted.load());
+    for (auto id : vbids) {
+        checkPersisted(id);
+        EXPECT_EQ(10, store->getVBucket(id)->getNumItems());
+        // The persistence callbacks have marked the items clean, so they can
+        // be evicted.
+        evict_key(id, makeStoredDocKey("key0"));
+    }
+
+    // Deletes in one vBucket, a state change alone in the next (persisted
+    // while preparing it, as the first one's commit is in flight) and more
+    // sets in the last.
+    delete_item(vbids[0], makeStoredDocKey("key1"));
+    delete_item(vbids[0], makeStoredDocKey("key2"));
+    store->setVBucketState(vbids[1], vbucket_state_replica, false);
+    ASSERT_TRUE(store_items(5, vbids[2], makeStoredDocKey("key_b"), "value"));
+    EXPECT_EQ(7, flushPipelined(vbids));
+
+    EXPECT_EQ(0, stats.diskQueueSize.load());
+    for (auto id : vbids) {
+        checkPersisted(id);
+    }
+    EXPECT_EQ(8, store->getVBucket(vbids[0])->getNumItems());
+    EXPECT_EQ(10, store->getVBucket(vbids[1])->getNumItems());
+    EXPECT_EQ(15, store->getVBucket(vbids[2])->getNumItems());
+}
+
 // Test cases which run in both Full and Value eviction
 INSTANTIATE_TEST_CASE_P(FullAndValueEviction,
                         EPStoreEvictionTest,
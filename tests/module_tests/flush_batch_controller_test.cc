@@ -0,0 +1,113 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the FlushBatchController class.
+ */
+
+#include "config.h"
+
+#include "flush_batch_controller.h"
+#include "stats.h"
+
+#include <gtest/gtest.h>
+
+class FlushBatchControllerTest : public ::testing::Test {
+protected:
+    FlushBatchControllerTest()
+        : dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4),
+                        25) {
+        controller.setTargetLatency(100000);
+    }
+
+    // Record flushes costing 1000us per commit plus 10us per item, of
+    // alternately 100 and 1000 items.
+    void recordFlushes(int count) {
+        for (int ii = 0; ii < count; ++ii) {
+            const size_t items = (ii % 2) ? 1000 : 100;
+            controller.recordFlush(items, 1000 + 10 * items);
+        }
+    }
+
+    FlushBatchController controller;
+    Histogram<hrtime_t> dirtyAgeHisto;
+};
+
+// With nothing to model the flushes on, batches aren't limited.
+TEST_F(FlushBatchControllerTest, UnlimitedUntilModelled) {
+    EXPECT_EQ(0, controller.getBatchLimit(4000));
+
+    // Flushes all of the same size don't separate commit and item costs.
+    for (int ii = 0; ii < 10; ++ii) {
+        controller.recordFlush(100, 2000);
+    }
+    EXPECT_EQ(0, controller.getBatchLimit(4000));
+    EXPECT_EQ(0, controller.getLastBatchLimit());
+}
+
+// Batches are sized to drain the queue within the target latency.
+TEST_F(FlushBatchControllerTest, ModelledLimit) {
+    recordFlushes(10);
+
+    // 4000 items take 40000us to write, leaving 60000us for commits:
+    // 4000 * 1000 / 60000 = 66.7 items per commit.
+    EXPECT_EQ(67, controller.getBatchLimit(4000));
+    EXPECT_EQ(67, controller.getLastBatchLimit());
+
+    // A queue which can't be written within the target isn't limited.
+    EXPECT_EQ(0, controller.getBatchLimit(10000));
+
+    controller.setMinBatchSize(500);
+    EXPECT_EQ(500, controller.getBatchLimit(4000));
+}
+
+// Items persisted later than the target scale the batch size up until they
+// no longer are.
+TEST_F(FlushBatchControllerTest, DirtyAgeBoost) {
+    recordFlushes(10);
+    controller.setTargetLatency(ONE_SECOND);
+    EXPECT_EQ(1, controller.getBoost());
+
+    dirtyAgeHisto.add(2 * ONE_SECOND);
+    controller.updateDirtyAge(dirtyAgeHisto);
+    EXPECT_EQ(2, controller.getBoost());
+
+    dirtyAgeHisto.add(2 * ONE_SECOND);
+    controller.updateDirtyAge(dirtyAgeHisto);
+    EXPECT_EQ(4, controller.getBoost());
+    const size_t boosted = controller.getBatchLimit(4000);
+
+    // No new items; no change.
+    controller.updateDirtyAge(dirtyAgeHisto);
+    EXPECT_EQ(4, controller.getBoost());
+
+    dirtyAgeHisto.add(ONE_SECOND / 2);
+    controller.updateDirtyAge(dirtyAgeHisto);
+    EXPECT_EQ(2, controller.getBoost());
+    EXPECT_EQ(boosted / 2, controller.getBatchLimit(4000));
+
+    // A reset of the histogram is ignored.
+    dirtyAgeHisto.reset();
+    controller.updateDirtyAge(dirtyAgeHisto);
+    EXPECT_EQ(2, controller.getBoost());
+
+    for (size_t ii = 0; ii < 10; ++ii) {
+        dirtyAgeHisto.add(2 * ONE_SECOND);
+        controller.updateDirtyAge(dirtyAgeHisto);
+    }
+    EXPECT_EQ(FlushBatchController::MaxBoost, controller.getBoost());
+}
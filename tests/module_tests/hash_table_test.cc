@@ -30,7 +30,10 @@
 
 #include <algorithm>
 #include <limits>
+#include <map>
+#include <numeric>
 #include <signal.h>
+#include <thread>
 
 EPStats global_stats;
 
@@ -249,6 +252,114 @@ TEST_F(HashTableTest, Resize) {
     verifyFound(h, keys);
 }
 
+TEST_F(HashTableTest, IncrementalResize) {
+    HashTable h(global_stats,
+                makeFactory(),
+                5,
+                3,
+                HashTable::ResizeMode::Incremental);
+    // Sizes are rounded up to a multiple of the lock count.
+    ASSERT_EQ(6, h.getSize());
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    h.resize(769);
+    EXPECT_EQ(771, h.getSize());
+    EXPECT_TRUE(h.isResizing());
+    EXPECT_EQ(6, h.getNumResizeBucketsRemaining());
+
+    // All items are still in the old bucket array, but must be found.
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    // Migrate part of the table; keys must be found in either array, and
+    // newly stored / deleted keys must work across both.
+    EXPECT_TRUE(h.migrateBuckets(2));
+    EXPECT_EQ(4, h.getNumResizeBucketsRemaining());
+    verifyFound(h, keys);
+    EXPECT_EQ(1000, count(h));
+
+    auto moreKeys = generateKeys(1100, 1000);
+    storeMany(h, moreKeys);
+    for (const auto& key : moreKeys) {
+        EXPECT_TRUE(del(h, key));
+    }
+    EXPECT_TRUE(del(h, keys.back()));
+    keys.pop_back();
+
+    // A further resize cannot start until this one completes.
+    h.resize(6143);
+    EXPECT_EQ(771, h.getSize());
+
+    EXPECT_FALSE(h.migrateBuckets(100));
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(0, h.getNumResizeBucketsRemaining());
+    EXPECT_EQ(1, h.getNumResizes());
+    verifyFound(h, keys);
+    EXPECT_EQ(999, count(h));
+
+    HashTableDepthStatVisitor depthCounter;
+    h.visitDepth(depthCounter);
+    EXPECT_EQ(999, depthCounter.size);
+}
+
+// Check the cache-line bucket layout finds (and stops finding) items,
+// including when buckets overflow the per-bucket index.
+TEST_F(HashTableTest, CacheLineLayout) {
+    HashTable h(global_stats,
+                makeFactory(),
+                5,
+                1,
+                HashTable::ResizeMode::Blocking,
+                HashTable::BucketLayout::CacheLine);
+
+    // 1000 keys in 5 buckets; every bucket overflows its index.
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+    verifyFound(h, keys);
+
+    std::vector<StoredDocKey> deleted(keys.begin() + 500, keys.end());
+    keys.resize(500);
+    for (const auto& key : deleted) {
+        EXPECT_TRUE(del(h, key));
+    }
+    for (const auto& key : deleted) {
+        EXPECT_FALSE(h.find(key, TrackReference::No, WantsDeleted::Yes));
+    }
+    verifyFound(h, keys);
+
+    // After growing, most buckets should be fully indexed.
+    h.resize(769);
+    verifyFound(h, keys);
+    for (const auto& key : keys) {
+        EXPECT_TRUE(del(h, key));
+    }
+    EXPECT_EQ(0, count(h));
+}
+
+TEST_F(HashTableTest, CacheLineLayoutIncrementalResize) {
+    HashTable h(global_stats,
+                makeFactory(),
+                5,
+                3,
+                HashTable::ResizeMode::Incremental,
+                HashTable::BucketLayout::CacheLine);
+
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    h.resize(769);
+    EXPECT_TRUE(h.migrateBuckets(3));
+    verifyFound(h, keys);
+    EXPECT_FALSE(h.migrateBuckets(3));
+    verifyFound(h, keys);
+    for (const auto& key : keys) {
+        EXPECT_TRUE(del(h, key));
+    }
+    EXPECT_EQ(0, count(h));
+}
+
 class AccessGenerator : public Generator<bool> {
 public:
 
@@ -293,6 +404,123 @@ TEST_F(HashTableTest, ConcurrentAccessResize) {
     getCompletedThreads(4, &gen);
 }
 
+// Check findShared() sees the same items as find(), and backs off while a
+// writer holds the bucket.
+TEST_F(HashTableTest, FindShared) {
+    HashTable h(global_stats, makeFactory(), 5, 3);
+
+    auto keys = generateKeys(100);
+    storeMany(h, keys);
+
+    for (const auto& key : keys) {
+        const StoredValue* found = nullptr;
+        EXPECT_TRUE(h.findShared(
+                key, [&found](const StoredValue* v) { found = v; }));
+        EXPECT_EQ(h.find(key, TrackReference::No, WantsDeleted::No), found);
+    }
+
+    auto missing = makeStoredDocKey("missing");
+    bool called = false;
+    EXPECT_TRUE(h.findShared(missing, [&called](const StoredValue* v) {
+        EXPECT_EQ(nullptr, v);
+        called = true;
+    }));
+    EXPECT_TRUE(called);
+
+    {
+        auto hbl = h.getLockedBucket(keys[0]);
+        called = false;
+        EXPECT_FALSE(h.findShared(
+                keys[0], [&called](const StoredValue*) { called = true; }));
+        EXPECT_FALSE(called);
+    }
+    EXPECT_TRUE(h.findShared(keys[0], [](const StoredValue* v) {
+        EXPECT_NE(nullptr, v);
+    }));
+}
+
+class SharedReadGenerator : public Generator<bool> {
+public:
+    SharedReadGenerator(const std::vector<StoredDocKey>& k, HashTable& h)
+        : keys(k), ht(h) {
+    }
+
+    bool operator()() {
+        for (int iteration = 0; iteration < 10; ++iteration) {
+            for (const auto& key : keys) {
+                ht.findShared(key, [&key](const StoredValue* v) {
+                    if (v) {
+                        EXPECT_TRUE(v->hasKey(key));
+                        EXPECT_NE(nullptr, v->getValue().get());
+                    }
+                });
+            }
+        }
+        return true;
+    }
+
+private:
+    const std::vector<StoredDocKey>& keys;
+    HashTable& ht;
+};
+
+// Shared readers racing with writers which delete and resize.
+TEST_F(HashTableTest, ConcurrentSharedReadResize) {
+    HashTable h(global_stats, makeFactory(), 5, 3);
+
+    auto keys = generateKeys(2000);
+    storeMany(h, keys);
+
+    srand(918475);
+    SharedReadGenerator readers(keys, h);
+    AccessGenerator writer(keys, h);
+    std::thread writerThread([&writer]() { writer(); });
+    getCompletedThreads(4, &readers);
+    writerThread.join();
+}
+
+// Check the (sharded) item counts and memory sizes are exact once
+// concurrent sets and deletes from many threads have finished.
+TEST_F(HashTableTest, ConcurrentStats) {
+    HashTable h(global_stats, makeFactory(), 5, 3);
+    const size_t numThreads = 8;
+    const size_t keysPerThread = 500;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&h, t, keysPerThread]() {
+            for (size_t i = 0; i < keysPerThread; ++i) {
+                auto key = makeStoredDocKey("t" + std::to_string(t) + "_" +
+                                            std::to_string(i));
+                Item item(key, 0, 0, "value", 5);
+                h.set(item);
+                // Delete every other key.
+                if (i % 2) {
+                    auto hbl = h.getLockedBucket(key);
+                    h.unlocked_del(hbl, key);
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const size_t expected = numThreads * keysPerThread / 2;
+    EXPECT_EQ(expected, h.getNumItems());
+    EXPECT_EQ(expected, h.getNumInMemoryItems());
+    EXPECT_EQ(0, h.getNumInMemoryNonResItems());
+    EXPECT_EQ(0, h.getNumTempItems());
+    const auto datatypeCounts = h.getDatatypeCounts();
+    EXPECT_EQ(expected,
+              std::accumulate(
+                      datatypeCounts.begin(), datatypeCounts.end(), size_t(0)));
+
+    // With every item resident, the item memory and cache size must agree.
+    EXPECT_EQ(h.getItemMemory(), h.getCacheSize());
+    EXPECT_LT(0, h.getMetaDataMemory());
+}
+
 TEST_F(HashTableTest, AutoResize) {
     HashTable h(global_stats, makeFactory(), 5, 3);
 
@@ -308,6 +536,59 @@ TEST_F(HashTableTest, AutoResize) {
     verifyFound(h, keys);
 }
 
+// Collects the keys of the items visited.
+class SampleCollector : public HashTableVisitor {
+public:
+    void visit(const HashTable::HashBucketLock& lh, StoredValue* v) override {
+        ++counts[StoredDocKey(v->getKey())];
+    }
+
+    std::map<StoredDocKey, size_t> counts;
+};
+
+TEST_F(HashTableTest, RandomSample) {
+    HashTable h(global_stats, makeFactory(), 47, 1);
+
+    SampleCollector empty;
+    EXPECT_EQ(0, h.visitRandomSample(empty, 10, 1));
+    EXPECT_FALSE(h.getRandomKey(1));
+
+    auto keys = generateKeys(40);
+    storeMany(h, keys);
+
+    // Soft-delete every fourth key; these should never be sampled.
+    for (size_t i = 0; i < keys.size(); i += 4) {
+        auto hbl = h.getLockedBucket(keys[i]);
+        StoredValue* v = h.unlocked_find(keys[i],
+                                         hbl.getBucketNum(),
+                                         WantsDeleted::No,
+                                         TrackReference::No);
+        ASSERT_TRUE(v);
+        h.unlocked_softDelete(hbl.getHTLock(), *v, /*onlyMarkDeleted*/ false);
+    }
+
+    const size_t samples = 30000;
+    SampleCollector collector;
+    EXPECT_EQ(samples, h.visitRandomSample(collector, samples, 12345));
+
+    // Every live key should be sampled roughly equally often (30 keys, so
+    // ~1000 times each), and no deleted key sampled at all.
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const auto it = collector.counts.find(keys[i]);
+        if (i % 4 == 0) {
+            EXPECT_EQ(collector.counts.end(), it) << keys[i].c_str();
+        } else {
+            ASSERT_NE(collector.counts.end(), it) << keys[i].c_str();
+            EXPECT_GT(it->second, 500) << keys[i].c_str();
+            EXPECT_LT(it->second, 1500) << keys[i].c_str();
+        }
+    }
+
+    auto item = h.getRandomKey(random());
+    ASSERT_TRUE(item);
+    EXPECT_FALSE(item->isDeleted());
+}
+
 TEST_F(HashTableTest, DepthCounting) {
     HashTable h(global_stats, makeFactory(), 5, 1);
     const int nkeys = 5000;
@@ -331,8 +612,8 @@ TEST_F(HashTableTest, PoisonKey) {
 TEST_F(HashTableTest, SizeStats) {
     global_stats.reset();
     HashTable ht(global_stats, makeFactory(), 5, 1);
-    ASSERT_EQ(0, ht.memSize.load());
-    ASSERT_EQ(0, ht.cacheSize.load());
+    ASSERT_EQ(0, ht.getItemMemory());
+    ASSERT_EQ(0, ht.getCacheSize());
     size_t initialSize = global_stats.currentSize.load();
 
     StoredDocKey k = makeStoredDocKey("somekey");
@@ -346,8 +627,8 @@ TEST_F(HashTableTest, SizeStats) {
 
     del(ht, k);
 
-    EXPECT_EQ(0, ht.memSize.load());
-    EXPECT_EQ(0, ht.cacheSize.load());
+    EXPECT_EQ(0, ht.getItemMemory());
+    EXPECT_EQ(0, ht.getCacheSize());
     EXPECT_EQ(initialSize, global_stats.currentSize.load());
 
     cb_free(someval);
@@ -356,8 +637,8 @@ TEST_F(HashTableTest, SizeStats) {
 TEST_F(HashTableTest, SizeStatsFlush) {
     global_stats.reset();
     HashTable ht(global_stats, makeFactory(), 5, 1);
-    ASSERT_EQ(0, ht.memSize.load());
-    ASSERT_EQ(0, ht.cacheSize.load());
+    ASSERT_EQ(0, ht.getItemMemory());
+    ASSERT_EQ(0, ht.getCacheSize());
     size_t initialSize = global_stats.currentSize.load();
 
     StoredDocKey k = makeStoredDocKey("somekey");
@@ -371,8 +652,8 @@ TEST_F(HashTableTest, SizeStatsFlush) {
 
     ht.clear();
 
-    EXPECT_EQ(0, ht.memSize.load());
-    EXPECT_EQ(0, ht.cacheSize.load());
+    EXPECT_EQ(0, ht.getItemMemory());
+    EXPECT_EQ(0, ht.getCacheSize());
     EXPECT_EQ(initialSize, global_stats.currentSize.load());
 
     cb_free(someval);
@@ -381,8 +662,8 @@ TEST_F(HashTableTest, SizeStatsFlush) {
 TEST_F(HashTableTest, SizeStatsEject) {
     global_stats.reset();
     HashTable ht(global_stats, makeFactory(), 5, 1);
-    ASSERT_EQ(0, ht.memSize.load());
-    ASSERT_EQ(0, ht.cacheSize.load());
+    ASSERT_EQ(0, ht.getItemMemory());
+    ASSERT_EQ(0, ht.getCacheSize());
     size_t initialSize = global_stats.currentSize.load();
 
     StoredDocKey key = makeStoredDocKey("somekey");
@@ -402,8 +683,8 @@ TEST_F(HashTableTest, SizeStatsEject) {
 
     del(ht, key);
 
-    EXPECT_EQ(0, ht.memSize.load());
-    EXPECT_EQ(0, ht.cacheSize.load());
+    EXPECT_EQ(0, ht.getItemMemory());
+    EXPECT_EQ(0, ht.getCacheSize());
     EXPECT_EQ(initialSize, global_stats.currentSize.load());
 
     cb_free(someval);
@@ -412,8 +693,8 @@ TEST_F(HashTableTest, SizeStatsEject) {
 TEST_F(HashTableTest, SizeStatsEjectFlush) {
     global_stats.reset();
     HashTable ht(global_stats, makeFactory(), 5, 1);
-    ASSERT_EQ(0, ht.memSize.load());
-    ASSERT_EQ(0, ht.cacheSize.load());
+    ASSERT_EQ(0, ht.getItemMemory());
+    ASSERT_EQ(0, ht.getCacheSize());
     size_t initialSize = global_stats.currentSize.load();
 
     StoredDocKey key = makeStoredDocKey("somekey");
@@ -433,8 +714,8 @@ TEST_F(HashTableTest, SizeStatsEjectFlush) {
 
     ht.clear();
 
-    EXPECT_EQ(0, ht.memSize.load());
-    EXPECT_EQ(0, ht.cacheSize.load());
+    EXPECT_EQ(0, ht.getItemMemory());
+    EXPECT_EQ(0, ht.getCacheSize());
     EXPECT_EQ(initialSize, global_stats.currentSize.load());
 
     cb_free(someval);
@@ -244,6 +244,40 @@ TEST_P(STItemPagerTest, ExpiredItemsDeletedFirst) {
     }
 }
 
+// Test that the random paging phase - which visits a random sample of each
+// vBucket's items rather than the whole hash table - pages out items which
+// have not been referenced since they were stored.
+TEST_P(STItemPagerTest, RandomPhasePagesOutSample) {
+    size_t count = 0;
+    const std::string value(512, 'x'); // 512B value to use for documents.
+    ENGINE_ERROR_CODE result;
+    for (result = ENGINE_SUCCESS; result == ENGINE_SUCCESS; count++) {
+        auto item = make_item(vbid,
+                              makeStoredDocKey("key_" + std::to_string(count)),
+                              value);
+        uint64_t cas;
+        result = engine->store(nullptr, &item, &cas, OPERATION_SET);
+    }
+    ASSERT_EQ(ENGINE_TMPFAIL, result);
+
+    store->getVBucket(vbid)->checkpointManager.createNewCheckpoint();
+    if (GetParam() == "persistent") {
+        store->flushVBucket(vbid);
+    }
+
+    // The first (unreferenced) phase finds no items at the maximum NRU value,
+    // so pages nothing out.
+    auto& stats = engine->getEpStats();
+    runItemPager();
+    const size_t memUsed = stats.getTotalMemoryUsed();
+    ASSERT_GT(memUsed, stats.mem_low_wat.load());
+
+    // The random phase samples the items to page out.
+    runItemPager();
+    EXPECT_LT(stats.getTotalMemoryUsed(), memUsed)
+            << "Expected the random phase to page out sampled items";
+}
+
 /**
  * Test fixture for Ephemeral-only item pager tests.
  */
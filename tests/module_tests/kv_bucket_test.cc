@@ -380,6 +380,43 @@ TEST_P(KVBucketParamTest, GetKeyStatsNMVB) {
                                    WantsDeleted::No));
 }
 
+// getMulti tests /////////////////////////////////////////////////////////////
+
+// Check that getMulti returns the same results as get for each key, for a
+// mix of existing and missing keys.
+TEST_P(KVBucketParamTest, GetMulti) {
+    std::vector<StoredDocKey> storedKeys;
+    for (int ii = 0; ii < 20; ++ii) {
+        storedKeys.push_back(makeStoredDocKey("key" + std::to_string(ii)));
+        if (ii % 3) {
+            store_item(vbid, storedKeys.back(), "value" + std::to_string(ii));
+        }
+    }
+    const std::vector<DocKey> keys(storedKeys.begin(), storedKeys.end());
+
+    const auto options = static_cast<get_options_t>(HONOR_STATES |
+                                                    TRACK_REFERENCE);
+    auto results = store->getVBucket(vbid)->getMulti(
+            keys, cookie, *engine, 0, options, false);
+    ASSERT_EQ(keys.size(), results.size());
+    for (size_t ii = 0; ii < keys.size(); ++ii) {
+        auto expected = store->get(keys[ii], vbid, cookie, options);
+        EXPECT_EQ(expected.getStatus(), results[ii].getStatus())
+                << storedKeys[ii].c_str();
+        if (expected.getValue()) {
+            ASSERT_NE(nullptr, results[ii].getValue());
+            EXPECT_EQ(expected.getValue()->getKey(),
+                      results[ii].getValue()->getKey());
+            EXPECT_EQ(expected.getValue()->getValue()->to_s(),
+                      results[ii].getValue()->getValue()->to_s());
+        } else {
+            EXPECT_EQ(nullptr, results[ii].getValue());
+        }
+        delete expected.getValue();
+        delete results[ii].getValue();
+    }
+}
+
 // Replace tests //////////////////////////////////////////////////////////////
 
 // Test replace against a non-existent key.
@@ -1135,11 +1135,10 @@ public:
         MutationRequestCallback requestcb;
         uint64_t fileRev = dbFileRevMap[itm.getVBucketId()];
 
-        // each req will be de-allocated after commit
+        // each req will be destroyed after commit
         requestcb.setCb = &cb;
-        MockCouchRequest *req = new MockCouchRequest(itm, fileRev, requestcb, deleteItem);
-        pendingReqsQ.push_back(req);
-        return req;
+        return pendingReqs.emplace<MockCouchRequest>(
+                itm, fileRev, requestcb, deleteItem);
     }
 };
 
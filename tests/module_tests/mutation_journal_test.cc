@@ -0,0 +1,277 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the MutationJournal class.
+ */
+
+#include "config.h"
+
+#include "mutation_journal.h"
+#include "tests/module_tests/test_helpers.h"
+
+#include <gtest/gtest.h>
+#include <platform/dirutils.h>
+#include <platform/make_unique.h>
+
+#include <fstream>
+#include <thread>
+
+static const size_t MaxVBuckets = 4;
+
+class MutationJournalTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        if (cb::io::isDirectory(dir)) {
+            cb::io::rmrf(dir);
+        }
+        cb::io::mkdirp(dir);
+        for (auto& seqno : persisted) {
+            seqno = 0;
+        }
+    }
+
+    void TearDown() override {
+        journal.reset();
+        cb::io::rmrf(dir);
+    }
+
+    void createJournal(size_t segmentSize = 1024 * 1024) {
+        journal = std::make_unique<MutationJournal>(
+                dir,
+                0,
+                MaxVBuckets,
+                segmentSize,
+                nullptr,
+                [](uint16_t) {},
+                [this](uint16_t vbid) { return persisted[vbid].load(); });
+    }
+
+    void append(uint16_t vbid,
+                int64_t seqno,
+                const std::string& value = "value",
+                bool deleted = false) {
+        const std::string key = "key" + std::to_string(seqno);
+        queued_item item(new Item(makeStoredDocKey(key),
+                                  0,
+                                  0,
+                                  value.data(),
+                                  value.size(),
+                                  nullptr,
+                                  0,
+                                  /*cas*/ seqno * 10,
+                                  seqno,
+                                  vbid));
+        if (deleted) {
+            item->setDeleted();
+        }
+        journal->append(item);
+    }
+
+    // Wait (up to 10s) for the predicate to become true.
+    bool waitFor(std::function<bool()> pred) {
+        const auto deadline =
+                std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (!pred()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    bool syncTo(uint16_t vbid, uint64_t seqno) {
+        journal->requestSync(vbid);
+        return waitFor([this, vbid, seqno] {
+            return journal->getDurableSeqno(vbid, persisted[vbid]) >= seqno;
+        });
+    }
+
+    size_t countSegments() {
+        return cb::io::findFilesWithPrefix(dir + "/journal.0.").size();
+    }
+
+    const std::string dir = "mutation_journal_test";
+    std::atomic<uint64_t> persisted[MaxVBuckets];
+    std::unique_ptr<MutationJournal> journal;
+};
+
+// Mutations become durable once synced.
+TEST_F(MutationJournalTest, SyncMakesDurable) {
+    createJournal();
+    journal->start();
+
+    for (int64_t seqno = 1; seqno <= 10; ++seqno) {
+        append(0, seqno);
+    }
+    ASSERT_TRUE(syncTo(0, 10));
+    EXPECT_EQ(10, journal->getDurableSeqno(0, 0));
+    EXPECT_EQ(10, journal->getDurableSeqno(0, 5));
+
+    // Persistence beyond the journal still counts.
+    EXPECT_EQ(12, journal->getDurableSeqno(0, 12));
+
+    // Nothing journaled for other vBuckets.
+    EXPECT_EQ(5, journal->getDurableSeqno(1, 5));
+}
+
+// The journal doesn't vouch for seqnos until those before it are persisted.
+TEST_F(MutationJournalTest, DurableOnlyAfterPredecessorsPersisted) {
+    createJournal();
+    journal->start();
+
+    for (int64_t seqno = 11; seqno <= 15; ++seqno) {
+        append(0, seqno);
+    }
+    persisted[0] = 10;
+    ASSERT_TRUE(syncTo(0, 15));
+
+    EXPECT_EQ(5, journal->getDurableSeqno(0, 5));
+    EXPECT_EQ(15, journal->getDurableSeqno(0, 10));
+}
+
+// A gap in a vBucket's seqnos restarts its journal.
+TEST_F(MutationJournalTest, GapResetsVBucket) {
+    createJournal();
+    journal->start();
+
+    for (int64_t seqno = 1; seqno <= 3; ++seqno) {
+        append(0, seqno);
+    }
+    append(0, 10);
+    append(0, 11);
+    persisted[0] = 9;
+    ASSERT_TRUE(syncTo(0, 11));
+
+    EXPECT_EQ(3, journal->getDurableSeqno(0, 3));
+    EXPECT_EQ(11, journal->getDurableSeqno(0, 9));
+
+    journal->stop();
+    createJournal();
+    auto items = journal->recover();
+    ASSERT_EQ(2, items[0].size());
+    EXPECT_EQ(10, items[0][0]->getBySeqno());
+    EXPECT_EQ(11, items[0][1]->getBySeqno());
+}
+
+// Mutations are recovered by a new journal after a restart.
+TEST_F(MutationJournalTest, Recover) {
+    createJournal();
+    journal->start();
+
+    append(0, 1, "one");
+    append(0, 2, "two");
+    append(0, 3, "", /*deleted*/ true);
+    append(1, 7, "seven");
+    journal->stop();
+
+    createJournal();
+    auto items = journal->recover();
+    ASSERT_EQ(2, items.size());
+
+    ASSERT_EQ(3, items[0].size());
+    EXPECT_EQ(makeStoredDocKey("key1"), items[0][0]->getKey());
+    EXPECT_EQ("one", std::string(items[0][0]->getData(),
+                                 items[0][0]->getNBytes()));
+    EXPECT_EQ(10, items[0][0]->getCas());
+    EXPECT_FALSE(items[0][0]->isDeleted());
+    EXPECT_EQ(2, items[0][1]->getBySeqno());
+    EXPECT_EQ(3, items[0][2]->getBySeqno());
+    EXPECT_TRUE(items[0][2]->isDeleted());
+
+    ASSERT_EQ(1, items[1].size());
+    EXPECT_EQ(7, items[1][0]->getBySeqno());
+    EXPECT_EQ(1, items[1][0]->getVBucketId());
+
+    // Recovered segments are kept until their mutations are persisted.
+    journal->start();
+    journal->stop();
+    createJournal();
+    EXPECT_EQ(2, journal->recover().size());
+}
+
+// Records preceding a reset of their vBucket aren't recovered.
+TEST_F(MutationJournalTest, ResetVBucket) {
+    createJournal();
+    journal->start();
+
+    for (int64_t seqno = 1; seqno <= 5; ++seqno) {
+        append(0, seqno);
+        append(1, seqno);
+    }
+    ASSERT_TRUE(syncTo(0, 5));
+    journal->resetVBucket(0);
+    EXPECT_EQ(0, journal->getDurableSeqno(0, 0));
+
+    append(0, 1);
+    journal->stop();
+
+    createJournal();
+    auto items = journal->recover();
+    ASSERT_EQ(1, items[0].size());
+    EXPECT_EQ(1, items[0][0]->getBySeqno());
+    EXPECT_EQ(5, items[1].size());
+}
+
+// Recovery stops at a record torn by a crash mid-write.
+TEST_F(MutationJournalTest, TornRecord) {
+    createJournal();
+    journal->start();
+    for (int64_t seqno = 1; seqno <= 5; ++seqno) {
+        append(0, seqno);
+    }
+    journal->stop();
+
+    const std::string path = dir + "/journal.0.0";
+    std::string data;
+    {
+        std::ifstream file(path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file),
+                    std::istreambuf_iterator<char>());
+    }
+    ASSERT_FALSE(data.empty());
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size() - 3);
+    }
+
+    createJournal();
+    auto items = journal->recover();
+    ASSERT_EQ(4, items[0].size());
+    EXPECT_EQ(4, items[0].back()->getBySeqno());
+}
+
+// Closed segments are deleted once their mutations have been persisted.
+TEST_F(MutationJournalTest, PersistedSegmentsRemoved) {
+    createJournal(4096);
+    journal->start();
+
+    const std::string value(1024, 'x');
+    for (int64_t seqno = 1; seqno <= 20; ++seqno) {
+        append(0, seqno, value);
+        ASSERT_TRUE(syncTo(0, seqno));
+    }
+    EXPECT_LT(1, countSegments());
+
+    persisted[0] = 10;
+    EXPECT_TRUE(waitFor([this] { return countSegments() <= 4; }));
+    EXPECT_LT(1, countSegments());
+
+    persisted[0] = 20;
+    EXPECT_TRUE(waitFor([this] { return countSegments() == 1; }));
+}
@@ -0,0 +1,108 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for sortQueuedItemsByKey.
+ */
+
+#include "config.h"
+
+#include "queued_item_sort.h"
+#include "tests/module_tests/test_helpers.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+
+class QueuedItemSortTest : public ::testing::TestWithParam<size_t> {
+protected:
+    void addItem(const std::string& key,
+                 DocNamespace ns = DocNamespace::DefaultCollection) {
+        items.emplace_back(new Item(makeStoredDocKey(key, ns),
+                                    0,
+                                    queue_op::set,
+                                    0,
+                                    ++seqno));
+    }
+
+    // Check sortQueuedItemsByKey orders the items exactly as sorting with
+    // CompareQueuedItemsBySeqnoAndKey does.
+    void checkSort() {
+        std::shuffle(items.begin(), items.end(), rng);
+        auto expected = items;
+        CompareQueuedItemsBySeqnoAndKey cq;
+        std::sort(expected.begin(), expected.end(), cq);
+
+        sortQueuedItemsByKey(items);
+        ASSERT_EQ(expected.size(), items.size());
+        for (size_t ii = 0; ii < items.size(); ++ii) {
+            ASSERT_EQ(expected[ii].get(), items[ii].get())
+                    << "at " << ii << ": expected " << expected[ii]->getKey()
+                    << ":" << expected[ii]->getBySeqno() << ", got "
+                    << items[ii]->getKey() << ":" << items[ii]->getBySeqno();
+        }
+    }
+
+    std::vector<queued_item> items;
+    int64_t seqno = 0;
+    std::mt19937 rng{42};
+};
+
+// Distinct random keys of assorted lengths.
+TEST_P(QueuedItemSortTest, RandomKeys) {
+    std::uniform_int_distribution<int> length(1, 40);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (size_t ii = 0; ii < GetParam(); ++ii) {
+        std::string key(length(rng), '\0');
+        for (auto& c : key) {
+            c = static_cast<char>(byte(rng));
+        }
+        addItem(key);
+    }
+    checkSort();
+}
+
+// Keys sharing long prefixes, with several versions of each, in both
+// namespaces - as a typical flusher batch with de-duplication to do.
+TEST_P(QueuedItemSortTest, DuplicatesWithCommonPrefixes) {
+    std::uniform_int_distribution<size_t> keyId(0, GetParam() / 4);
+    for (size_t ii = 0; ii < GetParam(); ++ii) {
+        const auto ns = (ii % 7) ? DocNamespace::DefaultCollection
+                                 : DocNamespace::Collections;
+        addItem("customer::profile::" + std::to_string(keyId(rng)), ns);
+    }
+    checkSort();
+}
+
+// Keys which only differ in length, or in trailing zero bytes, where the
+// zero-padded prefixes are equal.
+TEST_P(QueuedItemSortTest, ZeroPaddedPrefixes) {
+    for (size_t ii = 0; ii < GetParam(); ++ii) {
+        std::string key = "k";
+        key.append(ii % 20, '\0');
+        if (ii % 3 == 0) {
+            key.push_back('\1');
+        }
+        addItem(key);
+    }
+    checkSort();
+}
+
+INSTANTIATE_TEST_CASE_P(BatchSizes,
+                        QueuedItemSortTest,
+                        ::testing::Values(10, 1000, 20000), );
@@ -0,0 +1,191 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the SlabAllocator class.
+ */
+
+#include "config.h"
+
+#include "slab_allocator.h"
+#include "stats.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+class SlabAllocatorTest : public ::testing::Test {
+protected:
+    EPStats stats;
+};
+
+TEST_F(SlabAllocatorTest, SizeClasses) {
+    SlabAllocator slabs(stats);
+    void* a = slabs.allocate(1);
+    void* b = slabs.allocate(SlabAllocator::Granularity + 1);
+    void* c = slabs.allocate(SlabAllocator::MaxObjectSize);
+    EXPECT_EQ(SlabAllocator::Granularity, SlabAllocator::getAllocSize(a));
+    EXPECT_EQ(2 * SlabAllocator::Granularity, SlabAllocator::getAllocSize(b));
+    EXPECT_EQ(SlabAllocator::MaxObjectSize, SlabAllocator::getAllocSize(c));
+    EXPECT_EQ(3 * SlabAllocator::Granularity + SlabAllocator::MaxObjectSize,
+              slabs.getUsedBytes());
+
+    SlabAllocator::deallocate(a);
+    SlabAllocator::deallocate(b);
+    SlabAllocator::deallocate(c);
+    EXPECT_EQ(0, slabs.getUsedBytes());
+}
+
+TEST_F(SlabAllocatorTest, InvalidSize) {
+    SlabAllocator slabs(stats);
+    EXPECT_FALSE(SlabAllocator::canAllocate(0));
+    EXPECT_FALSE(SlabAllocator::canAllocate(SlabAllocator::MaxObjectSize + 1));
+    EXPECT_THROW(slabs.allocate(0), std::invalid_argument);
+    EXPECT_THROW(slabs.allocate(SlabAllocator::MaxObjectSize + 1),
+                 std::invalid_argument);
+}
+
+// Check that many objects can be allocated, don't overlap, and that freed
+// slots are reused rather than allocating more memory.
+TEST_F(SlabAllocatorTest, AllocateFreeReuse) {
+    SlabAllocator slabs(stats);
+    const size_t size = 72;
+    std::vector<void*> objects;
+    std::set<uintptr_t> addresses;
+    for (size_t ii = 0; ii < 10000; ++ii) {
+        objects.push_back(slabs.allocate(size));
+        std::memset(objects.back(), int(ii), size);
+        auto addr = reinterpret_cast<uintptr_t>(objects.back());
+        auto next = addresses.lower_bound(addr);
+        if (next != addresses.end()) {
+            EXPECT_GE(*next, addr + size);
+        }
+        addresses.insert(addr);
+    }
+    const size_t allocated = slabs.getAllocatedBytes();
+    EXPECT_EQ(allocated, stats.storedValSlabSize.load());
+
+    for (auto* obj : objects) {
+        SlabAllocator::deallocate(obj);
+    }
+    EXPECT_EQ(0, slabs.getUsedBytes());
+
+    // Empty slabs are reusable by a different size class.
+    for (auto& obj : objects) {
+        obj = slabs.allocate(size * 2);
+    }
+    for (size_t ii = 0; ii < objects.size() / 2; ++ii) {
+        SlabAllocator::deallocate(objects[ii]);
+    }
+    for (size_t ii = 0; ii < objects.size() / 2; ++ii) {
+        objects[ii] = slabs.allocate(size * 2);
+    }
+    // 2x the object size fits the original memory, apart from up to one
+    // extra chunk for the rounding of slots into slabs.
+    EXPECT_LE(slabs.getAllocatedBytes(),
+              2 * allocated + (SlabAllocator::SlabsPerChunk + 1) *
+                                      SlabAllocator::SlabSize);
+    for (auto* obj : objects) {
+        SlabAllocator::deallocate(obj);
+    }
+}
+
+TEST_F(SlabAllocatorTest, StatsReleasedOnDestruction) {
+    {
+        SlabAllocator slabs(stats);
+        slabs.allocate(64);
+        EXPECT_NE(0, stats.storedValSlabSize.load());
+        // Destroy with the object still allocated - as when a vBucket's
+        // HashTable is dropped, the whole slab is freed.
+    }
+    EXPECT_EQ(0, stats.storedValSlabSize.load());
+}
+
+TEST_F(SlabAllocatorTest, Concurrent) {
+    SlabAllocator slabs(stats);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&slabs, t]() {
+            std::vector<void*> objects;
+            for (int round = 0; round < 10; ++round) {
+                for (size_t ii = 0; ii < 1000; ++ii) {
+                    objects.push_back(slabs.allocate(16 + (ii + t) % 256));
+                }
+                for (auto* obj : objects) {
+                    SlabAllocator::deallocate(obj);
+                }
+                objects.clear();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(0, slabs.getUsedBytes());
+}
+
+// Objects may be freed by a different thread (and hence stripe) to the one
+// which allocated them; the slot is returned to the slab's own stripe.
+TEST_F(SlabAllocatorTest, FreeOnOtherThread) {
+    SlabAllocator slabs(stats);
+    std::vector<void*> objects;
+    for (size_t ii = 0; ii < 1000; ++ii) {
+        objects.push_back(slabs.allocate(64));
+    }
+    const size_t allocated = slabs.getAllocatedBytes();
+
+    std::thread other([&objects]() {
+        for (auto* obj : objects) {
+            SlabAllocator::deallocate(obj);
+        }
+    });
+    other.join();
+    EXPECT_EQ(0, slabs.getUsedBytes());
+
+    // The freed slabs are reused rather than allocating more memory.
+    for (auto& obj : objects) {
+        obj = slabs.allocate(64);
+    }
+    EXPECT_EQ(allocated, slabs.getAllocatedBytes());
+    for (auto* obj : objects) {
+        SlabAllocator::deallocate(obj);
+    }
+}
+
+// After releaseAll() objects are not returned to their slabs; the memory is
+// freed when the allocator is destroyed.
+TEST_F(SlabAllocatorTest, ReleaseAll) {
+    {
+        SlabAllocator slabs(stats);
+        std::vector<void*> objects;
+        for (size_t ii = 0; ii < 1000; ++ii) {
+            objects.push_back(slabs.allocate(64));
+        }
+        const size_t used = slabs.getUsedBytes();
+
+        slabs.releaseAll();
+        for (auto* obj : objects) {
+            SlabAllocator::deallocate(obj);
+        }
+        EXPECT_EQ(used, slabs.getUsedBytes());
+    }
+    EXPECT_EQ(0, stats.storedValSlabSize.load());
+}
@@ -146,3 +146,129 @@ TEST(OrderedStoredValueTest, expectedSize) {
             << "Unexpected change in OrderedStoredValue storage size for item: "
             << item;
 }
+
+/**
+ * Test fixture for StoredValues created by CompactStoredValueFactory, which
+ * hold small values in an inline buffer.
+ */
+class CompactStoredValueTest : public ::testing::Test {
+public:
+    CompactStoredValueTest()
+        : factory(stats, /*inlineThreshold*/ 16),
+          item(make_item(0, makeStoredDocKey("key"), "value")) {
+    }
+
+    void SetUp() override {
+        sv = factory(item, {});
+    }
+
+    /// Returns the value of the given StoredValue as a string.
+    static std::string getValueString(const StoredValue& v) {
+        const value_t value = v.copyValue();
+        return std::string(value->getData(), value->vlength());
+    }
+
+protected:
+    EPStats stats;
+    CompactStoredValueFactory factory;
+    Item item;
+    StoredValue::UniquePtr sv;
+};
+
+TEST_F(CompactStoredValueTest, ValueInline) {
+    EXPECT_TRUE(sv->hasInlineValueBuffer());
+    EXPECT_TRUE(sv->isValueInline());
+    EXPECT_TRUE(sv->isResident());
+    EXPECT_TRUE(sv->hasValue());
+    // The inline value has no separate Blob to reference.
+    EXPECT_EQ(nullptr, sv->getValue().get());
+    EXPECT_EQ("value", getValueString(*sv));
+    EXPECT_EQ(item.getValue()->getExtLen(), sv->copyValue()->getExtLen());
+    EXPECT_EQ(item.getDataType(), sv->getDatatype());
+}
+
+TEST_F(CompactStoredValueTest, Size) {
+    // The inline value is accounted as part of the object, not valuelen().
+    EXPECT_EQ(0, sv->valuelen());
+    EXPECT_EQ(sv->getObjectSize(), sv->size());
+    EXPECT_EQ(0, sv->getObjectSize() % 8)
+            << "Inline buffer should extend to the end of the allocation";
+    EXPECT_LT(sv->getObjectSize(),
+              StoredValue::getRequiredStorage(item) + sizeof(Blob) +
+                      /*value*/ 5 + /*extmeta*/ 2)
+            << "Inline StoredValue should be smaller than StoredValue + Blob";
+}
+
+TEST_F(CompactStoredValueTest, NotEvictable) {
+    sv->markClean();
+    EXPECT_FALSE(sv->eligibleForEviction(VALUE_ONLY));
+    EXPECT_TRUE(sv->eligibleForEviction(FULL_EVICTION));
+}
+
+TEST_F(CompactStoredValueTest, ToItem) {
+    auto itm = sv->toItem(false, 0);
+    EXPECT_EQ(item.getNBytes(), itm->getNBytes());
+    EXPECT_EQ("value", std::string(itm->getData(), itm->getNBytes()));
+}
+
+// Each read of an inline value gets its own copy; nothing is cached in the
+// StoredValue.
+TEST_F(CompactStoredValueTest, CopyValueAllocatesPerRead) {
+    const value_t first = sv->copyValue();
+    const value_t second = sv->copyValue();
+    EXPECT_NE(first.get(), second.get());
+    EXPECT_EQ(1, first.refCount());
+    EXPECT_TRUE(sv->isValueInline());
+}
+
+TEST_F(CompactStoredValueTest, LargeValueNotInline) {
+    auto large = make_item(0, makeStoredDocKey("large"), std::string(64, 'x'));
+    auto largeSv = factory(large, {});
+    EXPECT_FALSE(largeSv->hasInlineValueBuffer());
+    EXPECT_FALSE(largeSv->isValueInline());
+    EXPECT_EQ(large.getValue()->length(), largeSv->valuelen());
+    EXPECT_EQ(StoredValue::getRequiredStorage(large),
+              largeSv->getObjectSize());
+}
+
+// Check that a value which no longer fits the inline buffer is held in a
+// Blob, and a value which does fit is moved back inline.
+TEST_F(CompactStoredValueTest, SetValue) {
+    auto larger = make_item(0, makeStoredDocKey("key"), std::string(64, 'x'));
+    sv->setValue(larger);
+    EXPECT_FALSE(sv->isValueInline());
+    EXPECT_EQ(larger.getValue()->length(), sv->valuelen());
+    EXPECT_EQ(std::string(64, 'x'), getValueString(*sv));
+
+    auto smaller = make_item(0, makeStoredDocKey("key"), "val");
+    sv->setValue(smaller);
+    EXPECT_TRUE(sv->isValueInline());
+    EXPECT_EQ(0, sv->valuelen());
+    EXPECT_EQ("val", getValueString(*sv));
+}
+
+TEST_F(CompactStoredValueTest, EjectAndRestore) {
+    sv->markNotResident();
+    EXPECT_FALSE(sv->isResident());
+    EXPECT_FALSE(sv->isValueInline());
+
+    sv->restoreValue(item);
+    EXPECT_TRUE(sv->isValueInline());
+    EXPECT_EQ("value", getValueString(*sv));
+}
+
+TEST(SlabStoredValueTest, AllocatedFromSlabs) {
+    EPStats stats;
+    StoredValueFactory factory(stats, std::make_unique<SlabAllocator>(stats));
+    auto item = make_item(0, makeStoredDocKey("key"), "value");
+    auto sv = factory(item, {});
+    EXPECT_TRUE(sv->isSlabAllocated());
+    EXPECT_GE(SlabAllocator::getAllocSize(sv.get()), sv->getObjectSize());
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(sv.get()) % 8);
+
+    auto next = factory(item, std::move(sv));
+    EXPECT_TRUE(next->isSlabAllocated());
+    EXPECT_EQ("value",
+              std::string(next->getValue()->getData(),
+                          next->getValue()->vlength()));
+}